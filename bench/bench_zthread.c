@@ -0,0 +1,426 @@
+// Microbenchmarks for zthread primitives.
+// Every benchmark takes a number of samples; a sample times a batch of
+// operations and yields one ns/op figure. Each result is printed as one JSON
+// object per line (percentiles over the samples), so runs of the native and
+// futex builds, or of two commits, can be diffed or loaded as-is.
+//
+// Usage: bench_zthread [--quick] [filter]
+//   --quick   fewer samples and smaller batches (smoke test).
+//   filter    only run benchmarks whose name contains this string.
+
+#define ZTHREAD_IMPLEMENTATION
+#include "zthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#   define BENCH_OS "win32"
+#else
+#   define BENCH_OS "posix"
+#endif
+
+#ifdef ZTHREAD_USE_FUTEX
+#   define BENCH_LOCKS "futex"
+#else
+#   define BENCH_LOCKS "native"
+#endif
+
+#define BENCH_MAX_SAMPLES 64
+#define BENCH_MAX_THREADS 16
+
+static int bench_samples = 25;
+static int bench_scale = 1;         // Divides batch sizes (--quick).
+static const char *bench_filter = NULL;
+
+static int64_t bench_now_ns(void) 
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (0 == freq.QuadPart) 
+    {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (int64_t)(now.QuadPart / freq.QuadPart) * 1000000000 +
+           (int64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static int bench_cmp(const void *a, const void *b) 
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int bench_enabled(const char *name) 
+{
+    return !bench_filter || strstr(name, bench_filter) != NULL;
+}
+
+// Prints the percentiles of 'n' ns/op samples.
+static void bench_report(const char *name, int threads, int64_t ops, double *ns, int n) 
+{
+    qsort(ns, (size_t)n, sizeof(double), bench_cmp);
+    printf("{\"bench\":\"%s\",\"os\":\"%s\",\"locks\":\"%s\",\"threads\":%d,\"ops\":%lld,\"samples\":%d,"
+           "\"min_ns\":%.1f,\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f}\n",
+           name, BENCH_OS, BENCH_LOCKS, threads, (long long)ops, n,
+           ns[0], ns[n / 2], ns[(n * 9) / 10], ns[(n * 99) / 100], ns[n - 1]);
+    fflush(stdout);
+}
+
+static int64_t bench_ops(int64_t ops) 
+{
+    ops /= bench_scale;
+    return ops > 0 ? ops : 1;
+}
+
+// Runs 'body(ctx, tid)' on 'threads' threads per sample, all released at once
+// by a barrier. The sample spans the first thread starting to the last one
+// finishing; workers stamp their own times, since whichever thread trips the
+// barrier may run its whole batch before the caller is scheduled again.
+typedef void (*bench_body)(void *ctx, int tid);
+
+typedef struct 
+{
+    bench_body body;
+    void *ctx;
+    int tid;
+    zbarrier_t *start;
+    int64_t begin_ns;
+    int64_t end_ns;
+} bench_worker;
+
+static void bench_worker_main(bench_worker *w) 
+{
+    zbarrier_wait(w->start);
+    w->begin_ns = bench_now_ns();
+    w->body(w->ctx, w->tid);
+    w->end_ns = bench_now_ns();
+}
+
+static double bench_parallel(int threads, bench_body body, void *ctx, int64_t total_ops) 
+{
+    zthread_t t[BENCH_MAX_THREADS];
+    bench_worker w[BENCH_MAX_THREADS];
+    zbarrier_t start;
+    int64_t begin, end;
+    int i;
+
+    zbarrier_init(&start, threads);
+    for (i = 0; i < threads; i++) 
+    {
+        w[i].body = body;
+        w[i].ctx = ctx;
+        w[i].tid = i;
+        w[i].start = &start;
+        zthread_create(&t[i], bench_worker_main, &w[i]);
+    }
+    for (i = 0; i < threads; i++) 
+    {
+        zthread_join(t[i]);
+    }
+    zbarrier_destroy(&start);
+    begin = w[0].begin_ns;
+    end = w[0].end_ns;
+    for (i = 1; i < threads; i++) 
+    {
+        begin = w[i].begin_ns < begin ? w[i].begin_ns : begin;
+        end = w[i].end_ns > end ? w[i].end_ns : end;
+    }
+    return (double)(end - begin) / (double)total_ops;
+}
+
+// Mutex: each thread does 'ops' lock/increment/unlock rounds.
+typedef struct 
+{
+    zmutex_t lock;
+    int64_t ops;
+    volatile int64_t counter;
+} bench_mutex_ctx;
+
+static void bench_mutex_body(void *arg, int tid) 
+{
+    bench_mutex_ctx *c = (bench_mutex_ctx*)arg;
+    int64_t i;
+    (void)tid;
+    for (i = 0; i < c->ops; i++) 
+    {
+        zmutex_lock(&c->lock);
+        c->counter = c->counter + 1;
+        zmutex_unlock(&c->lock);
+    }
+}
+
+static void bench_mutex(const char *name, int flags, int threads) 
+{
+    double ns[BENCH_MAX_SAMPLES];
+    bench_mutex_ctx c;
+    int s;
+
+    if (!bench_enabled(name)) 
+    {
+        return;
+    }
+    c.ops = bench_ops(threads > 1 ? 200000 / threads : 1000000);
+    zmutex_init_ex(&c.lock, flags);
+    for (s = 0; s < bench_samples; s++) 
+    {
+        c.counter = 0;
+        ns[s] = bench_parallel(threads, bench_mutex_body, &c, c.ops * threads);
+    }
+    zmutex_destroy(&c.lock);
+    bench_report(name, threads, c.ops * threads, ns, bench_samples);
+}
+
+// Cond ping-pong: one round trip is two signals and two wakeups.
+typedef struct 
+{
+    zmutex_t lock;
+    zcond_t cv;
+    int turn;
+    int64_t rounds;
+} bench_pingpong_ctx;
+
+static void bench_pingpong_body(void *arg, int tid) 
+{
+    bench_pingpong_ctx *c = (bench_pingpong_ctx*)arg;
+    int64_t i;
+    for (i = 0; i < c->rounds; i++) 
+    {
+        zmutex_lock(&c->lock);
+        while (c->turn != tid) 
+        {
+            zcond_wait(&c->cv, &c->lock);
+        }
+        c->turn = 1 - tid;
+        zcond_signal(&c->cv);
+        zmutex_unlock(&c->lock);
+    }
+}
+
+static void bench_cond_pingpong(void) 
+{
+    double ns[BENCH_MAX_SAMPLES];
+    bench_pingpong_ctx c;
+    int s;
+
+    if (!bench_enabled("cond_pingpong")) 
+    {
+        return;
+    }
+    c.rounds = bench_ops(20000);
+    zmutex_init(&c.lock);
+    zcond_init(&c.cv);
+    for (s = 0; s < bench_samples; s++) 
+    {
+        c.turn = 0;
+        ns[s] = bench_parallel(2, bench_pingpong_body, &c, c.rounds);
+    }
+    zcond_destroy(&c.cv);
+    zmutex_destroy(&c.lock);
+    bench_report("cond_pingpong", 2, c.rounds, ns, bench_samples);
+}
+
+// Thread spawn + join versus a pool round trip for the same empty task.
+static void bench_empty(void *arg) 
+{
+    (void)arg;
+}
+
+static void bench_spawn_join(void) 
+{
+    double ns[BENCH_MAX_SAMPLES];
+    int64_t n = bench_ops(200), i;
+    int s;
+
+    if (!bench_enabled("spawn_join")) 
+    {
+        return;
+    }
+    for (s = 0; s < bench_samples; s++) 
+    {
+        int64_t t0 = bench_now_ns();
+        for (i = 0; i < n; i++) 
+        {
+            zthread_t t;
+            zthread_create(&t, bench_empty, NULL);
+            zthread_join(t);
+        }
+        ns[s] = (double)(bench_now_ns() - t0) / (double)n;
+    }
+    bench_report("spawn_join", 1, n, ns, bench_samples);
+}
+
+static void bench_pool_submit(int threads) 
+{
+    double ns[BENCH_MAX_SAMPLES];
+    int64_t n = bench_ops(100000), i;
+    zpool_t *p;
+    int s;
+
+    if (!bench_enabled("pool_submit")) 
+    {
+        return;
+    }
+    p = zpool_create(threads);
+    for (s = 0; s < bench_samples; s++) 
+    {
+        int64_t t0 = bench_now_ns();
+        for (i = 0; i < n; i++) 
+        {
+            zpool_submit(p, bench_empty, NULL);
+        }
+        zpool_wait_idle(p);
+        ns[s] = (double)(bench_now_ns() - t0) / (double)n;
+    }
+    zpool_shutdown(p);
+    bench_report("pool_submit", threads, n, ns, bench_samples);
+}
+
+// Queue throughput: producers push 'items' in total, consumers pop them all.
+typedef struct 
+{
+    zqueue_t *q;
+    int producers;
+    int64_t per_producer;
+    int64_t per_consumer;
+} bench_queue_ctx;
+
+static void bench_queue_body(void *arg, int tid) 
+{
+    bench_queue_ctx *c = (bench_queue_ctx*)arg;
+    int64_t i;
+    if (tid < c->producers) 
+    {
+        for (i = 0; i < c->per_producer; i++) 
+        {
+            zqueue_push(c->q, (void*)(intptr_t)(i + 1));
+        }
+    } 
+    else 
+    {
+        for (i = 0; i < c->per_consumer; i++) 
+        {
+            (void)zqueue_pop(c->q);
+        }
+    }
+}
+
+static void bench_queue(int producers, int consumers) 
+{
+    double ns[BENCH_MAX_SAMPLES];
+    bench_queue_ctx c;
+    char name[64];
+    int64_t items;
+    int s;
+
+    snprintf(name, sizeof(name), "queue_%dp%dc", producers, consumers);
+    if (!bench_enabled(name)) 
+    {
+        return;
+    }
+    // A multiple of both counts, so every item has exactly one consumer.
+    items = bench_ops(200000) / (producers * consumers) * (producers * consumers);
+    if (items <= 0) 
+    {
+        items = producers * consumers;
+    }
+    c.q = zqueue_create(1024);
+    c.producers = producers;
+    c.per_producer = items / producers;
+    c.per_consumer = items / consumers;
+    for (s = 0; s < bench_samples; s++) 
+    {
+        ns[s] = bench_parallel(producers + consumers, bench_queue_body, &c, items);
+    }
+    zqueue_destroy(c.q);
+    bench_report(name, producers + consumers, items, ns, bench_samples);
+}
+
+// Barrier: one op is one full phase of 'threads' arrivals.
+typedef struct 
+{
+    zbarrier_t b;
+    int64_t phases;
+} bench_barrier_ctx;
+
+static void bench_barrier_body(void *arg, int tid) 
+{
+    bench_barrier_ctx *c = (bench_barrier_ctx*)arg;
+    int64_t i;
+    (void)tid;
+    for (i = 0; i < c->phases; i++) 
+    {
+        zbarrier_wait(&c->b);
+    }
+}
+
+static void bench_barrier(int threads) 
+{
+    double ns[BENCH_MAX_SAMPLES];
+    bench_barrier_ctx c;
+    int s;
+
+    if (!bench_enabled("barrier")) 
+    {
+        return;
+    }
+    c.phases = bench_ops(5000);
+    zbarrier_init(&c.b, threads);
+    for (s = 0; s < bench_samples; s++) 
+    {
+        ns[s] = bench_parallel(threads, bench_barrier_body, &c, c.phases);
+    }
+    zbarrier_destroy(&c.b);
+    bench_report("barrier", threads, c.phases, ns, bench_samples);
+}
+
+int main(int argc, char **argv) 
+{
+    int counts[] = { 1, 2, 4, 8, 16 };
+    int cpus = zthread_cpu_count();
+    int i;
+
+    for (i = 1; i < argc; i++) 
+    {
+        if (0 == strcmp(argv[i], "--quick")) 
+        {
+            bench_samples = 5;
+            bench_scale = 20;
+        } 
+        else 
+        {
+            bench_filter = argv[i];
+        }
+    }
+
+    // Thread counts grow up to twice the CPU count (oversubscription shows
+    // how each lock degrades once holders get preempted).
+    for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++) 
+    {
+        if (counts[i] > 1 && counts[i] > 2 * cpus) 
+        {
+            break;
+        }
+        bench_mutex(counts[i] == 1 ? "mutex_uncontended" : "mutex_contended", ZMUTEX_DEFAULT, counts[i]);
+        bench_mutex(counts[i] == 1 ? "mutex_adaptive_uncontended" : "mutex_adaptive_contended", ZMUTEX_ADAPTIVE, counts[i]);
+    }
+    bench_cond_pingpong();
+    bench_spawn_join();
+    bench_pool_submit(cpus < BENCH_MAX_THREADS ? cpus : BENCH_MAX_THREADS);
+    bench_queue(1, 1);
+    bench_queue(1, 4);
+    bench_queue(4, 1);
+    bench_queue(4, 4);
+    for (i = 2; i <= 2 * cpus && i <= BENCH_MAX_THREADS; i *= 2) 
+    {
+        bench_barrier(i);
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+#include <string.h>
+
+// A worker with its own stack size, name and CPU. Its job needs more stack
+// than the smallest platform defaults give, so the size must be honored.
+
+#define FRAME 4096
+
+typedef struct 
+{
+    int depth;
+    long result;
+} Job;
+
+static long dig(int depth) 
+{
+    volatile char frame[FRAME];
+    memset((char*)frame, depth & 0x7f, sizeof(frame));
+    if (0 == depth) 
+    {
+        return frame[0];
+    }
+    return frame[FRAME - 1] + dig(depth - 1);
+}
+
+void deep_task(Job *job) 
+{
+    job->result = dig(job->depth);
+}
+
+int main(void) 
+{
+    thread_attr_t attr;
+    zthread_t t;
+    Job job = {200, 0};     // About 800 KiB of frames.
+    long expected = 0;
+    int ok = 1, rc;
+
+    for (int d = 0; d <= job.depth; d++) 
+    {
+        expected += d & 0x7f;
+    }
+
+    // Bad attributes are rejected up front.
+    thread_attr_init(&attr);
+    ok &= (thread_attr_set_cpu(&attr, ZTHREAD_MAX_CPUS) == Z_EINVAL);
+    attr.policy = 42;
+    ok &= (thread_create_ex(&t, deep_task, &job, &attr) == Z_EINVAL);
+
+    thread_attr_init(&attr);
+    attr.stack_size = 4 * 1024 * 1024;
+    attr.name = "deep-worker";
+    ok &= (thread_attr_set_cpu(&attr, 0) == Z_OK);
+    rc = thread_create_ex(&t, deep_task, &job, &attr);
+    printf("=> zthread_create_ex: %d\n", rc);
+    if (rc != Z_OK) 
+    {
+        return 1;
+    }
+    thread_join(t);
+
+    printf("=> Result: %ld (expected %ld)\n", job.result, expected);
+    ok &= (job.result == expected);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define JOBS_PER_NODE 64
+#define MAX_NODES 64
+
+// One pool per NUMA node, each pinned to the CPUs of its node, so the
+// workers of a node share its memory and caches. A single-node machine
+// gets a single pool. Every job checks that it runs on its pool's node.
+
+typedef struct 
+{
+    int node;
+    volatile int32_t done;
+    volatile int32_t off_node;
+} NodeStats;
+
+void count_task(NodeStats *s) 
+{
+    int cpu = zthread_cpu_current();
+    if (cpu >= 0 && zthread_numa_node_of_cpu(cpu) >= 0 && zthread_numa_node_of_cpu(cpu) != s->node) 
+    {
+        zatomic_fetch_add32(&s->off_node, 1, ZATOMIC_RELAXED);
+    }
+    zatomic_fetch_add32(&s->done, 1, ZATOMIC_RELAXED);
+}
+
+void where(int *cpu) 
+{
+    *cpu = zthread_cpu_current();
+}
+
+int main(void) 
+{
+    int nodes[MAX_NODES], count = 0, ok = 1;
+    thread_attr_t attr;
+
+    printf("=> %d CPU(s), %d NUMA node(s)\n", zthread_cpu_count(), zthread_numa_node_count());
+    ok &= (zthread_numa_node_count() >= 1);
+
+    // Distinct nodes of the CPUs we can run on.
+    for (int cpu = 0; cpu < zthread_cpu_count() && count < MAX_NODES; cpu++) 
+    {
+        int node = zthread_numa_node_of_cpu(cpu), seen = 0;
+        for (int i = 0; i < count; i++) 
+        {
+            seen |= (nodes[i] == node);
+        }
+        if (node >= 0 && !seen) 
+        {
+            nodes[count++] = node;
+        }
+    }
+    if (0 == count) 
+    {
+        nodes[count++] = 0;     // Topology unknown: everything is node 0.
+    }
+
+    for (int i = 0; i < count; i++) 
+    {
+        NodeStats stats = {nodes[i], 0, 0};
+        zpool_t *p = pool_create_node(0, nodes[i]);
+        if (!p) 
+        {
+            printf("=> No pool for node %d\n", nodes[i]);
+            return 1;
+        }
+        for (int j = 0; j < JOBS_PER_NODE; j++) 
+        {
+            pool_submit(p, count_task, &stats);
+        }
+        pool_wait_idle(p);
+        printf("=> Node %d: %d workers ran %d jobs, %d off the node\n", zpool_node(p), zpool_size(p), (int)stats.done,
+            (int)stats.off_node);
+        ok &= (zpool_node(p) == nodes[i] && stats.done == JOBS_PER_NODE && stats.off_node == 0);
+        pool_shutdown(p);
+
+        thread_attr_init(&attr);
+        ok &= (zthread_attr_set_node(&attr, nodes[i]) == Z_OK);
+    }
+
+    // A thread pinned to our current CPU runs there, and a mask of CPUs the
+    // machine does not have is refused rather than ignored.
+    int here = zthread_cpu_current(), there = -2;
+    zthread_t t;
+    if (here >= 0) 
+    {
+        thread_attr_init(&attr);
+        ok &= (thread_attr_set_cpu(&attr, here) == Z_OK);
+        ok &= (thread_create_ex(&t, where, &there, &attr) == Z_OK);
+        thread_join(t);
+        printf("=> Thread pinned to CPU %d ran on CPU %d\n", here, there);
+        ok &= (there == here);
+    }
+    if (zthread_cpu_count() < ZTHREAD_MAX_CPUS) 
+    {
+        thread_attr_init(&attr);
+        ok &= (thread_attr_set_cpu(&attr, ZTHREAD_MAX_CPUS - 1) == Z_OK);
+        ok &= (thread_create_ex(&t, where, &there, &attr) != Z_OK);
+    }
+
+    // A node without CPUs has nothing to pin to.
+    thread_attr_init(&attr);
+    ok &= (zthread_attr_set_node(&attr, 1 << 20) == Z_EINVAL);
+    ok &= (pool_create_node(0, 1 << 20) == NULL);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define ROUTES 16
+#define READERS 4
+#define READS 20000
+#define VERSIONS 200
+
+// A read-mostly routing table: readers only lock the slot of their own
+// thread, and the rare writer locks every slot to swap in a new version.
+// Readers must always see one version in every entry.
+
+typedef struct 
+{
+    zbrlock_t *lock;
+    int version[ROUTES];
+    volatile int32_t torn;
+} Table;
+
+void reader_task(Table *t) 
+{
+    for (int i = 0; i < READS; i++) 
+    {
+        int first, mixed = 0;
+        zbrlock_rdlock(t->lock);
+        first = t->version[0];
+        for (int r = 1; r < ROUTES; r++) 
+        {
+            mixed |= (t->version[r] != first);
+        }
+        zbrlock_rdunlock(t->lock);
+        if (mixed) 
+        {
+            zatomic_fetch_add32(&t->torn, 1, ZATOMIC_RELAXED);
+        }
+    }
+}
+
+void writer_task(Table *t) 
+{
+    for (int v = 1; v <= VERSIONS; v++) 
+    {
+        zbrlock_wrlock(t->lock);
+        for (int r = 0; r < ROUTES; r++) 
+        {
+            t->version[r] = v;
+        }
+        zbrlock_wrunlock(t->lock);
+        thread_sleep(0);
+    }
+}
+
+void probe_task(Table *t) 
+{
+    // The writer holds every slot, so this reader's slot is taken too.
+    t->torn += (zbrlock_tryrdlock(t->lock) == Z_OK) ? 1000 : 0;
+}
+
+int main(void) 
+{
+    Table t = {0};
+    zthread_t threads[READERS + 1];
+
+    t.lock = zbrlock_create(4, ZRWLOCK_DEFAULT);
+    if (!t.lock) 
+    {
+        return 1;
+    }
+    printf("=> %d reader slots\n", zbrlock_slots(t.lock));
+
+    for (int i = 0; i < READERS; i++) 
+    {
+        thread_create(&threads[i], reader_task, &t);
+    }
+    thread_create(&threads[READERS], writer_task, &t);
+    for (int i = 0; i <= READERS; i++) 
+    {
+        thread_join(threads[i]);
+    }
+
+    zbrlock_wrlock(t.lock);
+    thread_create(&threads[0], probe_task, &t);
+    thread_join(threads[0]);
+    zbrlock_wrunlock(t.lock);
+
+    printf("=> Final version %d, torn reads %d\n", t.version[ROUTES - 1], (int)t.torn);
+    int ok = (zbrlock_slots(t.lock) == 4 && t.torn == 0 && t.version[0] == VERSIONS);
+    zbrlock_destroy(t.lock);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define THREADS 4
+#define ROUNDS 100000
+
+// Per-thread counters, one cache line each so the threads never share one.
+typedef struct 
+{
+    volatile int64_t hits;
+    ZTHREAD_PAD(pad, sizeof(int64_t));
+} PaddedCounter;
+
+typedef struct 
+{
+    PaddedCounter counters[THREADS];
+    volatile int64_t max_seen;
+    int payload[64];
+    volatile int32_t published;
+    void *volatile mailbox;
+} Shared;
+
+typedef struct 
+{
+    Shared *s;
+    int id;
+} Arg;
+
+void count_task(Arg *a) 
+{
+    for (int i = 0; i < ROUNDS; i++) 
+    {
+        zatomic_fetch_add64(&a->s->counters[a->id].hits, 1, ZATOMIC_RELAXED);
+    }
+    // Lock-free maximum: retry until our value is in or a larger one is.
+    int64_t mine = (a->id + 1) * 1000, seen = zatomic_load64(&a->s->max_seen, ZATOMIC_RELAXED);
+    while (seen < mine && !zatomic_cas64(&a->s->max_seen, &seen, mine, ZATOMIC_ACQ_REL)) 
+    {
+        zthread_cpu_relax();
+    }
+}
+
+// Plain writes, then a release store: an acquire load that sees the flag
+// also sees the payload.
+void publish_task(Shared *s) 
+{
+    for (int i = 0; i < 64; i++) 
+    {
+        s->payload[i] = i * i;
+    }
+    zatomic_store32(&s->published, 1, ZATOMIC_RELEASE);
+}
+
+int main(void) 
+{
+    static Shared s;
+    static int token = 7;
+    Arg args[THREADS];
+    zthread_t threads[THREADS], pub;
+    int64_t total = 0;
+    int ok = 1;
+
+    thread_create(&pub, publish_task, &s);
+    for (int i = 0; i < THREADS; i++) 
+    {
+        args[i].s = &s;
+        args[i].id = i;
+        thread_create(&threads[i], count_task, &args[i]);
+    }
+    while (!zatomic_load32(&s.published, ZATOMIC_ACQUIRE)) 
+    {
+        thread_sleep(0);
+    }
+    for (int i = 0; i < 64; i++) 
+    {
+        ok &= (s.payload[i] == i * i);
+    }
+    for (int i = 0; i < THREADS; i++) 
+    {
+        thread_join(threads[i]);
+    }
+    thread_join(pub);
+
+    for (int i = 0; i < THREADS; i++) 
+    {
+        total += zatomic_load64(&s.counters[i].hits, ZATOMIC_RELAXED);
+    }
+    printf("=> Counted %lld (expected %d), max %lld\n", (long long)total, THREADS * ROUNDS, (long long)s.max_seen);
+    ok &= (total == THREADS * ROUNDS && s.max_seen == THREADS * 1000);
+    ok &= (sizeof(PaddedCounter) == ZTHREAD_CACHE_LINE);
+
+    // Exchange hands back what was there.
+    ok &= (zatomic_exchange_ptr(&s.mailbox, &token, ZATOMIC_ACQ_REL) == NULL);
+    ok &= (zatomic_exchange_ptr(&s.mailbox, NULL, ZATOMIC_ACQ_REL) == &token);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define WORKERS 4
+#define PHASES 50
+#define SLOTS 2
+
+// Each worker runs PHASES lock-step rounds on a barrier. In every round it
+// also uses one of SLOTS permits of a semaphore, and when it is done it
+// counts down a latch that main waits on.
+
+typedef struct 
+{
+    zsem_t permits;
+    zbarrier_t round;
+    zlatch_t finished;
+    mutex_t lock;
+    int in_use, max_in_use;
+    int stamp[WORKERS];
+    int serial_count;
+    int bad_rounds;
+} Shared;
+
+typedef struct 
+{
+    Shared *s;
+    int id;
+} Arg;
+
+void worker_task(Arg *a) 
+{
+    Shared *s = a->s;
+    for (int phase = 1; phase <= PHASES; phase++) 
+    {
+        zsem_wait(&s->permits);
+        mutex_lock(&s->lock);
+        if (++s->in_use > s->max_in_use) 
+        {
+            s->max_in_use = s->in_use;
+        }
+        mutex_unlock(&s->lock);
+        s->stamp[a->id] = phase;
+        mutex_lock(&s->lock);
+        s->in_use--;
+        mutex_unlock(&s->lock);
+        zsem_post(&s->permits);
+
+        // One thread per phase checks that everybody got this far.
+        if (barrier_wait(&s->round) == ZBARRIER_SERIAL) 
+        {
+            s->serial_count++;
+            for (int i = 0; i < WORKERS; i++) 
+            {
+                s->bad_rounds += (s->stamp[i] != phase);
+            }
+        }
+        barrier_wait(&s->round);
+    }
+    latch_count_down(&s->finished, 1);
+}
+
+int main(void) 
+{
+    static Shared s;
+    Arg args[WORKERS];
+    zthread_t threads[WORKERS];
+    zsem_t empty;
+    zbarrier_t none;
+    int ok = 1;
+
+    ok &= (zsem_init(&s.permits, SLOTS) == Z_OK);
+    ok &= (barrier_init(&s.round, WORKERS) == Z_OK);
+    ok &= (latch_init(&s.finished, WORKERS) == Z_OK);
+    ok &= (barrier_init(&none, 0) == Z_EINVAL);
+    mutex_init(&s.lock);
+
+    ok &= (zlatch_try_wait(&s.finished) == 0);
+    for (int i = 0; i < WORKERS; i++) 
+    {
+        args[i].s = &s;
+        args[i].id = i;
+        thread_create(&threads[i], worker_task, &args[i]);
+    }
+    latch_wait(&s.finished);
+    ok &= (zlatch_try_wait(&s.finished) == 1);
+    for (int i = 0; i < WORKERS; i++) 
+    {
+        thread_join(threads[i]);
+    }
+
+    printf("=> Serial winners: %d (expected %d), bad rounds: %d\n", s.serial_count, PHASES, s.bad_rounds);
+    printf("=> Max permits in use: %d (limit %d)\n", s.max_in_use, SLOTS);
+    ok &= (s.serial_count == PHASES && s.bad_rounds == 0 && s.max_in_use >= 1 && s.max_in_use <= SLOTS);
+
+    // An empty semaphore refuses at once, and after a timeout.
+    zsem_init(&empty, 0);
+    ok &= (zsem_trywait(&empty) == Z_ERR);
+    ok &= (zsem_timedwait(&empty, 10 * 1000000LL) == Z_ETIMEDOUT);
+    zsem_post(&empty);
+    ok &= (zsem_trywait(&empty) == Z_OK);
+    zsem_destroy(&empty);
+
+    mutex_destroy(&s.lock);
+    latch_destroy(&s.finished);
+    barrier_destroy(&s.round);
+    zsem_destroy(&s.permits);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
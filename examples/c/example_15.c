@@ -0,0 +1,100 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 4
+#define ROUNDS 1000
+
+// ZTHREAD_LOCAL for a plain per-thread counter, and a TLS key whose
+// destructor reclaims each thread's heap buffer when the thread exits.
+
+typedef struct 
+{
+    int owner;
+    long uses;
+} Scratch;
+
+static ZTHREAD_LOCAL long local_hits = 0;
+static tls_key_t scratch_key;
+static volatile int32_t reclaimed = 0;
+static volatile int64_t reclaimed_uses = 0;
+
+void scratch_free(void *p) 
+{
+    Scratch *s = (Scratch*)p;
+    zatomic_fetch_add32(&reclaimed, 1, ZATOMIC_ACQ_REL);
+    zatomic_fetch_add64(&reclaimed_uses, s->uses, ZATOMIC_ACQ_REL);
+    free(s);
+}
+
+static Scratch *scratch_get(int id) 
+{
+    Scratch *s = (Scratch*)tls_get(scratch_key);
+    if (!s) 
+    {
+        s = (Scratch*)calloc(1, sizeof(*s));
+        s->owner = id;
+        tls_set(scratch_key, s);
+    }
+    return s;
+}
+
+typedef struct 
+{
+    int id;
+    int wrong;
+} Arg;
+
+void worker_task(Arg *a) 
+{
+    for (int i = 0; i < ROUNDS; i++) 
+    {
+        Scratch *s = scratch_get(a->id);
+        s->uses++;
+        local_hits++;
+        a->wrong += (s->owner != a->id);
+    }
+    a->wrong += (local_hits != ROUNDS);
+}
+
+int main(void) 
+{
+    Arg args[THREADS];
+    zthread_t threads[THREADS];
+    int ok = 1;
+
+    if (tls_key_create(&scratch_key, scratch_free) != Z_OK) 
+    {
+        return 1;
+    }
+    for (int i = 0; i < THREADS; i++) 
+    {
+        args[i].id = i;
+        args[i].wrong = 0;
+        thread_create(&threads[i], worker_task, &args[i]);
+    }
+    for (int i = 0; i < THREADS; i++) 
+    {
+        thread_join(threads[i]);
+        ok &= (args[i].wrong == 0);
+    }
+
+    printf("=> Buffers reclaimed: %d (expected %d), uses %lld\n", (int)reclaimed, THREADS, (long long)reclaimed_uses);
+    ok &= (reclaimed == THREADS && reclaimed_uses == (int64_t)THREADS * ROUNDS);
+    // Main never set a value, and its ZTHREAD_LOCAL copy was not touched.
+    ok &= (tls_get(scratch_key) == NULL && local_hits == 0);
+
+    // A key created after a delete starts out NULL, even where the deleted
+    // key still had a value (the emulated Win32 keys reuse the index).
+    static int held = 7;
+    tls_key_t again;
+    ok &= (tls_set(scratch_key, &held) == Z_OK && tls_get(scratch_key) == &held);
+    tls_key_delete(scratch_key);
+    ok &= (tls_key_create(&again, NULL) == Z_OK && tls_get(again) == NULL);
+    tls_key_delete(again);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
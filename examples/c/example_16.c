@@ -0,0 +1,80 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define STAGES 6
+
+// A build pipeline: fetch -> (compile_a, compile_b, compile_c) -> link ->
+// package. Every task takes a ticket when it runs; a task's ticket must be
+// later than those of all its predecessors.
+
+typedef struct 
+{
+    volatile int32_t *clock;
+    int ticket;
+} Stage;
+
+void stage_task(Stage *s) 
+{
+    s->ticket = zatomic_fetch_add32(s->clock, 1, ZATOMIC_ACQ_REL);
+}
+
+static int check_order(const Stage *st) 
+{
+    int ok = 1;
+    for (int c = 1; c <= 3; c++) 
+    {
+        ok &= (st[c].ticket > st[0].ticket && st[4].ticket > st[c].ticket);
+    }
+    return ok && st[5].ticket > st[4].ticket;
+}
+
+int main(void) 
+{
+    static const char *names[STAGES] = {"fetch", "compile_a", "compile_b", "compile_c", "link", "package"};
+    volatile int32_t clock = 0;
+    Stage st[STAGES];
+    int id[STAGES], ok = 1;
+    zpool_t *pool = pool_create(3);
+    ztask_graph_t *g = ztask_graph_create();
+
+    if (!pool || !g) 
+    {
+        return 1;
+    }
+    for (int i = 0; i < STAGES; i++) 
+    {
+        st[i].clock = &clock;
+        id[i] = ztask_graph_add_task(g, stage_task, &st[i]);
+    }
+    for (int c = 1; c <= 3; c++) 
+    {
+        ztask_graph_add_edge(g, id[0], id[c]);
+        ztask_graph_add_edge(g, id[c], id[4]);
+    }
+    ztask_graph_add_edge(g, id[4], id[5]);
+    ok &= (ztask_graph_add_edge(g, id[2], id[2]) == Z_EINVAL);
+    ok &= (ztask_graph_size(g) == STAGES);
+
+    // Built once, run many times; the last run is inline.
+    for (int run = 0; run < 20; run++) 
+    {
+        ok &= (ztask_graph_run(g, (run < 19) ? pool : NULL) == Z_OK);
+        ok &= check_order(st);
+    }
+    for (int i = 0; i < STAGES; i++) 
+    {
+        printf("    => %-9s ticket %d\n", names[i], st[i].ticket);
+    }
+    ok &= (clock == 20 * STAGES);
+
+    // Closing the loop makes it a cycle, which is refused.
+    ztask_graph_add_edge(g, id[5], id[0]);
+    ok &= (ztask_graph_run(g, pool) == Z_EINVAL);
+
+    ztask_graph_destroy(g);
+    pool_shutdown(pool);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define PRODUCERS 100
+#define ITEMS 20
+#define CONSUMERS 4
+
+// Far more fibers than worker threads. Producers and consumers meet on a
+// small fiber queue, and a fiber mutex guards the totals; blocking on either
+// only parks the fiber, never the worker.
+
+typedef struct 
+{
+    zfqueue_t *q;
+    zfmutex_t lock;
+    long long sum;
+    int received;
+    volatile int32_t outside_fiber;
+} Shared;
+
+void producer_fiber(Shared *s) 
+{
+    static volatile int32_t next_id = 0;
+    int base = zatomic_fetch_add32(&next_id, 1, ZATOMIC_RELAXED) * ITEMS;
+    if (!zfiber_in_fiber()) 
+    {
+        zatomic_fetch_add32(&s->outside_fiber, 1, ZATOMIC_RELAXED);
+    }
+    for (int i = 1; i <= ITEMS; i++) 
+    {
+        zfqueue_push(s->q, (void*)(uintptr_t)(base + i));
+        if (i % 5 == 0) 
+        {
+            zfiber_yield();
+        }
+    }
+}
+
+void consumer_fiber(Shared *s) 
+{
+    for (int i = 0; i < PRODUCERS * ITEMS / CONSUMERS; i++) 
+    {
+        uintptr_t v = (uintptr_t)zfqueue_pop(s->q);
+        zfmutex_lock(&s->lock);
+        s->sum += (long long)v;
+        s->received++;
+        zfmutex_unlock(&s->lock);
+    }
+}
+
+int main(void) 
+{
+    static Shared s;
+    long long n = (long long)PRODUCERS * ITEMS;
+    zfiber_sched_t *sched = zfiber_sched_create(2, 0);
+    int ok = 1;
+
+    s.q = zfqueue_create(8);
+    if (!sched || !s.q) 
+    {
+        return 1;
+    }
+    zfmutex_init(&s.lock);
+    ok &= !zfiber_in_fiber();
+
+    for (int i = 0; i < CONSUMERS; i++) 
+    {
+        ok &= (zfiber_spawn(sched, consumer_fiber, &s) == Z_OK);
+    }
+    for (int i = 0; i < PRODUCERS; i++) 
+    {
+        ok &= (zfiber_spawn(sched, producer_fiber, &s) == Z_OK);
+    }
+    zfiber_sched_shutdown(sched);   // Returns once every fiber has finished.
+
+    printf("=> Received %d items, sum %lld (expected %lld)\n", s.received, s.sum, n * (n + 1) / 2);
+    ok &= (s.received == n && s.sum == n * (n + 1) / 2 && s.outside_fiber == 0);
+
+    void *left;
+    ok &= (zfqueue_try_pop(s.q, &left) == Z_EEMPTY);
+    zfqueue_destroy(s.q);
+    zfmutex_destroy(&s.lock);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#define ZTHREAD_PROFILE         // Per-lock contention and hold-time stats.
+#include "zthread.h"
+#include <stdio.h>
+
+#define ROUNDS 10000
+
+typedef struct 
+{
+    mutex_t hot;
+    mutex_t cold;
+    cond_t never;
+    long counter;
+} Locks;
+
+void hammer_task(Locks *l) 
+{
+    for (int i = 0; i < ROUNDS; i++) 
+    {
+        mutex_lock(&l->hot);
+        l->counter++;
+        mutex_unlock(&l->hot);
+    }
+}
+
+static int find(const void *lock, zprofile_stats_t *out) 
+{
+    int it = 0;
+    while ((it = zthread_profile_next(it, out))) 
+    {
+        if (out->lock == lock) 
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void) 
+{
+    static Locks l;
+    zthread_t threads[2];
+    zprofile_stats_t hot, cold, never;
+    int ok = 1;
+
+    mutex_init(&l.hot);
+    mutex_init(&l.cold);
+    cond_init(&l.never);
+    zthread_profile_name(&l.hot, "hot");
+    zthread_profile_name(&l.cold, "cold");
+    zthread_profile_name(&l.never, "never");
+
+    for (int i = 0; i < 2; i++) 
+    {
+        thread_create(&threads[i], hammer_task, &l);
+    }
+    for (int i = 0; i < 2; i++) 
+    {
+        thread_join(threads[i]);
+    }
+    mutex_lock(&l.cold);
+    for (int i = 0; i < 2; i++) 
+    {
+        ok &= (zcond_timedwait(&l.never, &l.cold, 1000000) == Z_ETIMEDOUT);
+    }
+    mutex_unlock(&l.cold);
+
+    zthread_profile_dump(stdout);
+    ok &= find(&l.hot, &hot) && find(&l.cold, &cold) && find(&l.never, &never);
+    ok &= (hot.acquires == 2 * ROUNDS && hot.contended <= hot.acquires && hot.kind == ZPROFILE_MUTEX);
+    ok &= (never.kind == ZPROFILE_COND && never.contended == 2);
+    // Re-acquiring 'cold' inside the waits counts toward the cond, not the mutex.
+    ok &= (cold.acquires == 1 && cold.contended == 0);
+    ok &= (l.counter == 2 * ROUNDS);
+
+    zthread_profile_reset();
+    ok &= find(&l.hot, &hot) && hot.acquires == 0;
+
+    cond_destroy(&l.never);
+    mutex_destroy(&l.cold);
+    mutex_destroy(&l.hot);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
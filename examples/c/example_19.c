@@ -0,0 +1,74 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLES 15
+#define BATCH 20000
+#define SPAWNS 50
+
+// Timing a primitive the way bench/ does: several samples, each a batch of
+// operations turned into one ns/op figure, reported as percentiles. The
+// work is still checked, so a broken primitive cannot post a fast number.
+
+static int by_value(const void *a, const void *b) 
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int report(const char *name, double *ns) 
+{
+    qsort(ns, SAMPLES, sizeof(double), by_value);
+    printf("    => %-16s min %8.1f  p50 %8.1f  max %8.1f ns/op\n", name, ns[0], ns[SAMPLES / 2], ns[SAMPLES - 1]);
+    return ns[0] > 0.0 && ns[0] <= ns[SAMPLES / 2] && ns[SAMPLES / 2] <= ns[SAMPLES - 1];
+}
+
+void empty_task(void *arg) 
+{
+    (void)arg;
+}
+
+int main(void) 
+{
+    mutex_t m;
+    double ns[SAMPLES];
+    long counter = 0;
+    int ok = 1;
+
+    mutex_init(&m);
+    for (int s = 0; s < SAMPLES; s++) 
+    {
+        int64_t t0 = zthread_now_ns();
+        for (int i = 0; i < BATCH; i++) 
+        {
+            mutex_lock(&m);
+            counter++;
+            mutex_unlock(&m);
+        }
+        // Clamp to 1 ns per batch so a coarse clock cannot report zero.
+        int64_t dt = zthread_now_ns() - t0;
+        ns[s] = (double)(dt > 0 ? dt : 1) / BATCH;
+    }
+    mutex_destroy(&m);
+    ok &= report("mutex_uncontended", ns);
+    ok &= (counter == (long)SAMPLES * BATCH);
+
+    for (int s = 0; s < SAMPLES; s++) 
+    {
+        int64_t t0 = zthread_now_ns();
+        for (int i = 0; i < SPAWNS; i++) 
+        {
+            zthread_t t;
+            ok &= (thread_create(&t, empty_task, NULL) == Z_OK);
+            thread_join(t);
+        }
+        int64_t dt = zthread_now_ns() - t0;
+        ns[s] = (double)(dt > 0 ? dt : 1) / SPAWNS;
+    }
+    ok &= report("spawn_join", ns);
+
+    printf("=> %s (full suite: make bench)\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#define ZTHREAD_TRACE           // Per-worker event rings.
+#include "zthread.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TASKS 100
+
+// Records a pool run, writes it in the binary format and reads it back:
+// every task must show up as one begin and one end event. The same buffer
+// could be written as Chrome trace JSON for chrome://tracing.
+
+static volatile int32_t ran = 0;
+
+void traced_task(void *arg) 
+{
+    (void)arg;
+    zatomic_fetch_add32(&ran, 1, ZATOMIC_RELAXED);
+}
+
+int main(void) 
+{
+    zpool_t *pool = pool_create(2);
+    FILE *f = tmpfile();
+    char magic[8];
+    ztrace_block_t block;
+    ztrace_event_t ev;
+    uint64_t id = (uint64_t)(uintptr_t)traced_task;
+    int begins = 0, ends = 0, blocks = 0, ok = 1;
+
+    if (!pool || !f) 
+    {
+        return 1;
+    }
+    for (int i = 0; i < TASKS; i++) 
+    {
+        pool_submit(pool, traced_task, NULL);
+    }
+    pool_wait_idle(pool);
+
+    ok &= (zthread_trace_flush(f, ZTRACE_BINARY) == Z_OK);
+    rewind(f);
+    ok &= (fread(magic, 1, 8, f) == 8 && 0 == memcmp(magic, "ZTRACE1", 8));
+    while (fread(&block, sizeof(block), 1, f) == 1) 
+    {
+        blocks++;
+        ok &= (block.kind == ZTRACE_POOL && block.sched == (uint64_t)(uintptr_t)pool);
+        for (uint32_t i = 0; i < block.count && fread(&ev, sizeof(ev), 1, f) == 1; i++) 
+        {
+            begins += (ev.type == ZTRACE_TASK_BEGIN && ev.id == id);
+            ends += (ev.type == ZTRACE_TASK_END && ev.id == id);
+        }
+    }
+    fclose(f);
+    printf("=> %d worker block(s), %d begins, %d ends for %d tasks\n", blocks, begins, ends, (int)ran);
+    ok &= (blocks >= 1 && begins == TASKS && ends == TASKS && ran == TASKS);
+
+    // JSON is the other supported format; anything else is refused.
+    f = tmpfile();
+    ok &= (f && zthread_trace_flush(f, ZTRACE_JSON) == Z_OK);
+    ok &= (f && zthread_trace_flush(f, 42) == Z_EINVAL);
+    if (f) 
+    {
+        fclose(f);
+    }
+
+    pool_shutdown(pool);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
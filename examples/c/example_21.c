@@ -0,0 +1,121 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define CONSUMERS 3
+#define ITEMS 3000
+
+// An event count in front of a lock-free token counter, and a thread parked
+// on its own token until another thread publishes a flag and unparks it.
+
+static zeventcount_t ec;
+static volatile int32_t tokens = 0;
+static volatile int32_t done = 0;
+
+static int take_token(void) 
+{
+    int32_t t = zatomic_load32(&tokens, ZATOMIC_ACQUIRE);
+    while (t > 0) 
+    {
+        if (zatomic_cas32(&tokens, &t, t - 1, ZATOMIC_ACQ_REL)) 
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ready(void) 
+{
+    return zatomic_load32(&tokens, ZATOMIC_ACQUIRE) > 0 || zatomic_load32(&done, ZATOMIC_ACQUIRE);
+}
+
+void consumer(int *taken) 
+{
+    for (;;) 
+    {
+        if (take_token()) 
+        {
+            (*taken)++;
+            continue;
+        }
+        if (zatomic_load32(&done, ZATOMIC_ACQUIRE) && !zatomic_load32(&tokens, ZATOMIC_ACQUIRE)) 
+        {
+            return;
+        }
+        int32_t key = zeventcount_prepare_wait(&ec);
+        if (ready()) 
+        {
+            zeventcount_cancel_wait(&ec);
+            continue;
+        }
+        zeventcount_commit_wait(&ec, key);
+    }
+}
+
+static void *volatile sleeper_parker = NULL;
+static volatile int32_t go = 0;
+
+void sleeper(int *wakeups) 
+{
+    zatomic_store_ptr(&sleeper_parker, zthread_parker(), ZATOMIC_RELEASE);
+    while (!zatomic_load32(&go, ZATOMIC_ACQUIRE)) 
+    {
+        zthread_park();
+        (*wakeups)++;
+    }
+}
+
+int main(void) 
+{
+    zthread_t t[CONSUMERS], s;
+    int taken[CONSUMERS] = {0}, wakeups = 0, total = 0, ok = 1;
+
+    zeventcount_init(&ec);
+    for (int i = 0; i < CONSUMERS; i++) 
+    {
+        thread_create(&t[i], consumer, &taken[i]);
+    }
+    for (int i = 0; i < ITEMS; i++) 
+    {
+        zatomic_fetch_add32(&tokens, 1, ZATOMIC_RELEASE);
+        zeventcount_notify(&ec);
+        if (i % 100 == 0) 
+        {
+            thread_sleep(0);
+        }
+    }
+    zatomic_store32(&done, 1, ZATOMIC_RELEASE);
+    zeventcount_notify_all(&ec);
+    for (int i = 0; i < CONSUMERS; i++) 
+    {
+        thread_join(t[i]);
+        total += taken[i];
+    }
+    zeventcount_destroy(&ec);
+    printf("=> Eventcount: %d/%d tokens taken (%d, %d, %d)\n", total, ITEMS, taken[0], taken[1], taken[2]);
+    ok &= (total == ITEMS && tokens == 0);
+
+    // No token: the park times out. A token set before the park is kept.
+    ok &= (zthread_park_for(1000000) == Z_ETIMEDOUT);
+    zthread_unpark(zthread_parker());
+    ok &= (zthread_park_for(1000000000) == Z_OK);
+    zthread_unpark(zthread_parker());
+    zthread_park();
+
+    thread_create(&s, sleeper, &wakeups);
+    while (!zatomic_load_ptr(&sleeper_parker, ZATOMIC_ACQUIRE)) 
+    {
+        thread_sleep(1);
+    }
+    thread_sleep(10);
+    zatomic_store32(&go, 1, ZATOMIC_RELEASE);
+    zthread_unpark((zparker_t*)zatomic_load_ptr(&sleeper_parker, ZATOMIC_ACQUIRE));
+    thread_join(s);
+    printf("=> Parked thread woke %d time(s)\n", wakeups);
+    ok &= (wakeups >= 1);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define MS 1000000LL
+
+// Delayed tasks and a periodic timer on the pool's timer wheel. Timers are
+// submitted out of order and must fire in deadline order, never early.
+
+typedef struct 
+{
+    int64_t delay_ns;
+    int64_t fired_ns;
+    int32_t order;
+} Delayed;
+
+static int64_t start_ns = 0;
+static volatile int32_t claimed = 0;
+static volatile int32_t fired = 0;
+static volatile int32_t ticks = 0;
+
+// Fills the record first and publishes it with the release increment that
+// main waits on.
+void on_delay(Delayed *d) 
+{
+    int32_t order = zatomic_fetch_add32(&claimed, 1, ZATOMIC_RELAXED);
+    d->fired_ns = thread_now_ns();
+    d->order = order;
+    zatomic_fetch_add32(&fired, 1, ZATOMIC_RELEASE);
+}
+
+void on_tick(void *arg) 
+{
+    (void)arg;
+    zatomic_fetch_add32(&ticks, 1, ZATOMIC_ACQ_REL);
+}
+
+static int wait_for(volatile int32_t *v, int32_t n) 
+{
+    for (int i = 0; i < 2000 && zatomic_load32(v, ZATOMIC_ACQUIRE) < n; i++) 
+    {
+        thread_sleep(1);
+    }
+    return zatomic_load32(v, ZATOMIC_ACQUIRE) >= n;
+}
+
+int main(void) 
+{
+    zpool_t *pool = pool_create(2);
+    Delayed d[3] = { {30 * MS, 0, -1}, {10 * MS, 0, -1}, {20 * MS, 0, -1} };
+    zpool_timer_t tick;
+    int ok = 1;
+
+    if (!pool) 
+    {
+        return 1;
+    }
+    start_ns = thread_now_ns();
+    for (int i = 0; i < 3; i++) 
+    {
+        ok &= (zpool_submit_after(pool, d[i].delay_ns, on_delay, &d[i]) == Z_OK);
+    }
+    ok &= (zpool_submit_after(pool, -1, on_delay, &d[0]) == Z_EINVAL);
+    ok &= wait_for(&fired, 3);
+    for (int i = 0; i < 3; i++) 
+    {
+        printf("=> %2lld ms timer fired #%d after %.2f ms\n", (long long)(d[i].delay_ns / MS), (int)d[i].order,
+            (double)(d[i].fired_ns - start_ns) / MS);
+        ok &= (d[i].fired_ns - start_ns >= d[i].delay_ns);
+    }
+    ok &= (d[1].order == 0 && d[2].order == 1 && d[0].order == 2);
+
+    // Every 5 ms until cancelled; no run starts after a successful cancel.
+    zpool_timer_init(&tick, on_tick, NULL);
+    ok &= (zpool_timer_start(pool, &tick, 5 * MS, -5 * MS) == Z_EINVAL);
+    ok &= (zpool_timer_start(pool, &tick, 5 * MS, 5 * MS) == Z_OK);
+    ok &= wait_for(&ticks, 5);
+    ok &= (zpool_timer_cancel(&tick) == Z_OK);
+    pool_wait_idle(pool);
+    int32_t at_cancel = zatomic_load32(&ticks, ZATOMIC_ACQUIRE);
+    thread_sleep(30);
+    printf("=> Periodic timer ran %d times, %d after cancel\n", (int)at_cancel, (int)(ticks - at_cancel));
+    ok &= (ticks == at_cancel);
+    ok &= (zpool_timer_cancel(&tick) == Z_ERR);
+
+    pool_shutdown(pool);
+
+    // A lone worker sleeping until a far timer still wakes up for new work.
+    zpool_t *single = pool_create(1);
+    zpool_timer_t far;
+    int64_t sent;
+    if (!single) 
+    {
+        return 1;
+    }
+    zpool_timer_init(&far, on_tick, NULL);
+    ok &= (zpool_timer_start(single, &far, 3000 * MS, 0) == Z_OK);
+    thread_sleep(20);
+    sent = thread_now_ns();
+    pool_submit(single, on_tick, NULL);
+    pool_wait_idle(single);
+    printf("=> Task behind a 3 s timer ran after %.2f ms\n", (double)(thread_now_ns() - sent) / MS);
+    ok &= (thread_now_ns() - sent < 1000 * MS);
+    ok &= (zpool_timer_cancel(&far) == Z_OK);
+    pool_shutdown(single);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
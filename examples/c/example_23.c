@@ -0,0 +1,57 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define US 1000LL
+#define MS 1000000LL
+#define PERIODS 50
+
+// Nanosecond sleeps never return early. The precise variant spins out the
+// last stretch to trim the oversleep of the OS timer.
+
+int main(void) 
+{
+    static const int64_t naps[] = { 50 * US, 200 * US, 1 * MS, 5 * MS };
+    int ok = 1;
+
+    for (int i = 0; i < 4; i++) 
+    {
+        int64_t t0 = thread_now_ns();
+        thread_sleep_ns(naps[i]);
+        int64_t t1 = thread_now_ns();
+        zthread_sleep_precise(naps[i]);
+        int64_t t2 = thread_now_ns();
+        printf("=> %5lld us: sleep_ns took %7.1f us, sleep_precise %7.1f us\n", (long long)(naps[i] / US),
+            (double)(t1 - t0) / US, (double)(t2 - t1) / US);
+        ok &= (t1 - t0 >= naps[i] && t2 - t1 >= naps[i]);
+    }
+
+    // A deadline in the past returns at once; so do zero and negative naps.
+    int64_t t0 = thread_now_ns();
+    thread_sleep_until(t0 - MS);
+    zthread_sleep_precise_until(t0 - MS);
+    thread_sleep_ns(0);
+    thread_sleep_ns(-MS);
+    ok &= (thread_now_ns() - t0 < 50 * MS);
+
+    // Fixed-rate loop on absolute deadlines: lateness does not accumulate.
+    int64_t deadline = thread_now_ns(), worst = 0, begin = deadline;
+    for (int i = 0; i < PERIODS; i++) 
+    {
+        zthread_sleep_precise_until(deadline += MS);
+        int64_t late = thread_now_ns() - deadline;
+        ok &= (late >= 0);
+        worst = (late > worst) ? late : worst;
+    }
+    int64_t total = thread_now_ns() - begin;
+    printf("=> %d x 1 ms periods took %.2f ms, worst lateness %.1f us\n", PERIODS, (double)total / MS,
+        (double)worst / US);
+    ok &= (total >= PERIODS * MS);
+
+    thread_sleep_until(deadline + 2 * MS);
+    ok &= (thread_now_ns() >= deadline + 2 * MS);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
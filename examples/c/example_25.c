@@ -0,0 +1,131 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAGIC 0x5afe5afeu
+#define FILLER 200
+
+// A reader holds on to a node that a writer has already unlinked and
+// retired, first inside an EBR critical section, then through a hazard
+// pointer. The node must survive until the reader lets go, and be freed
+// once it has.
+
+typedef struct 
+{
+    uint32_t magic;
+    volatile int32_t *freed;
+} Node;
+
+static void *volatile shared = NULL;
+static volatile int32_t holding = 0;
+static volatile int32_t release = 0;
+static volatile int32_t fillers_freed = 0;
+
+static Node *node_new(volatile int32_t *freed) 
+{
+    Node *n = (Node*)malloc(sizeof(*n));
+    n->magic = MAGIC;
+    n->freed = freed;
+    return n;
+}
+
+void node_free(Node *n) 
+{
+    if (n->freed) 
+    {
+        zatomic_store32(n->freed, 1, ZATOMIC_RELEASE);
+    }
+    else 
+    {
+        zatomic_fetch_add32(&fillers_freed, 1, ZATOMIC_ACQ_REL);
+    }
+    n->magic = 0;
+    free(n);
+}
+
+static void wait_flag(volatile int32_t *flag, int32_t v) 
+{
+    while (zatomic_load32(flag, ZATOMIC_ACQUIRE) != v) 
+    {
+        thread_sleep(0);
+    }
+}
+
+void ebr_reader(int *intact) 
+{
+    zebr_enter();
+    Node *n = (Node*)zatomic_load_ptr(&shared, ZATOMIC_ACQUIRE);
+    zatomic_store32(&holding, 1, ZATOMIC_RELEASE);
+    wait_flag(&release, 1);
+    *intact = (n && n->magic == MAGIC);
+    zebr_exit();
+}
+
+void hazard_reader(int *intact) 
+{
+    Node *n = (Node*)zhazard_protect(0, &shared);
+    zatomic_store32(&holding, 1, ZATOMIC_RELEASE);
+    wait_flag(&release, 1);
+    *intact = (n && n->magic == MAGIC);
+    zhazard_clear(0);
+}
+
+typedef void (*reader_fn)(int*);
+
+// Unlinks and retires the shared node while 'reader' still uses it.
+static int run(const char *name, reader_fn reader, int hazard) 
+{
+    volatile int32_t freed = 0;
+    int intact = 0, ok = 1;
+    zthread_t t;
+    int32_t early;
+
+    zatomic_store32(&holding, 0, ZATOMIC_RELAXED);
+    zatomic_store32(&release, 0, ZATOMIC_RELAXED);
+    zatomic_store_ptr(&shared, node_new(&freed), ZATOMIC_RELEASE);
+    thread_create(&t, reader, &intact);
+    wait_flag(&holding, 1);
+
+    Node *old = (Node*)zatomic_exchange_ptr(&shared, NULL, ZATOMIC_ACQ_REL);
+    ok &= ((hazard ? zhazard_retire(old, node_free) : zebr_retire(old, node_free)) == Z_OK);
+    // Enough retires to trigger reclamation passes; the held node survives them.
+    for (int i = 0; i < FILLER; i++) 
+    {
+        ok &= ((hazard ? zhazard_retire(node_new(NULL), node_free) : zebr_retire(node_new(NULL), node_free)) == Z_OK);
+    }
+    if (hazard) 
+    {
+        zhazard_scan();
+    }
+    early = zatomic_load32(&freed, ZATOMIC_ACQUIRE);
+
+    zatomic_store32(&release, 1, ZATOMIC_RELEASE);
+    thread_join(t);
+    if (hazard) 
+    {
+        zhazard_scan();
+    }
+    else 
+    {
+        zebr_synchronize();
+    }
+    printf("=> %s: freed while held %d, intact %d, freed after %d\n", name, (int)early, intact, (int)freed);
+    ok &= (!early && intact && freed);
+    return ok;
+}
+
+int main(void) 
+{
+    int ok = 1;
+
+    ok &= run("EBR", ebr_reader, 0);
+    int32_t after_ebr = zatomic_load32(&fillers_freed, ZATOMIC_ACQUIRE);
+    ok &= run("Hazard", hazard_reader, 1);
+    printf("=> Filler nodes freed: %d by EBR, %d by hazard scans\n", (int)after_ebr, (int)(fillers_freed - after_ebr));
+    ok &= (after_ebr == FILLER && fillers_freed == 2 * FILLER);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
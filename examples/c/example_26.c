@@ -0,0 +1,130 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 4
+#define PER_THREAD 2000
+#define SHARED 100
+
+// Threads fill a string-keyed zcmap_t with their own keys and race on a
+// common set; each common key must be inserted exactly once. Then lookups,
+// batches, replacement and erasure are checked against what went in.
+
+static char own_keys[THREADS][PER_THREAD][16];
+static char shared_keys[SHARED][16];
+
+static uint64_t str_hash(const void *key) 
+{
+    uint64_t h = 1469598103934665603ull;
+    for (const char *s = (const char*)key; *s; s++) 
+    {
+        h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    }
+    return h;
+}
+
+static int str_eq(const void *a, const void *b) 
+{
+    return 0 == strcmp((const char*)a, (const char*)b);
+}
+
+typedef struct 
+{
+    zcmap_t *map;
+    int id;
+    int inserted;
+    int existed;
+} Filler;
+
+void fill(Filler *f) 
+{
+    for (int i = 0; i < PER_THREAD; i++) 
+    {
+        f->inserted += (zcmap_insert(f->map, own_keys[f->id][i], (void*)(intptr_t)(f->id * PER_THREAD + i + 1)) == Z_OK);
+        if (i < SHARED) 
+        {
+            int rc = zcmap_insert(f->map, shared_keys[i], (void*)(intptr_t)(f->id + 1));
+            f->existed += (rc == Z_EEXIST);
+        }
+    }
+}
+
+int main(void) 
+{
+    zcmap_t *map = zcmap_create(8, str_hash, str_eq);
+    Filler f[THREADS];
+    zthread_t t[THREADS];
+    int inserted = 0, existed = 0, mismatched = 0, ok = 1;
+    void *v = NULL;
+
+    if (!map) 
+    {
+        return 1;
+    }
+    ok &= (zcmap_create((size_t)-1, NULL, NULL) == NULL);
+    for (int i = 0; i < SHARED; i++) 
+    {
+        snprintf(shared_keys[i], sizeof(shared_keys[i]), "shared-%d", i);
+    }
+    for (int i = 0; i < THREADS; i++) 
+    {
+        for (int k = 0; k < PER_THREAD; k++) 
+        {
+            snprintf(own_keys[i][k], sizeof(own_keys[i][k]), "t%d-%d", i, k);
+        }
+        f[i].map = map;
+        f[i].id = i;
+        f[i].inserted = f[i].existed = 0;
+        thread_create(&t[i], fill, &f[i]);
+    }
+    for (int i = 0; i < THREADS; i++) 
+    {
+        thread_join(t[i]);
+        inserted += f[i].inserted;
+        existed += f[i].existed;
+    }
+    printf("=> %d own keys, %d lost races on %d shared keys, size %d\n", inserted, existed, SHARED,
+        (int)zcmap_size(map));
+    ok &= (inserted == THREADS * PER_THREAD && existed == (THREADS - 1) * SHARED);
+    ok &= (zcmap_size(map) == THREADS * PER_THREAD + SHARED);
+
+    // Lookups with an equal key at a different address.
+    for (int i = 0; i < THREADS; i++) 
+    {
+        for (int k = 0; k < PER_THREAD; k++) 
+        {
+            char key[16];
+            memcpy(key, own_keys[i][k], sizeof(key));
+            mismatched += (zcmap_find(map, key, &v) != Z_OK || v != (void*)(intptr_t)(i * PER_THREAD + k + 1));
+        }
+    }
+    ok &= (mismatched == 0);
+
+    const void *batch[4] = { own_keys[0][7], "missing", shared_keys[3], own_keys[3][1999] };
+    void *values[4];
+    int results[4];
+    ok &= (zcmap_find_many(map, batch, values, 4, results) == 3);
+    ok &= (results[1] == Z_ENOTFOUND && values[1] == NULL && values[0] == (void*)(intptr_t)8);
+
+    const void *fresh[3] = { "new-a", "new-b", own_keys[1][0] };
+    void *const fresh_values[3] = { (void*)1, (void*)2, (void*)3 };
+    ok &= (zcmap_insert_many(map, fresh, fresh_values, 3, results) == 2 && results[2] == Z_EEXIST);
+
+    // Replace, then erase.
+    ok &= (zcmap_put(map, "new-a", (void*)10, &v) == Z_OK && v == (void*)1);
+    ok &= (zcmap_put(map, "new-c", (void*)11, &v) == Z_OK && v == NULL);
+    ok &= (zcmap_erase(map, "new-a", &v) == Z_OK && v == (void*)10);
+    ok &= (zcmap_erase(map, "new-a", NULL) == Z_ENOTFOUND && zcmap_find(map, "new-a", NULL) == Z_ENOTFOUND);
+    for (int k = 0; k < PER_THREAD; k++) 
+    {
+        ok &= (zcmap_erase(map, own_keys[2][k], NULL) == Z_OK);
+    }
+    printf("=> Size after batches and erasing one thread's keys: %d\n", (int)zcmap_size(map));
+    ok &= (zcmap_size(map) == (THREADS - 1) * PER_THREAD + SHARED + 2);
+    zcmap_destroy(map);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
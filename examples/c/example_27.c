@@ -0,0 +1,104 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stddef.h>
+#include <stdio.h>
+
+#define SENDERS 4
+#define MESSAGES 5000
+
+// Several senders post into one intrusive zmpsc_t mailbox, some of them
+// three messages at a time with zmpsc_push_list. The consumer drains it in
+// batches; each sender's messages must arrive once and in order.
+
+typedef struct 
+{
+    zmpsc_node_t node;
+    int sender;
+    int seq;
+} Msg;
+
+static Msg msgs[SENDERS][MESSAGES];
+
+typedef struct 
+{
+    zmpsc_t *box;
+    int id;
+} Sender;
+
+void send_all(Sender *s) 
+{
+    Msg *m = msgs[s->id];
+    for (int i = 0, pushes = 1; i < MESSAGES; pushes++) 
+    {
+        if (pushes % 200 == 0) 
+        {
+            thread_sleep(0);
+        }
+        if (i % 10 == 0 && i + 3 <= MESSAGES) 
+        {
+            m[i].node.next = &m[i + 1].node;
+            m[i + 1].node.next = &m[i + 2].node;
+            zmpsc_push_list(s->box, &m[i].node, &m[i + 2].node);
+            i += 3;
+        }
+        else 
+        {
+            zmpsc_push(s->box, &m[i++].node);
+        }
+    }
+}
+
+int main(void) 
+{
+    zmpsc_t *box = zmpsc_create();
+    Msg a = {{NULL}, 0, 1}, b = {{NULL}, 0, 2};
+    Sender s[SENDERS];
+    zthread_t t[SENDERS];
+    int next_seq[SENDERS] = {0}, received = 0, batches = 0, errors = 0, ok = 1;
+
+    if (!box) 
+    {
+        return 1;
+    }
+    ok &= (zmpsc_empty(box) && zmpsc_try_pop(box) == NULL && zmpsc_try_pop_all(box) == NULL);
+    zmpsc_push(box, &a.node);
+    zmpsc_push(box, &b.node);
+    ok &= (!zmpsc_empty(box) && zmpsc_try_pop(box) == &a.node && zmpsc_pop(box) == &b.node && zmpsc_empty(box));
+
+    for (int i = 0; i < SENDERS; i++) 
+    {
+        for (int k = 0; k < MESSAGES; k++) 
+        {
+            msgs[i][k].sender = i;
+            msgs[i][k].seq = k;
+        }
+        s[i].box = box;
+        s[i].id = i;
+        thread_create(&t[i], send_all, &s[i]);
+    }
+    while (received < SENDERS * MESSAGES) 
+    {
+        zmpsc_node_t *n, *next;
+        for (n = zmpsc_pop_all(box); n; n = next) 
+        {
+            Msg *m = ZMPSC_ENTRY(n, Msg, node);
+            next = n->next;
+            errors += (m->seq != next_seq[m->sender]);
+            next_seq[m->sender] = m->seq + 1;
+            received++;
+        }
+        batches++;
+    }
+    for (int i = 0; i < SENDERS; i++) 
+    {
+        thread_join(t[i]);
+        errors += (next_seq[i] != MESSAGES);
+    }
+    printf("=> %d messages from %d senders in %d batches, %d out of order\n", received, SENDERS, batches, errors);
+    ok &= (received == SENDERS * MESSAGES && errors == 0 && zmpsc_empty(box));
+    zmpsc_destroy(box);
+
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
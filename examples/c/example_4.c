@@ -0,0 +1,51 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define NUM_JOBS 10
+
+typedef struct 
+{
+    int id;
+    int result;
+} Job;
+
+// Runs on a pool worker; no thread is spawned per job.
+void process_job(Job *job) 
+{
+    job->result = job->id * job->id;
+    printf("    => [Worker] Job #%d done.\n", job->id);
+}
+
+int main(void) 
+{
+    Job jobs[NUM_JOBS];
+
+    printf("=> Thread pool demo.\n");
+
+    pool_t *pool = pool_create(2);
+    if (!pool) 
+    {
+        return 1;
+    }
+
+    for (int i = 0; i < NUM_JOBS; i++) 
+    {
+        jobs[i].id = i + 1;
+        pool_submit(pool, process_job, &jobs[i]);
+    }
+
+    // Blocks until every queued job has run.
+    pool_wait_idle(pool);
+
+    int sum = 0;
+    for (int i = 0; i < NUM_JOBS; i++) 
+    {
+        sum += jobs[i].result;
+    }
+    printf("=> Sum of squares: %d (expected 385)\n", sum);
+
+    pool_shutdown(pool);
+    return (sum == 385) ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define ROUNDS 2000
+
+// Each spawner allocates its child's start block from its own descriptor
+// cache and exits at once, so the child often returns the block while the
+// spawner's cache is being torn down. The cache must be freed exactly once.
+
+typedef struct 
+{
+    zthread_t child;
+    volatile int32_t *ran;
+} Spawn;
+
+void child_task(volatile int32_t *ran) 
+{
+    zatomic_fetch_add32(ran, 1, ZATOMIC_RELAXED);
+}
+
+void spawner_task(Spawn *s) 
+{
+    thread_create(&s->child, child_task, s->ran);
+}
+
+int main(void) 
+{
+    volatile int32_t ran = 0;
+    Spawn s;
+
+    printf("=> Spawning %d short-lived parent/child pairs...\n", ROUNDS);
+    s.ran = &ran;
+    for (int i = 0; i < ROUNDS; i++) 
+    {
+        zthread_t spawner;
+        if (thread_create(&spawner, spawner_task, &s) != Z_OK) 
+        {
+            return 1;
+        }
+        thread_join(spawner);
+        thread_join(s.child);
+    }
+
+    printf("=> Children run: %d\n", (int)ran);
+    if (ran != ROUNDS) 
+    {
+        printf("=> FAILED\n");
+        return 1;
+    }
+    printf("=> OK\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define NUM_THREADS 4
+#define ROUNDS 100000
+
+// Short critical sections are where an adaptive mutex pays off: a waiter
+// spins briefly instead of parking, since the owner is about to release.
+
+typedef struct 
+{
+    long hits;
+    mutex_t lock;
+} Counter;
+
+void bump_task(Counter *c) 
+{
+    for (int i = 0; i < ROUNDS; i++) 
+    {
+        mutex_lock(&c->lock);
+        c->hits++;
+        mutex_unlock(&c->lock);
+    }
+}
+
+int main(void) 
+{
+    Counter c = {0};
+    zthread_t threads[NUM_THREADS];
+    mutex_t bad;
+
+    if (mutex_init_ex(&bad, 0x80) != Z_EINVAL) 
+    {
+        printf("=> Unknown flags were accepted.\n");
+        return 1;
+    }
+    if (mutex_init_ex(&c.lock, ZMUTEX_ADAPTIVE) != Z_OK) 
+    {
+        return 1;
+    }
+
+    printf("=> %d threads bumping an adaptive mutex...\n", NUM_THREADS);
+    for (int i = 0; i < NUM_THREADS; i++) 
+    {
+        thread_create(&threads[i], bump_task, &c);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) 
+    {
+        thread_join(threads[i]);
+    }
+    mutex_destroy(&c.lock);
+
+    printf("=> Hits: %ld (expected %d)\n", c.hits, NUM_THREADS * ROUNDS);
+    return (c.hits == (long)NUM_THREADS * ROUNDS) ? 0 : 1;
+}
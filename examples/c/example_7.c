@@ -0,0 +1,74 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#ifndef ZTHREAD_USE_FUTEX
+#   define ZTHREAD_USE_FUTEX    // 4-byte mutex and cond on Linux and Windows.
+#endif
+#include "zthread.h"
+#include <stdio.h>
+
+#define ROUNDS 10000
+
+// Two threads take turns through one mutex and cond: each round is a
+// wait, a wake and a hand-off, which is what the futex backend speeds up.
+
+typedef struct 
+{
+    int turn;
+    int passes;
+    mutex_t lock;
+    cond_t changed;
+} PingPong;
+
+typedef struct 
+{
+    PingPong *game;
+    int me;
+} Player;
+
+void play_task(Player *p) 
+{
+    PingPong *g = p->game;
+    for (int i = 0; i < ROUNDS; i++) 
+    {
+        mutex_lock(&g->lock);
+        while (g->turn != p->me) 
+        {
+            cond_wait(&g->changed, &g->lock);
+        }
+        g->passes++;
+        g->turn = 1 - p->me;
+        cond_signal(&g->changed);
+        mutex_unlock(&g->lock);
+    }
+}
+
+int main(void) 
+{
+    PingPong game = {0};
+    Player players[2] = {{&game, 0}, {&game, 1}};
+    zthread_t threads[2];
+
+#if defined(__linux__) || defined(_WIN32)
+    printf("=> sizeof(zmutex_t) = %d, sizeof(zcond_t) = %d\n", (int)sizeof(zmutex_t), (int)sizeof(zcond_t));
+    if (sizeof(zmutex_t) != 4 || sizeof(zcond_t) != 4) 
+    {
+        return 1;
+    }
+#endif
+
+    mutex_init(&game.lock);
+    cond_init(&game.changed);
+    for (int i = 0; i < 2; i++) 
+    {
+        thread_create(&threads[i], play_task, &players[i]);
+    }
+    for (int i = 0; i < 2; i++) 
+    {
+        thread_join(threads[i]);
+    }
+    cond_destroy(&game.changed);
+    mutex_destroy(&game.lock);
+
+    printf("=> Passes: %d (expected %d)\n", game.passes, 2 * ROUNDS);
+    return (game.passes == 2 * ROUNDS) ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define MS 1000000LL
+
+typedef struct 
+{
+    mutex_t lock;
+    cond_t ready;
+    int flag;
+    int trylock_rc;
+    int timedlock_rc;
+} Shared;
+
+// Runs while main holds the lock: both attempts must give up.
+void contender_task(Shared *s) 
+{
+    s->trylock_rc = mutex_trylock(&s->lock);
+    s->timedlock_rc = mutex_timedlock(&s->lock, 20 * MS);
+}
+
+void signaller_task(Shared *s) 
+{
+    thread_sleep(10);
+    mutex_lock(&s->lock);
+    s->flag = 1;
+    cond_signal(&s->ready);
+    mutex_unlock(&s->lock);
+}
+
+int main(void) 
+{
+    Shared s = {0};
+    zthread_t t;
+    int ok = 1, rc;
+
+    mutex_init(&s.lock);
+    cond_init(&s.ready);
+
+    mutex_lock(&s.lock);
+    thread_create(&t, contender_task, &s);
+    thread_join(t);
+    mutex_unlock(&s.lock);
+    printf("=> Held lock: trylock %d, timedlock %d\n", s.trylock_rc, s.timedlock_rc);
+    ok &= (s.trylock_rc == Z_ERR && s.timedlock_rc == Z_ETIMEDOUT);
+
+    // Free lock: both succeed at once.
+    ok &= (mutex_trylock(&s.lock) == Z_OK);
+    mutex_unlock(&s.lock);
+    ok &= (mutex_timedlock(&s.lock, 20 * MS) == Z_OK);
+
+    // Nobody signals: the wait times out with the lock re-acquired.
+    rc = cond_timedwait(&s.ready, &s.lock, 20 * MS);
+    printf("=> Unsignalled timedwait: %d\n", rc);
+    ok &= (rc == Z_ETIMEDOUT);
+
+    // Signalled well before the (long) timeout.
+    thread_create(&t, signaller_task, &s);
+    while (!s.flag) 
+    {
+        if (cond_timedwait(&s.ready, &s.lock, 5000 * MS) == Z_ETIMEDOUT) 
+        {
+            ok = 0;
+            break;
+        }
+    }
+    mutex_unlock(&s.lock);
+    thread_join(t);
+    printf("=> Signalled timedwait saw flag = %d\n", s.flag);
+
+    cond_destroy(&s.ready);
+    mutex_destroy(&s.lock);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#define ZTHREAD_IMPLEMENTATION
+#define ZTHREAD_SHORT_NAMES
+#include "zthread.h"
+#include <stdio.h>
+
+#define PER_PRODUCER 50000
+#define PRODUCERS 2
+#define CONSUMERS 2
+
+// A small ring, so producers regularly block on a full queue and consumers
+// on an empty one. Items are the numbers 1..N smuggled through void*.
+
+typedef struct 
+{
+    zqueue_t *q;
+    int first;
+    long long sum;
+} Worker;
+
+void producer_task(Worker *w) 
+{
+    for (int i = 0; i < PER_PRODUCER; i++) 
+    {
+        zqueue_push(w->q, (void*)(uintptr_t)(w->first + i));
+    }
+}
+
+void consumer_task(Worker *w) 
+{
+    for (int i = 0; i < PRODUCERS * PER_PRODUCER / CONSUMERS; i++) 
+    {
+        w->sum += (long long)(uintptr_t)zqueue_pop(w->q);
+    }
+}
+
+int main(void) 
+{
+    zqueue_t *q = zqueue_create(60);
+    Worker producers[PRODUCERS], consumers[CONSUMERS];
+    zthread_t threads[PRODUCERS + CONSUMERS];
+    long long n = (long long)PRODUCERS * PER_PRODUCER, sum = 0;
+    void *out;
+    int ok = 1;
+
+    if (!q) 
+    {
+        return 1;
+    }
+    printf("=> Capacity %d (60 rounded up)\n", (int)zqueue_capacity(q));
+    ok &= (zqueue_capacity(q) == 64);
+    ok &= (zqueue_create((size_t)-1) == NULL);     // No power of two that large.
+    ok &= (zqueue_try_pop(q, &out) == Z_EEMPTY);
+
+    for (int i = 0; i < PRODUCERS; i++) 
+    {
+        producers[i].q = q;
+        producers[i].first = 1 + i * PER_PRODUCER;
+        thread_create(&threads[i], producer_task, &producers[i]);
+    }
+    for (int i = 0; i < CONSUMERS; i++) 
+    {
+        consumers[i].q = q;
+        consumers[i].sum = 0;
+        thread_create(&threads[PRODUCERS + i], consumer_task, &consumers[i]);
+    }
+    for (int i = 0; i < PRODUCERS + CONSUMERS; i++) 
+    {
+        thread_join(threads[i]);
+    }
+    for (int i = 0; i < CONSUMERS; i++) 
+    {
+        sum += consumers[i].sum;
+    }
+    printf("=> Sum: %lld (expected %lld)\n", sum, n * (n + 1) / 2);
+    ok &= (sum == n * (n + 1) / 2);
+
+    // Fill it up: the 65th push is refused.
+    for (int i = 0; i < 64; i++) 
+    {
+        ok &= (zqueue_try_push(q, (void*)(uintptr_t)1) == Z_OK);
+    }
+    ok &= (zqueue_try_push(q, (void*)(uintptr_t)1) == Z_EFULL);
+
+    zqueue_destroy(q);
+    printf("=> %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+#define ZTHREAD_IMPLEMENTATION
+#include "zthread.h"
+#include <atomic>
+#include <iostream>
+#include <string>
+
+// z_thread::thread stores the callable and decayed copies of its arguments
+// in one block handed straight to the new thread: an rvalue callable is
+// moved there, never copied.
+
+static std::atomic<int> copies(0);
+static std::atomic<int> total(0);
+
+struct Job 
+{
+    int weight;
+
+    explicit Job(int w) : weight(w) {}
+    Job(const Job &o) : weight(o.weight) { copies++; }
+    Job(Job &&o) noexcept : weight(o.weight) {}
+
+    void operator()(const std::string &tag, int &bonus) 
+    {
+        bonus += 1;     // A copy local to this thread, like std::bind.
+        total += weight + bonus + (int)tag.size();
+    }
+};
+
+int main() 
+{
+    const int waves = 50, per_wave = 4;
+    int bonus = 10;
+
+    for (int w = 0; w < waves; w++) 
+    {
+        z_thread::thread threads[per_wave];
+        for (int i = 0; i < per_wave; i++) 
+        {
+            threads[i] = z_thread::thread(Job(i), std::string("job"), bonus);
+        }
+        for (auto &t : threads) 
+        {
+            t.join();
+        }
+    }
+
+    // Per thread: weight + (bonus + 1) + strlen("job").
+    int expected = waves * (0 + 1 + 2 + 3 + per_wave * (bonus + 1 + 3));
+    std::cout << "Total: " << total << " (expected " << expected << ")\n";
+    std::cout << "Callable copies: " << copies << " (expected 0)\n";
+    std::cout << "Caller's bonus: " << bonus << " (expected 10)\n";
+    return (total == expected && copies == 0 && bonus == 10) ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#define ZTHREAD_IMPLEMENTATION
+#include "zthread.h"
+#include <atomic>
+#include <iostream>
+
+// Writers move money between two accounts under the exclusive lock; readers
+// check the total under the shared lock and must never see a transfer half
+// done. ZRWLOCK_PREFER_WRITER keeps the readers from starving the writers.
+
+struct Ledger 
+{
+    z_thread::shared_mutex rw{ZRWLOCK_PREFER_WRITER};
+    z_thread::mutex stats_lock;
+    long a = 1000, b = 1000;
+    long reads = 0;
+};
+
+int main() 
+{
+    Ledger l;
+    std::atomic<int> torn(0);
+    const int readers = 3, rounds = 20000;
+
+    z_thread::thread writer([&] {
+        for (int i = 0; i < rounds; i++) 
+        {
+            z_thread::lock_guard g(l.rw);
+            l.a -= 7;
+            l.b += 7;
+        }
+    });
+
+    z_thread::thread pool[readers];
+    for (auto &t : pool) 
+    {
+        t = z_thread::thread([&] {
+            for (int i = 0; i < rounds; i++) 
+            {
+                long sum;
+                {
+                    z_thread::shared_lock_guard g(l.rw);
+                    sum = l.a + l.b;
+                }
+                if (sum != 2000) 
+                {
+                    torn++;
+                }
+                z_thread::lock_guard g(l.stats_lock);
+                l.reads++;
+            }
+        });
+    }
+
+    writer.join();
+    for (auto &t : pool) 
+    {
+        t.join();
+    }
+
+    // A held exclusive lock refuses both kinds of try-lock.
+    bool refused;
+    {
+        z_thread::lock_guard g(l.rw);
+        bool got_shared = false, got_exclusive = false;
+        z_thread::thread probe([&] {
+            got_shared = l.rw.try_lock_shared();
+            got_exclusive = l.rw.try_lock();
+        });
+        probe.join();
+        refused = !got_shared && !got_exclusive;
+    }
+
+    std::cout << "Reads: " << l.reads << ", torn: " << torn << ", a + b = " << l.a + l.b << "\n";
+    std::cout << "Try-locks refused while held: " << (refused ? "yes" : "no") << "\n";
+    return (torn == 0 && l.reads == (long)readers * rounds && l.a == 1000 - 7L * rounds && refused) ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#define ZTHREAD_IMPLEMENTATION
+#include "zthread.h"
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// A small pipeline on a pool: each stage is a continuation that runs on
+// the worker that finished the previous one.
+
+static int parse(const std::string &text) 
+{
+    if (text.empty()) 
+    {
+        throw std::invalid_argument("empty input");
+    }
+    return std::stoi(text);
+}
+
+int main() 
+{
+    z_thread::pool pool(2);
+    bool ok = true;
+
+    auto total = z_thread::async(pool, parse, std::string("41"))
+                     .then([](int n) { return n + 1; })
+                     .then([](int n) { return std::to_string(n) + " answers"; });
+    std::string s = total.get();
+    std::cout << "Pipeline: " << s << "\n";
+    ok &= (s == "42 answers");
+
+    // The exception skips the continuation and comes out of get().
+    auto broken = z_thread::async(pool, parse, std::string()).then([](int n) { return n * 2; });
+    try 
+    {
+        broken.get();
+        ok = false;
+    } 
+    catch (const std::invalid_argument &e) 
+    {
+        std::cout << "Rethrown: " << e.what() << "\n";
+    }
+
+    // Manual producer side.
+    z_thread::promise<int> p;
+    z_thread::future<int> f = p.get_future();
+    z_thread::thread producer([&p] { p.set_value(7); });
+    ok &= (f.get() == 7);
+    producer.join();
+
+    try 
+    {
+        p.set_value(8);
+        ok = false;
+    } 
+    catch (const std::logic_error &) 
+    {
+        std::cout << "Second set_value refused\n";
+    }
+
+    // A promise that dies without a result breaks its future.
+    z_thread::future<int> orphan;
+    {
+        z_thread::promise<int> gone;
+        orphan = gone.get_future();
+    }
+    try 
+    {
+        orphan.get();
+        ok = false;
+    } 
+    catch (const z_thread::broken_promise &) 
+    {
+        std::cout << "Broken promise reported\n";
+    }
+
+    return ok ? 0 : 1;
+}
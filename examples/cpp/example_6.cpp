@@ -0,0 +1,53 @@
+#define ZTHREAD_IMPLEMENTATION
+#include "zthread.h"
+#include <iostream>
+
+// Recursive splitting over the pool: a loop, a nested loop, a reduction
+// and two independent calls, each checked against the serial answer.
+
+int main() 
+{
+    z_thread::pool pool(3);
+    const int n = 100000, rows = 64, cols = 256;
+    static long squares[100000];
+    static int grid[64][256];
+    bool ok = true;
+
+    z_thread::parallel_for(pool, 0, n, [&](int i) { squares[i] = (long)i * i; });
+    for (int i = 0; i < n; i++) 
+    {
+        ok &= (squares[i] == (long)i * i);
+    }
+
+    // Nested: the outer waiters run inner chunks meanwhile.
+    z_thread::parallel_for(pool, 0, rows, [&](int r) {
+        z_thread::parallel_for(pool, 0, cols, [&](int c) { grid[r][c] = r * cols + c; }, 32);
+    });
+    long grid_sum = 0;
+    for (int r = 0; r < rows; r++) 
+    {
+        for (int c = 0; c < cols; c++) 
+        {
+            grid_sum += grid[r][c];
+        }
+    }
+    long cells = (long)rows * cols;
+    ok &= (grid_sum == cells * (cells - 1) / 2);
+
+    long total = z_thread::parallel_reduce(pool, 0, n, 0L,
+        [&](int i) { return squares[i] % 1000; },
+        [](long a, long b) { return a + b; });
+    long expected = 0;
+    for (int i = 0; i < n; i++) 
+    {
+        expected += squares[i] % 1000;
+    }
+
+    int left = 0, right = 0;
+    z_thread::parallel_invoke(pool, [&] { left = 1; }, [&] { right = 2; });
+
+    std::cout << "Reduce: " << total << " (expected " << expected << ")\n";
+    std::cout << "Grid sum: " << grid_sum << ", invoke: " << left << " " << right << "\n";
+    ok &= (total == expected && left == 1 && right == 2);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#define ZTHREAD_IMPLEMENTATION
+#include "zthread.h"
+#include <iostream>
+
+#ifdef __cpp_impl_coroutine
+
+// Coroutines on the pool: a producer and two consumers meet on a small
+// async_queue, and the consumers share a total under an async_mutex.
+// Waiting on either suspends the coroutine, never a worker thread.
+
+struct Totals 
+{
+    z_thread::async_mutex lock;
+    long sum = 0;
+    int received = 0;
+
+    explicit Totals(z_thread::pool *p) : lock(p) {}
+};
+
+static const int items = 2000;
+
+z_thread::fire_and_forget produce(z_thread::pool &pool, z_thread::async_queue<int> &q, z_thread::latch &done) 
+{
+    co_await pool.schedule();
+    for (int i = 1; i <= items; i++) 
+    {
+        co_await q.push(i);
+    }
+    done.count_down();
+}
+
+z_thread::fire_and_forget consume(z_thread::pool &pool, z_thread::async_queue<int> &q, Totals &t, int count, z_thread::latch &done) 
+{
+    co_await pool.schedule();
+    for (int i = 0; i < count; i++) 
+    {
+        int v = co_await q.pop();
+        auto g = co_await t.lock.scoped_lock_async();
+        t.sum += v;
+        t.received++;
+    }
+    done.count_down();
+}
+
+int main() 
+{
+    z_thread::pool pool(2);
+    z_thread::async_queue<int> q(4, &pool);
+    Totals t(&pool);
+    z_thread::latch done(3);
+
+    consume(pool, q, t, items / 2, done);
+    consume(pool, q, t, items / 2, done);
+    produce(pool, q, done);
+    done.wait();
+
+    long expected = (long)items * (items + 1) / 2;
+    bool ok = (t.received == items && t.sum == expected);
+    int left;
+    ok &= !q.try_pop(left) && t.lock.try_lock();
+    t.lock.unlock();
+
+    std::cout << "Received " << t.received << ", sum " << t.sum << " (expected " << expected << ")\n";
+    return ok ? 0 : 1;
+}
+
+#else
+
+int main() 
+{
+    std::cout << "Coroutine support needs C++20; nothing to do.\n";
+    return 0;
+}
+
+#endif
@@ -0,0 +1,113 @@
+#define ZTHREAD_IMPLEMENTATION
+#include "zthread.h"
+#include <atomic>
+#include <iostream>
+
+// Readers take lock-free snapshots of a config while the main thread
+// publishes new versions and two threads apply read-copy-update edits.
+// A snapshot must never be half written, versions must only move forward,
+// no edit may be lost, and every replaced version must be freed.
+
+static std::atomic<int> live(0);
+
+struct Config 
+{
+    int version;
+    int values[16];
+    long hits;
+
+    explicit Config(int v = 0) : version(v), hits(0) 
+    {
+        for (int &x : values) 
+        {
+            x = v;
+        }
+        live++;
+    }
+
+    Config(const Config &o) : version(o.version), hits(o.hits) 
+    {
+        for (int i = 0; i < 16; i++) 
+        {
+            values[i] = o.values[i];
+        }
+        live++;
+    }
+
+    ~Config() 
+    {
+        live--;
+    }
+};
+
+int main() 
+{
+    z_thread::rcu_ptr<Config> config(new Config(0));
+    std::atomic<bool> stop(false);
+    std::atomic<int> torn(0), backwards(0);
+    std::atomic<long> snapshots(0);
+    const int readers = 3, versions = 500, edits = 1000;
+    bool ok = true;
+
+    z_thread::thread pool[readers];
+    for (auto &t : pool) 
+    {
+        t = z_thread::thread([&] {
+            int last = 0;
+            while (!stop.load()) 
+            {
+                auto r = config.read();
+                for (int x : r->values) 
+                {
+                    torn += (x != r->version);
+                }
+                backwards += (r->version < last);
+                last = r->version;
+                snapshots++;
+            }
+        });
+    }
+
+    for (int v = 1; v <= versions; v++) 
+    {
+        config.store(new Config(v));
+        if (v % 50 == 0) 
+        {
+            z_thread::thread::sleep(1);
+        }
+    }
+
+    // Concurrent edits retry on conflict, so none is lost.
+    auto edit = [&] {
+        for (int i = 0; i < edits; i++) 
+        {
+            config.update([](Config &c) { c.hits++; });
+        }
+    };
+    z_thread::thread e1(edit), e2(edit);
+    e1.join();
+    e2.join();
+    stop = true;
+    for (auto &t : pool) 
+    {
+        t.join();
+    }
+
+    {
+        auto r = config.read();
+        std::cout << "=> " << snapshots.load() << " snapshots, last version " << r->version << ", hits " << r->hits
+                  << ", torn " << torn.load() << ", backwards " << backwards.load() << std::endl;
+        ok &= (r->version == versions && r->hits == 2L * edits);
+    }
+    ok &= (torn == 0 && backwards == 0 && snapshots > 0);
+
+    // The editors have exited: the first grace period adopts the versions
+    // they retired, the second frees them.
+    z_thread::ebr_guard::synchronize();
+    z_thread::ebr_guard::synchronize();
+    std::cout << "=> Versions still allocated after the grace periods: " << live.load() << std::endl;
+    ok &= (live == 1);
+
+    std::cout << "=> " << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
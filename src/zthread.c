@@ -11,6 +11,7 @@
  * • Native Win32 and POSIX (pthread) backends.
  * • Type-safe thread creation macros (zthread_create).
  * • Unified Mutex and Condition Variable primitives.
+ * • Work-stealing thread pool (zpool_t, z_thread::pool).
  * • Optional short names via ZTHREAD_SHORT_NAMES.
  * • Full C++ RAII wrappers (z_thread::thread, z_thread::mutex).
  * • Zero dependencies (only standard system headers).
@@ -26,23 +27,133 @@
 
 #include "zcommon.h"
 
+// ZTHREAD_USE_FUTEX: 4-byte mutex/cond on Linux futex or Win32 WaitOnAddress.
+// Ignored on other platforms, which keep the native objects.
+#if defined(ZTHREAD_USE_FUTEX) && (defined(_WIN32) || defined(__linux__))
+#   define ZTHREAD__FUTEX 1
+#endif
+
 #ifdef _WIN32
 #   include <windows.h>
 #   include <process.h>
     typedef HANDLE zthread_t;
+#   ifndef ZTHREAD__FUTEX
     typedef CRITICAL_SECTION zmutex_t;
     typedef CONDITION_VARIABLE zcond_t;
+#   endif
     // Internal Windows thread signature.
 #   define ZTHREAD_Func unsigned __stdcall
+    typedef unsigned (__stdcall *zthread__entry_fn)(void *arg);
+    // Index into the library's key table (all keys share one FLS slot).
+    typedef unsigned ztls_key_t;
 #else
 #   include <pthread.h>
 #   include <unistd.h>
 #   include <time.h>
+#   include <errno.h>
+#   include <sched.h>
+#   include <limits.h>
     typedef pthread_t zthread_t;
+#   ifndef ZTHREAD__FUTEX
     typedef pthread_mutex_t zmutex_t;
     typedef pthread_cond_t zcond_t;
+#   endif
+    // Monotonic condvars, timed mutexes and rwlocks need POSIX.1-2001, which
+    // strict ISO modes (-std=c11 without _POSIX_C_SOURCE) hide; fall back there.
+#   if !defined(__STRICT_ANSI__) || (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L) || \
+       (defined(_XOPEN_SOURCE) && _XOPEN_SOURCE >= 600)
+#       define ZTHREAD__POSIX_2001 1
+#   endif
     // Internal POSIX thread signature.
 #   define ZTHREAD_Func void*
+    typedef void *(*zthread__entry_fn)(void *arg);
+    typedef pthread_key_t ztls_key_t;
+#endif
+
+#ifdef ZTHREAD__FUTEX
+    // Mutex word: bits 0-1 hold the state (0 free, 1 locked, 2 locked with
+    // waiters), bit 30 marks ZMUTEX_ADAPTIVE. The cond word is a sequence.
+    typedef struct { volatile int32_t state; } zmutex_t;
+    typedef struct { volatile int32_t seq; } zcond_t;
+#endif
+
+// Counting semaphore: the native object, or a counter word with ZTHREAD_USE_FUTEX.
+#if defined(ZTHREAD__FUTEX)
+    typedef struct { volatile int32_t count; volatile int32_t waiters; } zsem_t;
+#elif defined(_WIN32)
+    typedef HANDLE zsem_t;
+#elif defined(__APPLE__)
+    // macOS does not implement unnamed POSIX semaphores.
+#   include <dispatch/dispatch.h>
+    typedef dispatch_semaphore_t zsem_t;
+#else
+#   include <semaphore.h>
+    typedef sem_t zsem_t;
+#endif
+
+// Reusable barrier. Waiters spin, then park on the semaphore of their phase's
+// parity; the last arrival posts exactly one token per parked thread, so
+// nobody has to re-acquire a shared mutex on the way out.
+typedef struct 
+{
+    volatile int32_t remaining;     // Arrivals still missing in this phase.
+    volatile int32_t phase;
+    volatile int32_t sleepers[2];
+    int32_t total;
+    int32_t spin;
+    zsem_t sem[2];
+} zbarrier_t;
+
+// One-shot latch: waiters block until the count reaches zero.
+typedef struct 
+{
+    volatile int32_t count;
+    volatile int32_t done;
+    volatile int32_t sleepers;
+    int32_t spin;
+    zsem_t sem;
+} zlatch_t;
+
+// Event count: 'epoch' moves on every notify that found a waiter.
+typedef struct 
+{
+    volatile int32_t epoch;
+    volatile int32_t waiters;       // Between prepare_wait and commit/cancel.
+#ifndef ZTHREAD__FUTEX
+    zmutex_t lock;
+    zcond_t cv;
+#endif
+} zeventcount_t;
+
+// A thread's park token (see zthread_parker).
+typedef struct zparker zparker_t;
+
+// Reader-writer lock. ZRWLOCK_PREFER_WRITER adds a turnstile that readers only
+// touch while a writer is waiting, so the read path stays a single native call.
+#if defined(_WIN32) || defined(ZTHREAD__POSIX_2001)
+    typedef struct 
+    {
+#   ifdef _WIN32
+        SRWLOCK lock;
+#   else
+        pthread_rwlock_t lock;
+#   endif
+        zmutex_t turnstile;
+        volatile int32_t writers;   // Writers waiting or holding (PREFER_WRITER).
+        int flags;
+    } zrwlock_t;
+#else
+    // Strict ISO mode has no pthread_rwlock_t: build one on mutex + cond.
+    typedef struct 
+    {
+        zmutex_t m;
+        zcond_t readers_cv;
+        zcond_t writers_cv;
+        int readers;                // Active readers.
+        int writer;                 // 1 while a writer holds the lock.
+        int writers;                // Writers waiting.
+        int flags;
+    } zrwlock_t;
 #endif
 
 // C++ moment.
@@ -50,6 +161,16 @@
 extern "C" {
 #endif
 
+// Returned by the timed waits when the timeout expires first.
+#ifndef Z_ETIMEDOUT
+#   define Z_ETIMEDOUT -8
+#endif
+
+// Returned by the non-blocking queue push when there is no free slot.
+#ifndef Z_EFULL
+#   define Z_EFULL -9
+#endif
+
 // Allocator overrides (user may redefine).
 #ifndef ZTHREAD_MALLOC
     #define ZTHREAD_MALLOC(sz)      Z_MALLOC(sz)
@@ -67,6 +188,220 @@ extern "C" {
     #define ZTHREAD_FREE(p)         Z_FREE(p)
 #endif
 
+/* * Atomics and memory fences.
+ * Thin inline layer over the GCC/Clang __atomic builtins and the MSVC
+ * Interlocked intrinsics, so code built on zthread.h needs no #ifdef of its
+ * own. Orders use the C11 memory_order values. On MSVC every operation is a
+ * full barrier, so the order only matters for the other compilers.
+ * Usage: volatile int32_t n; zatomic_fetch_add32(&n, 1, ZATOMIC_RELAXED);
+*/
+#define ZATOMIC_RELAXED 0
+#define ZATOMIC_ACQUIRE 2
+#define ZATOMIC_RELEASE 3
+#define ZATOMIC_ACQ_REL 4
+#define ZATOMIC_SEQ_CST 5
+
+// Destructive interference size: pad hot, independently written fields apart.
+#ifndef ZTHREAD_CACHE_LINE
+#   if defined(__APPLE__) && defined(__aarch64__)
+#       define ZTHREAD_CACHE_LINE 128
+#   elif defined(__powerpc64__)
+#       define ZTHREAD_CACHE_LINE 128
+#   else
+#       define ZTHREAD_CACHE_LINE 64
+#   endif
+#endif
+
+// Alignment of a declaration: ZTHREAD_ALIGNAS(16) int v; / ZTHREAD_CACHE_ALIGNED int64_t hot;
+#if defined(__cplusplus)
+#   define ZTHREAD_ALIGNAS(n) alignas(n)
+#elif defined(_MSC_VER)
+#   define ZTHREAD_ALIGNAS(n) __declspec(align(n))
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#   define ZTHREAD_ALIGNAS(n) _Alignas(n)
+#else
+#   define ZTHREAD_ALIGNAS(n) __attribute__((aligned(n)))
+#endif
+#define ZTHREAD_CACHE_ALIGNED ZTHREAD_ALIGNAS(ZTHREAD_CACHE_LINE)
+
+// Fills the rest of a cache line after 'used' bytes: ZTHREAD_PAD(pad0, sizeof(int64_t));
+#define ZTHREAD_PAD(name, used) char name[ZTHREAD_CACHE_LINE - (used) % ZTHREAD_CACHE_LINE]
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#   include <intrin.h>
+    static inline int32_t zatomic_load32(const volatile int32_t *p, int mo) 
+    { 
+        (void)mo; 
+        return (int32_t)InterlockedCompareExchange((volatile LONG*)p, 0, 0); 
+    }
+    static inline void zatomic_store32(volatile int32_t *p, int32_t v, int mo) 
+    { 
+        (void)mo; 
+        InterlockedExchange((volatile LONG*)p, (LONG)v); 
+    }
+    static inline int32_t zatomic_exchange32(volatile int32_t *p, int32_t v, int mo) 
+    { 
+        (void)mo; 
+        return (int32_t)InterlockedExchange((volatile LONG*)p, (LONG)v); 
+    }
+    static inline int32_t zatomic_fetch_add32(volatile int32_t *p, int32_t v, int mo) 
+    { 
+        (void)mo; 
+        return (int32_t)InterlockedExchangeAdd((volatile LONG*)p, (LONG)v); 
+    }
+    static inline int zatomic_cas32(volatile int32_t *p, int32_t *expected, int32_t desired, int mo) 
+    { 
+        LONG seen = InterlockedCompareExchange((volatile LONG*)p, (LONG)desired, (LONG)*expected);
+        (void)mo; 
+        if (seen == (LONG)*expected) 
+        {
+            return 1;
+        }
+        *expected = (int32_t)seen;
+        return 0;
+    }
+    static inline int64_t zatomic_load64(const volatile int64_t *p, int mo) 
+    { 
+        (void)mo; 
+        return InterlockedCompareExchange64((volatile LONG64*)p, 0, 0); 
+    }
+    static inline void zatomic_store64(volatile int64_t *p, int64_t v, int mo) 
+    { 
+        (void)mo; 
+        InterlockedExchange64(p, v); 
+    }
+    static inline int64_t zatomic_exchange64(volatile int64_t *p, int64_t v, int mo) 
+    { 
+        (void)mo; 
+        return InterlockedExchange64(p, v); 
+    }
+    static inline int64_t zatomic_fetch_add64(volatile int64_t *p, int64_t v, int mo) 
+    { 
+        (void)mo; 
+        return InterlockedExchangeAdd64(p, v); 
+    }
+    static inline int zatomic_cas64(volatile int64_t *p, int64_t *expected, int64_t desired, int mo) 
+    { 
+        int64_t seen = InterlockedCompareExchange64(p, desired, *expected);
+        (void)mo; 
+        if (seen == *expected) 
+        {
+            return 1;
+        }
+        *expected = seen;
+        return 0;
+    }
+    static inline void *zatomic_load_ptr(void *const volatile *p, int mo) 
+    { 
+        (void)mo; 
+        return InterlockedCompareExchangePointer((void *volatile*)p, NULL, NULL); 
+    }
+    static inline void zatomic_store_ptr(void *volatile *p, void *v, int mo) 
+    { 
+        (void)mo; 
+        InterlockedExchangePointer(p, v); 
+    }
+    static inline void *zatomic_exchange_ptr(void *volatile *p, void *v, int mo) 
+    { 
+        (void)mo; 
+        return InterlockedExchangePointer(p, v); 
+    }
+    static inline int zatomic_cas_ptr(void *volatile *p, void **expected, void *desired, int mo) 
+    { 
+        void *seen = InterlockedCompareExchangePointer(p, desired, *expected);
+        (void)mo; 
+        if (seen == *expected) 
+        {
+            return 1;
+        }
+        *expected = seen;
+        return 0;
+    }
+    static inline void zatomic_fence(int mo) 
+    { 
+        (void)mo; 
+        MemoryBarrier(); 
+    }
+    // Spin-wait hint (PAUSE / YIELD).
+    static inline void zthread_cpu_relax(void) 
+    { 
+        YieldProcessor(); 
+    }
+#else
+    // A failed CAS may not use a release order.
+#   define ZATOMIC__FAIL(mo) ((mo) == ZATOMIC_ACQ_REL ? ZATOMIC_ACQUIRE : (mo) == ZATOMIC_RELEASE ? ZATOMIC_RELAXED : (mo))
+
+    static inline int32_t zatomic_load32(const volatile int32_t *p, int mo) 
+    { 
+        return __atomic_load_n(p, mo); 
+    }
+    static inline void zatomic_store32(volatile int32_t *p, int32_t v, int mo) 
+    { 
+        __atomic_store_n(p, v, mo); 
+    }
+    static inline int32_t zatomic_exchange32(volatile int32_t *p, int32_t v, int mo) 
+    { 
+        return __atomic_exchange_n(p, v, mo); 
+    }
+    static inline int32_t zatomic_fetch_add32(volatile int32_t *p, int32_t v, int mo) 
+    { 
+        return __atomic_fetch_add(p, v, mo); 
+    }
+    static inline int zatomic_cas32(volatile int32_t *p, int32_t *expected, int32_t desired, int mo) 
+    { 
+        return __atomic_compare_exchange_n(p, expected, desired, 0, mo, ZATOMIC__FAIL(mo)); 
+    }
+    static inline int64_t zatomic_load64(const volatile int64_t *p, int mo) 
+    { 
+        return __atomic_load_n(p, mo); 
+    }
+    static inline void zatomic_store64(volatile int64_t *p, int64_t v, int mo) 
+    { 
+        __atomic_store_n(p, v, mo); 
+    }
+    static inline int64_t zatomic_exchange64(volatile int64_t *p, int64_t v, int mo) 
+    { 
+        return __atomic_exchange_n(p, v, mo); 
+    }
+    static inline int64_t zatomic_fetch_add64(volatile int64_t *p, int64_t v, int mo) 
+    { 
+        return __atomic_fetch_add(p, v, mo); 
+    }
+    static inline int zatomic_cas64(volatile int64_t *p, int64_t *expected, int64_t desired, int mo) 
+    { 
+        return __atomic_compare_exchange_n(p, expected, desired, 0, mo, ZATOMIC__FAIL(mo)); 
+    }
+    static inline void *zatomic_load_ptr(void *const volatile *p, int mo) 
+    { 
+        return __atomic_load_n(p, mo); 
+    }
+    static inline void zatomic_store_ptr(void *volatile *p, void *v, int mo) 
+    { 
+        __atomic_store_n(p, v, mo); 
+    }
+    static inline void *zatomic_exchange_ptr(void *volatile *p, void *v, int mo) 
+    { 
+        return __atomic_exchange_n(p, v, mo); 
+    }
+    static inline int zatomic_cas_ptr(void *volatile *p, void **expected, void *desired, int mo) 
+    { 
+        return __atomic_compare_exchange_n(p, expected, desired, 0, mo, ZATOMIC__FAIL(mo)); 
+    }
+    static inline void zatomic_fence(int mo) 
+    { 
+        __atomic_thread_fence(mo); 
+    }
+    // Spin-wait hint (PAUSE / YIELD).
+    static inline void zthread_cpu_relax(void) 
+    { 
+#   if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#   elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#   endif
+    }
+#endif
+
 // The raw function signature required by the OS.
 typedef void (*zthread_proxy_fn)(void* arg);
 
@@ -75,6 +410,24 @@ typedef void (*zthread_proxy_fn)(void* arg);
 // Internal raw creation function. Returns Z_OK on success.
 int zthread__create_ptr(zthread_t *t, zthread_proxy_fn func, void *arg);
 
+// Internal: starts 'entry' (declared as 'static ZTHREAD_Func f(void*)') directly,
+// without the heap wrapper zthread__create_ptr needs. Returns Z_OK on success.
+int zthread__create_raw(zthread_t *t, zthread__entry_fn entry, void *arg);
+
+// Blocks cached per size class and thread by the descriptor allocator below
+// (0 routes every descriptor straight to ZTHREAD_MALLOC/ZTHREAD_FREE).
+#ifndef ZTHREAD_TASK_CACHE
+#   define ZTHREAD_TASK_CACHE 64
+#endif
+
+// Internal descriptor allocator for spawn records, pool tasks and C++ invokers.
+// Each thread keeps free lists refilled from ZTHREAD_MALLOC; a block freed on
+// another thread goes back to its owner in a batch. Blocks are aligned to
+// ZTHREAD__BLOCK_ALIGN and may be freed on any thread. Returns NULL on OOM.
+#define ZTHREAD__BLOCK_ALIGN 16
+void *zthread__cache_alloc(size_t sz);
+void  zthread__cache_free(void *p);
+
 /* * Type-safe creation macro.
  * Automatically casts the function and argument to void*.
  * Usage: zthread_create(&t, my_func, &my_data);
@@ -93,478 +446,12225 @@ int zthread__create_ptr(zthread_t *t, zthread_proxy_fn func, void *arg);
     void name##__impl(type var)
 
 
+/* * Thread attributes for zthread_create_ex.
+ * Zero/NULL fields keep the platform default, so an initialized attr behaves
+ * like zthread_create. Name and affinity are skipped where the platform has
+ * no API for them (affinity on macOS, the name on Linux without _GNU_SOURCE).
+ * Without _GNU_SOURCE, Linux threads pin themselves before running 'func',
+ * and creation waits for that, so a mask that cannot be applied still fails.
+ * Usage: zthread_attr_t a; zthread_attr_init(&a); a.stack_size = 64 * 1024;
+ *        zthread_attr_set_cpu(&a, 2); zthread_create_ex(&t, my_func, &data, &a);
+*/
+#ifndef ZTHREAD_MAX_CPUS
+#   define ZTHREAD_MAX_CPUS 256     // Width of the affinity mask (multiple of 64).
+#endif
+
+// zthread_attr_t.policy values.
+#define ZTHREAD_SCHED_DEFAULT 0     // Inherit the creator's scheduling.
+#define ZTHREAD_SCHED_OTHER   1     // Time-sharing.
+#define ZTHREAD_SCHED_FIFO    2     // Real-time FIFO (usually needs privileges).
+#define ZTHREAD_SCHED_RR      3     // Real-time round-robin.
+
+typedef struct zthread_attr 
+{
+    size_t stack_size;      // 0 = default. POSIX rounds up to PTHREAD_STACK_MIN, Win32 only reserves it.
+    size_t guard_size;      // 0 = default. POSIX only.
+    uint64_t affinity[ZTHREAD_MAX_CPUS / 64];   // Bit i = logical CPU i. All clear = no pinning.
+    int policy;             // ZTHREAD_SCHED_*. Ignored on Win32.
+    int priority;           // sched_param priority (POSIX, non-default policy) or THREAD_PRIORITY_* (Win32).
+    const char *name;       // Copied at creation. Linux keeps the first 15 bytes.
+} zthread_attr_t;
+
+void zthread_attr_init(zthread_attr_t *a);
+// Adds 'cpu' to the affinity mask. Returns Z_OK, or Z_EINVAL if out of range.
+int  zthread_attr_set_cpu(zthread_attr_t *a, int cpu);
+
+// Internal raw creation function with attributes (NULL = zthread__create_ptr).
+// Returns Z_OK, Z_ENOMEM, Z_EINVAL if an attribute was rejected, or Z_ERR.
+int zthread__create_ex_ptr(zthread_t *t, zthread_proxy_fn func, void *arg, const zthread_attr_t *attr);
+
+#define zthread_create_ex(t, func, arg, attr) \
+    zthread__create_ex_ptr((t), (zthread_proxy_fn)(func), (void*)(arg), (attr))
+
 // Thread control.
 void zthread_join(zthread_t t);
 void zthread_detach(zthread_t t);
 void zthread_sleep(int ms);
 
+// High-resolution sleeps on the monotonic clock of zthread_now_ns. They never
+// return early; how late they return depends on the OS timer (tens of us on
+// Linux, about 0.5 ms with the Windows high-resolution timer).
+int64_t zthread_now_ns(void);
+void zthread_sleep_ns(int64_t ns);
+void zthread_sleep_until(int64_t deadline_ns);
+
+// Low-jitter pacing: sleeps until shortly before the deadline, then spins.
+// The spin window is ZTHREAD_SLEEP_SPIN_NS plus the calling thread's recent
+// oversleep, so it follows the OS timer. Burns CPU for that window.
+// Usage: for (t = zthread_now_ns();; ) { step(); zthread_sleep_precise_until(t += period); }
+#ifndef ZTHREAD_SLEEP_SPIN_NS
+#   define ZTHREAD_SLEEP_SPIN_NS 20000
+#endif
+void zthread_sleep_precise(int64_t ns);
+void zthread_sleep_precise_until(int64_t deadline_ns);
+
+/* * Thread-local storage.
+ * ZTHREAD_LOCAL marks a static or global variable as per-thread; it compiles
+ * to a plain memory access and suits counters and caches on hot paths.
+ * ztls_key_t adds a destructor that runs on the key's value when a thread
+ * exits, so heap-allocated per-thread data is reclaimed. It is built on
+ * pthread keys (POSIX) or a single FLS slot (Win32) and therefore covers every
+ * thread, not only the ones started by zthread_create. As with
+ * pthread_key_delete, deleting a key runs no destructors.
+ * Usage: static ZTHREAD_LOCAL int hits;
+ *        ztls_key_create(&k, free); if (!ztls_get(k)) ztls_set(k, malloc(4096));
+*/
+#if defined(__cplusplus)
+#   define ZTHREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#   define ZTHREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#   define ZTHREAD_LOCAL _Thread_local
+#else
+#   define ZTHREAD_LOCAL __thread
+#endif
+
+// Number of live keys on Win32 (POSIX uses PTHREAD_KEYS_MAX).
+#ifndef ZTHREAD_TLS_KEYS
+#   define ZTHREAD_TLS_KEYS 128
+#endif
+
+typedef void (*ztls_dtor_fn)(void *value);
+
+// 'dtor' may be NULL. Returns Z_OK, or Z_ENOMEM when no key is left.
+int   ztls_key_create(ztls_key_t *k, ztls_dtor_fn dtor);
+void  ztls_key_delete(ztls_key_t k);
+// Returns Z_OK, or Z_ENOMEM if the per-thread table could not be allocated.
+int   ztls_set(ztls_key_t k, void *value);
+// Returns NULL if this thread never set a value for 'k'.
+void *ztls_get(ztls_key_t k);
+
 // Mutexes.
+
+// zmutex_init_ex flags.
+#define ZMUTEX_DEFAULT  0
+#define ZMUTEX_ADAPTIVE 1   // Spin (with a CPU pause) before parking; budget self-tunes.
+
+// Initial spin budget for ZMUTEX_ADAPTIVE on Win32 (user may redefine).
+#ifndef ZTHREAD_SPIN_COUNT
+#   define ZTHREAD_SPIN_COUNT 4000
+#endif
+
 void zmutex_init(zmutex_t *m);
+// Same as zmutex_init, with ZMUTEX_* flags. Returns Z_OK, or Z_EINVAL on unknown flags.
+int  zmutex_init_ex(zmutex_t *m, int flags);
 void zmutex_lock(zmutex_t *m);
 void zmutex_unlock(zmutex_t *m);
 void zmutex_destroy(zmutex_t *m);
+// Returns Z_OK if the lock was taken, Z_ERR if it is held elsewhere.
+int  zmutex_trylock(zmutex_t *m);
+// Returns Z_OK if the lock was taken, Z_ETIMEDOUT after 'timeout_ns', or
+// Z_EINVAL / Z_ERR if the native call failed otherwise (EINVAL, EDEADLK).
+int  zmutex_timedlock(zmutex_t *m, int64_t timeout_ns);
+
+// Reader-writer locks.
+
+// zrwlock_init_ex flags.
+#define ZRWLOCK_DEFAULT       0
+#define ZRWLOCK_PREFER_WRITER 1     // New readers queue behind a waiting writer.
+
+void zrwlock_init(zrwlock_t *rw);
+// Same as zrwlock_init, with ZRWLOCK_* flags. Returns Z_OK, or Z_EINVAL on unknown flags.
+int  zrwlock_init_ex(zrwlock_t *rw, int flags);
+void zrwlock_rdlock(zrwlock_t *rw);
+void zrwlock_wrlock(zrwlock_t *rw);
+// Return Z_OK if the lock was taken, Z_ERR otherwise.
+int  zrwlock_tryrdlock(zrwlock_t *rw);
+int  zrwlock_trywrlock(zrwlock_t *rw);
+void zrwlock_rdunlock(zrwlock_t *rw);
+void zrwlock_wrunlock(zrwlock_t *rw);
+void zrwlock_destroy(zrwlock_t *rw);
+
+/* * Distributed ("big reader") lock for read-mostly data.
+ * One zrwlock_t per slot, each on its own cache lines. A reader only locks the
+ * slot of its thread (threads are spread over the slots round-robin), so the
+ * read side never shares a line with other readers. A writer locks every slot
+ * in order, which makes writes O(slots): use it when writes are rare.
+ * Usage: zbrlock_t *b = zbrlock_create(0, ZRWLOCK_DEFAULT); zbrlock_rdlock(b);
+*/
+typedef struct zbrlock zbrlock_t;
+
+// 'slots' <= 0 uses zthread_cpu_count(). 'flags' are ZRWLOCK_* (per slot). NULL on failure.
+zbrlock_t *zbrlock_create(int slots, int flags);
+void zbrlock_destroy(zbrlock_t *b);
+void zbrlock_rdlock(zbrlock_t *b);
+// Must be called from the thread that took the read lock.
+void zbrlock_rdunlock(zbrlock_t *b);
+void zbrlock_wrlock(zbrlock_t *b);
+void zbrlock_wrunlock(zbrlock_t *b);
+// Return Z_OK if the lock was taken, Z_ERR otherwise.
+int  zbrlock_tryrdlock(zbrlock_t *b);
+int  zbrlock_trywrlock(zbrlock_t *b);
+int  zbrlock_slots(const zbrlock_t *b);
 
 // Condition variables.
 void zcond_init(zcond_t *c);
 void zcond_wait(zcond_t *c, zmutex_t *m);
+// Like zcond_wait, but gives up after 'timeout_ns' (monotonic clock).
+// Returns Z_OK when woken (spurious wakeups included) or Z_ETIMEDOUT.
+int  zcond_timedwait(zcond_t *c, zmutex_t *m, int64_t timeout_ns);
 void zcond_signal(zcond_t *c);
 void zcond_broadcast(zcond_t *c);
 void zcond_destroy(zcond_t *c);
 
-// Short names (optional).
-#ifdef ZTHREAD_SHORT_NAMES
-    typedef zthread_t   thread_t;
-    typedef zmutex_t    mutex_t;
-    typedef zcond_t     cond_t;
+/* * Lock profiling (ZTHREAD_PROFILE).
+ * Each zmutex_t and zcond_t gets a stats slot keyed by its address, created
+ * on first use. A slot holds the acquisitions, the contended acquisitions,
+ * total and max wait time and total hold time, timed with the CPU cycle
+ * counter (rdtsc, cntvct_el0, QueryPerformanceCounter). Uncontended locks
+ * pay one trylock and two counter reads. Without ZTHREAD_PROFILE the calls
+ * below are empty macros and the lock paths are unchanged.
+ * Usage: zthread_profile_name(&cache_lock, "cache"); ... zthread_profile_dump(NULL);
+*/
+#define ZPROFILE_MUTEX 0
+#define ZPROFILE_COND  1
 
-#   define thread_create   zthread_create
-#   define thread_join     zthread_join
-#   define thread_detach   zthread_detach
-#   define thread_sleep    zthread_sleep
-    
-    // Macro wrapper alias.
-#   define THREAD_WRAP     ZTHREAD_WRAP
+typedef struct 
+{
+    const void *lock;       // Address of the zmutex_t / zcond_t.
+    const char *name;       // From zthread_profile_name, or NULL.
+    int kind;               // ZPROFILE_MUTEX or ZPROFILE_COND.
+    int destroyed;          // 1 once the lock was destroyed (its stats are kept).
+    int64_t acquires;       // Mutex: acquisitions. Cond: completed waits.
+    int64_t contended;      // Mutex: acquisitions that had to wait. Cond: timed-out waits.
+    int64_t wait_ns;        // Total time spent blocked.
+    int64_t max_wait_ns;
+    int64_t hold_ns;        // Mutex: total time held (cond waits excluded).
+} zprofile_stats_t;
 
-#   define mutex_init      zmutex_init
-#   define mutex_lock      zmutex_lock
-#   define mutex_unlock    zmutex_unlock
-#   define mutex_destroy   zmutex_destroy
+#ifdef ZTHREAD_PROFILE
+#   include <stdio.h>
+#   ifndef ZTHREAD_PROFILE_SLOTS
+#       define ZTHREAD_PROFILE_SLOTS 4096   // Locks tracked; later ones are skipped.
+#   endif
 
-#   define cond_init       zcond_init
-#   define cond_wait       zcond_wait
-#   define cond_signal     zcond_signal
-#   define cond_broadcast  zcond_broadcast
-#   define cond_destroy    zcond_destroy
-#endif
+// Labels 'lock' in the report. 'name' must outlive the profile.
+void zthread_profile_name(const void *lock, const char *name);
 
-#ifdef __cplusplus
-}
+// Iteration: start with cursor 0. Returns the next cursor (> 0) after filling
+// '*out', or 0 when there are no more locks.
+// Usage: int it = 0; zprofile_stats_t s; while ((it = zthread_profile_next(it, &s))) { ... }
+int zthread_profile_next(int cursor, zprofile_stats_t *out);
+
+// Zeroes every counter (slots and names stay).
+void zthread_profile_reset(void);
+
+// Writes one line per lock that was used to 'out' (NULL = stderr).
+void zthread_profile_dump(FILE *out);
+#else
+#   define zthread_profile_name(lock, name) ((void)0)
+#   define zthread_profile_next(cursor, out) ((void)(cursor), (void)(out), 0)
+#   define zthread_profile_reset() ((void)0)
+#   define zthread_profile_dump(out) ((void)0)
 #endif
 
-// namespace: z_thread.
-#ifdef __cplusplus
+// Semaphores.
+// Returns Z_OK, or Z_ERR (Z_EINVAL if 'initial' exceeds INT32_MAX).
+int  zsem_init(zsem_t *s, unsigned initial);
+void zsem_wait(zsem_t *s);
+// Returns Z_OK if a unit was taken, Z_ERR if the count is zero.
+int  zsem_trywait(zsem_t *s);
+// Returns Z_OK, or Z_ETIMEDOUT after 'timeout_ns'.
+int  zsem_timedwait(zsem_t *s, int64_t timeout_ns);
+void zsem_post(zsem_t *s);
+void zsem_destroy(zsem_t *s);
 
-#include <utility>
-#include <exception>
-#include <functional>
+// Barriers and latches.
 
-namespace z_thread 
-{
-    class mutex 
-    {
-        ::zmutex_t inner;
-        friend class cond;
+// Spin iterations before a barrier/latch waiter parks (0 on single-CPU machines).
+#ifndef ZTHREAD_WAIT_SPIN
+#   define ZTHREAD_WAIT_SPIN 2000
+#endif
 
-     public:
-        // RAII: Initialize on construction.
-        mutex() 
-        { 
-            ::zmutex_init(&inner); 
-        }
+// Returned by zbarrier_wait in exactly one thread per phase.
+#define ZBARRIER_SERIAL 1
 
-        // RAII: Destroy on destruction.
-        ~mutex() 
-        { 
-            ::zmutex_destroy(&inner); 
-        }
+// Returns Z_OK, Z_EINVAL if count <= 0, or Z_ERR.
+int  zbarrier_init(zbarrier_t *b, int count);
+// Blocks until 'count' threads have arrived. Returns ZBARRIER_SERIAL or 0.
+int  zbarrier_wait(zbarrier_t *b);
+void zbarrier_destroy(zbarrier_t *b);
 
-        // Non-copyable.
-        mutex(const mutex&) = delete;
-        mutex &operator=(const mutex&) = delete;
+// Returns Z_OK, Z_EINVAL if count < 0, or Z_ERR.
+int  zlatch_init(zlatch_t *l, int count);
+void zlatch_count_down(zlatch_t *l, int n);
+// Returns 1 once the count has reached zero, 0 before.
+int  zlatch_try_wait(const zlatch_t *l);
+void zlatch_wait(zlatch_t *l);
+void zlatch_arrive_and_wait(zlatch_t *l, int n);
+void zlatch_destroy(zlatch_t *l);
 
-        void lock() 
-        { 
-            ::zmutex_lock(&inner); 
-        }
+/* * Event counts and parking.
+ * A zeventcount_t wakes threads that wait for a condition published without
+ * a lock (a lock-free queue becoming non-empty, a flag). The waiter announces
+ * itself, re-checks the condition, then cancels or commits the wait; the
+ * producer publishes, then notifies. A notify with nobody waiting is one
+ * fence and one load. Waits sleep on a futex (WaitOnAddress on Windows) with
+ * ZTHREAD_USE_FUTEX, and on a mutex and cond otherwise.
+ * Usage: while (!ready()) { int32_t key = zeventcount_prepare_wait(&ec);
+ *            if (ready()) { zeventcount_cancel_wait(&ec); break; }
+ *            zeventcount_commit_wait(&ec, key); }
+ *        publish(); zeventcount_notify(&ec);
+*/
+void zeventcount_init(zeventcount_t *ec);
+// Announces a wait. Returns the key for commit_wait.
+int32_t zeventcount_prepare_wait(zeventcount_t *ec);
+// Withdraws a prepared wait (the condition held on the re-check).
+void zeventcount_cancel_wait(zeventcount_t *ec);
+// Blocks until a notify that follows the matching prepare_wait; returns at
+// once if one already happened.
+void zeventcount_commit_wait(zeventcount_t *ec, int32_t key);
+// Wake one / every committed waiter. Publish the state change first.
+void zeventcount_notify(zeventcount_t *ec);
+void zeventcount_notify_all(zeventcount_t *ec);
+void zeventcount_destroy(zeventcount_t *ec);
 
-        void unlock() 
-        { 
-            ::zmutex_unlock(&inner); 
-        }
-        
-        // Raw access if needed.
-        ::zmutex_t *native_handle() 
-        { 
-            return &inner; 
-        }
-    };
+// Every thread owns one park token. zthread_unpark sets it, waking the
+// thread if it is parked; zthread_park takes it, blocking until it is set,
+// so an unpark just before the park is not lost. Unparking a thread that is
+// not parked makes no system call.
+// The calling thread's parker. Valid until that thread exits.
+zparker_t *zthread_parker(void);
+void zthread_park(void);
+// Returns Z_OK once unparked, or Z_ETIMEDOUT after 'timeout_ns' (also on an
+// early wakeup, so re-check the condition either way).
+int  zthread_park_for(int64_t timeout_ns);
+void zthread_unpark(zparker_t *p);
 
-    // Simple RAII lock guard (scoped lock).
-    class lock_guard 
-    {
-        mutex& m_mutex;
-     public:
-        explicit lock_guard(mutex& m) : m_mutex(m) 
-        { 
-            m_mutex.lock(); 
-        }
+// Number of logical processors available (at least 1).
+int zthread_cpu_count(void);
+// Logical CPU the caller is running on (it may move at any time), or -1 if
+// the platform cannot tell (macOS).
+int zthread_cpu_current(void);
 
-        ~lock_guard() 
-        { 
-            m_mutex.unlock(); 
-        }
-        
-        // Non-copyable.
-        lock_guard(const lock_guard&) = delete;
-        lock_guard &operator=(const lock_guard&) = delete;
-    };
+/* * NUMA topology.
+ * Discovered once, from sysfs on Linux and GetLogicalProcessorInformationEx
+ * on Windows. Other platforms report a single node. Nodes use the OS
+ * numbering, and CPU indices match the zthread_attr_t affinity mask.
+*/
+// Number of nodes (at least 1).
+int zthread_numa_node_count(void);
+// Node of logical CPU 'cpu', or -1 if it is unknown.
+int zthread_numa_node_of_cpu(int cpu);
+// Adds every CPU of 'node' to a's affinity mask. Z_EINVAL if the node has no CPUs.
+int zthread_attr_set_node(zthread_attr_t *a, int node);
 
-    class cond 
-    {
-        ::zcond_t inner;
+// Node-local allocation, used by per-node pools (user may redefine, e.g. to
+// numa_alloc_onnode / numa_free). The default relies on first-touch placement.
+#ifndef ZTHREAD_NODE_MALLOC
+#   define ZTHREAD_NODE_MALLOC(sz, node)    ((void)(node), ZTHREAD_MALLOC(sz))
+#endif
 
-     public:
-        cond() 
-        { 
-            ::zcond_init(&inner); 
-        }
+#ifndef ZTHREAD_NODE_FREE
+#   define ZTHREAD_NODE_FREE(p, sz, node)   ((void)(sz), (void)(node), ZTHREAD_FREE(p))
+#endif
 
-        ~cond() 
-        { 
-            ::zcond_destroy(&inner); 
-        }
+/* * Thread pool (work-stealing).
+ * Each worker owns a Chase-Lev deque. Tasks submitted from a worker go to its
+ * own deque, tasks from any other thread go to a shared injection queue, and
+ * idle workers steal from their peers before parking.
+ * Usage: zpool_t *p = zpool_create(0); zpool_submit(p, my_task, &data);
+*/
+typedef void (*zpool_task_fn)(void *arg);
+typedef struct zpool zpool_t;
 
-        // Non-copyable.
-        cond(const cond&) = delete;
-        cond &operator=(const cond&) = delete;
+// Spawns 'num_threads' workers (<= 0 uses zthread_cpu_count()). NULL on failure.
+zpool_t *zpool_create(int num_threads);
 
-        void wait(mutex &m) 
-        { 
-            ::zcond_wait(&inner, &m.inner); 
-        }
+// Same, with the workers pinned to NUMA 'node' and the pool's memory (workers,
+// deques) from ZTHREAD_NODE_MALLOC. <= 0 threads uses one per
+// CPU of the node. NULL on failure or for a node without CPUs.
+zpool_t *zpool_create_node(int num_threads, int node);
 
-        void signal() 
-        { 
-            ::zcond_signal(&inner); 
-        }
+// NUMA node of a pool from zpool_create_node, -1 otherwise.
+int zpool_node(const zpool_t *p);
 
-        void broadcast() 
-        { 
-            ::zcond_broadcast(&inner);
-        }
-        
-        ::zcond_t *native_handle() 
-        { 
-            return &inner; 
-        }
-    };
+// Internal raw submission function. Returns Z_OK on success.
+int zpool__submit_ptr(zpool_t *p, zpool_task_fn func, void *arg);
 
-    class thread 
-    {
-        ::zthread_t inner;
-        bool joinable;
+// Type-safe submission macro (same casting rules as zthread_create).
+#define zpool_submit(p, func, arg) \
+    zpool__submit_ptr((p), (zpool_task_fn)(func), (void*)(arg))
 
-        // Internal proxy for C++ lambdas/functions.
-        struct impl_base 
-        { 
-            virtual void run() = 0; 
-            virtual ~impl_base() {} 
-        };
-        
-        template <typename Func>
-        struct impl_type : impl_base 
-        {
-            Func f;
-            impl_type(Func &&func) : f(std::forward<Func>(func)) {}
-            void run() override { f(); }
-        };
+// Task descriptor. zpool__submit_node queues one the caller owns (the C++
+// awaitables embed it in the coroutine frame), so it allocates nothing; the
+// node must stay valid until 'fn' starts, and 'fn' may then free it.
+struct zpool__task 
+{
+    zpool_task_fn fn;
+    void *arg;
+    struct zpool__task *next;
+    int cached;     // 1: descriptor cache block, released by the pool.
+};
 
-        // Static thunk matching zthread_proxy_fn signature (void(*)(void*)).
-        static void proxy_thunk(void *arg) 
-        {
-            impl_base *p = static_cast<impl_base*>(arg);
-            p->run();
-            delete p;
-        }
+// Internal: queues a caller-owned 't' (fn and arg set). Returns Z_OK.
+int zpool__submit_node(zpool_t *p, struct zpool__task *t);
 
-    public:
-        thread() : joinable(false) 
-        {
-#           ifdef _WIN32
-            inner = NULL;
-#           else
-            inner = 0;
-#           endif
-        }
+/* * Pool timers.
+ * Each pool keeps a hierarchical timer wheel: six levels of 64 slots, the
+ * first one ZTHREAD_TIMER_TICK ns per slot. Arming and cancelling are O(1),
+ * and a timer waits in the wheel without a thread. A due timer is queued as
+ * a pool task, never before its deadline. One idle worker sleeps until the
+ * nearest deadline, and busy workers check it between tasks. Periodic
+ * timers keep absolute deadlines, so they do not drift; missed periods are
+ * skipped, not replayed. zpool_wait_idle does not wait for armed timers,
+ * and zpool_shutdown drops them.
+ * Usage: zpool_timer_t t; zpool_timer_init(&t, on_timeout, req);
+ *        zpool_timer_start(p, &t, 500000000, 0); ... zpool_timer_cancel(&t);
+*/
+#ifndef ZTHREAD_TIMER_TICK
+#   define ZTHREAD_TIMER_TICK 100000    // Wheel resolution in ns.
+#endif
 
-        // Move constructor.
-        thread(thread &&other) noexcept : inner(other.inner), joinable(other.joinable) 
+// Caller-owned timer (fields are internal). It must stay valid while armed.
+typedef struct zpool_timer 
+{
+    struct zpool__task task;        // Queued when the timer fires.
+    struct zpool_timer *prev;       // Wheel slot list.
+    struct zpool_timer *next;
+    zpool_task_fn fn;
+    void *arg;
+    zpool_t *pool;
+    int64_t deadline;               // Monotonic ns.
+    int64_t period;                 // 0 for a one-shot timer.
+    uint64_t expiry;                // Wheel tick.
+    int32_t level;
+    int32_t slot;
+    int32_t state;
+    int32_t owned;                  // Allocated by zpool_submit_after.
+} zpool_timer_t;
+
+// Internal raw init function.
+void zpool__timer_init_ptr(zpool_timer_t *t, zpool_task_fn func, void *arg);
+
+// Sets the callback of an idle timer (same casting rules as zthread_create).
+#define zpool_timer_init(t, func, arg) \
+    zpool__timer_init_ptr((t), (zpool_task_fn)(func), (void*)(arg))
+
+// Arms 't' on 'p': fn(arg) runs 'delay_ns' from now, then every 'period_ns'
+// if it is > 0. Arming an armed timer moves it. A timer only moves to
+// another pool while idle. Returns Z_OK, Z_EINVAL for a negative delay or
+// period or a timer armed on another pool, or Z_ERR if it fired and its run
+// has not started yet.
+int zpool_timer_start(zpool_t *p, zpool_timer_t *t, int64_t delay_ns, int64_t period_ns);
+
+// Disarms 't'. Returns Z_OK if no run starts after this call (one may still
+// be executing) and the pool no longer refers to 't'. Returns Z_ERR if 't'
+// was not armed. In that case a run it already queued still starts, but
+// does not re-arm; the pool refers to 't' until then.
+int zpool_timer_cancel(zpool_timer_t *t);
+
+// Internal raw delayed submission. Returns Z_OK, Z_EINVAL or Z_ENOMEM.
+int zpool__submit_after_ptr(zpool_t *p, int64_t delay_ns, zpool_task_fn func, void *arg);
+
+// Runs func(arg) on the pool after 'delay_ns' (one-shot, no handle).
+#define zpool_submit_after(p, delay_ns, func, arg) \
+    zpool__submit_after_ptr((p), (delay_ns), (zpool_task_fn)(func), (void*)(arg))
+
+// Blocks until every submitted task has finished. Do not call from a task.
+void zpool_wait_idle(zpool_t *p);
+
+// Runs the remaining tasks, joins all workers and frees the pool.
+void zpool_shutdown(zpool_t *p);
+
+int zpool_size(const zpool_t *p);
+
+// Index (0 .. zpool_size - 1) of the calling thread among p's workers, or -1
+// if it is not one of them (including p == NULL).
+int zpool_worker_index(const zpool_t *p);
+
+/* * Parallel loops over a pool.
+ * zparallel_for calls fn(b, e, ctx) on disjoint sub-ranges covering
+ * [begin, end) and returns once all have run. The range is split recursively:
+ * the caller keeps the left half and queues the right one, so idle workers
+ * steal large pieces first. With grain > 0 ranges are split down to 'grain'
+ * iterations. With grain <= 0 the grain is derived from the range and the
+ * pool size, and a range is only split while the splitter's own queue is
+ * empty (lazy splitting). A worker that waits for the loop
+ * runs other pool tasks in the meantime, so nested loops are fine. p == NULL
+ * runs fn(begin, end, ctx) inline.
+ * Usage: zparallel_for(pool, 0, n, 0, scale_rows, &img);
+*/
+typedef void (*zparallel_fn)(int64_t begin, int64_t end, void *ctx);
+
+// Returns Z_OK, or Z_EINVAL if end < begin.
+int zparallel_for(zpool_t *p, int64_t begin, int64_t end, int64_t grain, zparallel_fn fn, void *ctx);
+
+/* * Task graph (DAG) over a pool.
+ * Build the graph once, then run it any number of times without allocating.
+ * Each task keeps a count of its unfinished predecessors. The task that
+ * finishes last among them releases a successor and runs it inline or pushes
+ * it onto its own worker deque, so data stays in the warm cache. A graph must
+ * not be changed or run twice at the same time while it is running.
+ * Usage: int a = ztask_graph_add_task(g, load, &ctx), b = ztask_graph_add_task(g, parse, &ctx);
+ *        ztask_graph_add_edge(g, a, b); ztask_graph_run(g, pool);
+*/
+typedef struct ztask_graph ztask_graph_t;
+
+// NULL on failure.
+ztask_graph_t *ztask_graph_create(void);
+void ztask_graph_destroy(ztask_graph_t *g);
+
+// Returns the new task's id (>= 0), or Z_ENOMEM.
+int ztask_graph__add_ptr(ztask_graph_t *g, zpool_task_fn fn, void *arg);
+
+#define ztask_graph_add_task(g, func, arg) \
+    ztask_graph__add_ptr((g), (zpool_task_fn)(func), (void*)(arg))
+
+// 'to' runs after 'from'. Returns Z_OK, Z_EINVAL for a bad id or a
+// self-edge, or Z_ENOMEM.
+int ztask_graph_add_edge(ztask_graph_t *g, int from, int to);
+
+// Runs every task once and returns when all have finished. A worker calling
+// it helps run the graph. p == NULL runs the tasks inline in dependency order.
+// Returns Z_OK, or Z_EINVAL if the edges form a cycle.
+int ztask_graph_run(ztask_graph_t *g, zpool_t *p);
+
+int ztask_graph_size(const ztask_graph_t *g);
+
+/* * Bounded MPMC queue (Vyukov ring).
+ * Each slot carries a sequence number and sits on its own cache line, so
+ * producers and consumers only contend on the slot they claim. The blocking
+ * variants spin briefly and only park when the queue is full or empty.
+ * Usage: zqueue_t *q = zqueue_create(1024); zqueue_push(q, item);
+*/
+typedef struct zqueue zqueue_t;
+
+// Capacity is rounded up to a power of two (at least 2). NULL on failure.
+zqueue_t *zqueue_create(size_t capacity);
+void zqueue_destroy(zqueue_t *q);
+
+// Non-blocking. Return Z_OK, or Z_EFULL / Z_EEMPTY.
+int zqueue_try_push(zqueue_t *q, void *item);
+int zqueue_try_pop(zqueue_t *q, void **out);
+
+// Blocking: wait for space / for an item.
+void zqueue_push(zqueue_t *q, void *item);
+void *zqueue_pop(zqueue_t *q);
+
+size_t zqueue_capacity(const zqueue_t *q);
+
+/* * Bounded SPSC ring of fixed-size elements.
+ * For exactly one producer thread and one consumer thread: no CAS, and each
+ * side keeps a cached copy of the other side's index on its own cache line,
+ * so it only reads the shared one when the cache says full or empty.
+ * reserve/commit and peek/release work on a batch in place, with one
+ * release store per batch. A reserved or peeked run is contiguous, so it
+ * may be shorter than asked for at the end of the ring; call again for the
+ * rest. Non-blocking (wait on a zeventcount_t if needed).
+ * Usage: n = 0; Msg *m = zspsc_reserve(q, 32, &n); fill(m, n); zspsc_commit(q, n);
+*/
+typedef struct zspsc zspsc_t;
+
+// Capacity is rounded up to a power of two (at least 2). NULL on failure.
+zspsc_t *zspsc_create(size_t elem_size, size_t capacity);
+void zspsc_destroy(zspsc_t *q);
+
+// Producer only. Returns up to 'want' free slots in place ('*got' of them),
+// or NULL when full. zspsc_commit publishes the first 'n' (n <= *got).
+void *zspsc_reserve(zspsc_t *q, size_t want, size_t *got);
+void zspsc_commit(zspsc_t *q, size_t n);
+
+// Consumer only. Returns up to 'want' queued elements in place ('*got' of
+// them), or NULL when empty. zspsc_release frees the first 'n' (n <= *got).
+const void *zspsc_peek(zspsc_t *q, size_t want, size_t *got);
+void zspsc_release(zspsc_t *q, size_t n);
+
+// Copying single-element variants. Return Z_OK, or Z_EFULL / Z_EEMPTY.
+int zspsc_try_push(zspsc_t *q, const void *item);
+int zspsc_try_pop(zspsc_t *q, void *out);
+
+// Queued elements; exact only when called by the producer or the consumer
+// while the other side is idle.
+size_t zspsc_size(const zspsc_t *q);
+size_t zspsc_capacity(const zspsc_t *q);
+
+/* * Intrusive MPSC queue (Vyukov), for mailboxes with many senders and one
+ * consumer. Nodes live inside the caller's structs, so a push never
+ * allocates: it is one atomic exchange, one store and an event-count notify
+ * (a fence and a load while the consumer is awake). The consumer sleeps on
+ * that event count only when the queue is empty. zmpsc_try_pop_all takes
+ * every queued node with one exchange and hands them back as a NULL
+ * terminated FIFO chain through 'next'. The queue never frees nodes.
+ * Usage: struct msg { zmpsc_node_t node; int op; }; zmpsc_push(q, &m->node);
+ *        for (n = zmpsc_pop_all(q); n; n = next) { next = n->next; handle(ZMPSC_ENTRY(n, struct msg, node)); }
+*/
+typedef struct zmpsc_node 
+{
+    struct zmpsc_node *volatile next;
+} zmpsc_node_t;
+
+typedef struct zmpsc zmpsc_t;
+
+// The struct of type 'type' whose member 'member' is the node 'n'.
+#define ZMPSC_ENTRY(n, type, member) ((type*)((char*)(n) - offsetof(type, member)))
+
+// NULL on failure.
+zmpsc_t *zmpsc_create(void);
+// Queued nodes are left alone.
+void zmpsc_destroy(zmpsc_t *q);
+
+// Any thread. Wait-free. 'n' must not be queued already.
+void zmpsc_push(zmpsc_t *q, zmpsc_node_t *n);
+// Pushes the caller-linked chain first..last (first->next ... == last) in
+// one exchange, so it stays contiguous and in order.
+void zmpsc_push_list(zmpsc_t *q, zmpsc_node_t *first, zmpsc_node_t *last);
+
+// Consumer only. try_pop returns NULL when empty, and also while the last
+// sender is between its exchange and its link (its notify follows, so
+// zmpsc_pop cannot miss it). zmpsc_pop blocks until a node arrives.
+zmpsc_node_t *zmpsc_try_pop(zmpsc_t *q);
+zmpsc_node_t *zmpsc_pop(zmpsc_t *q);
+
+// Consumer only. Detaches every queued node with one exchange and returns
+// the oldest (a FIFO chain ending in NULL), or NULL when empty. zmpsc_pop_all
+// blocks until there is at least one.
+zmpsc_node_t *zmpsc_try_pop_all(zmpsc_t *q);
+zmpsc_node_t *zmpsc_pop_all(zmpsc_t *q);
+
+// Consumer only (a hint from other threads).
+int zmpsc_empty(const zmpsc_t *q);
+
+/* * Memory reclamation for lock-free structures.
+ * Epoch-based reclamation (EBR): readers bracket their accesses with
+ * zebr_enter/zebr_exit, which cost two stores and a fence, and writers pass
+ * unlinked nodes to zebr_retire. A node is freed once every critical section
+ * that was running when it was retired has ended. One stalled reader holds
+ * back every free, so where memory must stay bounded use hazard pointers
+ * (zhazard_*) instead: at most ZTHREAD_HAZARDS nodes per thread stay
+ * protected, at the cost of a fence per protected load.
+ * Threads register on first use and unregister at exit through a TLS
+ * destructor; the nodes they could not free yet are adopted by the others.
+ * Usage: zebr_enter(); n = find(list, key); use(n); zebr_exit();
+ *        (writer) unlink(list, n); zebr_retire(n, free);
+*/
+typedef void (*zreclaim_fn)(void *ptr);
+
+#ifndef ZTHREAD_EBR_SCAN
+#   define ZTHREAD_EBR_SCAN 64      // Retires between two epoch advance attempts.
+#endif
+#ifndef ZTHREAD_HAZARDS
+#   define ZTHREAD_HAZARDS 4        // Hazard pointer slots per thread.
+#endif
+#ifndef ZTHREAD_HAZARD_SCAN
+#   define ZTHREAD_HAZARD_SCAN 64   // Retired nodes per thread before a scan (plus 2 per live hazard).
+#endif
+
+// Enters / leaves a read-side critical section. They nest.
+void zebr_enter(void);
+void zebr_exit(void);
+
+// Internal raw retire function.
+int zebr__retire_ptr(void *ptr, zreclaim_fn fn);
+
+// Calls fn(ptr) once no critical section can still see 'ptr' (same casting
+// rules as zthread_create). Call it after unlinking 'ptr', inside or outside
+// a critical section. Returns Z_OK, or Z_ENOMEM (and 'ptr' is not retired).
+#define zebr_retire(ptr, fn) \
+    zebr__retire_ptr((void*)(ptr), (zreclaim_fn)(fn))
+
+// Outside a critical section: waits until every critical section running at
+// the call has ended, then frees what the calling thread retired before.
+void zebr_synchronize(void);
+
+// Internal raw protect function.
+void *zhazard__protect_ptr(int slot, void *const volatile *src);
+
+// Loads the pointer at 'src' and publishes it in the calling thread's hazard
+// 'slot' (0 to ZTHREAD_HAZARDS - 1), re-reading until it is stable. The node
+// is not freed by zhazard_retire until the slot is cleared or reused.
+#define zhazard_protect(slot, src) \
+    zhazard__protect_ptr((slot), (void *const volatile*)(src))
+
+// Publishes 'ptr' in 'slot' (with a full fence). The caller must then check
+// that 'ptr' is still reachable before using it.
+void zhazard_set(int slot, void *ptr);
+void zhazard_clear(int slot);
+
+// Internal raw retire function.
+int zhazard__retire_ptr(void *ptr, zreclaim_fn fn);
+
+// Calls fn(ptr) once no hazard slot holds 'ptr'. Returns Z_OK or Z_ENOMEM.
+#define zhazard_retire(ptr, fn) \
+    zhazard__retire_ptr((void*)(ptr), (zreclaim_fn)(fn))
+
+// Frees every node the calling thread retired that no hazard protects.
+void zhazard_scan(void);
+
+/* * RCU-style versioned pointer, on top of EBR.
+ * Readers load the current version inside a zrcu_read_lock section: one
+ * acquire load of a shared line that only changes on update, and the EBR
+ * entry, which writes only the reader's own line. No atomic RMW. Updaters
+ * publish a whole new version; the old one is freed after a grace period.
+ * Usage: zrcu_read_lock(); const Routes *r = zrcu_load(&routes); route(r); zrcu_read_unlock();
+ *        (updater) zrcu_store(&routes, build_routes());
+*/
+typedef struct 
+{
+    void *volatile ptr;
+    zreclaim_fn free_fn;
+} zrcu_ptr_t;
+
+#define zrcu_read_lock()   zebr_enter()
+#define zrcu_read_unlock() zebr_exit()
+#define zrcu_synchronize() zebr_synchronize()
+
+// Internal raw init function.
+void zrcu__init_ptr(zrcu_ptr_t *r, void *initial, zreclaim_fn free_fn);
+
+// 'free_fn' frees replaced versions (same casting rules as zthread_create).
+#define zrcu_init(r, initial, free_fn) \
+    zrcu__init_ptr((r), (void*)(initial), (zreclaim_fn)(free_fn))
+
+// Inside a read-side section: the current version, valid until the unlock.
+static inline void *zrcu_load(const zrcu_ptr_t *r) 
+{
+    return zatomic_load_ptr(&r->ptr, ZATOMIC_ACQUIRE);
+}
+
+// Publishes 'next' and frees the old version after a grace period. Safe
+// against concurrent updaters. If the old version cannot be queued
+// (Z_ENOMEM), it waits for the grace period and frees it in place, so call
+// it outside a read-side section.
+void zrcu_store(zrcu_ptr_t *r, void *next);
+
+// Publishes 'next' only if the current version is still 'expected' (for
+// read-copy-update loops). Returns Z_OK, or Z_ERR and leaves 'next' to the
+// caller.
+int zrcu_compare_store(zrcu_ptr_t *r, void *expected, void *next);
+
+// Publishes 'next' and returns the old version, which the caller must only
+// free after a grace period (zrcu_synchronize or zebr_retire).
+void *zrcu_exchange(zrcu_ptr_t *r, void *next);
+
+// Frees the current version at once: no reader may remain.
+void zrcu_destroy(zrcu_ptr_t *r);
+
+/* * Sharded concurrent hash map (void* keys and values).
+ * Keys hash to one of a power-of-two number of shards. Each shard has its
+ * own cache-line-aligned header with a zrwlock_t and an open-addressing
+ * table (linear probing, deletion by backward shift, so no tombstones), so
+ * threads only contend when they hit the same shard, and lookups share it.
+ * The batch calls group their keys by shard and lock each shard once.
+ * The map never frees keys or values.
+ * Usage: zcmap_t *m = zcmap_create(0, str_hash, str_eq); zcmap_insert(m, name, user);
+*/
+typedef struct zcmap zcmap_t;
+
+typedef uint64_t (*zcmap_hash_fn)(const void *key);
+typedef int (*zcmap_eq_fn)(const void *a, const void *b);
+
+// 'shards' is rounded up to a power of two (0 = 4 per logical CPU). A NULL
+// 'hash' / 'eq' compares the key pointers themselves. NULL on failure.
+zcmap_t *zcmap_create(size_t shards, zcmap_hash_fn hash, zcmap_eq_fn eq);
+void zcmap_destroy(zcmap_t *m);
+
+// Returns Z_OK, Z_EEXIST (the stored value is kept) or Z_ENOMEM.
+int zcmap_insert(zcmap_t *m, const void *key, void *value);
+// Inserts or replaces. '*old' (if not NULL) gets the replaced value, or NULL.
+// Returns Z_OK or Z_ENOMEM.
+int zcmap_put(zcmap_t *m, const void *key, void *value, void **old);
+// Return Z_OK, or Z_ENOTFOUND. 'value' may be NULL.
+int zcmap_find(zcmap_t *m, const void *key, void **value);
+int zcmap_erase(zcmap_t *m, const void *key, void **value);
+
+// Batches of 'n' keys, one lock per shard touched. 'results' (if not NULL)
+// gets the per-key return code. insert_many returns the number inserted;
+// find_many returns the number found and stores NULL for missing keys.
+size_t zcmap_insert_many(zcmap_t *m, const void *const *keys, void *const *values, size_t n, int *results);
+size_t zcmap_find_many(zcmap_t *m, const void *const *keys, void **values, size_t n, int *results);
+
+// Entries; exact only while no thread modifies the map.
+size_t zcmap_size(const zcmap_t *m);
+
+/* * Fibers (stackful coroutines), M:N over a set of worker threads.
+ * A fiber costs one small pooled stack (guard-paged where mmap exists), and
+ * switching is a register swap: hand-written on x86-64 and AArch64,
+ * CreateFiber/SwitchToFiber on Win32, ucontext elsewhere (or with
+ * ZTHREAD_FIBER_UCONTEXT). A fiber that blocks on a zfmutex_t, zfcond_t or
+ * zfqueue_t hands its worker straight to the next ready fiber. The same calls
+ * from a plain thread simply block that thread. Fibers may resume on another
+ * worker, so do not keep pointers to ZTHREAD_LOCAL data across a blocking call.
+ * Usage: zfiber_sched_t *s = zfiber_sched_create(0, 0); zfiber_spawn(s, handler, conn);
+*/
+#ifndef ZTHREAD_FIBER_STACK
+#   define ZTHREAD_FIBER_STACK (64 * 1024)     // Default fiber stack size.
+#endif
+
+typedef void (*zfiber_fn)(void *arg);
+typedef struct zfiber_sched zfiber_sched_t;
+struct zfiber__waiter;
+
+// Fiber-aware mutex: the lock is handed straight to the next waiter.
+typedef struct 
+{
+    volatile int32_t spin;
+    int32_t locked;
+    struct zfiber__waiter *head;
+    struct zfiber__waiter *tail;
+} zfmutex_t;
+
+typedef struct 
+{
+    volatile int32_t spin;
+    struct zfiber__waiter *head;
+    struct zfiber__waiter *tail;
+} zfcond_t;
+
+typedef struct zfqueue zfqueue_t;
+
+// 'num_threads' <= 0 uses zthread_cpu_count(), 'stack_size' 0 uses
+// ZTHREAD_FIBER_STACK. NULL on failure.
+zfiber_sched_t *zfiber_sched_create(int num_threads, size_t stack_size);
+
+// Waits for every fiber to finish, then joins the workers and frees 's'.
+// Call it from a plain thread, not from a fiber.
+void zfiber_sched_shutdown(zfiber_sched_t *s);
+
+// Internal raw spawn function. Returns Z_OK, or Z_ENOMEM.
+int zfiber__spawn_ptr(zfiber_sched_t *s, zfiber_fn fn, void *arg);
+
+// Starts fn(arg) in a new fiber (same casting rules as zthread_create).
+#define zfiber_spawn(s, func, arg) \
+    zfiber__spawn_ptr((s), (zfiber_fn)(func), (void*)(arg))
+
+// Lets other ready fibers run. On a plain thread it yields the CPU.
+void zfiber_yield(void);
+
+// 1 if the caller runs inside a fiber.
+int zfiber_in_fiber(void);
+
+void zfmutex_init(zfmutex_t *m);
+void zfmutex_lock(zfmutex_t *m);
+// Returns Z_OK if the lock was taken, Z_ERR if it is held.
+int  zfmutex_trylock(zfmutex_t *m);
+void zfmutex_unlock(zfmutex_t *m);
+void zfmutex_destroy(zfmutex_t *m);
+
+void zfcond_init(zfcond_t *c);
+void zfcond_wait(zfcond_t *c, zfmutex_t *m);
+void zfcond_signal(zfcond_t *c);
+void zfcond_broadcast(zfcond_t *c);
+void zfcond_destroy(zfcond_t *c);
+
+// Bounded FIFO of pointers whose blocking calls suspend only the fiber.
+// NULL on failure.
+zfqueue_t *zfqueue_create(size_t capacity);
+void zfqueue_destroy(zfqueue_t *q);
+void zfqueue_push(zfqueue_t *q, void *item);
+void *zfqueue_pop(zfqueue_t *q);
+// Return Z_OK, or Z_EFULL / Z_EEMPTY.
+int zfqueue_try_push(zfqueue_t *q, void *item);
+int zfqueue_try_pop(zfqueue_t *q, void **out);
+
+/* * Scheduler tracing (ZTHREAD_TRACE).
+ * Every pool and fiber worker appends fixed-size events to its own ring of
+ * ZTHREAD_TRACE_EVENTS entries: plain stores and one release store per event,
+ * no locks, no atomic read-modify-write. Once a ring is full the oldest
+ * events are overwritten. zthread_trace_flush writes what is buffered as
+ * Chrome trace JSON (chrome://tracing, ui.perfetto.dev) or as a binary file,
+ * and drops it from the rings. Without ZTHREAD_TRACE nothing is recorded.
+ * Usage: FILE *f = fopen("pool.json", "w"); zthread_trace_flush(f, ZTRACE_JSON);
+*/
+// ztrace_event_t.type values.
+#define ZTRACE_TASK_BEGIN  1    // id: task function (pool) or fiber.
+#define ZTRACE_TASK_END    2    // id: same as the matching begin.
+#define ZTRACE_STEAL       3    // arg: victim worker, id: task function.
+#define ZTRACE_STEAL_FAIL  4    // arg: victim worker (lost the race for its task).
+#define ZTRACE_PARK        5    // The worker goes to sleep.
+#define ZTRACE_UNPARK      6
+#define ZTRACE_QUEUE_DEPTH 7    // arg: own deque (pool) or ready queue (fibers); id: pool injection queue.
+
+// ztrace_block_t.kind values.
+#define ZTRACE_POOL   1
+#define ZTRACE_FIBERS 2
+
+// zthread_trace_flush formats.
+#define ZTRACE_JSON   0
+#define ZTRACE_BINARY 1
+
+typedef struct 
+{
+    int64_t ts_ns;          // Monotonic clock.
+    uint64_t id;
+    uint16_t type;          // ZTRACE_*.
+    uint16_t reserved;
+    int32_t arg;
+} ztrace_event_t;
+
+// Binary format: the 8 bytes "ZTRACE1\0", then for each worker thread one
+// block followed by 'count' ztrace_event_t, all in native byte order.
+typedef struct 
+{
+    uint32_t thread;        // Trace thread id, unique per worker thread.
+    int32_t kind;           // ZTRACE_POOL or ZTRACE_FIBERS.
+    int32_t worker;         // Worker index in its scheduler.
+    uint32_t count;
+    uint64_t sched;         // Address of the zpool_t / zfiber_sched_t.
+    int64_t dropped;        // Events overwritten before this flush.
+} ztrace_block_t;
+
+#ifdef ZTHREAD_TRACE
+#   include <stdio.h>
+#   ifndef ZTHREAD_TRACE_EVENTS
+#       define ZTHREAD_TRACE_EVENTS 8192   // Per worker; a power of two.
+#   endif
+
+// Writes the events recorded since the last flush to 'out' and drops them
+// from the rings. Returns Z_OK, Z_EINVAL for an unknown format, or Z_ERR if
+// writing failed.
+int zthread_trace_flush(FILE *out, int format);
+#else
+#   define zthread_trace_flush(out, format) ((void)(out), (void)(format), Z_OK)
+#endif
+
+// Short names (optional).
+#ifdef ZTHREAD_SHORT_NAMES
+    typedef zthread_t   thread_t;
+    typedef zmutex_t    mutex_t;
+    typedef zcond_t     cond_t;
+    typedef zrwlock_t   rwlock_t;
+    typedef zsem_t      sem_handle_t;
+    typedef zbarrier_t  barrier_t;
+    typedef zlatch_t    latch_t;
+    typedef zthread_attr_t thread_attr_t;
+
+#   define thread_create   zthread_create
+#   define thread_create_ex zthread_create_ex
+#   define thread_attr_init zthread_attr_init
+#   define thread_attr_set_cpu zthread_attr_set_cpu
+#   define thread_join     zthread_join
+#   define thread_detach   zthread_detach
+#   define thread_sleep    zthread_sleep
+#   define thread_sleep_ns zthread_sleep_ns
+#   define thread_sleep_until zthread_sleep_until
+#   define thread_now_ns   zthread_now_ns
+
+    typedef ztls_key_t  tls_key_t;
+
+#   define tls_key_create  ztls_key_create
+#   define tls_key_delete  ztls_key_delete
+#   define tls_set         ztls_set
+#   define tls_get         ztls_get
+    
+    // Macro wrapper alias.
+#   define THREAD_WRAP     ZTHREAD_WRAP
+
+#   define mutex_init      zmutex_init
+#   define mutex_init_ex   zmutex_init_ex
+#   define mutex_lock      zmutex_lock
+#   define mutex_unlock    zmutex_unlock
+#   define mutex_destroy   zmutex_destroy
+#   define mutex_trylock   zmutex_trylock
+#   define mutex_timedlock zmutex_timedlock
+
+#   define rwlock_init     zrwlock_init
+#   define rwlock_init_ex  zrwlock_init_ex
+#   define rwlock_rdlock   zrwlock_rdlock
+#   define rwlock_wrlock   zrwlock_wrlock
+#   define rwlock_tryrdlock zrwlock_tryrdlock
+#   define rwlock_trywrlock zrwlock_trywrlock
+#   define rwlock_rdunlock zrwlock_rdunlock
+#   define rwlock_wrunlock zrwlock_wrunlock
+#   define rwlock_destroy  zrwlock_destroy
+
+#   define barrier_init    zbarrier_init
+#   define barrier_wait    zbarrier_wait
+#   define barrier_destroy zbarrier_destroy
+
+#   define latch_init      zlatch_init
+#   define latch_count_down zlatch_count_down
+#   define latch_wait      zlatch_wait
+#   define latch_destroy   zlatch_destroy
+
+#   define cond_init       zcond_init
+#   define cond_wait       zcond_wait
+#   define cond_timedwait  zcond_timedwait
+#   define cond_signal     zcond_signal
+#   define cond_broadcast  zcond_broadcast
+#   define cond_destroy    zcond_destroy
+
+    typedef zpool_t     pool_t;
+
+#   define pool_create     zpool_create
+#   define pool_create_node zpool_create_node
+#   define pool_submit     zpool_submit
+#   define pool_wait_idle  zpool_wait_idle
+#   define pool_shutdown   zpool_shutdown
+#   define pool_worker_index zpool_worker_index
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+// namespace: z_thread.
+#ifdef __cplusplus
+
+#include <utility>
+#include <exception>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#   if __has_include(<coroutine>)
+#       include <coroutine>
+#       define ZTHREAD__COROUTINES 1
+#   endif
+#endif
+
+namespace z_thread 
+{
+    // ZATOMIC_* order <-> std::memory_order, for code that mixes zatomic_* on
+    // C structures with std::atomic.
+    inline constexpr std::memory_order to_std_order(int mo) 
+    {
+        return mo == ZATOMIC_RELAXED ? std::memory_order_relaxed :
+               mo == ZATOMIC_ACQUIRE ? std::memory_order_acquire :
+               mo == ZATOMIC_RELEASE ? std::memory_order_release :
+               mo == ZATOMIC_ACQ_REL ? std::memory_order_acq_rel : std::memory_order_seq_cst;
+    }
+
+    inline constexpr int from_std_order(std::memory_order mo) 
+    {
+        return mo == std::memory_order_relaxed ? ZATOMIC_RELAXED :
+               (mo == std::memory_order_consume || mo == std::memory_order_acquire) ? ZATOMIC_ACQUIRE :
+               mo == std::memory_order_release ? ZATOMIC_RELEASE :
+               mo == std::memory_order_acq_rel ? ZATOMIC_ACQ_REL : ZATOMIC_SEQ_CST;
+    }
+
+    constexpr size_t cache_line_size = ZTHREAD_CACHE_LINE;
+
+    inline void cpu_relax() 
+    { 
+        ::zthread_cpu_relax(); 
+    }
+
+    // A value alone on its cache line, so neighbours in an array do not share it.
+    // Usage: z_thread::cache_padded<std::atomic<int64_t>> counters[8]; counters[i]->fetch_add(1);
+    template <typename T>
+    struct alignas(ZTHREAD_CACHE_LINE) cache_padded 
+    {
+        T value;
+
+        cache_padded() : value() {}
+
+        template <typename... Args>
+        explicit cache_padded(Args&&... args) : value(std::forward<Args>(args)...) {}
+
+        T &operator*() 
+        { 
+            return value; 
+        }
+
+        const T &operator*() const 
+        { 
+            return value; 
+        }
+
+        T *operator->() 
+        { 
+            return &value; 
+        }
+
+        const T *operator->() const 
+        { 
+            return &value; 
+        }
+    };
+
+    namespace detail
+    {
+        // Compile-time index list for unpacking the stored arguments (C++11).
+        template <size_t... I> struct index_seq {};
+        template <size_t N, size_t... I> struct make_index_seq : make_index_seq<N - 1, N - 1, I...> {};
+        template <size_t... I> struct make_index_seq<0, I...> { typedef index_seq<I...> type; };
+
+        // Plain callables are called directly, member pointers go through std::mem_fn.
+        template <typename F, typename... A>
+        auto call(F &f, A&... a) 
+            -> typename std::enable_if<!std::is_member_pointer<F>::value, decltype(f(a...))>::type
+        { 
+            return f(a...); 
+        }
+
+        template <typename F, typename... A>
+        auto call(F &f, A&... a) 
+            -> typename std::enable_if<std::is_member_pointer<F>::value, decltype(std::mem_fn(f)(a...))>::type
+        { 
+            return std::mem_fn(f)(a...); 
+        }
+
+        // Objects handed between threads (invokers, future states) come from the
+        // calling thread's descriptor cache unless their type needs more
+        // alignment than the cache provides.
+        template <typename T, typename... A>
+        T *cache_new(A&&... a) 
         {
-            other.joinable = false;
-#           ifdef _WIN32
-            other.inner = NULL;
-#           else
-            other.inner = 0;
-#           endif
+            if (alignof(T) > ZTHREAD__BLOCK_ALIGN) 
+            {
+                return new T(std::forward<A>(a)...);
+            }
+            void *mem = ::zthread__cache_alloc(sizeof(T));
+            if (!mem) 
+            {
+                throw std::bad_alloc();
+            }
+            try 
+            {
+                return new (mem) T(std::forward<A>(a)...);
+            } 
+            catch (...) 
+            {
+                ::zthread__cache_free(mem);
+                throw;
+            }
         }
 
-        thread &operator=(thread &&other) noexcept 
+        template <typename T>
+        void cache_delete(T *p) 
         {
-            if (joinable) 
+            if (alignof(T) > ZTHREAD__BLOCK_ALIGN) 
             {
-                std::terminate();
+                delete p;
+                return;
             }
-            inner = other.inner;
-            joinable = other.joinable;
-            other.joinable = false;
-            return *this;
+            p->~T();
+            ::zthread__cache_free(p);
         }
 
-        // Standard thread constructor (Function + Args).
-        // Usage: z_thread::thread t([]{ printf("Hello"); });
-        template <typename Function, typename... Args>
-        explicit thread(Function &&f, Args&&... args) 
+        // Decayed copies of the callable and its arguments in a single block.
+        // 'run' and 'entry' are plain functions, so the thread/pool trampoline
+        // needs neither std::bind nor a virtual call. Arguments are passed as
+        // lvalues, like std::bind did.
+        template <typename Func, typename... Args>
+        struct invoker 
         {
-            auto bound_func = std::bind(std::forward<Function>(f), std::forward<Args>(args)...);
+            Func f;
+            std::tuple<Args...> args;
 
-            impl_base* p = new impl_type<decltype(bound_func)>(std::move(bound_func));
-            
-            if (::zthread__create_ptr(&inner, proxy_thunk, p) == Z_OK) 
+            template <typename F, typename... A>
+            explicit invoker(F &&func, A&&... a) : f(std::forward<F>(func)), args(std::forward<A>(a)...) {}
+
+            template <size_t... I>
+            void invoke(index_seq<I...>) 
+            { 
+                detail::call(f, std::get<I>(args)...); 
+            }
+
+            // Matches zpool_task_fn. Runs once and frees the block.
+            static void run(void *arg) 
             {
-                joinable = true;
-            } 
-            else 
+                invoker *p = static_cast<invoker*>(arg);
+                p->invoke(typename make_index_seq<sizeof...(Args)>::type());
+                cache_delete(p);
+            }
+
+            // Matches the OS thread signature (zthread__create_raw).
+            static ZTHREAD_Func entry(void *arg) 
             {
-                delete p; // Cleanup if creation failed.
-                joinable = false;
+                run(arg);
+                return 0;
             }
+        };
+
+        template <typename Function, typename... Args>
+        invoker<typename std::decay<Function>::type, typename std::decay<Args>::type...> *
+        make_invoker(Function &&f, Args&&... args)
+        {
+            return cache_new<invoker<typename std::decay<Function>::type, typename std::decay<Args>::type...> >(
+                std::forward<Function>(f), std::forward<Args>(args)...);
         }
 
-        ~thread() 
+        template <typename Rep, typename Period>
+        int64_t to_ns(const std::chrono::duration<Rep, Period> &d)
         {
-            if (joinable) 
+            return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        }
+
+#ifdef ZTHREAD__COROUTINES
+        // Pool task that resumes the coroutine whose address is 'arg'.
+        inline void resume_handle(void *arg) 
+        {
+            std::coroutine_handle<>::from_address(arg).resume();
+        }
+
+        // Resumes 'h' on 'p' through 'node', which lives in the suspended
+        // coroutine's frame (inline if there is no pool).
+        inline void resume_on(::zpool_t *p, ::zpool__task &node, std::coroutine_handle<> h) 
+        {
+            if (p) 
             {
-                std::terminate();
+                node.fn = &resume_handle;
+                node.arg = h.address();
+                node.cached = 0;
+                if (::zpool__submit_node(p, &node) == Z_OK) 
+                {
+                    return;
+                }
             }
+            h.resume();
         }
 
-        void join() 
+        // co_await pool.schedule(): continues on one of the pool's workers.
+        class schedule_awaiter 
         {
-            if (joinable) 
+            ::zpool_t *pool;
+            ::zpool__task node;
+
+         public:
+            explicit schedule_awaiter(::zpool_t *p) noexcept : pool(p) {}
+
+            bool await_ready() const noexcept 
+            { 
+                return !pool; 
+            }
+
+            // The coroutine may already run elsewhere once the node is queued,
+            // so nothing of *this is touched after the submit.
+            bool await_suspend(std::coroutine_handle<> h) noexcept 
             {
-                ::zthread_join(inner);
-                joinable = false;
+                node.fn = &resume_handle;
+                node.arg = h.address();
+                node.cached = 0;
+                return ::zpool__submit_node(pool, &node) == Z_OK;
             }
-        }
 
-        void detach() 
+            void await_resume() const noexcept {}
+        };
+#endif
+    }
+
+    class mutex 
+    {
+        ::zmutex_t inner;
+        friend class cond;
+
+     public:
+        // RAII: Initialize on construction.
+        mutex() 
+        { 
+            ::zmutex_init(&inner); 
+        }
+
+        // Usage: z_thread::mutex m(ZMUTEX_ADAPTIVE);
+        explicit mutex(int flags) 
+        { 
+            ::zmutex_init_ex(&inner, flags); 
+        }
+
+        // RAII: Destroy on destruction.
+        ~mutex() 
+        { 
+            ::zmutex_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        mutex(const mutex&) = delete;
+        mutex &operator=(const mutex&) = delete;
+
+        void lock() 
+        { 
+            ::zmutex_lock(&inner); 
+        }
+
+        void unlock() 
+        { 
+            ::zmutex_unlock(&inner); 
+        }
+
+        bool try_lock() 
+        { 
+            return ::zmutex_trylock(&inner) == Z_OK; 
+        }
+
+        bool try_lock_for(int64_t timeout_ns) 
+        { 
+            return ::zmutex_timedlock(&inner, timeout_ns) == Z_OK; 
+        }
+
+        template <typename Rep, typename Period>
+        bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout) 
+        { 
+            return try_lock_for(detail::to_ns(timeout)); 
+        }
+        
+        // Raw access if needed.
+        ::zmutex_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    // Reader-writer lock. Method names follow std::shared_mutex, so
+    // std::shared_lock and std::unique_lock work with it too.
+    // Usage: z_thread::shared_mutex rw(ZRWLOCK_PREFER_WRITER);
+    class shared_mutex 
+    {
+        ::zrwlock_t inner;
+
+     public:
+        shared_mutex() 
+        { 
+            ::zrwlock_init(&inner); 
+        }
+
+        explicit shared_mutex(int flags) 
+        { 
+            ::zrwlock_init_ex(&inner, flags); 
+        }
+
+        ~shared_mutex() 
+        { 
+            ::zrwlock_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        shared_mutex(const shared_mutex&) = delete;
+        shared_mutex &operator=(const shared_mutex&) = delete;
+
+        void lock() 
+        { 
+            ::zrwlock_wrlock(&inner); 
+        }
+
+        void unlock() 
+        { 
+            ::zrwlock_wrunlock(&inner); 
+        }
+
+        bool try_lock() 
+        { 
+            return ::zrwlock_trywrlock(&inner) == Z_OK; 
+        }
+
+        void lock_shared() 
+        { 
+            ::zrwlock_rdlock(&inner); 
+        }
+
+        void unlock_shared() 
+        { 
+            ::zrwlock_rdunlock(&inner); 
+        }
+
+        bool try_lock_shared() 
+        { 
+            return ::zrwlock_tryrdlock(&inner) == Z_OK; 
+        }
+
+        ::zrwlock_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    // Distributed reader lock (zbrlock_t): reads scale with the core count,
+    // writes lock every slot. Works with lock_guard and shared_lock_guard.
+    // Usage: z_thread::distributed_shared_mutex routes; z_thread::shared_lock_guard g(routes);
+    class distributed_shared_mutex 
+    {
+        ::zbrlock_t *inner;
+
+     public:
+        // 'slots' = 0 uses one per logical CPU. 'flags' are ZRWLOCK_*.
+        explicit distributed_shared_mutex(int slots = 0, int flags = ZRWLOCK_DEFAULT) 
+            : inner(::zbrlock_create(slots, flags)) 
+        {
+            if (!inner) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~distributed_shared_mutex() 
+        { 
+            ::zbrlock_destroy(inner); 
+        }
+
+        // Non-copyable.
+        distributed_shared_mutex(const distributed_shared_mutex&) = delete;
+        distributed_shared_mutex &operator=(const distributed_shared_mutex&) = delete;
+
+        void lock() 
+        { 
+            ::zbrlock_wrlock(inner); 
+        }
+
+        void unlock() 
+        { 
+            ::zbrlock_wrunlock(inner); 
+        }
+
+        bool try_lock() 
+        { 
+            return ::zbrlock_trywrlock(inner) == Z_OK; 
+        }
+
+        void lock_shared() 
+        { 
+            ::zbrlock_rdlock(inner); 
+        }
+
+        void unlock_shared() 
+        { 
+            ::zbrlock_rdunlock(inner); 
+        }
+
+        bool try_lock_shared() 
+        { 
+            return ::zbrlock_tryrdlock(inner) == Z_OK; 
+        }
+
+        ::zbrlock_t *native_handle() 
+        { 
+            return inner; 
+        }
+    };
+
+    // Simple RAII lock guard (scoped lock).
+    // z_thread::mutex unlocks directly. Other lockables (lock()/unlock()), such
+    // as shared_mutex, unlock through a per-type thunk, so 'lock_guard g(m)'
+    // keeps working without template arguments.
+    class lock_guard 
+    {
+        mutex *m_mutex;
+        void *m_lock;
+        void (*m_unlock)(void*);
+
+        template <typename Lockable>
+        static void unlock_thunk(void *l) 
+        { 
+            static_cast<Lockable*>(l)->unlock(); 
+        }
+
+     public:
+        explicit lock_guard(mutex& m) : m_mutex(&m), m_lock(nullptr), m_unlock(nullptr) 
+        { 
+            m.lock(); 
+        }
+
+        template <typename Lockable>
+        explicit lock_guard(Lockable& m) : m_mutex(nullptr), m_lock(&m), m_unlock(&unlock_thunk<Lockable>) 
+        { 
+            m.lock(); 
+        }
+
+        ~lock_guard() 
+        {
+            if (m_mutex) 
+            {
+                m_mutex->unlock();
+            } 
+            else 
+            {
+                m_unlock(m_lock);
+            }
+        }
+        
+        // Non-copyable.
+        lock_guard(const lock_guard&) = delete;
+        lock_guard &operator=(const lock_guard&) = delete;
+    };
+
+    // Shared (reader) guard for any lock with lock_shared()/unlock_shared().
+    // Usage: z_thread::shared_lock_guard g(rw);
+    class shared_lock_guard 
+    {
+        void *m_lock;
+        void (*m_unlock)(void*);
+
+        template <typename Lockable>
+        static void unlock_thunk(void *l) 
+        { 
+            static_cast<Lockable*>(l)->unlock_shared(); 
+        }
+
+     public:
+        template <typename Lockable>
+        explicit shared_lock_guard(Lockable& m) : m_lock(&m), m_unlock(&unlock_thunk<Lockable>) 
+        { 
+            m.lock_shared(); 
+        }
+
+        ~shared_lock_guard() 
+        { 
+            m_unlock(m_lock); 
+        }
+
+        // Non-copyable.
+        shared_lock_guard(const shared_lock_guard&) = delete;
+        shared_lock_guard &operator=(const shared_lock_guard&) = delete;
+    };
+
+    class cond 
+    {
+        ::zcond_t inner;
+
+     public:
+        cond() 
+        { 
+            ::zcond_init(&inner); 
+        }
+
+        ~cond() 
+        { 
+            ::zcond_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        cond(const cond&) = delete;
+        cond &operator=(const cond&) = delete;
+
+        void wait(mutex &m) 
+        { 
+            ::zcond_wait(&inner, &m.inner); 
+        }
+
+        // Returns false if the timeout expired before a wakeup.
+        bool wait_for(mutex &m, int64_t timeout_ns) 
+        { 
+            return ::zcond_timedwait(&inner, &m.inner, timeout_ns) == Z_OK; 
+        }
+
+        template <typename Rep, typename Period>
+        bool wait_for(mutex &m, const std::chrono::duration<Rep, Period> &timeout) 
+        { 
+            return wait_for(m, detail::to_ns(timeout)); 
+        }
+
+        void signal() 
+        { 
+            ::zcond_signal(&inner); 
+        }
+
+        void broadcast() 
+        { 
+            ::zcond_broadcast(&inner);
+        }
+        
+        ::zcond_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    // Counting semaphore (zsem_t).
+    // Usage: z_thread::counting_semaphore slots(4); slots.acquire(); ...; slots.release();
+    class counting_semaphore 
+    {
+        ::zsem_t inner;
+
+     public:
+        explicit counting_semaphore(unsigned initial = 0) 
+        { 
+            if (::zsem_init(&inner, initial) != Z_OK) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~counting_semaphore() 
+        { 
+            ::zsem_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        counting_semaphore(const counting_semaphore&) = delete;
+        counting_semaphore &operator=(const counting_semaphore&) = delete;
+
+        void acquire() 
+        { 
+            ::zsem_wait(&inner); 
+        }
+
+        bool try_acquire() 
+        { 
+            return ::zsem_trywait(&inner) == Z_OK; 
+        }
+
+        bool try_acquire_for(int64_t timeout_ns) 
+        { 
+            return ::zsem_timedwait(&inner, timeout_ns) == Z_OK; 
+        }
+
+        template <typename Rep, typename Period>
+        bool try_acquire_for(const std::chrono::duration<Rep, Period> &d) 
+        { 
+            return try_acquire_for(detail::to_ns(d)); 
+        }
+
+        void release(unsigned n = 1) 
+        { 
+            while (n-- > 0) 
+            {
+                ::zsem_post(&inner);
+            }
+        }
+
+        ::zsem_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    // Reusable barrier (zbarrier_t).
+    // Usage: z_thread::barrier sync(n); ... sync.arrive_and_wait();
+    class barrier 
+    {
+        ::zbarrier_t inner;
+
+     public:
+        explicit barrier(int count) 
+        { 
+            if (::zbarrier_init(&inner, count) != Z_OK) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~barrier() 
+        { 
+            ::zbarrier_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        barrier(const barrier&) = delete;
+        barrier &operator=(const barrier&) = delete;
+
+        // Returns true in exactly one thread per phase.
+        bool arrive_and_wait() 
+        { 
+            return ::zbarrier_wait(&inner) == ZBARRIER_SERIAL; 
+        }
+
+        ::zbarrier_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    // One-shot latch (zlatch_t).
+    // Usage: z_thread::latch ready(n); ready.count_down(); ready.wait();
+    class latch 
+    {
+        ::zlatch_t inner;
+
+     public:
+        explicit latch(int count) 
+        { 
+            if (::zlatch_init(&inner, count) != Z_OK) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~latch() 
+        { 
+            ::zlatch_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        latch(const latch&) = delete;
+        latch &operator=(const latch&) = delete;
+
+        void count_down(int n = 1) 
+        { 
+            ::zlatch_count_down(&inner, n); 
+        }
+
+        bool try_wait() const 
+        { 
+            return ::zlatch_try_wait(&inner) != 0; 
+        }
+
+        void wait() 
+        { 
+            ::zlatch_wait(&inner); 
+        }
+
+        void arrive_and_wait(int n = 1) 
+        { 
+            ::zlatch_arrive_and_wait(&inner, n); 
+        }
+    };
+
+    // Event count (zeventcount_t): lock-free producers wake waiting threads.
+    // Usage: z_thread::event_count ec; ec.wait([&] { return !q.empty(); });
+    //        q.push(x); ec.notify();
+    class event_count 
+    {
+        ::zeventcount_t inner;
+
+     public:
+        event_count() 
+        { 
+            ::zeventcount_init(&inner); 
+        }
+
+        ~event_count() 
+        { 
+            ::zeventcount_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        event_count(const event_count&) = delete;
+        event_count &operator=(const event_count&) = delete;
+
+        int32_t prepare_wait() 
+        { 
+            return ::zeventcount_prepare_wait(&inner); 
+        }
+
+        void cancel_wait() 
+        { 
+            ::zeventcount_cancel_wait(&inner); 
+        }
+
+        void commit_wait(int32_t key) 
+        { 
+            ::zeventcount_commit_wait(&inner, key); 
+        }
+
+        // Blocks until pred() returns true; pred runs without any lock held.
+        template <typename Pred>
+        void wait(Pred pred) 
+        {
+            while (!pred()) 
+            {
+                int32_t key = prepare_wait();
+                if (pred()) 
+                {
+                    cancel_wait();
+                    return;
+                }
+                commit_wait(key);
+            }
+        }
+
+        void notify() 
+        { 
+            ::zeventcount_notify(&inner); 
+        }
+
+        void notify_all() 
+        { 
+            ::zeventcount_notify_all(&inner); 
+        }
+
+        ::zeventcount_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    // Per-thread owning pointer: each thread's object is deleted when that
+    // thread exits (or on reset). For plain values prefer ZTHREAD_LOCAL.
+    template <typename T>
+    class thread_specific_ptr 
+    {
+        ::ztls_key_t key;
+
+        static void cleanup(void *p) 
+        { 
+            delete static_cast<T*>(p); 
+        }
+
+     public:
+        thread_specific_ptr() 
+        { 
+            if (::ztls_key_create(&key, cleanup) != Z_OK) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        // Deletes the calling thread's object; other threads' objects are
+        // leaked, so destroy only after the threads that used it are gone.
+        ~thread_specific_ptr() 
+        { 
+            delete get();
+            ::ztls_key_delete(key); 
+        }
+
+        // Non-copyable.
+        thread_specific_ptr(const thread_specific_ptr&) = delete;
+        thread_specific_ptr &operator=(const thread_specific_ptr&) = delete;
+
+        T *get() const 
+        { 
+            return static_cast<T*>(::ztls_get(key)); 
+        }
+
+        T *operator->() const 
+        { 
+            return get(); 
+        }
+
+        T &operator*() const 
+        { 
+            return *get(); 
+        }
+
+        // Takes ownership of 'p' for this thread; deletes the previous object.
+        void reset(T *p = nullptr) 
+        {
+            T *old = get();
+            if (old == p) 
+            {
+                return;
+            }
+            if (::ztls_set(key, p) != Z_OK) 
+            {
+                delete p;
+                throw std::bad_alloc();
+            }
+            delete old;
+        }
+
+        // Gives up ownership of this thread's object without deleting it.
+        T *release() 
+        {
+            T *old = get();
+            ::ztls_set(key, nullptr);
+            return old;
+        }
+    };
+
+    // Creation options for z_thread::thread (wraps zthread_attr_t).
+    // Usage: z_thread::thread t(z_thread::thread_options().name("io").stack_size(64 << 10).cpu(2), fn);
+    class thread_options 
+    {
+        ::zthread_attr_t attr;
+
+     public:
+        thread_options() 
+        { 
+            ::zthread_attr_init(&attr); 
+        }
+
+        thread_options &stack_size(size_t bytes) 
+        { 
+            attr.stack_size = bytes; 
+            return *this; 
+        }
+
+        thread_options &guard_size(size_t bytes) 
+        { 
+            attr.guard_size = bytes; 
+            return *this; 
+        }
+
+        // Adds a CPU to the affinity mask (may be called repeatedly).
+        thread_options &cpu(int index) 
+        { 
+            ::zthread_attr_set_cpu(&attr, index); 
+            return *this; 
+        }
+
+        // Adds every CPU of a NUMA node to the affinity mask.
+        thread_options &node(int index) 
+        { 
+            ::zthread_attr_set_node(&attr, index); 
+            return *this; 
+        }
+
+        // 'policy' is a ZTHREAD_SCHED_* value.
+        thread_options &priority(int policy, int value) 
+        { 
+            attr.policy = policy; 
+            attr.priority = value; 
+            return *this; 
+        }
+
+        // The string is copied when the thread starts, not when set here.
+        thread_options &name(const char *n) 
+        { 
+            attr.name = n; 
+            return *this; 
+        }
+
+        const ::zthread_attr_t *native() const 
+        { 
+            return &attr; 
+        }
+    };
+
+    class thread 
+    {
+        ::zthread_t inner;
+        bool joinable;
+
+    public:
+        thread() : joinable(false) 
+        {
+#           ifdef _WIN32
+            inner = NULL;
+#           else
+            inner = 0;
+#           endif
+        }
+
+        // Move constructor.
+        thread(thread &&other) noexcept : inner(other.inner), joinable(other.joinable) 
+        {
+            other.joinable = false;
+#           ifdef _WIN32
+            other.inner = NULL;
+#           else
+            other.inner = 0;
+#           endif
+        }
+
+        thread &operator=(thread &&other) noexcept 
+        {
+            if (joinable) 
+            {
+                std::terminate();
+            }
+            inner = other.inner;
+            joinable = other.joinable;
+            other.joinable = false;
+            return *this;
+        }
+
+        // Standard thread constructor (Function + Args).
+        // Usage: z_thread::thread t([]{ printf("Hello"); });
+        template <typename Function, typename... Args,
+                  typename = typename std::enable_if<
+                      !std::is_same<typename std::decay<Function>::type, thread_options>::value &&
+                      !std::is_same<typename std::decay<Function>::type, thread>::value>::type>
+        explicit thread(Function &&f, Args&&... args) 
+        {
+            // One allocation: the invoker is handed straight to the OS thread.
+            auto *p = detail::make_invoker(std::forward<Function>(f), std::forward<Args>(args)...);
+            
+            if (::zthread__create_raw(&inner, p->entry, p) == Z_OK) 
+            {
+                joinable = true;
+            } 
+            else 
+            {
+                detail::cache_delete(p); // Cleanup if creation failed.
+                joinable = false;
+            }
+        }
+
+        // Same, with stack size, affinity, priority and name.
+        // Usage: z_thread::thread t(z_thread::thread_options().cpu(0), work, 42);
+        template <typename Function, typename... Args>
+        thread(const thread_options &opts, Function &&f, Args&&... args) 
+        {
+            auto *p = detail::make_invoker(std::forward<Function>(f), std::forward<Args>(args)...);
+
+            if (::zthread__create_ex_ptr(&inner, p->run, p, opts.native()) == Z_OK) 
+            {
+                joinable = true;
+            } 
+            else 
+            {
+                detail::cache_delete(p);
+                joinable = false;
+            }
+        }
+
+        ~thread() 
+        {
+            if (joinable) 
+            {
+                std::terminate();
+            }
+        }
+
+        void join() 
+        {
+            if (joinable) 
+            {
+                ::zthread_join(inner);
+                joinable = false;
+            }
+        }
+
+        void detach() 
+        {
+            if (joinable) 
+            {
+                ::zthread_detach(inner);
+                joinable = false;
+            }
+        }
+
+        bool joinable_state() const 
+        { 
+            return joinable; 
+        }
+
+        ::zthread_t native_handle() 
+        { 
+            return inner; 
+        }
+        
+        static void sleep(int ms) 
+        { 
+            ::zthread_sleep(ms); 
+        }
+
+        // High-resolution sleeps (zthread_sleep_ns, zthread_sleep_until).
+        static int64_t now_ns() 
+        { 
+            return ::zthread_now_ns(); 
+        }
+
+        static void sleep_for(int64_t ns) 
+        { 
+            ::zthread_sleep_ns(ns); 
+        }
+
+        template <typename Rep, typename Period>
+        static void sleep_for(const std::chrono::duration<Rep, Period> &d) 
+        { 
+            ::zthread_sleep_ns(detail::to_ns(d)); 
+        }
+
+        static void sleep_until(int64_t deadline_ns) 
+        { 
+            ::zthread_sleep_until(deadline_ns); 
+        }
+
+        // Sleeps, then spins for the last stretch (zthread_sleep_precise_until).
+        static void sleep_precise_until(int64_t deadline_ns) 
+        { 
+            ::zthread_sleep_precise_until(deadline_ns); 
+        }
+
+        template <typename Rep, typename Period>
+        static void sleep_precise_for(const std::chrono::duration<Rep, Period> &d) 
+        { 
+            ::zthread_sleep_precise(detail::to_ns(d)); 
+        }
+
+        // Parking (zthread_park): the caller's token for unpark().
+        static ::zparker_t *parker() 
+        { 
+            return ::zthread_parker(); 
+        }
+
+        static void park() 
+        { 
+            ::zthread_park(); 
+        }
+
+        // Returns true once unparked, false on timeout.
+        static bool park_for(int64_t timeout_ns) 
+        { 
+            return ::zthread_park_for(timeout_ns) == Z_OK; 
+        }
+
+        template <typename Rep, typename Period>
+        static bool park_for(const std::chrono::duration<Rep, Period> &d) 
+        { 
+            return park_for(detail::to_ns(d)); 
+        }
+
+        static void unpark(::zparker_t *p) 
+        { 
+            ::zthread_unpark(p); 
+        }
+    };
+
+    class pool 
+    {
+        ::zpool_t *inner;
+
+     public:
+        // Spawns 'num_threads' workers (0 = one per logical CPU).
+        explicit pool(int num_threads = 0) : inner(::zpool_create(num_threads)) {}
+
+        // Workers pinned to NUMA 'node', with node-local memory (0 threads = one per CPU of the node).
+        pool(int num_threads, int node) : inner(::zpool_create_node(num_threads, node)) {}
+
+        // Runs the remaining tasks and joins the workers.
+        ~pool() 
+        { 
+            shutdown(); 
+        }
+
+        // Non-copyable.
+        pool(const pool&) = delete;
+        pool &operator=(const pool&) = delete;
+
+        // Queues f(args...) for execution. Returns false if it could not be queued.
+        // Usage: p.submit([&]{ work(); });
+        template <typename Function, typename... Args>
+        bool submit(Function &&f, Args&&... args) 
+        {
+            if (!inner) 
+            {
+                return false;
+            }
+            auto *p = detail::make_invoker(std::forward<Function>(f), std::forward<Args>(args)...);
+
+            if (::zpool__submit_ptr(inner, p->run, p) != Z_OK) 
+            {
+                detail::cache_delete(p);
+                return false;
+            }
+            return true;
+        }
+
+        // Queues f(args...) once 'delay_ns' have passed (see zpool_submit_after).
+        // Usage: p.submit_after(std::chrono::milliseconds(50), [&]{ retry(); });
+        template <typename Function, typename... Args>
+        bool submit_after(int64_t delay_ns, Function &&f, Args&&... args) 
+        {
+            if (!inner) 
+            {
+                return false;
+            }
+            auto *p = detail::make_invoker(std::forward<Function>(f), std::forward<Args>(args)...);
+
+            if (::zpool__submit_after_ptr(inner, delay_ns, p->run, p) != Z_OK) 
+            {
+                detail::cache_delete(p);
+                return false;
+            }
+            return true;
+        }
+
+        template <typename Rep, typename Period, typename Function, typename... Args>
+        bool submit_after(const std::chrono::duration<Rep, Period> &d, Function &&f, Args&&... args) 
+        {
+            return submit_after(detail::to_ns(d), std::forward<Function>(f), std::forward<Args>(args)...);
+        }
+
+        void wait_idle() 
+        { 
+            if (inner) 
+            {
+                ::zpool_wait_idle(inner); 
+            }
+        }
+
+        void shutdown() 
+        {
+            if (inner) 
+            {
+                ::zpool_shutdown(inner);
+                inner = nullptr;
+            }
+        }
+
+        int size() const 
+        { 
+            return inner ? ::zpool_size(inner) : 0; 
+        }
+
+        // NUMA node of a per-node pool, -1 otherwise.
+        int node() const 
+        { 
+            return inner ? ::zpool_node(inner) : -1; 
+        }
+
+        bool valid() const 
+        { 
+            return inner != nullptr; 
+        }
+
+        ::zpool_t *native_handle() 
+        { 
+            return inner; 
+        }
+
+#ifdef ZTHREAD__COROUTINES
+        // Usage: co_await p.schedule(); (continues on a worker; inline if the
+        // pool is not valid).
+        detail::schedule_awaiter schedule() noexcept 
+        { 
+            return detail::schedule_awaiter(inner); 
+        }
+#endif
+    };
+
+    // Thrown by future::get when the promise was destroyed without a result.
+    class broken_promise : public std::logic_error 
+    {
+     public:
+        broken_promise() : std::logic_error("z_thread: promise destroyed without a result") {}
+    };
+
+    template <typename T> class future;
+
+    namespace detail 
+    {
+        // Shared state of a promise/future pair, in one block: the reference
+        // count, a flag word, a latch that blocked readers park on, the result
+        // and an optional .then() continuation. Completion and .then() both set
+        // their bit with one fetch_or; whichever comes second runs the
+        // continuation, so it fires inline on the completing thread.
+        struct state_base 
+        {
+            enum { READY = 1, CONT = 2, SET = 4 };
+
+            std::atomic<int> refs;
+            std::atomic<int> flags;
+            ::zlatch_t done;
+            std::exception_ptr error;
+            state_base *next;
+            void (*fire)(state_base *next, state_base *self);
+            void (*dispose)(state_base *self);
+
+            explicit state_base(int r) : refs(r), flags(0), next(nullptr), fire(nullptr), dispose(nullptr) 
+            {
+                if (::zlatch_init(&done, 1) != Z_OK) 
+                {
+                    throw std::bad_alloc();
+                }
+            }
+
+            ~state_base() 
+            { 
+                ::zlatch_destroy(&done); 
+            }
+
+            // Reserves the right to store the result. False if already taken.
+            bool claim() 
+            { 
+                return !(flags.fetch_or(SET, std::memory_order_relaxed) & SET); 
+            }
+
+            void complete() 
+            {
+                int old = flags.fetch_or(READY, std::memory_order_acq_rel);
+                ::zlatch_count_down(&done, 1);
+                if (old & CONT) 
+                {
+                    fire(next, this);
+                }
+            }
+
+            void attach(state_base *n, void (*f)(state_base*, state_base*)) 
+            {
+                next = n;
+                fire = f;
+                if (flags.fetch_or(CONT, std::memory_order_acq_rel) & READY) 
+                {
+                    f(n, this);
+                }
+            }
+
+            bool ready() const 
+            { 
+                return (flags.load(std::memory_order_acquire) & READY) != 0; 
+            }
+
+            void wait() 
+            { 
+                if (!ready()) 
+                {
+                    ::zlatch_wait(&done);
+                }
+            }
+
+            void release() 
+            {
+                if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) 
+                {
+                    dispose(this);
+                }
+            }
+        };
+
+        struct state_ref 
+        {
+            state_base *p;
+
+            ~state_ref() 
+            { 
+                p->release(); 
+            }
+        };
+
+        template <typename T>
+        struct state : state_base 
+        {
+            alignas(T) unsigned char storage[sizeof(T)];
+            bool has_value;
+
+            explicit state(int r) : state_base(r), has_value(false) 
+            { 
+                dispose = &destroy; 
+            }
+
+            ~state() 
+            {
+                if (has_value) 
+                {
+                    value().~T();
+                }
+            }
+
+            T &value() 
+            { 
+                return *reinterpret_cast<T*>(storage); 
+            }
+
+            template <typename U>
+            void set(U &&v) 
+            {
+                new (storage) T(std::forward<U>(v));
+                has_value = true;
+            }
+
+            // Moves the result out, or rethrows the stored exception.
+            static T take(state *s) 
+            {
+                state_ref r = { s };
+                if (s->error) 
+                {
+                    std::rethrow_exception(s->error);
+                }
+                return std::move(s->value());
+            }
+
+            // Calls g() and stores what it returns.
+            template <typename G>
+            void fulfil(G &g) 
+            { 
+                set(g()); 
+            }
+
+            template <typename F>
+            static auto apply(F &f, state *s) -> decltype(f(std::move(s->value()))) 
+            { 
+                return f(std::move(s->value())); 
+            }
+
+            static void destroy(state_base *b) 
+            { 
+                cache_delete(static_cast<state*>(b)); 
+            }
+        };
+
+        template <>
+        struct state<void> : state_base 
+        {
+            explicit state(int r) : state_base(r) 
+            { 
+                dispose = &destroy; 
+            }
+
+            static void take(state *s) 
+            {
+                state_ref r = { s };
+                if (s->error) 
+                {
+                    std::rethrow_exception(s->error);
+                }
+            }
+
+            template <typename G>
+            void fulfil(G &g) 
+            { 
+                g(); 
+            }
+
+            template <typename F>
+            static auto apply(F &f, state*) -> decltype(f()) 
+            { 
+                return f(); 
+            }
+
+            static void destroy(state_base *b) 
+            { 
+                cache_delete(static_cast<state*>(b)); 
+            }
+        };
+
+        // Stores g()'s result or exception in 's', completes it and drops the
+        // producer's reference.
+        template <typename T, typename G>
+        void settle(state<T> *s, G g) 
+        {
+            try 
+            {
+                s->fulfil(g);
+            } 
+            catch (...) 
+            {
+                s->error = std::current_exception();
+            }
+            s->complete();
+            s->release();
+        }
+
+        template <typename T, typename F>
+        struct then_result 
+        {
+            typedef typename std::decay<decltype(state<T>::apply(std::declval<F&>(), static_cast<state<T>*>(nullptr)))>::type type;
+        };
+
+        // State of the future returned by .then(): also holds the continuation.
+        template <typename R, typename T, typename F>
+        struct then_state : state<R> 
+        {
+            F f;
+
+            template <typename G>
+            explicit then_state(G &&g) : state<R>(2), f(std::forward<G>(g)) 
+            { 
+                this->dispose = &destroy; 
+            }
+
+            static void destroy(state_base *b) 
+            { 
+                cache_delete(static_cast<then_state*>(b)); 
+            }
+
+            static void fire(state_base *next, state_base *self) 
+            {
+                then_state *n = static_cast<then_state*>(next);
+                state<T> *src = static_cast<state<T>*>(self);
+                if (src->error) 
+                {
+                    // Skip f and pass the exception down the chain.
+                    n->error = src->error;
+                    n->complete();
+                    n->release();
+                } 
+                else 
+                {
+                    settle(n, [n, src]() { return state<T>::apply(n->f, src); });
+                }
+                src->release();
+            }
+        };
+
+        // Pool task behind z_thread::async.
+        template <typename R, typename F>
+        struct async_task 
+        {
+            state<R> *s;
+            F f;
+
+            template <typename... A>
+            void operator()(A&... a) 
+            {
+                F &fn = f;
+                settle(s, [&fn, &a...]() { return detail::call(fn, a...); });
+            }
+        };
+    }
+
+    // Single-consumer result of a promise or z_thread::async. Move-only;
+    // get() and then() consume it. T must be void or an object type.
+    template <typename T>
+    class future 
+    {
+        static_assert(!std::is_reference<T>::value, "z_thread::future<T&> is not supported");
+
+        detail::state<T> *s;
+
+        void reset() 
+        {
+            if (s) 
+            {
+                s->release();
+                s = nullptr;
+            }
+        }
+
+     public:
+        future() : s(nullptr) {}
+
+        // Internal: adopts one reference to 'st'.
+        explicit future(detail::state<T> *st) : s(st) {}
+
+        future(future &&o) noexcept : s(o.s) 
+        { 
+            o.s = nullptr; 
+        }
+
+        future &operator=(future &&o) noexcept 
+        {
+            if (this != &o) 
+            {
+                reset();
+                s = o.s;
+                o.s = nullptr;
+            }
+            return *this;
+        }
+
+        ~future() 
+        { 
+            reset(); 
+        }
+
+        // Non-copyable.
+        future(const future&) = delete;
+        future &operator=(const future&) = delete;
+
+        bool valid() const 
+        { 
+            return s != nullptr; 
+        }
+
+        bool ready() const 
+        { 
+            return s && s->ready(); 
+        }
+
+        void wait() const 
+        { 
+            s->wait(); 
+        }
+
+        // Waits, then returns the result or rethrows the producer's exception.
+        T get() 
+        {
+            detail::state<T> *st = s;
+            s = nullptr;
+            st->wait();
+            return detail::state<T>::take(st);
+        }
+
+        // Runs f(result) (f() for void) on the thread that completes this
+        // future, or right here if it is already complete, and returns a
+        // future for what f returns. Exceptions skip f and propagate.
+        // Usage: auto n = z_thread::async(p, load).then([](std::string s) { return s.size(); });
+        template <typename F, typename R = typename detail::then_result<T, typename std::decay<F>::type>::type>
+        future<R> then(F &&f) 
+        {
+            typedef detail::then_state<R, T, typename std::decay<F>::type> next_type;
+            next_type *n = detail::cache_new<next_type>(std::forward<F>(f));
+            detail::state<T> *st = s;
+            s = nullptr;
+            st->attach(n, &next_type::fire);
+            return future<R>(n);
+        }
+    };
+
+    // Producer side of a future. Destroying an unsatisfied promise stores
+    // z_thread::broken_promise in its future.
+    template <typename T>
+    class promise 
+    {
+        detail::state<T> *s;
+        bool retrieved;
+
+        void abandon() 
+        {
+            if (!s) 
+            {
+                return;
+            }
+            if (s->claim()) 
+            {
+                s->error = std::make_exception_ptr(broken_promise());
+                s->complete();
+            }
+            s->release();
+            s = nullptr;
+        }
+
+        void claim() 
+        {
+            if (!s->claim()) 
+            {
+                throw std::logic_error("z_thread: promise already satisfied");
+            }
+        }
+
+     public:
+        promise() : s(detail::cache_new<detail::state<T> >(1)), retrieved(false) {}
+
+        promise(promise &&o) noexcept : s(o.s), retrieved(o.retrieved) 
+        { 
+            o.s = nullptr; 
+        }
+
+        promise &operator=(promise &&o) noexcept 
+        {
+            if (this != &o) 
+            {
+                abandon();
+                s = o.s;
+                retrieved = o.retrieved;
+                o.s = nullptr;
+            }
+            return *this;
+        }
+
+        ~promise() 
+        { 
+            abandon(); 
+        }
+
+        // Non-copyable.
+        promise(const promise&) = delete;
+        promise &operator=(const promise&) = delete;
+
+        // May be called once.
+        future<T> get_future() 
+        {
+            if (retrieved) 
+            {
+                throw std::logic_error("z_thread: future already retrieved");
+            }
+            retrieved = true;
+            s->refs.fetch_add(1, std::memory_order_relaxed);
+            return future<T>(s);
+        }
+
+        // set_value(v) for object types, set_value() for void. Each promise
+        // takes one value or exception; a second one throws std::logic_error.
+        template <typename U>
+        void set_value(U &&v) 
+        {
+            claim();
+            try 
+            {
+                s->set(std::forward<U>(v));
+            } 
+            catch (...) 
+            {
+                s->error = std::current_exception();
+            }
+            s->complete();
+        }
+
+        void set_value() 
+        {
+            claim();
+            s->complete();
+        }
+
+        void set_exception(std::exception_ptr e) 
+        {
+            claim();
+            s->error = e;
+            s->complete();
+        }
+    };
+
+    // Runs f(args...) on 'p' and returns a future for its result. Exceptions
+    // thrown by f are caught and rethrown from future::get. Throws
+    // std::bad_alloc if the task could not be queued.
+    // Usage: auto sum = z_thread::async(p, add, 1, 2); int v = sum.get();
+    template <typename Function, typename... Args,
+              typename R = typename std::decay<decltype(detail::call(
+                  std::declval<typename std::decay<Function>::type&>(),
+                  std::declval<typename std::decay<Args>::type&>()...))>::type>
+    future<R> async(pool &p, Function &&f, Args&&... args) 
+    {
+        typedef detail::async_task<R, typename std::decay<Function>::type> task_type;
+        detail::state<R> *s = detail::cache_new<detail::state<R> >(2);
+        bool queued;
+        try 
+        {
+            queued = p.submit(task_type{ s, std::forward<Function>(f) }, std::forward<Args>(args)...);
+        } 
+        catch (...) 
+        {
+            s->dispose(s);
+            throw;
+        }
+        if (!queued) 
+        {
+            s->dispose(s);
+            throw std::bad_alloc();
+        }
+        return future<R>(s);
+    }
+
+    namespace detail 
+    {
+        template <typename T> struct identity { typedef T type; };
+
+        // Exceptions must not unwind through the C pool: bodies catch them,
+        // skip the rest of the loop and the first one is rethrown by the caller.
+        struct parallel_error 
+        {
+            std::atomic<bool> failed;
+            std::exception_ptr error;
+
+            parallel_error() : failed(false) {}
+
+            void capture() 
+            {
+                if (!failed.exchange(true, std::memory_order_acq_rel)) 
+                {
+                    error = std::current_exception();
+                }
+            }
+
+            bool skip() const 
+            { 
+                return failed.load(std::memory_order_relaxed); 
+            }
+
+            void rethrow() 
+            {
+                if (error) 
+                {
+                    std::rethrow_exception(error);
+                }
+            }
+        };
+
+        template <typename Index, typename F>
+        struct for_body 
+        {
+            F *f;
+            parallel_error err;
+
+            static void run(int64_t b, int64_t e, void *ctx) 
+            {
+                for_body *self = static_cast<for_body*>(ctx);
+                if (self->err.skip()) 
+                {
+                    return;
+                }
+                try 
+                {
+                    for (int64_t i = b; i < e; i++) 
+                    {
+                        (*self->f)(static_cast<Index>(i));
+                    }
+                } 
+                catch (...) 
+                {
+                    self->err.capture();
+                }
+            }
+        };
+
+        // One accumulator per worker plus one for the calling thread, each on
+        // its own cache line; chunks fold locally and touch their slot once.
+        template <typename Index, typename T, typename Map, typename Reduce>
+        struct reduce_body 
+        {
+            ::zpool_t *pool;
+            Map *map;
+            Reduce *reduce;
+            cache_padded<T> *slots;
+            parallel_error err;
+
+            static void run(int64_t b, int64_t e, void *ctx) 
+            {
+                reduce_body *self = static_cast<reduce_body*>(ctx);
+                if (self->err.skip()) 
+                {
+                    return;
+                }
+                try 
+                {
+                    T local = (*self->map)(static_cast<Index>(b));
+                    for (int64_t i = b + 1; i < e; i++) 
+                    {
+                        local = (*self->reduce)(std::move(local), (*self->map)(static_cast<Index>(i)));
+                    }
+                    T &slot = self->slots[::zpool_worker_index(self->pool) + 1].value;
+                    slot = (*self->reduce)(std::move(slot), std::move(local));
+                } 
+                catch (...) 
+                {
+                    self->err.capture();
+                }
+            }
+        };
+
+        template <typename... F>
+        struct invoke_body 
+        {
+            typedef std::tuple<F&...> tuple_type;
+            typedef void (*call_fn)(tuple_type&);
+
+            tuple_type fns;
+            const call_fn *table;
+            parallel_error err;
+
+            invoke_body(const call_fn *t, F&... f) : fns(f...), table(t) {}
+
+            template <size_t I>
+            static void call_one(tuple_type &t) 
+            { 
+                std::get<I>(t)(); 
+            }
+
+            static void run(int64_t b, int64_t e, void *ctx) 
+            {
+                invoke_body *self = static_cast<invoke_body*>(ctx);
+                for (int64_t i = b; i < e; i++) 
+                {
+                    try 
+                    {
+                        self->table[i](self->fns);
+                    } 
+                    catch (...) 
+                    {
+                        self->err.capture();
+                    }
+                }
+            }
+        };
+
+        template <typename... F, size_t... I>
+        void invoke_all(::zpool_t *p, index_seq<I...>, F&... f) 
+        {
+            typedef invoke_body<F...> body_type;
+            static const typename body_type::call_fn table[] = { &body_type::template call_one<I>... };
+            body_type body(table, f...);
+            ::zparallel_for(p, 0, (int64_t)sizeof...(F), 1, &body_type::run, &body);
+            body.err.rethrow();
+        }
+    }
+
+    // Calls f(i) for every i in [begin, end) on the pool (zparallel_for).
+    // grain 0 picks the chunk size automatically. The first exception thrown
+    // by f stops the remaining chunks and is rethrown here.
+    // Usage: z_thread::parallel_for(p, 0, v.size(), [&](size_t i) { v[i] *= 2; });
+    template <typename Index, typename Function>
+    void parallel_for(pool &p, typename detail::identity<Index>::type begin, Index end, Function &&f,
+                      typename detail::identity<Index>::type grain = 0) 
+    {
+        typedef detail::for_body<Index, typename std::remove_reference<Function>::type> body_type;
+        body_type body;
+        body.f = &f;
+        ::zparallel_for(p.native_handle(), (int64_t)begin, (int64_t)end, (int64_t)grain, &body_type::run, &body);
+        body.err.rethrow();
+    }
+
+    // Folds map(i) over [begin, end) with 'reduce', which must be associative
+    // and commutative; 'identity' must be its neutral element.
+    // Usage: double s = z_thread::parallel_reduce(p, 0, n, 0.0,
+    //            [&](int i) { return x[i] * y[i]; }, [](double a, double b) { return a + b; });
+    template <typename Index, typename T, typename Map, typename Reduce>
+    T parallel_reduce(pool &p, typename detail::identity<Index>::type begin, Index end, T identity,
+                      Map &&map, Reduce &&reduce, typename detail::identity<Index>::type grain = 0) 
+    {
+        typedef cache_padded<T> slot;
+        typedef detail::reduce_body<Index, T, typename std::remove_reference<Map>::type,
+                                    typename std::remove_reference<Reduce>::type> body_type;
+        size_t n = (size_t)p.size() + 1, built = 0;
+        void *raw = ::operator new(n * sizeof(slot) + alignof(slot));
+        slot *slots = reinterpret_cast<slot*>(((uintptr_t)raw + alignof(slot) - 1) & ~(uintptr_t)(alignof(slot) - 1));
+        T result = identity;
+        try 
+        {
+            for (; built < n; built++) 
+            {
+                new (&slots[built]) slot(identity);
+            }
+            body_type body;
+            body.pool = p.native_handle();
+            body.map = &map;
+            body.reduce = &reduce;
+            body.slots = slots;
+            ::zparallel_for(body.pool, (int64_t)begin, (int64_t)end, (int64_t)grain, &body_type::run, &body);
+            body.err.rethrow();
+            for (size_t i = 0; i < n; i++) 
+            {
+                result = reduce(std::move(result), std::move(slots[i].value));
+            }
+        } 
+        catch (...) 
+        {
+            while (built > 0) 
+            {
+                slots[--built].~slot();
+            }
+            ::operator delete(raw);
+            throw;
+        }
+        while (built > 0) 
+        {
+            slots[--built].~slot();
+        }
+        ::operator delete(raw);
+        return result;
+    }
+
+    // Runs every callable on the pool and returns when all have finished.
+    // Usage: z_thread::parallel_invoke(p, [&] { sort(a); }, [&] { sort(b); });
+    template <typename... Functions>
+    void parallel_invoke(pool &p, Functions&&... fns) 
+    {
+        detail::invoke_all(p.native_handle(), typename detail::make_index_seq<sizeof...(Functions)>::type(), fns...);
+    }
+
+    // Reusable DAG of callables (ztask_graph_t). The callables are owned by
+    // the graph and run once per run(); the first exception one throws makes
+    // the rest of that run skip their bodies and is rethrown from run().
+    // Usage: z_thread::task_graph g; int a = g.add(load), b = g.add(parse);
+    //        g.precede(a, b); g.run(pool);
+    class task_graph 
+    {
+        struct holder_base 
+        {
+            holder_base *next;
+            void (*destroy)(holder_base *self);
+        };
+
+        template <typename F>
+        struct holder : holder_base 
+        {
+            F f;
+            detail::parallel_error *err;
+
+            template <typename G>
+            holder(G &&g, detail::parallel_error *e) : f(std::forward<G>(g)), err(e) 
+            {
+                destroy = &destroy_self;
+            }
+
+            static void destroy_self(holder_base *self) 
+            { 
+                delete static_cast<holder*>(self); 
+            }
+
+            static void call(void *arg) 
+            {
+                holder *self = static_cast<holder*>(arg);
+                if (self->err->skip()) 
+                {
+                    return;
+                }
+                try 
+                {
+                    self->f();
+                } 
+                catch (...) 
+                {
+                    self->err->capture();
+                }
+            }
+        };
+
+        ::ztask_graph_t *inner;
+        holder_base *owned;
+        detail::parallel_error err;
+
+     public:
+        task_graph() : inner(::ztask_graph_create()), owned(nullptr) 
+        {
+            if (!inner) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~task_graph() 
+        {
+            ::ztask_graph_destroy(inner);
+            while (owned) 
+            {
+                holder_base *h = owned;
+                owned = h->next;
+                h->destroy(h);
+            }
+        }
+
+        // Non-copyable.
+        task_graph(const task_graph&) = delete;
+        task_graph &operator=(const task_graph&) = delete;
+
+        // Adds a task calling f() and returns its id.
+        template <typename Function>
+        int add(Function &&f) 
+        {
+            typedef holder<typename std::decay<Function>::type> holder_type;
+            holder_type *h = new holder_type(std::forward<Function>(f), &err);
+            int id = ::ztask_graph__add_ptr(inner, &holder_type::call, h);
+            if (id < 0) 
+            {
+                delete h;
+                throw std::bad_alloc();
+            }
+            h->next = owned;
+            owned = h;
+            return id;
+        }
+
+        // 'after' runs once 'before' has finished.
+        void precede(int before, int after) 
+        {
+            int rc = ::ztask_graph_add_edge(inner, before, after);
+            if (rc == Z_EINVAL) 
+            {
+                throw std::invalid_argument("z_thread::task_graph: bad task id");
+            }
+            if (rc != Z_OK) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        // Runs the whole graph on 'p' and waits. Throws std::logic_error on a cycle.
+        void run(pool &p) 
+        {
+            err.failed.store(false, std::memory_order_relaxed);
+            err.error = nullptr;
+            if (::ztask_graph_run(inner, p.native_handle()) != Z_OK) 
+            {
+                throw std::logic_error("z_thread::task_graph: dependency cycle");
+            }
+            err.rethrow();
+        }
+
+        int size() const 
+        { 
+            return ::ztask_graph_size(inner); 
+        }
+
+        ::ztask_graph_t *native_handle() 
+        { 
+            return inner; 
+        }
+    };
+
+    // Bounded MPMC queue of T (same Vyukov ring as zqueue_t, but typed).
+    // Elements are constructed in place inside their slot and moved out.
+    template <typename T>
+    class bounded_queue 
+    {
+        struct alignas(ZTHREAD_CACHE_LINE) slot 
+        {
+            std::atomic<size_t> seq;
+            alignas(T) unsigned char storage[sizeof(T)];
+
+            T *value() 
+            { 
+                return reinterpret_cast<T*>(&storage); 
+            }
+        };
+
+        static const int spin_count = 64;
+
+        alignas(ZTHREAD_CACHE_LINE) std::atomic<size_t> enqueue_pos;
+        alignas(ZTHREAD_CACHE_LINE) std::atomic<size_t> dequeue_pos;
+        alignas(ZTHREAD_CACHE_LINE) std::atomic<int> push_waiters;
+        std::atomic<int> pop_waiters;
+        slot *slots;
+        size_t mask;
+        void *raw;
+        mutex lock;
+        cond not_full;
+        cond not_empty;
+
+        template <typename... Args>
+        bool push_raw(Args&&... args) 
+        {
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            slot *s;
+            for (;;) 
+            {
+                s = &slots[pos & mask];
+                intptr_t diff = (intptr_t)s->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+                if (0 == diff) 
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) 
+                    {
+                        break;
+                    }
+                } 
+                else if (diff < 0) 
+                {
+                    return false;
+                } 
+                else 
+                {
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            new (&s->storage) T(std::forward<Args>(args)...);
+            s->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop_raw(T &out) 
+        {
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            slot *s;
+            for (;;) 
+            {
+                s = &slots[pos & mask];
+                intptr_t diff = (intptr_t)s->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+                if (0 == diff) 
+                {
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) 
+                    {
+                        break;
+                    }
+                } 
+                else if (diff < 0) 
+                {
+                    return false;
+                } 
+                else 
+                {
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            out = std::move(*s->value());
+            s->value()->~T();
+            s->seq.store(pos + mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Skips the lock entirely when nobody is parked.
+        void notify(std::atomic<int> &waiters, cond &c) 
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters.load(std::memory_order_relaxed) > 0) 
+            {
+                lock_guard g(lock);
+                c.signal();
+            }
+        }
+
+     public:
+        // Capacity is rounded up to a power of two (at least 2).
+        explicit bounded_queue(size_t capacity) 
+            : enqueue_pos(0), dequeue_pos(0), push_waiters(0), pop_waiters(0) 
+        {
+            size_t cap = 2;
+            if (capacity > ((size_t)-1 - alignof(slot)) / sizeof(slot)) 
+            {
+                throw std::bad_alloc();
+            }
+            while (cap < capacity) 
+            {
+                cap <<= 1;
+            }
+            if (cap > ((size_t)-1 - alignof(slot)) / sizeof(slot)) 
+            {
+                throw std::bad_alloc();
+            }
+            raw = ::operator new(cap * sizeof(slot) + alignof(slot));
+            slots = reinterpret_cast<slot*>(((uintptr_t)raw + alignof(slot) - 1) & ~(uintptr_t)(alignof(slot) - 1));
+            mask = cap - 1;
+            for (size_t i = 0; i < cap; i++) 
+            {
+                new (&slots[i]) slot();
+                slots[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        ~bounded_queue() 
+        {
+            // No concurrent users left: destroy whatever is still queued.
+            size_t end = enqueue_pos.load(std::memory_order_relaxed);
+            for (size_t pos = dequeue_pos.load(std::memory_order_relaxed); pos != end; pos++) 
+            {
+                slots[pos & mask].value()->~T();
+            }
+            for (size_t i = 0; i <= mask; i++) 
+            {
+                slots[i].~slot();
+            }
+            ::operator delete(raw);
+        }
+
+        // Non-copyable.
+        bounded_queue(const bounded_queue&) = delete;
+        bounded_queue &operator=(const bounded_queue&) = delete;
+
+        // Non-blocking. Return false when full / empty.
+        template <typename... Args>
+        bool try_emplace(Args&&... args) 
+        {
+            if (!push_raw(std::forward<Args>(args)...)) 
+            {
+                return false;
+            }
+            notify(pop_waiters, not_empty);
+            return true;
+        }
+
+        bool try_push(T &&value) 
+        { 
+            return try_emplace(std::move(value)); 
+        }
+
+        bool try_push(const T &value) 
+        { 
+            return try_emplace(value); 
+        }
+
+        bool try_pop(T &out) 
+        {
+            if (!pop_raw(out)) 
+            {
+                return false;
+            }
+            notify(push_waiters, not_full);
+            return true;
+        }
+
+        // Blocking: wait for space. 'args' are only consumed once a slot is claimed.
+        template <typename... Args>
+        void emplace(Args&&... args) 
+        {
+            for (int i = 0; i < spin_count; i++) 
+            {
+                if (push_raw(std::forward<Args>(args)...)) 
+                {
+                    notify(pop_waiters, not_empty);
+                    return;
+                }
+            }
+            {
+                lock_guard g(lock);
+                push_waiters.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                while (!push_raw(std::forward<Args>(args)...)) 
+                {
+                    not_full.wait(lock);
+                }
+                push_waiters.fetch_sub(1);
+            }
+            notify(pop_waiters, not_empty);
+        }
+
+        void push(T &&value) 
+        { 
+            emplace(std::move(value)); 
+        }
+
+        void push(const T &value) 
+        { 
+            emplace(value); 
+        }
+
+        // Blocking: wait for an item.
+        void pop(T &out) 
+        {
+            for (int i = 0; i < spin_count; i++) 
+            {
+                if (pop_raw(out)) 
+                {
+                    notify(push_waiters, not_full);
+                    return;
+                }
+            }
+            {
+                lock_guard g(lock);
+                pop_waiters.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                while (!pop_raw(out)) 
+                {
+                    not_empty.wait(lock);
+                }
+                pop_waiters.fetch_sub(1);
+            }
+            notify(push_waiters, not_full);
+        }
+
+        T pop() 
+        {
+            T out;
+            pop(out);
+            return out;
+        }
+
+        size_t capacity() const 
+        { 
+            return mask + 1; 
+        }
+    };
+
+    // Bounded SPSC ring of T (zspsc_t with a compile-time capacity, so the
+    // index mask is a constant). One producer thread, one consumer thread.
+    // reserve() hands out raw slots: construct each one with placement new
+    // before commit(). peek() hands out live elements: release() destroys them.
+    template <typename T, size_t N>
+    class spsc_queue 
+    {
+        static_assert(N >= 2 && (N & (N - 1)) == 0, "spsc_queue capacity must be a power of two");
+        static const size_t mask = N - 1;
+
+        alignas(ZTHREAD_CACHE_LINE) std::atomic<size_t> tail;
+        size_t head_cache;
+        alignas(ZTHREAD_CACHE_LINE) std::atomic<size_t> head;
+        size_t tail_cache;
+        alignas(ZTHREAD_CACHE_LINE > alignof(T) ? ZTHREAD_CACHE_LINE : alignof(T)) unsigned char storage[N * sizeof(T)];
+
+        T *slot(size_t pos) 
+        { 
+            return reinterpret_cast<T*>(storage) + (pos & mask); 
+        }
+
+     public:
+        spsc_queue() : tail(0), head_cache(0), head(0), tail_cache(0) {}
+
+        ~spsc_queue() 
+        {
+            size_t end = tail.load(std::memory_order_relaxed);
+            for (size_t pos = head.load(std::memory_order_relaxed); pos != end; pos++) 
+            {
+                slot(pos)->~T();
+            }
+        }
+
+        // Non-copyable.
+        spsc_queue(const spsc_queue&) = delete;
+        spsc_queue &operator=(const spsc_queue&) = delete;
+
+        // Producer only. Up to 'want' contiguous free slots ('got' of them), or nullptr.
+        T *reserve(size_t want, size_t &got) 
+        {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t n = N - (t - head_cache);
+            if (n < want) 
+            {
+                head_cache = head.load(std::memory_order_acquire);
+                n = N - (t - head_cache);
+            }
+            n = (n < want) ? n : want;
+            n = (n < N - (t & mask)) ? n : N - (t & mask);
+            got = n;
+            return n ? slot(t) : nullptr;
+        }
+
+        void commit(size_t n) 
+        { 
+            tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release); 
+        }
+
+        // Consumer only. Up to 'want' contiguous elements ('got' of them), or nullptr.
+        T *peek(size_t want, size_t &got) 
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            size_t n = tail_cache - h;
+            if (n < want) 
+            {
+                tail_cache = tail.load(std::memory_order_acquire);
+                n = tail_cache - h;
+            }
+            n = (n < want) ? n : want;
+            n = (n < N - (h & mask)) ? n : N - (h & mask);
+            got = n;
+            return n ? slot(h) : nullptr;
+        }
+
+        void release(size_t n) 
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < n; i++) 
+            {
+                slot(h + i)->~T();
+            }
+            head.store(h + n, std::memory_order_release);
+        }
+
+        // Non-blocking. Return false when full / empty.
+        template <typename... Args>
+        bool try_emplace(Args&&... args) 
+        {
+            size_t got;
+            T *s = reserve(1, got);
+            if (!s) 
+            {
+                return false;
+            }
+            new (s) T(std::forward<Args>(args)...);
+            commit(1);
+            return true;
+        }
+
+        bool try_push(T &&value) 
+        { 
+            return try_emplace(std::move(value)); 
+        }
+
+        bool try_push(const T &value) 
+        { 
+            return try_emplace(value); 
+        }
+
+        bool try_pop(T &out) 
+        {
+            size_t got;
+            T *s = peek(1, got);
+            if (!s) 
+            {
+                return false;
+            }
+            out = std::move(*s);
+            release(1);
+            return true;
+        }
+
+        // Exact only from the producer or the consumer while the other is idle.
+        size_t size() const 
+        { 
+            size_t h = head.load(std::memory_order_acquire);
+            return tail.load(std::memory_order_acquire) - h; 
+        }
+
+        bool empty() const 
+        { 
+            return 0 == size(); 
+        }
+
+        static constexpr size_t capacity() 
+        { 
+            return N; 
+        }
+    };
+
+    // Intrusive MPSC mailbox (zmpsc_t). T derives from zmpsc_node_t, so a
+    // push never allocates; the queue never owns or deletes its nodes.
+    // Usage: struct msg : zmpsc_node_t { int op; }; box.push(m); box.consume_all([](msg *m) { ... });
+    template <typename T>
+    class mpsc_queue 
+    {
+        ::zmpsc_t *inner;
+
+        static T *entry(::zmpsc_node_t *n) 
+        { 
+            return static_cast<T*>(n); 
+        }
+
+     public:
+        mpsc_queue() : inner(::zmpsc_create()) 
+        {
+            if (!inner) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~mpsc_queue() 
+        { 
+            ::zmpsc_destroy(inner); 
+        }
+
+        // Non-copyable.
+        mpsc_queue(const mpsc_queue&) = delete;
+        mpsc_queue &operator=(const mpsc_queue&) = delete;
+
+        // Any thread.
+        void push(T *item) 
+        { 
+            ::zmpsc_push(inner, item); 
+        }
+
+        // Consumer only. nullptr when empty.
+        T *try_pop() 
+        { 
+            return entry(::zmpsc_try_pop(inner)); 
+        }
+
+        // Consumer only. Blocks until an item arrives.
+        T *pop() 
+        { 
+            return entry(::zmpsc_pop(inner)); 
+        }
+
+        // Consumer only. Every queued item as a FIFO chain (walk with next()),
+        // or nullptr; pop_all blocks until there is one.
+        T *try_pop_all() 
+        { 
+            return entry(::zmpsc_try_pop_all(inner)); 
+        }
+
+        T *pop_all() 
+        { 
+            return entry(::zmpsc_pop_all(inner)); 
+        }
+
+        static T *next(T *item) 
+        { 
+            return entry(item->next); 
+        }
+
+        // Consumer only. Detaches everything with one exchange and calls
+        // f(T*) on each item in order; 'f' may delete or re-queue it.
+        // Returns the number of items.
+        template <typename F>
+        size_t consume_all(F &&f) 
+        {
+            size_t n = 0;
+            T *item = try_pop_all();
+            while (item) 
+            {
+                T *following = next(item);
+                f(item);
+                item = following;
+                n++;
+            }
+            return n;
+        }
+
+        bool empty() const 
+        { 
+            return ::zmpsc_empty(inner) != 0; 
+        }
+
+        ::zmpsc_t *native_handle() 
+        { 
+            return inner; 
+        }
+    };
+
+    // Read-side EBR critical section (zebr_enter / zebr_exit) for a scope.
+    class ebr_guard 
+    {
+        template <typename T>
+        static void destroy(void *p) 
+        { 
+            delete static_cast<T*>(p); 
+        }
+
+     public:
+        ebr_guard() 
+        { 
+            ::zebr_enter(); 
+        }
+
+        ~ebr_guard() 
+        { 
+            ::zebr_exit(); 
+        }
+
+        // Non-copyable.
+        ebr_guard(const ebr_guard&) = delete;
+        ebr_guard &operator=(const ebr_guard&) = delete;
+
+        // Deletes 'p' once no critical section can see it (zebr_retire).
+        template <typename T>
+        static void retire(T *p) 
+        {
+            if (::zebr__retire_ptr(p, &ebr_guard::destroy<T>) != Z_OK) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        static void synchronize() 
+        { 
+            ::zebr_synchronize(); 
+        }
+    };
+
+    // One hazard pointer slot of the calling thread, cleared on scope exit.
+    // Usage: z_thread::hazard_ptr h(0); Node *n = h.protect(head); ... hazard_ptr::retire(old);
+    class hazard_ptr 
+    {
+        int slot;
+
+        template <typename T>
+        static void destroy(void *p) 
+        { 
+            delete static_cast<T*>(p); 
+        }
+
+     public:
+        // 'slot' is 0 to ZTHREAD_HAZARDS - 1, used by one hazard_ptr at a time.
+        explicit hazard_ptr(int s) : slot(s) {}
+
+        ~hazard_ptr() 
+        { 
+            ::zhazard_clear(slot); 
+        }
+
+        // Non-copyable.
+        hazard_ptr(const hazard_ptr&) = delete;
+        hazard_ptr &operator=(const hazard_ptr&) = delete;
+
+        // Loads 'src' and protects the result (zhazard_protect).
+        template <typename T>
+        T *protect(const std::atomic<T*> &src) 
+        {
+            T *p = src.load(std::memory_order_acquire);
+            for (;;) 
+            {
+                ::zhazard_set(slot, p);
+                T *again = src.load(std::memory_order_acquire);
+                if (again == p) 
+                {
+                    return p;
+                }
+                p = again;
+            }
+        }
+
+        template <typename T>
+        T *protect(T *const volatile &src) 
+        { 
+            return static_cast<T*>(::zhazard__protect_ptr(slot, (void *const volatile*)&src)); 
+        }
+
+        void reset() 
+        { 
+            ::zhazard_clear(slot); 
+        }
+
+        // Deletes 'p' once no hazard slot holds it (zhazard_retire).
+        template <typename T>
+        static void retire(T *p) 
+        {
+            if (::zhazard__retire_ptr(p, &hazard_ptr::destroy<T>) != Z_OK) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+    };
+
+    // RCU-style owning pointer (zrcu_ptr_t) for read-mostly data: readers
+    // get a const snapshot without locks, updaters publish a new version.
+    // Usage: z_thread::rcu_ptr<Routes> routes(new Routes);
+    //        { auto r = routes.read(); route(*r); }   routes.store(new Routes(next));
+    template <typename T>
+    class rcu_ptr 
+    {
+        ::zrcu_ptr_t inner;
+
+        static void destroy(void *p) 
+        { 
+            delete static_cast<T*>(p); 
+        }
+
+     public:
+        // Read-side section holding one snapshot. Keep it short: it delays
+        // every reclamation of the EBR domain.
+        class reader 
+        {
+            const T *p;
+            bool active;
+
+         public:
+            explicit reader(const rcu_ptr &r) : active(true) 
+            { 
+                ::zebr_enter();
+                p = static_cast<const T*>(::zrcu_load(&r.inner)); 
+            }
+
+            reader(reader &&o) noexcept : p(o.p), active(o.active) 
+            { 
+                o.active = false; 
+            }
+
+            ~reader() 
+            { 
+                if (active) 
+                {
+                    ::zebr_exit();
+                }
+            }
+
+            reader(const reader&) = delete;
+            reader &operator=(const reader&) = delete;
+            reader &operator=(reader&&) = delete;
+
+            const T *get() const 
+            { 
+                return p; 
+            }
+
+            const T &operator*() const 
+            { 
+                return *p; 
+            }
+
+            const T *operator->() const 
+            { 
+                return p; 
+            }
+
+            explicit operator bool() const 
+            { 
+                return p != nullptr; 
+            }
+        };
+
+        explicit rcu_ptr(T *initial = nullptr) 
+        { 
+            ::zrcu__init_ptr(&inner, initial, destroy); 
+        }
+
+        // No reader may remain.
+        ~rcu_ptr() 
+        { 
+            ::zrcu_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        rcu_ptr(const rcu_ptr&) = delete;
+        rcu_ptr &operator=(const rcu_ptr&) = delete;
+
+        reader read() const 
+        { 
+            return reader(*this); 
+        }
+
+        // Inside an ebr_guard (or zrcu_read_lock) section only.
+        const T *load() const 
+        { 
+            return static_cast<const T*>(::zrcu_load(&inner)); 
+        }
+
+        // Takes ownership of 'next'; the old version is deleted after a grace period.
+        void store(T *next) 
+        { 
+            ::zrcu_store(&inner, next); 
+        }
+
+        // Read-copy-update: applies f to a copy of the current version and
+        // publishes it, retrying if another update got in first. f runs in a
+        // read-side section, which also keeps the compared version alive.
+        template <typename F>
+        void update(F &&f) 
+        {
+            for (;;) 
+            {
+                T *cur;
+                {
+                    ebr_guard g;
+                    cur = const_cast<T*>(load());
+                    T *next = cur ? new T(*cur) : new T();
+                    try 
+                    {
+                        f(*next);
+                    } 
+                    catch (...) 
+                    {
+                        delete next;
+                        throw;
+                    }
+                    void *expected = cur;
+                    if (!::zatomic_cas_ptr(&inner.ptr, &expected, next, ZATOMIC_ACQ_REL)) 
+                    {
+                        delete next;
+                        continue;
+                    }
+                }
+                if (cur && ::zebr__retire_ptr(cur, destroy) != Z_OK) 
+                {
+                    ::zebr_synchronize();
+                    delete cur;
+                }
+                return;
+            }
+        }
+
+        ::zrcu_ptr_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    // Sharded concurrent hash map (the typed zcmap_t): per-shard shared_mutex
+    // and open-addressing table, cache-line-aligned shard headers. Values are
+    // copied out, so no reference outlives its shard lock.
+    // Usage: z_thread::concurrent_map<std::string, int> m; m.insert("a", 1); int v; m.find("a", v);
+    template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+    class concurrent_map 
+    {
+        typedef std::pair<K, V> value_type;
+
+        struct slot 
+        {
+            uint64_t tag;           // Mixed hash, 0 for an empty slot.
+            alignas(value_type) unsigned char storage[sizeof(value_type)];
+
+            value_type *value() 
+            { 
+                return reinterpret_cast<value_type*>(&storage); 
+            }
+        };
+
+        struct alignas(ZTHREAD_CACHE_LINE) shard 
+        {
+            mutable shared_mutex lock;
+            slot *slots;
+            size_t cap;
+            std::atomic<size_t> count;
+
+            shard() : slots(nullptr), cap(0), count(0) {}
+        };
+
+        shard *shards;
+        size_t mask;
+        void *raw;
+        Hash hasher;
+        KeyEqual equal;
+
+        // Same finalizer as zcmap_t: std::hash is often the identity.
+        uint64_t tag_of(const K &key) const 
+        {
+            uint64_t h = (uint64_t)hasher(key);
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h ? h : 1;
+        }
+
+        shard &shard_of(uint64_t tag) const 
+        { 
+            return shards[(size_t)(tag >> 40) & mask]; 
+        }
+
+        slot *lookup(const shard &s, uint64_t tag, const K &key) const 
+        {
+            if (!s.slots) 
+            {
+                return nullptr;
+            }
+            size_t m = s.cap - 1;
+            for (size_t i = (size_t)tag & m;; i = (i + 1) & m) 
+            {
+                slot *e = &s.slots[i];
+                if (0 == e->tag) 
+                {
+                    return nullptr;
+                }
+                if (e->tag == tag && equal(e->value()->first, key)) 
+                {
+                    return e;
+                }
+            }
+        }
+
+        static slot *free_slot(slot *slots, size_t cap, uint64_t tag) 
+        {
+            size_t i = (size_t)tag & (cap - 1);
+            while (slots[i].tag) 
+            {
+                i = (i + 1) & (cap - 1);
+            }
+            return &slots[i];
+        }
+
+        static void grow(shard &s) 
+        {
+            size_t cap = s.cap ? s.cap * 2 : 8;
+            slot *slots = static_cast<slot*>(::operator new(cap * sizeof(slot)));
+            for (size_t i = 0; i < cap; i++) 
+            {
+                slots[i].tag = 0;
+            }
+            for (size_t i = 0; i < s.cap; i++) 
+            {
+                slot &e = s.slots[i];
+                if (e.tag) 
+                {
+                    slot *d = free_slot(slots, cap, e.tag);
+                    new (&d->storage) value_type(std::move(*e.value()));
+                    d->tag = e.tag;
+                    e.value()->~value_type();
+                }
+            }
+            ::operator delete(s.slots);
+            s.slots = slots;
+            s.cap = cap;
+        }
+
+        // Under the shard's write lock. Returns the slot of 'key', constructing
+        // it from (key, args...) if absent; 'inserted' tells which.
+        template <typename... Args>
+        slot *acquire(shard &s, uint64_t tag, const K &key, bool &inserted, Args&&... args) 
+        {
+            slot *e = lookup(s, tag, key);
+            inserted = false;
+            if (e) 
+            {
+                return e;
+            }
+            size_t n = s.count.load(std::memory_order_relaxed);
+            if ((n + 1) * 4 > s.cap * 3) 
+            {
+                grow(s);
+            }
+            e = free_slot(s.slots, s.cap, tag);
+            new (&e->storage) value_type(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+            e->tag = tag;
+            s.count.store(n + 1, std::memory_order_relaxed);
+            inserted = true;
+            return e;
+        }
+
+        // Backward-shift deletion (see zcmap_erase).
+        static void remove(shard &s, slot *e) 
+        {
+            size_t m = s.cap - 1, i = (size_t)(e - s.slots), j = i;
+            s.slots[i].value()->~value_type();
+            for (;;) 
+            {
+                j = (j + 1) & m;
+                if (0 == s.slots[j].tag) 
+                {
+                    break;
+                }
+                size_t home = (size_t)s.slots[j].tag & m;
+                if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) 
+                {
+                    new (&s.slots[i].storage) value_type(std::move(*s.slots[j].value()));
+                    s.slots[i].tag = s.slots[j].tag;
+                    s.slots[j].value()->~value_type();
+                    i = j;
+                }
+            }
+            s.slots[i].tag = 0;
+            s.count.store(s.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+
+        // Keys grouped by shard (counting sort), as zcmap_t's batch calls do.
+        struct batch 
+        {
+            uint64_t *tags;
+            size_t *order;
+            size_t *start;
+
+            template <typename KeyOf>
+            batch(const concurrent_map &map, size_t n, KeyOf key_of) 
+                : tags(new uint64_t[n]), order(nullptr), start(nullptr) 
+            {
+                size_t shards = map.mask + 1;
+                try 
+                {
+                    order = new size_t[n];
+                    start = new size_t[shards + 1]();
+                } 
+                catch (...) 
+                {
+                    delete[] order;
+                    delete[] tags;
+                    throw;
+                }
+                for (size_t i = 0; i < n; i++) 
+                {
+                    tags[i] = map.tag_of(key_of(i));
+                    start[((size_t)(tags[i] >> 40) & map.mask) + 1]++;
+                }
+                for (size_t i = 0; i < shards; i++) 
+                {
+                    start[i + 1] += start[i];
+                }
+                for (size_t i = 0; i < n; i++) 
+                {
+                    order[start[(size_t)(tags[i] >> 40) & map.mask]++] = i;
+                }
+                for (size_t i = shards; i > 0; i--) 
+                {
+                    start[i] = start[i - 1];
+                }
+                start[0] = 0;
+            }
+
+            ~batch() 
+            {
+                delete[] start;
+                delete[] order;
+                delete[] tags;
+            }
+
+            batch(const batch&) = delete;
+            batch &operator=(const batch&) = delete;
+        };
+
+     public:
+        // 'num_shards' is rounded up to a power of two (0 = 4 per logical CPU).
+        explicit concurrent_map(size_t num_shards = 0, const Hash &h = Hash(), const KeyEqual &eq = KeyEqual()) 
+            : hasher(h), equal(eq) 
+        {
+            size_t n = 1;
+            if (0 == num_shards) 
+            {
+                num_shards = (size_t)::zthread_cpu_count() * 4;
+            }
+            if (num_shards > ((size_t)-1 - alignof(shard)) / sizeof(shard)) 
+            {
+                throw std::bad_alloc();
+            }
+            while (n < num_shards) 
+            {
+                n <<= 1;
+            }
+            if (n > ((size_t)-1 - alignof(shard)) / sizeof(shard)) 
+            {
+                throw std::bad_alloc();
+            }
+            raw = ::operator new(n * sizeof(shard) + alignof(shard));
+            shards = reinterpret_cast<shard*>(((uintptr_t)raw + alignof(shard) - 1) & ~(uintptr_t)(alignof(shard) - 1));
+            for (size_t i = 0; i < n; i++) 
+            {
+                new (&shards[i]) shard();
+            }
+            mask = n - 1;
+        }
+
+        // No concurrent users left.
+        ~concurrent_map() 
+        {
+            for (size_t i = 0; i <= mask; i++) 
+            {
+                shard &s = shards[i];
+                for (size_t j = 0; j < s.cap; j++) 
+                {
+                    if (s.slots[j].tag) 
+                    {
+                        s.slots[j].value()->~value_type();
+                    }
+                }
+                ::operator delete(s.slots);
+                s.~shard();
+            }
+            ::operator delete(raw);
+        }
+
+        // Non-copyable.
+        concurrent_map(const concurrent_map&) = delete;
+        concurrent_map &operator=(const concurrent_map&) = delete;
+
+        // Inserts (key, V(args...)) if 'key' is absent. Returns true if it did.
+        template <typename... Args>
+        bool emplace(const K &key, Args&&... args) 
+        {
+            uint64_t tag = tag_of(key);
+            shard &s = shard_of(tag);
+            bool inserted;
+            lock_guard g(s.lock);
+            acquire(s, tag, key, inserted, std::forward<Args>(args)...);
+            return inserted;
+        }
+
+        bool insert(const K &key, const V &value) 
+        { 
+            return emplace(key, value); 
+        }
+
+        // Inserts or overwrites. Returns true if 'key' was new.
+        template <typename M>
+        bool insert_or_assign(const K &key, M &&value) 
+        {
+            uint64_t tag = tag_of(key);
+            shard &s = shard_of(tag);
+            bool inserted;
+            lock_guard g(s.lock);
+            slot *e = acquire(s, tag, key, inserted, std::forward<M>(value));
+            if (!inserted) 
+            {
+                e->value()->second = std::forward<M>(value);
+            }
+            return inserted;
+        }
+
+        // Copies the value of 'key' into 'out'. Returns false if absent.
+        bool find(const K &key, V &out) const 
+        {
+            uint64_t tag = tag_of(key);
+            shard &s = shard_of(tag);
+            shared_lock_guard g(s.lock);
+            slot *e = lookup(s, tag, key);
+            if (!e) 
+            {
+                return false;
+            }
+            out = e->value()->second;
+            return true;
+        }
+
+        bool contains(const K &key) const 
+        {
+            uint64_t tag = tag_of(key);
+            shard &s = shard_of(tag);
+            shared_lock_guard g(s.lock);
+            return lookup(s, tag, key) != nullptr;
+        }
+
+        // Calls f(const V&) under the shard's read lock. Returns false if absent.
+        template <typename F>
+        bool visit(const K &key, F &&f) const 
+        {
+            uint64_t tag = tag_of(key);
+            shard &s = shard_of(tag);
+            shared_lock_guard g(s.lock);
+            slot *e = lookup(s, tag, key);
+            if (e) 
+            {
+                f(static_cast<const V&>(e->value()->second));
+            }
+            return e != nullptr;
+        }
+
+        // Calls f(V&) under the shard's write lock. Returns false if absent.
+        template <typename F>
+        bool update(const K &key, F &&f) 
+        {
+            uint64_t tag = tag_of(key);
+            shard &s = shard_of(tag);
+            lock_guard g(s.lock);
+            slot *e = lookup(s, tag, key);
+            if (e) 
+            {
+                f(e->value()->second);
+            }
+            return e != nullptr;
+        }
+
+        bool erase(const K &key) 
+        {
+            uint64_t tag = tag_of(key);
+            shard &s = shard_of(tag);
+            lock_guard g(s.lock);
+            slot *e = lookup(s, tag, key);
+            if (e) 
+            {
+                remove(s, e);
+            }
+            return e != nullptr;
+        }
+
+        // Inserts the absent keys of items[0..n), one write lock per shard
+        // touched. 'inserted' (if not null) gets the per-item result. Returns
+        // the number inserted.
+        size_t insert_many(const std::pair<K, V> *items, size_t n, bool *inserted = nullptr) 
+        {
+            if (0 == n) 
+            {
+                return 0;
+            }
+            batch b(*this, n, [items](size_t i) -> const K& { return items[i].first; });
+            size_t done = 0;
+            for (size_t sh = 0; sh <= mask; sh++) 
+            {
+                if (b.start[sh] == b.start[sh + 1]) 
+                {
+                    continue;
+                }
+                shard &s = shards[sh];
+                lock_guard g(s.lock);
+                for (size_t k = b.start[sh]; k < b.start[sh + 1]; k++) 
+                {
+                    size_t i = b.order[k];
+                    bool fresh;
+                    acquire(s, b.tags[i], items[i].first, fresh, items[i].second);
+                    done += fresh;
+                    if (inserted) 
+                    {
+                        inserted[i] = fresh;
+                    }
+                }
+            }
+            return done;
+        }
+
+        // Copies out the values of keys[0..n), one read lock per shard
+        // touched. 'found' (if not null) gets the per-key result; missing
+        // keys leave out[i] untouched. Returns the number found.
+        size_t find_many(const K *keys, size_t n, V *out, bool *found = nullptr) const 
+        {
+            if (0 == n) 
+            {
+                return 0;
+            }
+            batch b(*this, n, [keys](size_t i) -> const K& { return keys[i]; });
+            size_t hits = 0;
+            for (size_t sh = 0; sh <= mask; sh++) 
+            {
+                if (b.start[sh] == b.start[sh + 1]) 
+                {
+                    continue;
+                }
+                shard &s = shards[sh];
+                shared_lock_guard g(s.lock);
+                for (size_t k = b.start[sh]; k < b.start[sh + 1]; k++) 
+                {
+                    size_t i = b.order[k];
+                    slot *e = lookup(s, b.tags[i], keys[i]);
+                    if (e) 
+                    {
+                        out[i] = e->value()->second;
+                        hits++;
+                    }
+                    if (found) 
+                    {
+                        found[i] = (e != nullptr);
+                    }
+                }
+            }
+            return hits;
+        }
+
+        // Exact only while no thread modifies the map.
+        size_t size() const 
+        {
+            size_t n = 0;
+            for (size_t i = 0; i <= mask; i++) 
+            {
+                n += shards[i].count.load(std::memory_order_relaxed);
+            }
+            return n;
+        }
+
+        size_t shard_count() const 
+        { 
+            return mask + 1; 
+        }
+    };
+
+    // M:N fiber scheduler (zfiber_sched_t). The destructor waits for every
+    // fiber to finish. Usage: z_thread::fiber_scheduler s(4); s.spawn([&]{ serve(conn); });
+    class fiber_scheduler 
+    {
+        ::zfiber_sched_t *inner;
+
+     public:
+        // 'num_threads' 0 = one worker per logical CPU, 'stack_size' 0 = ZTHREAD_FIBER_STACK.
+        explicit fiber_scheduler(int num_threads = 0, size_t stack_size = 0) 
+            : inner(::zfiber_sched_create(num_threads, stack_size)) 
+        {
+            if (!inner) 
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~fiber_scheduler() 
+        { 
+            ::zfiber_sched_shutdown(inner); 
+        }
+
+        // Non-copyable.
+        fiber_scheduler(const fiber_scheduler&) = delete;
+        fiber_scheduler &operator=(const fiber_scheduler&) = delete;
+
+        // Runs f(args...) in a new fiber. Returns false if it could not be started.
+        template <typename Function, typename... Args>
+        bool spawn(Function &&f, Args&&... args) 
+        {
+            auto *p = detail::make_invoker(std::forward<Function>(f), std::forward<Args>(args)...);
+            if (::zfiber__spawn_ptr(inner, p->run, p) != Z_OK) 
+            {
+                detail::cache_delete(p);
+                return false;
+            }
+            return true;
+        }
+
+        // Lets other fibers run (yields the CPU on a plain thread).
+        static void yield() 
+        { 
+            ::zfiber_yield(); 
+        }
+
+        static bool in_fiber() 
+        { 
+            return ::zfiber_in_fiber() != 0; 
+        }
+
+        ::zfiber_sched_t *native_handle() 
+        { 
+            return inner; 
+        }
+    };
+
+    // Mutex that parks only the calling fiber (and blocks a plain thread).
+    // Works with lock_guard. Usage: z_thread::fiber_mutex m; z_thread::lock_guard g(m);
+    class fiber_mutex 
+    {
+        ::zfmutex_t inner;
+        friend class fiber_cond;
+
+     public:
+        fiber_mutex() 
+        { 
+            ::zfmutex_init(&inner); 
+        }
+
+        ~fiber_mutex() 
+        { 
+            ::zfmutex_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        fiber_mutex(const fiber_mutex&) = delete;
+        fiber_mutex &operator=(const fiber_mutex&) = delete;
+
+        void lock() 
+        { 
+            ::zfmutex_lock(&inner); 
+        }
+
+        void unlock() 
+        { 
+            ::zfmutex_unlock(&inner); 
+        }
+
+        bool try_lock() 
+        { 
+            return ::zfmutex_trylock(&inner) == Z_OK; 
+        }
+
+        ::zfmutex_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+    class fiber_cond 
+    {
+        ::zfcond_t inner;
+
+     public:
+        fiber_cond() 
+        { 
+            ::zfcond_init(&inner); 
+        }
+
+        ~fiber_cond() 
+        { 
+            ::zfcond_destroy(&inner); 
+        }
+
+        // Non-copyable.
+        fiber_cond(const fiber_cond&) = delete;
+        fiber_cond &operator=(const fiber_cond&) = delete;
+
+        void wait(fiber_mutex &m) 
+        { 
+            ::zfcond_wait(&inner, &m.inner); 
+        }
+
+        void signal() 
+        { 
+            ::zfcond_signal(&inner); 
+        }
+
+        void broadcast() 
+        { 
+            ::zfcond_broadcast(&inner); 
+        }
+
+        ::zfcond_t *native_handle() 
+        { 
+            return &inner; 
+        }
+    };
+
+#ifdef ZTHREAD__COROUTINES
+    // Minimal eager coroutine type for code that only awaits.
+    // Usage: z_thread::fire_and_forget serve(pool &p) { co_await p.schedule(); ... }
+    struct fire_and_forget 
+    {
+        struct promise_type 
+        {
+            fire_and_forget get_return_object() noexcept 
+            { 
+                return fire_and_forget(); 
+            }
+
+            std::suspend_never initial_suspend() noexcept 
+            { 
+                return {}; 
+            }
+
+            std::suspend_never final_suspend() noexcept 
+            { 
+                return {}; 
+            }
+
+            void return_void() noexcept {}
+
+            void unhandled_exception() noexcept 
+            { 
+                std::terminate(); 
+            }
+        };
+    };
+
+    class async_mutex;
+
+    // Releases an async_mutex on scope exit (from co_await m.scoped_lock_async()).
+    class async_lock_guard 
+    {
+        async_mutex *m;
+
+     public:
+        explicit async_lock_guard(async_mutex &mu) noexcept : m(&mu) {}
+
+        async_lock_guard(async_lock_guard &&other) noexcept : m(other.m) 
+        { 
+            other.m = nullptr; 
+        }
+
+        inline ~async_lock_guard();
+
+        async_lock_guard(const async_lock_guard&) = delete;
+        async_lock_guard &operator=(const async_lock_guard&) = delete;
+    };
+
+    // Mutex for coroutines: a contended co_await m.lock_async() suspends the
+    // coroutine instead of the thread. The state word is "unlocked" (the
+    // mutex's own address), "locked" (NULL) or the newest waiter of a LIFO
+    // stack of awaiters; the holder reverses that stack into FIFO order on
+    // unlock and hands the lock straight to the oldest waiter. Waiters live
+    // in their coroutine frames, so awaiting never allocates. They resume on
+    // 'resume_pool' when one is given, otherwise inline in unlock().
+    class async_mutex 
+    {
+     public:
+        class lock_awaiter 
+        {
+            friend class async_mutex;
+
+         protected:
+            async_mutex &m;
+
+         private:
+            lock_awaiter *next;
+            std::coroutine_handle<> handle;
+            ::zpool__task node;
+
+         public:
+            explicit lock_awaiter(async_mutex &mu) noexcept : m(mu), next(nullptr) {}
+
+            bool await_ready() noexcept 
+            { 
+                return m.try_lock(); 
+            }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept 
+            {
+                handle = h;
+                void *old = m.state.load(std::memory_order_acquire);
+                for (;;) 
+                {
+                    if (old == m.unlocked()) 
+                    {
+                        if (m.state.compare_exchange_weak(old, nullptr, std::memory_order_acquire, std::memory_order_acquire)) 
+                        {
+                            return false;
+                        }
+                    } 
+                    else 
+                    {
+                        next = static_cast<lock_awaiter*>(old);
+                        if (m.state.compare_exchange_weak(old, this, std::memory_order_release, std::memory_order_acquire)) 
+                        {
+                            return true;
+                        }
+                    }
+                }
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        class scoped_lock_awaiter : public lock_awaiter 
+        {
+         public:
+            explicit scoped_lock_awaiter(async_mutex &mu) noexcept : lock_awaiter(mu) {}
+
+            async_lock_guard await_resume() noexcept 
+            { 
+                return async_lock_guard(m); 
+            }
+        };
+
+        explicit async_mutex(pool *resume_pool = nullptr) noexcept 
+            : state(unlocked()), waiters(nullptr), resume(resume_pool ? resume_pool->native_handle() : nullptr) {}
+
+        // Non-copyable.
+        async_mutex(const async_mutex&) = delete;
+        async_mutex &operator=(const async_mutex&) = delete;
+
+        // Usage: co_await m.lock_async(); ...; m.unlock();
+        lock_awaiter lock_async() noexcept 
+        { 
+            return lock_awaiter(*this); 
+        }
+
+        // Usage: auto g = co_await m.scoped_lock_async();
+        scoped_lock_awaiter scoped_lock_async() noexcept 
+        { 
+            return scoped_lock_awaiter(*this); 
+        }
+
+        bool try_lock() noexcept 
+        {
+            void *old = unlocked();
+            return state.compare_exchange_strong(old, nullptr, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        void unlock() noexcept 
+        {
+            lock_awaiter *w = waiters;
+            if (!w) 
+            {
+                void *old = nullptr;
+                if (state.compare_exchange_strong(old, unlocked(), std::memory_order_release, std::memory_order_relaxed)) 
+                {
+                    return;
+                }
+                // New arrivals: take the whole stack and reverse it.
+                lock_awaiter *lifo = static_cast<lock_awaiter*>(state.exchange(nullptr, std::memory_order_acquire));
+                while (lifo) 
+                {
+                    lock_awaiter *n = lifo->next;
+                    lifo->next = w;
+                    w = lifo;
+                    lifo = n;
+                }
+            }
+            waiters = w->next;
+            detail::resume_on(resume, w->node, w->handle);
+        }
+
+     private:
+        std::atomic<void*> state;
+        lock_awaiter *waiters;      // FIFO, owned by the holder.
+        ::zpool_t *resume;
+
+        void *unlocked() noexcept 
+        { 
+            return this; 
+        }
+    };
+
+    inline async_lock_guard::~async_lock_guard() 
+    {
+        if (m) 
+        {
+            m->unlock();
+        }
+    }
+
+    // Bounded FIFO for coroutines: co_await q.push(v) and co_await q.pop()
+    // suspend while full / empty. A value meets a waiting popper directly, and
+    // a popper that frees a slot pulls in the oldest waiting pusher's value.
+    // The lock only covers the list and ring updates; resumption happens
+    // after it is released, on 'resume_pool' when one is given.
+    template <typename T>
+    class async_queue 
+    {
+        struct cell 
+        {
+            alignas(T) unsigned char storage[sizeof(T)];
+
+            T *value() 
+            { 
+                return reinterpret_cast<T*>(&storage); 
+            }
+        };
+
+        struct waiter 
+        {
+            waiter *next;
+            std::coroutine_handle<> handle;
+            ::zpool__task node;
+            cell item;      // Popper: handed-in value. Pusher: value to hand out.
+            bool full;      // 'item' holds a live T.
+        };
+
+        mutex lock;
+        cell *ring;
+        size_t cap;
+        size_t head;
+        size_t count;
+        waiter *poppers;
+        waiter *poppers_tail;
+        waiter *pushers;
+        waiter *pushers_tail;
+        ::zpool_t *resume;
+
+        static void enqueue(waiter *&head_w, waiter *&tail_w, waiter *w) 
+        {
+            w->next = nullptr;
+            if (tail_w) 
+            {
+                tail_w->next = w;
+            } 
+            else 
+            {
+                head_w = w;
+            }
+            tail_w = w;
+        }
+
+        static waiter *dequeue(waiter *&head_w, waiter *&tail_w) 
+        {
+            waiter *w = head_w;
+            if (w) 
+            {
+                head_w = w->next;
+                if (!head_w) 
+                {
+                    tail_w = nullptr;
+                }
+            }
+            return w;
+        }
+
+        // Under 'lock'. Returns the popper to resume, or nullptr after storing 'v' in the ring.
+        template <typename U>
+        waiter *put(U &&v) 
+        {
+            waiter *w = dequeue(poppers, poppers_tail);
+            if (w) 
+            {
+                new (&w->item.storage) T(std::forward<U>(v));
+                w->full = true;
+                return w;
+            }
+            new (&ring[(head + count) % cap].storage) T(std::forward<U>(v));
+            count++;
+            return nullptr;
+        }
+
+        // Under 'lock', with count > 0. Returns the pusher to resume, if any.
+        waiter *take(T *out) 
+        {
+            cell &c = ring[head];
+            new (out) T(std::move(*c.value()));
+            c.value()->~T();
+            head = (head + 1) % cap;
+            count--;
+            waiter *w = dequeue(pushers, pushers_tail);
+            if (w) 
+            {
+                new (&ring[(head + count) % cap].storage) T(std::move(*w->item.value()));
+                w->item.value()->~T();
+                w->full = false;
+                count++;
+            }
+            return w;
+        }
+
+        void wake(waiter *w) 
+        {
+            if (w) 
+            {
+                detail::resume_on(resume, w->node, w->handle);
+            }
+        }
+
+     public:
+        class push_awaiter 
+        {
+            async_queue &q;
+            waiter w;
+
+         public:
+            template <typename U>
+            push_awaiter(async_queue &queue, U &&v) : q(queue) 
+            { 
+                new (&w.item.storage) T(std::forward<U>(v)); 
+                w.full = true;
+            }
+
+            ~push_awaiter() 
+            {
+                if (w.full) 
+                {
+                    w.item.value()->~T();
+                }
+            }
+
+            push_awaiter(const push_awaiter&) = delete;
+            push_awaiter &operator=(const push_awaiter&) = delete;
+
+            bool await_ready() const noexcept 
+            { 
+                return false; 
+            }
+
+            bool await_suspend(std::coroutine_handle<> h) 
+            {
+                waiter *popper;
+                {
+                    lock_guard g(q.lock);
+                    if (q.count == q.cap && !q.poppers) 
+                    {
+                        // The popper that makes room moves the value out.
+                        w.handle = h;
+                        enqueue(q.pushers, q.pushers_tail, &w);
+                        return true;
+                    }
+                    popper = q.put(std::move(*w.item.value()));
+                }
+                w.item.value()->~T();
+                w.full = false;
+                q.wake(popper);
+                return false;
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        class pop_awaiter 
+        {
+            async_queue &q;
+            waiter w;
+
+         public:
+            explicit pop_awaiter(async_queue &queue) noexcept : q(queue) 
+            { 
+                w.full = false; 
+            }
+
+            ~pop_awaiter() 
+            {
+                if (w.full) 
+                {
+                    w.item.value()->~T();
+                }
+            }
+
+            pop_awaiter(const pop_awaiter&) = delete;
+            pop_awaiter &operator=(const pop_awaiter&) = delete;
+
+            bool await_ready() const noexcept 
+            { 
+                return false; 
+            }
+
+            bool await_suspend(std::coroutine_handle<> h) 
+            {
+                waiter *pusher;
+                {
+                    lock_guard g(q.lock);
+                    if (0 == q.count) 
+                    {
+                        w.handle = h;
+                        enqueue(q.poppers, q.poppers_tail, &w);
+                        return true;
+                    }
+                    pusher = q.take(w.item.value());
+                    w.full = true;
+                }
+                q.wake(pusher);
+                return false;
+            }
+
+            T await_resume() 
+            {
+                T v(std::move(*w.item.value()));
+                w.item.value()->~T();
+                w.full = false;
+                return v;
+            }
+        };
+
+        // 'capacity' of at least 1. 'resume_pool' resumes woken coroutines on
+        // its workers instead of inline in the waking push or pop.
+        explicit async_queue(size_t capacity, pool *resume_pool = nullptr) 
+            : cap(capacity ? capacity : 1), head(0), count(0), poppers(nullptr), poppers_tail(nullptr), 
+              pushers(nullptr), pushers_tail(nullptr), resume(resume_pool ? resume_pool->native_handle() : nullptr) 
+        {
+            ring = static_cast<cell*>(::operator new(cap * sizeof(cell)));
+        }
+
+        // No waiters may be left.
+        ~async_queue() 
+        {
+            for (size_t i = 0; i < count; i++) 
+            {
+                ring[(head + i) % cap].value()->~T();
+            }
+            ::operator delete(ring);
+        }
+
+        // Non-copyable.
+        async_queue(const async_queue&) = delete;
+        async_queue &operator=(const async_queue&) = delete;
+
+        // Usage: co_await q.push(std::move(job));
+        template <typename U>
+        push_awaiter push(U &&v) 
+        { 
+            return push_awaiter(*this, std::forward<U>(v)); 
+        }
+
+        // Usage: Job job = co_await q.pop();
+        pop_awaiter pop() noexcept 
+        { 
+            return pop_awaiter(*this); 
+        }
+
+        // Non-blocking. Return false when full / empty.
+        template <typename U>
+        bool try_push(U &&v) 
+        {
+            waiter *popper;
+            {
+                lock_guard g(lock);
+                if (count == cap && !poppers) 
+                {
+                    return false;
+                }
+                popper = put(std::forward<U>(v));
+            }
+            wake(popper);
+            return true;
+        }
+
+        bool try_pop(T &out) 
+        {
+            waiter *pusher;
+            {
+                lock_guard g(lock);
+                if (0 == count) 
+                {
+                    return false;
+                }
+                cell tmp;
+                pusher = take(tmp.value());
+                out = std::move(*tmp.value());
+                tmp.value()->~T();
+            }
+            wake(pusher);
+            return true;
+        }
+
+        size_t capacity() const 
+        { 
+            return cap; 
+        }
+    };
+#endif // ZTHREAD__COROUTINES
+}
+
+#endif // __cplusplus
+
+#endif // ZTHREAD_H
+
+#ifdef ZTHREAD_IMPLEMENTATION
+#ifndef ZTHREAD_IMPLEMENTATION_GUARD
+#define ZTHREAD_IMPLEMENTATION_GUARD
+
+// Internal atomics: shorthands over the public zatomic_* layer.
+#define ZTHREAD__RLX ZATOMIC_RELAXED
+#define ZTHREAD__ACQ ZATOMIC_ACQUIRE
+#define ZTHREAD__REL ZATOMIC_RELEASE
+#define ZTHREAD__SEQ ZATOMIC_SEQ_CST
+#define ZTHREAD__ACQ_REL ZATOMIC_ACQ_REL
+#define zthread__ld(p, mo)        zatomic_load64((p), (mo))
+#define zthread__st(p, v, mo)     zatomic_store64((p), (v), (mo))
+#define zthread__fadd(p, v, mo)   zatomic_fetch_add64((p), (v), (mo))
+#define zthread__ld32(p, mo)      zatomic_load32((p), (mo))
+#define zthread__st32(p, v, mo)   zatomic_store32((p), (v), (mo))
+#define zthread__xchg32(p, v, mo) zatomic_exchange32((p), (v), (mo))
+#define zthread__fadd32(p, v, mo) zatomic_fetch_add32((p), (v), (mo))
+#define zthread__ldp(p, mo)       zatomic_load_ptr((p), (mo))
+#define zthread__stp(p, v, mo)    zatomic_store_ptr((p), (v), (mo))
+#define zthread__fence(mo)        zatomic_fence(mo)
+#define ZTHREAD__PAUSE()          zthread_cpu_relax()
+
+// Sequentially consistent CAS on a value (the expected value is not written back).
+static inline int zthread__cas(volatile int64_t *p, int64_t expected, int64_t desired) 
+{ 
+    return zatomic_cas64(p, &expected, desired, ZATOMIC_SEQ_CST); 
+}
+
+static inline int zthread__cas32(volatile int32_t *p, int32_t expected, int32_t desired) 
+{ 
+    return zatomic_cas32(p, &expected, desired, ZATOMIC_SEQ_CST); 
+}
+
+// One-time initialization. '*state' is 0 none, 1 initializing, 2 ready or 3
+// failed; the first caller runs init() and the others yield until it is done.
+// Returns 1 if init() returned Z_OK, 0 if it failed (it is not retried).
+static int zthread__once(volatile int32_t *state, int (*init)(void)) 
+{
+    int32_t st = zthread__ld32(state, ZTHREAD__ACQ);
+    if (st < 2 && zthread__cas32(state, 0, 1)) 
+    {
+        st = (init() == Z_OK) ? 2 : 3;
+        zthread__st32(state, st, ZTHREAD__REL);
+    }
+    while (st < 2) 
+    {
+        zthread_sleep(0);
+        st = zthread__ld32(state, ZTHREAD__ACQ);
+    }
+    return 2 == st;
+}
+
+// GCC's ipa-reference treats a function made only of atomics and leaf calls
+// (such as syscall) as unable to touch the caller's unescaped statics, and then
+// hoists their loads across our lock calls. noipa keeps those entry points opaque.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 8
+#   define ZTHREAD__NOIPA __attribute__((noipa))
+#else
+#   define ZTHREAD__NOIPA
+#endif
+
+// Descriptor cache. A block is a 16-byte header (owning cache, size class)
+// followed by the caller's bytes; the free-list link lives in those bytes.
+// Owners pop and push their own lists without atomics. Other threads push
+// onto the owner's 'remote' stack, which the owner takes whole with one
+// exchange when a list runs dry. An exiting owner swaps in a sentinel and
+// counts its outstanding blocks down; whoever returns the last one frees it.
+#if ZTHREAD_TASK_CACHE > 0
+
+#define ZTHREAD__CACHE_CLASSES 3
+
+static const size_t zthread__cache_sizes[ZTHREAD__CACHE_CLASSES] = { 64, 128, 256 };
+
+struct zthread__block 
+{
+    struct zthread__cache *owner;   // NULL: plain ZTHREAD_MALLOC block.
+    int32_t cls;
+};
+
+struct zthread__cache 
+{
+    void *volatile remote;          // Blocks freed elsewhere, or the orphan sentinel.
+    ZTHREAD_PAD(pad0, sizeof(void*));
+    void *local[ZTHREAD__CACHE_CLASSES];
+    int count[ZTHREAD__CACHE_CLASSES];
+    int64_t live;                   // Handed out and not back yet (owner only).
+    volatile int64_t orphan_live;   // Same, after the owner exited.
+};
+
+static char zthread__cache_orphan;
+static ZTHREAD_LOCAL struct zthread__cache *zthread__cache_tls = NULL;
+static ZTHREAD_LOCAL int zthread__cache_dead = 0;
+static ztls_key_t zthread__cache_key;
+static volatile int32_t zthread__cache_state = 0;   // zthread__once.
+
+#define ZTHREAD__NEXT(b) (*(void**)((char*)(b) + ZTHREAD__BLOCK_ALIGN))
+
+static void zthread__cache_exit(void *arg) 
+{
+    struct zthread__cache *c = (struct zthread__cache*)arg;
+    void *list;
+    int64_t n = 0;
+    int i;
+
+    zthread__cache_tls = NULL;
+    zthread__cache_dead = 1;
+    for (i = 0; i < ZTHREAD__CACHE_CLASSES; i++) 
+    {
+        while (c->local[i]) 
+        {
+            void *b = c->local[i];
+            c->local[i] = ZTHREAD__NEXT(b);
+            ZTHREAD_FREE(b);
+        }
+    }
+    // One extra reference for the owner itself: a remote free that sees the
+    // sentinel cannot take the count to zero while we still touch 'c'.
+    zthread__st(&c->orphan_live, c->live + 1, ZTHREAD__RLX);
+    list = zatomic_exchange_ptr(&c->remote, &zthread__cache_orphan, ZATOMIC_ACQ_REL);
+    while (list) 
+    {
+        void *b = list;
+        list = ZTHREAD__NEXT(b);
+        ZTHREAD_FREE(b);
+        n++;
+    }
+    if (zthread__fadd(&c->orphan_live, -(n + 1), ZTHREAD__ACQ_REL) == n + 1) 
+    {
+        ZTHREAD_FREE(c);
+    }
+}
+
+static int zthread__cache_init(void) 
+{
+    return ztls_key_create(&zthread__cache_key, zthread__cache_exit);
+}
+
+static struct zthread__cache *zthread__cache_get(void) 
+{
+    struct zthread__cache *c = zthread__cache_tls;
+    if (c || zthread__cache_dead) 
+    {
+        return c;
+    }
+    if (!zthread__once(&zthread__cache_state, zthread__cache_init)) 
+    {
+        return NULL;
+    }
+    c = (struct zthread__cache*)ZTHREAD_CALLOC(1, sizeof(*c));
+    if (c && ztls_set(zthread__cache_key, c) != Z_OK) 
+    {
+        ZTHREAD_FREE(c);
+        c = NULL;
+    }
+    zthread__cache_tls = c;
+    zthread__cache_dead = !c;   // Do not retry on every allocation.
+    return c;
+}
+
+// Owner only: moves every remotely freed block back to the local lists.
+static void zthread__cache_drain(struct zthread__cache *c) 
+{
+    void *list = zatomic_exchange_ptr(&c->remote, NULL, ZATOMIC_ACQUIRE);
+    while (list) 
+    {
+        struct zthread__block *b = (struct zthread__block*)list;
+        list = ZTHREAD__NEXT(b);
+        c->live--;
+        if (c->count[b->cls] < ZTHREAD_TASK_CACHE) 
+        {
+            ZTHREAD__NEXT(b) = c->local[b->cls];
+            c->local[b->cls] = b;
+            c->count[b->cls]++;
+        } 
+        else 
+        {
+            ZTHREAD_FREE(b);
+        }
+    }
+}
+
+void *zthread__cache_alloc(size_t sz) 
+{
+    struct zthread__cache *c;
+    struct zthread__block *b;
+    int cls = 0;
+
+    while (cls < ZTHREAD__CACHE_CLASSES && sz + ZTHREAD__BLOCK_ALIGN > zthread__cache_sizes[cls]) 
+    {
+        cls++;
+    }
+    c = (cls < ZTHREAD__CACHE_CLASSES) ? zthread__cache_get() : NULL;
+    if (!c) 
+    {
+        b = (struct zthread__block*)ZTHREAD_MALLOC(sz + ZTHREAD__BLOCK_ALIGN);
+        if (!b) 
+        {
+            return NULL;
+        }
+        b->owner = NULL;
+        b->cls = -1;
+        return (char*)b + ZTHREAD__BLOCK_ALIGN;
+    }
+
+    if (!c->local[cls] && zthread__ldp(&c->remote, ZTHREAD__RLX)) 
+    {
+        zthread__cache_drain(c);
+    }
+    b = (struct zthread__block*)c->local[cls];
+    if (b) 
+    {
+        c->local[cls] = ZTHREAD__NEXT(b);
+        c->count[cls]--;
+    } 
+    else 
+    {
+        b = (struct zthread__block*)ZTHREAD_MALLOC(zthread__cache_sizes[cls]);
+        if (!b) 
+        {
+            return NULL;
+        }
+        b->owner = c;
+        b->cls = cls;
+    }
+    c->live++;
+    return (char*)b + ZTHREAD__BLOCK_ALIGN;
+}
+
+void zthread__cache_free(void *p) 
+{
+    struct zthread__block *b;
+    struct zthread__cache *c;
+    void *head;
+
+    if (!p) 
+    {
+        return;
+    }
+    b = (struct zthread__block*)((char*)p - ZTHREAD__BLOCK_ALIGN);
+    c = b->owner;
+    if (!c) 
+    {
+        ZTHREAD_FREE(b);
+        return;
+    }
+    if (c == zthread__cache_tls) 
+    {
+        c->live--;
+        if (c->count[b->cls] < ZTHREAD_TASK_CACHE) 
+        {
+            ZTHREAD__NEXT(b) = c->local[b->cls];
+            c->local[b->cls] = b;
+            c->count[b->cls]++;
+        } 
+        else 
+        {
+            ZTHREAD_FREE(b);
+        }
+        return;
+    }
+
+    head = zthread__ldp(&c->remote, ZTHREAD__ACQ);
+    for (;;) 
+    {
+        if (head == (void*)&zthread__cache_orphan) 
+        {
+            ZTHREAD_FREE(b);
+            if (zthread__fadd(&c->orphan_live, -1, ZTHREAD__ACQ_REL) == 1) 
+            {
+                ZTHREAD_FREE(c);
+            }
+            return;
+        }
+        ZTHREAD__NEXT(b) = head;
+        if (zatomic_cas_ptr(&c->remote, &head, b, ZATOMIC_ACQ_REL)) 
+        {
+            return;
+        }
+    }
+}
+
+#undef ZTHREAD__NEXT
+
+#else
+
+void *zthread__cache_alloc(size_t sz) 
+{
+    return ZTHREAD_MALLOC(sz);
+}
+
+void zthread__cache_free(void *p) 
+{
+    ZTHREAD_FREE(p);
+}
+
+#endif // ZTHREAD_TASK_CACHE
+
+struct zthread__wrap 
+{ 
+    zthread_proxy_fn f; 
+    void *arg; 
+};
+
+void zthread_attr_init(zthread_attr_t *a) 
+{
+    memset(a, 0, sizeof(*a));
+}
+
+int zthread_attr_set_cpu(zthread_attr_t *a, int cpu) 
+{
+    if (cpu < 0 || cpu >= ZTHREAD_MAX_CPUS) 
+    {
+        return Z_EINVAL;
+    }
+    a->affinity[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+    return Z_OK;
+}
+
+static int zthread__attr_valid(const zthread_attr_t *a) 
+{
+    return a->policy >= ZTHREAD_SCHED_DEFAULT && a->policy <= ZTHREAD_SCHED_RR;
+}
+
+// ZTHREAD_PROFILE: the backends below define the native lock calls under
+// internal names; the public ones, defined after them, time and count around
+// those. Library code in between keeps calling the native ones.
+#ifdef ZTHREAD_PROFILE
+#   define zmutex_lock      zmutex__native_lock
+#   define zmutex_unlock    zmutex__native_unlock
+#   define zmutex_trylock   zmutex__native_trylock
+#   define zmutex_timedlock zmutex__native_timedlock
+#   define zmutex_destroy   zmutex__native_destroy
+#   define zcond_wait       zcond__native_wait
+#   define zcond_timedwait  zcond__native_timedwait
+#   define zcond_destroy    zcond__native_destroy
+void zmutex_lock(zmutex_t *m);
+void zmutex_unlock(zmutex_t *m);
+int  zmutex_trylock(zmutex_t *m);
+int  zmutex_timedlock(zmutex_t *m, int64_t timeout_ns);
+void zmutex_destroy(zmutex_t *m);
+void zcond_wait(zcond_t *c, zmutex_t *m);
+int  zcond_timedwait(zcond_t *c, zmutex_t *m, int64_t timeout_ns);
+void zcond_destroy(zcond_t *c);
+#endif
+
+// Bounded copy; 'cap' includes the terminator.
+static void zthread__copy_name(char *dst, const char *src, size_t cap) 
+{
+    size_t i = 0;
+    if (src) 
+    {
+        for (; i + 1 < cap && src[i]; i++) 
+        {
+            dst[i] = src[i];
+        }
+    }
+    dst[i] = '\0';
+}
+
+#ifdef _WIN32
+static unsigned __stdcall zthread__proxy_entry(void *p) 
+{
+    struct zthread__wrap *w = (struct zthread__wrap*)p;
+    // NULL when zthread__create_ex_ptr cancelled the suspended thread.
+    if (w->f) 
+    {
+        w->f(w->arg); 
+    }
+    zthread__cache_free(w); 
+    return 0;
+}
+int zthread__create_ptr(zthread_t *t, zthread_proxy_fn func, void *arg) 
+{
+    struct zthread__wrap *w = (struct zthread__wrap*)zthread__cache_alloc(sizeof(*w)); 
+    if (!w) 
+    {
+        return Z_ENOMEM;
+    }
+    w->f = func; 
+    w->arg = arg;
+
+    if (zthread__create_raw(t, zthread__proxy_entry, w) != Z_OK) 
+    {
+        zthread__cache_free(w);
+        return Z_ERR;
+    }
+    return Z_OK;
+}
+
+int zthread__create_raw(zthread_t *t, zthread__entry_fn entry, void *arg) 
+{
+    *t = (HANDLE)_beginthreadex(NULL, 0, entry, arg, 0, NULL);
+    return (NULL == *t) ? Z_ERR : Z_OK;
+}
+
+// SetThreadDescription only exists on Windows 10 1607+, so look it up.
+typedef HRESULT (WINAPI *zthread__set_desc_fn)(HANDLE, PCWSTR);
+
+static void zthread__set_name(HANDLE h, const char *name) 
+{
+    char buf[64];
+    WCHAR wide[64];
+    zthread__set_desc_fn fn = (zthread__set_desc_fn)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription");
+    zthread__copy_name(buf, name, sizeof(buf));
+    if (fn && MultiByteToWideChar(CP_UTF8, 0, buf, -1, wide, 64) > 0) 
+    {
+        fn(h, wide);
+    }
+}
+
+// CPU indices run across processor groups in order, but a thread can only be
+// bound to one group: we use the first group that has a CPU in the mask.
+static int zthread__set_affinity(HANDLE h, const zthread_attr_t *a) 
+{
+    WORD groups = GetActiveProcessorGroupCount();
+    WORD g;
+    int base = 0;
+    for (g = 0; g < groups; g++) 
+    {
+        DWORD n = GetActiveProcessorCount(g);
+        KAFFINITY mask = 0;
+        DWORD j;
+        for (j = 0; j < n && j < sizeof(KAFFINITY) * 8 && base + (int)j < ZTHREAD_MAX_CPUS; j++) 
+        {
+            int cpu = base + (int)j;
+            if ((a->affinity[cpu / 64] >> (cpu % 64)) & 1) 
+            {
+                mask |= (KAFFINITY)1 << j;
+            }
+        }
+        if (mask) 
+        {
+            GROUP_AFFINITY ga;
+            ZeroMemory(&ga, sizeof(ga));
+            ga.Group = g;
+            ga.Mask = mask;
+            return SetThreadGroupAffinity(h, &ga, NULL) ? Z_OK : Z_EINVAL;
+        }
+        base += (int)n;
+    }
+    // Only CPUs that are not online were requested.
+    for (g = 0; g < ZTHREAD_MAX_CPUS / 64; g++) 
+    {
+        if (a->affinity[g]) 
+        {
+            return Z_EINVAL;
+        }
+    }
+    return Z_OK;
+}
+
+int zthread__create_ex_ptr(zthread_t *t, zthread_proxy_fn func, void *arg, const zthread_attr_t *attr) 
+{
+    struct zthread__wrap *w;
+    unsigned flags = CREATE_SUSPENDED;
+    int rc;
+    if (!attr) 
+    {
+        return zthread__create_ptr(t, func, arg);
+    }
+    if (!zthread__attr_valid(attr) || attr->stack_size > 0xFFFFFFFFu) 
+    {
+        return Z_EINVAL;
+    }
+    w = (struct zthread__wrap*)zthread__cache_alloc(sizeof(*w));
+    if (!w) 
+    {
+        return Z_ENOMEM;
+    }
+    w->f = func; 
+    w->arg = arg;
+
+    // Reserve (not commit) the requested stack, so small stacks stay cheap.
+    if (attr->stack_size) 
+    {
+        flags |= STACK_SIZE_PARAM_IS_A_RESERVATION;
+    }
+    *t = (HANDLE)_beginthreadex(NULL, (unsigned)attr->stack_size, zthread__proxy_entry, w, flags, NULL);
+    if (NULL == *t) 
+    {
+        zthread__cache_free(w);
+        return Z_ERR;
+    }
+
+    // The thread is suspended, so everything applies before 'func' runs.
+    rc = zthread__set_affinity(*t, attr);
+    if (Z_OK == rc && attr->priority != 0 && !SetThreadPriority(*t, attr->priority)) 
+    {
+        rc = Z_EINVAL;
+    }
+    if (Z_OK == rc && attr->name) 
+    {
+        zthread__set_name(*t, attr->name);
+    }
+    if (Z_OK != rc) 
+    {
+        // Let it exit without running the task (it frees 'w').
+        w->f = NULL;
+        ResumeThread(*t);
+        WaitForSingleObject(*t, INFINITE);
+        CloseHandle(*t);
+        return rc;
+    }
+    ResumeThread(*t);
+    return Z_OK;
+}
+
+void zthread_join(zthread_t t) 
+{ 
+    WaitForSingleObject(t, INFINITE); 
+    CloseHandle(t); 
+}
+
+void zthread_detach(zthread_t t) 
+{ 
+    CloseHandle(t); 
+}
+
+void zthread_sleep(int ms) 
+{ 
+    Sleep(ms); 
+}
+
+// FLS callbacks are WINAPI and only receive the slot value, so every key lives
+// in one per-thread block behind a single FLS slot, whose callback runs the
+// destructors. Rounds repeat while destructors store new values, as POSIX does.
+// Each value carries the generation of its key, which ztls_key_delete bumps:
+// a key created on a reused index reads NULL in every thread, like POSIX.
+#define ZTLS__ROUNDS 4
+
+struct ztls__block 
+{
+    void *values[ZTHREAD_TLS_KEYS];
+    int32_t gens[ZTHREAD_TLS_KEYS];
+};
+
+static ztls_dtor_fn ztls__dtor[ZTHREAD_TLS_KEYS];
+static volatile int32_t ztls__used[ZTHREAD_TLS_KEYS];   // 0 free, 1 claimed, 2 live.
+static volatile int32_t ztls__gen[ZTHREAD_TLS_KEYS];
+static volatile int32_t ztls__state = 0;    // zthread__once.
+static DWORD ztls__fls = FLS_OUT_OF_INDEXES;
+
+static VOID WINAPI ztls__thread_exit(PVOID p) 
+{
+    struct ztls__block *b = (struct ztls__block*)p;
+    int round, i, again = 1;
+    for (round = 0; again && round < ZTLS__ROUNDS; round++) 
+    {
+        again = 0;
+        for (i = 0; i < ZTHREAD_TLS_KEYS; i++) 
+        {
+            void *v = b->values[i];
+            if (v && 2 == zthread__ld32(&ztls__used[i], ZTHREAD__ACQ) && ztls__dtor[i] &&
+                b->gens[i] == zthread__ld32(&ztls__gen[i], ZTHREAD__ACQ)) 
+            {
+                ztls_dtor_fn d = ztls__dtor[i];
+                b->values[i] = NULL;
+                d(v);
+                again = 1;
+            }
+        }
+    }
+    // Later FLS callbacks may still call ztls_get on this thread.
+    FlsSetValue(ztls__fls, NULL);
+    ZTHREAD_FREE(b);
+}
+
+static int ztls__alloc_slot(void) 
+{
+    ztls__fls = FlsAlloc(ztls__thread_exit);
+    return (FLS_OUT_OF_INDEXES == ztls__fls) ? Z_ERR : Z_OK;
+}
+
+static int ztls__init(void) 
+{
+    return zthread__once(&ztls__state, ztls__alloc_slot);
+}
+
+int ztls_key_create(ztls_key_t *k, ztls_dtor_fn dtor) 
+{
+    unsigned i;
+    if (!ztls__init()) 
+    {
+        return Z_ENOMEM;
+    }
+    for (i = 0; i < ZTHREAD_TLS_KEYS; i++) 
+    {
+        if (zthread__cas32(&ztls__used[i], 0, 1)) 
+        {
+            ztls__dtor[i] = dtor;
+            zthread__st32(&ztls__used[i], 2, ZTHREAD__REL);
+            *k = i;
+            return Z_OK;
+        }
+    }
+    return Z_ENOMEM;
+}
+
+void ztls_key_delete(ztls_key_t k) 
+{
+    if (k < ZTHREAD_TLS_KEYS) 
+    {
+        // Orphans the values every thread still holds under 'k'.
+        zthread__fadd32(&ztls__gen[k], 1, ZTHREAD__REL);
+        zthread__st32(&ztls__used[k], 0, ZTHREAD__REL);
+    }
+}
+
+int ztls_set(ztls_key_t k, void *value) 
+{
+    struct ztls__block *b = (struct ztls__block*)FlsGetValue(ztls__fls);
+    if (!b) 
+    {
+        if (!value) 
+        {
+            return Z_OK;
+        }
+        b = (struct ztls__block*)ZTHREAD_CALLOC(1, sizeof(*b));
+        if (!b || !FlsSetValue(ztls__fls, b)) 
+        {
+            ZTHREAD_FREE(b);
+            return Z_ENOMEM;
+        }
+    }
+    b->values[k] = value;
+    b->gens[k] = zthread__ld32(&ztls__gen[k], ZTHREAD__ACQ);
+    return Z_OK;
+}
+
+void *ztls_get(ztls_key_t k) 
+{
+    struct ztls__block *b = (struct ztls__block*)FlsGetValue(ztls__fls);
+    return (b && b->gens[k] == zthread__ld32(&ztls__gen[k], ZTHREAD__ACQ)) ? b->values[k] : NULL;
+}
+
+// Monotonic clock for the timed waits.
+static inline int64_t zthread__mono_ns(void) 
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (0 == freq.QuadPart) 
+    {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (int64_t)(now.QuadPart / freq.QuadPart) * 1000000000 +
+           (int64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}
+
+// Win32 waits take milliseconds: round up so we never wake early.
+static DWORD zthread__ns_to_ms(int64_t ns) 
+{
+    int64_t ms;
+    if (ns <= 0) 
+    {
+        return 0;
+    }
+    ms = (ns + 999999) / 1000000;
+    return ms >= (int64_t)INFINITE ? INFINITE - 1 : (DWORD)ms;
+}
+
+// Sleep() rounds up to the system tick (15.6 ms by default). Waitable timers
+// created with CREATE_WAITABLE_TIMER_HIGH_RESOLUTION (Windows 10 1803+) do
+// not; each thread keeps one, closed at thread exit. Older systems get a
+// normal timer, with Sleep() as the last resort.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#   define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static ZTHREAD_LOCAL HANDLE zthread__sleep_timer;
+static ZTHREAD_LOCAL int zthread__sleep_ready;
+static ztls_key_t zthread__sleep_key;
+static volatile int32_t zthread__sleep_state = 0;  // zthread__once.
+
+static void zthread__sleep_exit(void *arg) 
+{
+    CloseHandle((HANDLE)arg);
+    zthread__sleep_timer = NULL;
+    zthread__sleep_ready = 0;
+}
+
+static int zthread__sleep_init(void) 
+{
+    return ztls_key_create(&zthread__sleep_key, zthread__sleep_exit);
+}
+
+static HANDLE zthread__sleep_handle(void) 
+{
+    int ready;
+    if (zthread__sleep_ready) 
+    {
+        return zthread__sleep_timer;
+    }
+    ready = zthread__once(&zthread__sleep_state, zthread__sleep_init);
+    zthread__sleep_ready = 1;
+    // Without the key a timer would leak per thread: use Sleep() instead.
+    if (!ready) 
+    {
+        return NULL;
+    }
+#   if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+    zthread__sleep_timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+#   endif
+    if (!zthread__sleep_timer) 
+    {
+        zthread__sleep_timer = CreateWaitableTimer(NULL, TRUE, NULL);
+    }
+    if (zthread__sleep_timer && ztls_set(zthread__sleep_key, zthread__sleep_timer) != Z_OK) 
+    {
+        CloseHandle(zthread__sleep_timer);
+        zthread__sleep_timer = NULL;
+    }
+    return zthread__sleep_timer;
+}
+
+void zthread_sleep_until(int64_t deadline_ns) 
+{
+    HANDLE h = zthread__sleep_handle();
+    for (;;) 
+    {
+        int64_t left = deadline_ns - zthread__mono_ns();
+        LARGE_INTEGER due;
+        if (left <= 0) 
+        {
+            break;
+        }
+        // Relative, in 100 ns units. The timer runs on interrupt time, not
+        // on QueryPerformanceCounter, so the loop re-checks the clock.
+        due.QuadPart = -((left + 99) / 100);
+        if (h && SetWaitableTimer(h, &due, 0, NULL, NULL, FALSE)) 
+        {
+            WaitForSingleObject(h, INFINITE);
+        } 
+        else 
+        {
+            Sleep(zthread__ns_to_ms(left));
+        }
+    }
+}
+
+int zthread_cpu_count(void) 
+{ 
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+int zthread_cpu_current(void) 
+{
+    return (int)GetCurrentProcessorNumber();
+}
+
+#ifndef ZTHREAD__FUTEX
+void zmutex_init(zmutex_t *m) 
+{ 
+    InitializeCriticalSection(m); 
+}
+
+int zmutex_init_ex(zmutex_t *m, int flags) 
+{
+    if (flags & ~ZMUTEX_ADAPTIVE) 
+    {
+        return Z_EINVAL;
+    }
+    if (!(flags & ZMUTEX_ADAPTIVE)) 
+    {
+        InitializeCriticalSection(m);
+        return Z_OK;
+    }
+    // EnterCriticalSection spins with YieldProcessor before waiting; with
+    // dynamic spin the kernel retunes the budget from observed contention.
+#   if defined(RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN) && defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+    if (InitializeCriticalSectionEx(m, ZTHREAD_SPIN_COUNT, RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN)) 
+    {
+        return Z_OK;
+    }
+#   endif
+    InitializeCriticalSectionAndSpinCount(m, ZTHREAD_SPIN_COUNT);
+    return Z_OK;
+}
+
+void zmutex_lock(zmutex_t *m) 
+{ 
+    EnterCriticalSection(m); 
+}
+
+void zmutex_unlock(zmutex_t *m) 
+{ 
+    LeaveCriticalSection(m); 
+}
+
+void zmutex_destroy(zmutex_t *m) 
+{ 
+    DeleteCriticalSection(m); 
+}
+
+int zmutex_trylock(zmutex_t *m) 
+{ 
+    return TryEnterCriticalSection(m) ? Z_OK : Z_ERR; 
+}
+
+int zmutex_timedlock(zmutex_t *m, int64_t timeout_ns) 
+{
+    // No native timed EnterCriticalSection: poll with an escalating backoff.
+    int64_t deadline = zthread__mono_ns() + timeout_ns;
+    int i;
+    for (i = 0; !TryEnterCriticalSection(m); i++) 
+    {
+        if (zthread__mono_ns() >= deadline) 
+        {
+            return Z_ETIMEDOUT;
+        }
+        if (i < 16) 
+        {
+            YieldProcessor();
+        } 
+        else if (i < 64) 
+        {
+            SwitchToThread();
+        } 
+        else 
+        {
+            Sleep(1);
+        }
+    }
+    return Z_OK;
+}
+
+void zcond_init(zcond_t *c) 
+{ 
+    InitializeConditionVariable(c); 
+}
+void zcond_wait(zcond_t *c, zmutex_t *m) 
+{ 
+    SleepConditionVariableCS(c, m, INFINITE); 
+}
+
+int zcond_timedwait(zcond_t *c, zmutex_t *m, int64_t timeout_ns) 
+{
+    if (!SleepConditionVariableCS(c, m, zthread__ns_to_ms(timeout_ns)) && ERROR_TIMEOUT == GetLastError()) 
+    {
+        return Z_ETIMEDOUT;
+    }
+    return Z_OK;
+}
+
+void zcond_signal(zcond_t *c) 
+{ 
+    WakeConditionVariable(c); 
+}
+
+void zcond_broadcast(zcond_t *c) 
+{ 
+    WakeAllConditionVariable(c); 
+}
+
+void zcond_destroy(zcond_t *c) 
+{ 
+    (void)c; 
+} 
+
+int zsem_init(zsem_t *s, unsigned initial) 
+{
+    if (initial > 0x7FFFFFFFu) 
+    {
+        return Z_EINVAL;
+    }
+    *s = CreateSemaphoreW(NULL, (LONG)initial, 0x7FFFFFFF, NULL);
+    return *s ? Z_OK : Z_ERR;
+}
+
+void zsem_wait(zsem_t *s) 
+{
+    WaitForSingleObject(*s, INFINITE);
+}
+
+int zsem_trywait(zsem_t *s) 
+{
+    return WAIT_OBJECT_0 == WaitForSingleObject(*s, 0) ? Z_OK : Z_ERR;
+}
+
+int zsem_timedwait(zsem_t *s, int64_t timeout_ns) 
+{
+    return WAIT_OBJECT_0 == WaitForSingleObject(*s, zthread__ns_to_ms(timeout_ns)) ? Z_OK : Z_ETIMEDOUT;
+}
+
+void zsem_post(zsem_t *s) 
+{
+    ReleaseSemaphore(*s, 1, NULL);
+}
+
+void zsem_destroy(zsem_t *s) 
+{
+    CloseHandle(*s);
+}
+#endif // ZTHREAD__FUTEX
+
+#else
+// POSIX implementation.
+
+#ifdef __linux__
+#   include <sys/syscall.h>
+// <unistd.h> only declares syscall() with _DEFAULT_SOURCE/_GNU_SOURCE, which
+// strict -std=c99/c11 builds lack (and C++ always has).
+#   if !defined(__cplusplus) && !defined(__USE_MISC) && !defined(_GNU_SOURCE) && !defined(_BSD_SOURCE)
+extern long syscall(long number, ...);
+#   endif
+// Without _GNU_SOURCE there is no pthread affinity API: the new thread
+// applies the mask to itself with the raw syscall.
+#   ifndef _GNU_SOURCE
+#       define ZTHREAD__SELF_PIN 1
+#   endif
+#endif
+
+static void* zthread__proxy_entry(void *p) 
+{
+    struct zthread__wrap *w = (struct zthread__wrap*)p;
+    w->f(w->arg); 
+    zthread__cache_free(w); 
+    return NULL;
+}
+
+int zthread__create_ptr(zthread_t *t, zthread_proxy_fn func, void *arg) 
+{
+    struct zthread__wrap *w = (struct zthread__wrap*)zthread__cache_alloc(sizeof(*w));
+    if (!w) 
+    {
+        return Z_ENOMEM; 
+    }
+    w->f = func; 
+    w->arg = arg;
+
+    if (zthread__create_raw(t, zthread__proxy_entry, w) != Z_OK) 
+    {
+        zthread__cache_free(w);
+        return Z_ERR;
+    }
+    return Z_OK;
+}
+
+int zthread__create_raw(zthread_t *t, zthread__entry_fn entry, void *arg) 
+{
+    return (0 != pthread_create(t, NULL, entry, arg)) ? Z_ERR : Z_OK;
+}
+
+// Names are set by the new thread itself (macOS can only name the caller).
+#ifdef __linux__
+#   define ZTHREAD__NAME_MAX 16
+#else
+#   define ZTHREAD__NAME_MAX 64
+#endif
+
+struct zthread__wrap_ex 
+{
+    zthread_proxy_fn f;
+    void *arg;
+    char name[ZTHREAD__NAME_MAX];
+#ifdef ZTHREAD__SELF_PIN
+    // Set when the new thread pins itself. It posts 'pinned' with the result
+    // in 'pin_rc', and from then on the creator owns the record.
+    int pin;
+    int pin_rc;
+    zsem_t pinned;
+    unsigned long mask[ZTHREAD_MAX_CPUS / (8 * sizeof(unsigned long))];
+#endif
+};
+
+static void* zthread__proxy_entry_ex(void *p) 
+{
+    struct zthread__wrap_ex *w = (struct zthread__wrap_ex*)p;
+    zthread_proxy_fn f = w->f;
+    void *arg = w->arg;
+    if (w->name[0]) 
+    {
+#       if defined(__APPLE__)
+        pthread_setname_np(w->name);
+#       elif defined(__linux__) && defined(_GNU_SOURCE)
+        pthread_setname_np(pthread_self(), w->name);
+#       endif
+    }
+#ifdef ZTHREAD__SELF_PIN
+    if (w->pin) 
+    {
+        int rc = (0 == syscall(SYS_sched_setaffinity, 0, sizeof(w->mask), w->mask)) ? Z_OK : Z_ERR;
+        w->pin_rc = rc;
+        zsem_post(&w->pinned);
+        if (Z_OK != rc) 
+        {
+            return NULL;
+        }
+        f(arg);
+        return NULL;
+    }
+#endif
+    zthread__cache_free(w);
+    f(arg);
+    return NULL;
+}
+
+static int zthread__apply_attr(pthread_attr_t *pa, const zthread_attr_t *a) 
+{
+    if (a->stack_size) 
+    {
+        size_t sz = a->stack_size;
+        long page = sysconf(_SC_PAGESIZE);
+#       ifdef PTHREAD_STACK_MIN
+        if (sz < (size_t)PTHREAD_STACK_MIN) 
+        {
+            sz = (size_t)PTHREAD_STACK_MIN;
+        }
+#       endif
+        // Some implementations insist on whole pages.
+        if (page > 0) 
+        {
+            sz = (sz + (size_t)page - 1) / (size_t)page * (size_t)page;
+        }
+        if (0 != pthread_attr_setstacksize(pa, sz)) 
+        {
+            return Z_EINVAL;
+        }
+    }
+#   ifdef ZTHREAD__POSIX_2001
+    if (a->guard_size && 0 != pthread_attr_setguardsize(pa, a->guard_size)) 
+    {
+        return Z_EINVAL;
+    }
+    if (a->policy != ZTHREAD_SCHED_DEFAULT) 
+    {
+        struct sched_param sp;
+        int pol = (ZTHREAD_SCHED_FIFO == a->policy) ? SCHED_FIFO :
+                  (ZTHREAD_SCHED_RR == a->policy) ? SCHED_RR : SCHED_OTHER;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = a->priority;
+        if (0 != pthread_attr_setinheritsched(pa, PTHREAD_EXPLICIT_SCHED) ||
+            0 != pthread_attr_setschedpolicy(pa, pol) ||
+            0 != pthread_attr_setschedparam(pa, &sp)) 
+        {
+            return Z_EINVAL;
+        }
+    }
+#   endif
+#   if defined(__linux__) && defined(_GNU_SOURCE)
+    {
+        cpu_set_t set;
+        int i, any = 0;
+        CPU_ZERO(&set);
+        for (i = 0; i < ZTHREAD_MAX_CPUS && i < CPU_SETSIZE; i++) 
+        {
+            if ((a->affinity[i / 64] >> (i % 64)) & 1) 
+            {
+                CPU_SET(i, &set);
+                any = 1;
+            }
+        }
+        if (any && 0 != pthread_attr_setaffinity_np(pa, sizeof(set), &set)) 
+        {
+            return Z_EINVAL;
+        }
+    }
+#   endif
+    return Z_OK;
+}
+
+int zthread__create_ex_ptr(zthread_t *t, zthread_proxy_fn func, void *arg, const zthread_attr_t *attr) 
+{
+    struct zthread__wrap_ex *w;
+    pthread_attr_t pa;
+    int rc;
+    if (!attr) 
+    {
+        return zthread__create_ptr(t, func, arg);
+    }
+    if (!zthread__attr_valid(attr)) 
+    {
+        return Z_EINVAL;
+    }
+    w = (struct zthread__wrap_ex*)zthread__cache_alloc(sizeof(*w));
+    if (!w) 
+    {
+        return Z_ENOMEM;
+    }
+    w->f = func;
+    w->arg = arg;
+    zthread__copy_name(w->name, attr->name, sizeof(w->name));
+
+    if (0 != pthread_attr_init(&pa)) 
+    {
+        zthread__cache_free(w);
+        return Z_ERR;
+    }
+    rc = zthread__apply_attr(&pa, attr);
+#ifdef ZTHREAD__SELF_PIN
+    w->pin = 0;
+    if (Z_OK == rc) 
+    {
+        const size_t bits = 8 * sizeof(unsigned long);
+        size_t i;
+        memset(w->mask, 0, sizeof(w->mask));
+        for (i = 0; i < ZTHREAD_MAX_CPUS; i++) 
+        {
+            if ((attr->affinity[i / 64] >> (i % 64)) & 1) 
+            {
+                w->mask[i / bits] |= 1UL << (i % bits);
+                w->pin = 1;
+            }
+        }
+        if (w->pin && Z_OK != zsem_init(&w->pinned, 0)) 
+        {
+            rc = Z_ERR;
+        }
+    }
+#endif
+    if (Z_OK == rc && 0 != pthread_create(t, &pa, zthread__proxy_entry_ex, w)) 
+    {
+        // Typically EPERM for real-time policies, or EINVAL for offline CPUs.
+        rc = Z_ERR;
+#ifdef ZTHREAD__SELF_PIN
+        if (w->pin) 
+        {
+            zsem_destroy(&w->pinned);
+        }
+#endif
+    }
+#ifdef ZTHREAD__SELF_PIN
+    else if (Z_OK == rc && w->pin) 
+    {
+        zsem_wait(&w->pinned);
+        zsem_destroy(&w->pinned);
+        rc = w->pin_rc;
+        if (Z_OK != rc) 
+        {
+            // Like an offline CPU with pthread_attr_setaffinity_np.
+            pthread_join(*t, NULL);
+        }
+        zthread__cache_free(w);
+        pthread_attr_destroy(&pa);
+        return rc;
+    }
+#endif
+    pthread_attr_destroy(&pa);
+    if (Z_OK != rc) 
+    {
+        zthread__cache_free(w);
+    }
+    return rc;
+}
+
+void zthread_join(zthread_t t) 
+{ 
+    pthread_join(t, NULL); 
+}
+
+void zthread_detach(zthread_t t) 
+{ 
+    pthread_detach(t); 
+}
+
+void zthread_sleep(int ms) 
+{ 
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+int ztls_key_create(ztls_key_t *k, ztls_dtor_fn dtor) 
+{
+    return (0 == pthread_key_create(k, dtor)) ? Z_OK : Z_ENOMEM;
+}
+
+void ztls_key_delete(ztls_key_t k) 
+{
+    pthread_key_delete(k);
+}
+
+int ztls_set(ztls_key_t k, void *value) 
+{
+    return (0 == pthread_setspecific(k, value)) ? Z_OK : Z_ENOMEM;
+}
+
+void *ztls_get(ztls_key_t k) 
+{
+    return pthread_getspecific(k);
+}
+
+static inline int64_t zthread__mono_ns(void) 
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void zthread_sleep_until(int64_t deadline_ns) 
+{
+#   if defined(ZTHREAD__POSIX_2001) && !defined(__APPLE__)
+    struct timespec ts;
+    if (deadline_ns <= zthread__mono_ns()) 
+    {
+        return;
+    }
+    ts.tv_sec = (time_t)(deadline_ns / 1000000000);
+    ts.tv_nsec = (long)(deadline_ns % 1000000000);
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) 
+    {
+    }
+#   else
+    // Darwin has no clock_nanosleep: sleep for what is left until it is past.
+    for (;;) 
+    {
+        int64_t left = deadline_ns - zthread__mono_ns();
+        struct timespec rel;
+        if (left <= 0) 
+        {
+            break;
+        }
+        rel.tv_sec = (time_t)(left / 1000000000);
+        rel.tv_nsec = (long)(left % 1000000000);
+        nanosleep(&rel, NULL);
+    }
+#   endif
+}
+
+// Absolute deadline 'ns' from now on 'clk', as the pthread timed calls expect.
+static inline struct timespec zthread__deadline(clockid_t clk, int64_t ns) 
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    if (ns < 0) 
+    {
+        ns = 0;
+    }
+    ts.tv_sec += (time_t)(ns / 1000000000);
+    ts.tv_nsec += (long)(ns % 1000000000);
+    if (ts.tv_nsec >= 1000000000) 
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+int zthread_cpu_count(void) 
+{ 
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+int zthread_cpu_current(void) 
+{
+#if defined(__linux__)
+    unsigned cpu = 0;
+    return (0 == syscall(SYS_getcpu, &cpu, NULL, NULL)) ? (int)cpu : -1;
+#else
+    return -1;
+#endif
+}
+
+#ifndef ZTHREAD__FUTEX
+void zmutex_init(zmutex_t *m) 
+{ 
+    pthread_mutex_init(m, NULL); 
+}
+
+int zmutex_init_ex(zmutex_t *m, int flags) 
+{
+    if (flags & ~ZMUTEX_ADAPTIVE) 
+    {
+        return Z_EINVAL;
+    }
+    // glibc's adaptive mutex spins with a pause instruction before the futex
+    // wait, and tracks a per-mutex moving average of how long acquiring took.
+    // Elsewhere there is no native equivalent, so we use a normal mutex.
+#   if defined(__GLIBC__) && defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+    if (flags & ZMUTEX_ADAPTIVE) 
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+        pthread_mutex_init(m, &attr);
+        pthread_mutexattr_destroy(&attr);
+        return Z_OK;
+    }
+#   endif
+    pthread_mutex_init(m, NULL);
+    return Z_OK;
+}
+
+void zmutex_lock(zmutex_t *m) 
+{ 
+    pthread_mutex_lock(m); 
+}
+
+void zmutex_unlock(zmutex_t *m) 
+{ 
+    pthread_mutex_unlock(m); 
+}
+
+void zmutex_destroy(zmutex_t *m) 
+{ 
+    pthread_mutex_destroy(m); 
+}
+
+int zmutex_trylock(zmutex_t *m) 
+{ 
+    return 0 == pthread_mutex_trylock(m) ? Z_OK : Z_ERR; 
+}
+
+// Only ETIMEDOUT is a timeout; other failures are reported as such.
+static int zthread__timed_rc(int rc) 
+{
+    if (0 == rc) 
+    {
+        return Z_OK;
+    }
+    return (ETIMEDOUT == rc) ? Z_ETIMEDOUT : (EINVAL == rc) ? Z_EINVAL : Z_ERR;
+}
+
+int zmutex_timedlock(zmutex_t *m, int64_t timeout_ns) 
+{
+#   if defined(__GLIBC__) && defined(_GNU_SOURCE) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+    struct timespec ts = zthread__deadline(CLOCK_MONOTONIC, timeout_ns);
+    return zthread__timed_rc(pthread_mutex_clocklock(m, CLOCK_MONOTONIC, &ts));
+#   elif defined(ZTHREAD__POSIX_2001) && !defined(__APPLE__)
+    // Only the realtime clock is available here.
+    struct timespec ts = zthread__deadline(CLOCK_REALTIME, timeout_ns);
+    return zthread__timed_rc(pthread_mutex_timedlock(m, &ts));
+#   else
+    // No pthread_mutex_timedlock: poll with an escalating backoff.
+    int64_t deadline = zthread__mono_ns() + timeout_ns;
+    int i, rc;
+    for (i = 0; 0 != (rc = pthread_mutex_trylock(m)); i++) 
+    {
+        if (EBUSY != rc) 
+        {
+            return zthread__timed_rc(rc);
+        }
+        if (zthread__mono_ns() >= deadline) 
+        {
+            return Z_ETIMEDOUT;
+        }
+        if (i < 64) 
+        {
+            sched_yield();
+        } 
+        else 
+        {
+            zthread_sleep(1);
+        }
+    }
+    return Z_OK;
+#   endif
+}
+
+void zcond_init(zcond_t *c) 
+{ 
+#   if defined(ZTHREAD__POSIX_2001) && !defined(__APPLE__)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(c, &attr);
+    pthread_condattr_destroy(&attr);
+#   else
+    // Darwin has no condattr clock (timed waits use the relative variant).
+    pthread_cond_init(c, NULL); 
+#   endif
+}
+
+void zcond_wait(zcond_t *c, zmutex_t *m) 
+{ 
+    pthread_cond_wait(c, m); 
+}
+
+int zcond_timedwait(zcond_t *c, zmutex_t *m, int64_t timeout_ns) 
+{
+    int rc;
+#   if defined(__APPLE__)
+    struct timespec rel;
+    if (timeout_ns < 0) 
+    {
+        timeout_ns = 0;
+    }
+    rel.tv_sec = (time_t)(timeout_ns / 1000000000);
+    rel.tv_nsec = (long)(timeout_ns % 1000000000);
+    rc = pthread_cond_timedwait_relative_np(c, m, &rel);
+#   elif defined(ZTHREAD__POSIX_2001)
+    struct timespec ts = zthread__deadline(CLOCK_MONOTONIC, timeout_ns);
+    rc = pthread_cond_timedwait(c, m, &ts);
+#   else
+    struct timespec ts = zthread__deadline(CLOCK_REALTIME, timeout_ns);
+    rc = pthread_cond_timedwait(c, m, &ts);
+#   endif
+    return ETIMEDOUT == rc ? Z_ETIMEDOUT : Z_OK;
+}
+
+void zcond_signal(zcond_t *c) 
+{ 
+    pthread_cond_signal(c); 
+}
+
+void zcond_broadcast(zcond_t *c) 
+{ 
+    pthread_cond_broadcast(c); 
+}
+
+void zcond_destroy(zcond_t *c) 
+{ 
+    pthread_cond_destroy(c); 
+}
+
+#if defined(__APPLE__)
+int zsem_init(zsem_t *s, unsigned initial) 
+{
+    if (initial > 0x7FFFFFFFu) 
+    {
+        return Z_EINVAL;
+    }
+    *s = dispatch_semaphore_create((long)initial);
+    return *s ? Z_OK : Z_ERR;
+}
+
+void zsem_wait(zsem_t *s) 
+{
+    dispatch_semaphore_wait(*s, DISPATCH_TIME_FOREVER);
+}
+
+int zsem_trywait(zsem_t *s) 
+{
+    return 0 == dispatch_semaphore_wait(*s, DISPATCH_TIME_NOW) ? Z_OK : Z_ERR;
+}
+
+int zsem_timedwait(zsem_t *s, int64_t timeout_ns) 
+{
+    dispatch_time_t t = dispatch_time(DISPATCH_TIME_NOW, timeout_ns < 0 ? 0 : timeout_ns);
+    return 0 == dispatch_semaphore_wait(*s, t) ? Z_OK : Z_ETIMEDOUT;
+}
+
+void zsem_post(zsem_t *s) 
+{
+    dispatch_semaphore_signal(*s);
+}
+
+void zsem_destroy(zsem_t *s) 
+{
+    dispatch_release(*s);
+}
+#else
+int zsem_init(zsem_t *s, unsigned initial) 
+{
+    if (initial > 0x7FFFFFFFu) 
+    {
+        return Z_EINVAL;
+    }
+    return 0 == sem_init(s, 0, initial) ? Z_OK : Z_ERR;
+}
+
+void zsem_wait(zsem_t *s) 
+{
+    while (0 != sem_wait(s) && EINTR == errno) 
+    {
+    }
+}
+
+int zsem_trywait(zsem_t *s) 
+{
+    int rc;
+    while (0 != (rc = sem_trywait(s)) && EINTR == errno) 
+    {
+    }
+    return 0 == rc ? Z_OK : Z_ERR;
+}
+
+int zsem_timedwait(zsem_t *s, int64_t timeout_ns) 
+{
+#   if defined(ZTHREAD__POSIX_2001)
+    int rc;
+#       if defined(__GLIBC__) && defined(_GNU_SOURCE) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+    struct timespec ts = zthread__deadline(CLOCK_MONOTONIC, timeout_ns);
+    while (0 != (rc = sem_clockwait(s, CLOCK_MONOTONIC, &ts)) && EINTR == errno) 
+    {
+    }
+#       else
+    struct timespec ts = zthread__deadline(CLOCK_REALTIME, timeout_ns);
+    while (0 != (rc = sem_timedwait(s, &ts)) && EINTR == errno) 
+    {
+    }
+#       endif
+    return 0 == rc ? Z_OK : Z_ETIMEDOUT;
+#   else
+    // No sem_timedwait: poll with an escalating backoff.
+    int64_t deadline = zthread__mono_ns() + timeout_ns;
+    int i;
+    for (i = 0; Z_OK != zsem_trywait(s); i++) 
+    {
+        if (zthread__mono_ns() >= deadline) 
+        {
+            return Z_ETIMEDOUT;
+        }
+        if (i < 64) 
+        {
+            sched_yield();
+        } 
+        else 
+        {
+            zthread_sleep(1);
+        }
+    }
+    return Z_OK;
+#   endif
+}
+
+void zsem_post(zsem_t *s) 
+{
+    sem_post(s);
+}
+
+void zsem_destroy(zsem_t *s) 
+{
+    sem_destroy(s);
+}
+#endif
+#endif // ZTHREAD__FUTEX
+#endif
+
+// High-resolution sleeps.
+
+// Moving average (1/8) of how far past its target the coarse sleep of
+// zthread_sleep_precise_until woke up, per thread.
+static ZTHREAD_LOCAL int64_t zthread__sleep_late = 0;
+
+int64_t zthread_now_ns(void) 
+{
+    return zthread__mono_ns();
+}
+
+void zthread_sleep_ns(int64_t ns) 
+{
+    if (ns > 0) 
+    {
+        zthread_sleep_until(zthread__mono_ns() + ns);
+    }
+}
+
+void zthread_sleep_precise_until(int64_t deadline_ns) 
+{
+    int64_t wake = deadline_ns - ZTHREAD_SLEEP_SPIN_NS - zthread__sleep_late;
+    int64_t now = zthread__mono_ns();
+    if (wake > now) 
+    {
+        zthread_sleep_until(wake);
+        now = zthread__mono_ns();
+        zthread__sleep_late += (now - wake - zthread__sleep_late) / 8;
+    }
+    while (now < deadline_ns) 
+    {
+        ZTHREAD__PAUSE();
+        now = zthread__mono_ns();
+    }
+}
+
+void zthread_sleep_precise(int64_t ns) 
+{
+    if (ns > 0) 
+    {
+        zthread_sleep_precise_until(zthread__mono_ns() + ns);
+    }
+}
+
+// NUMA topology.
+
+static int16_t zthread__cpu_node[ZTHREAD_MAX_CPUS];
+static int zthread__numa_nodes = 1;
+// 0 = unknown, 1 = being discovered, 2 = ready.
+static volatile int32_t zthread__numa_state = 0;    // zthread__once.
+
+#if defined(_WIN32)
+static void zthread__numa_discover(void) 
+{
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *buf;
+    DWORD len = 0, off;
+    int base[64 + 1], g, groups = (int)GetActiveProcessorGroupCount();
+
+    GetLogicalProcessorInformationEx(RelationNumaNode, NULL, &len);
+    buf = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)ZTHREAD_MALLOC(len ? len : 1);
+    if (!buf || groups > 64 || !GetLogicalProcessorInformationEx(RelationNumaNode, buf, &len)) 
+    {
+        ZTHREAD_FREE(buf);
+        return;
+    }
+    // Linear CPU index = processors in the earlier groups + bit in the group.
+    base[0] = 0;
+    for (g = 0; g < groups; g++) 
+    {
+        base[g + 1] = base[g] + (int)GetActiveProcessorCount((WORD)g);
+    }
+    for (off = 0; off < len; ) 
+    {
+        SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)((char*)buf + off);
+        if (RelationNumaNode == info->Relationship && info->NumaNode.GroupMask.Group < groups) 
+        {
+            int node = (int)info->NumaNode.NodeNumber;
+            KAFFINITY mask = info->NumaNode.GroupMask.Mask;
+            int j, cpu0 = base[info->NumaNode.GroupMask.Group];
+            for (j = 0; j < (int)sizeof(KAFFINITY) * 8; j++) 
+            {
+                if (((mask >> j) & 1) && cpu0 + j < ZTHREAD_MAX_CPUS) 
+                {
+                    zthread__cpu_node[cpu0 + j] = (int16_t)node;
+                    if (node >= zthread__numa_nodes) 
+                    {
+                        zthread__numa_nodes = node + 1;
+                    }
+                }
+            }
+        }
+        off += info->Size;
+    }
+    ZTHREAD_FREE(buf);
+}
+#elif defined(__linux__)
+#   include <stdio.h>
+
+// Parses a sysfs list such as "0-3,8,10-11" into a bitmask. Returns the count.
+static int zthread__read_list(const char *path, uint64_t *mask) 
+{
+    FILE *f = fopen(path, "r");
+    int lo, hi, c, n = 0;
+    if (!f) 
+    {
+        return 0;
+    }
+    while (fscanf(f, "%d", &lo) == 1) 
+    {
+        hi = lo;
+        c = fgetc(f);
+        if ('-' == c) 
+        {
+            if (fscanf(f, "%d", &hi) != 1) 
+            {
+                break;
+            }
+            c = fgetc(f);
+        }
+        for (; lo <= hi && lo < ZTHREAD_MAX_CPUS; lo++) 
+        {
+            if (lo >= 0) 
+            {
+                mask[lo / 64] |= (uint64_t)1 << (lo % 64);
+                n++;
+            }
+        }
+        if (',' != c) 
+        {
+            break;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static void zthread__numa_discover(void) 
+{
+    uint64_t nodes[ZTHREAD_MAX_CPUS / 64];
+    int node, cpu;
+
+    memset(nodes, 0, sizeof(nodes));
+    if (!zthread__read_list("/sys/devices/system/node/online", nodes)) 
+    {
+        return;
+    }
+    for (node = 0; node < ZTHREAD_MAX_CPUS; node++) 
+    {
+        uint64_t cpus[ZTHREAD_MAX_CPUS / 64];
+        char path[64];
+        if (!((nodes[node / 64] >> (node % 64)) & 1)) 
+        {
+            continue;
+        }
+        memset(cpus, 0, sizeof(cpus));
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+        zthread__read_list(path, cpus);
+        for (cpu = 0; cpu < ZTHREAD_MAX_CPUS; cpu++) 
+        {
+            if ((cpus[cpu / 64] >> (cpu % 64)) & 1) 
+            {
+                zthread__cpu_node[cpu] = (int16_t)node;
+            }
+        }
+        zthread__numa_nodes = node + 1;
+    }
+}
+#else
+static void zthread__numa_discover(void) 
+{
+}
+#endif
+
+static int zthread__numa_load(void) 
+{
+    int cpu, n = zthread_cpu_count();
+    // Without topology data every online CPU is on node 0.
+    for (cpu = 0; cpu < ZTHREAD_MAX_CPUS; cpu++) 
+    {
+        zthread__cpu_node[cpu] = (int16_t)(cpu < n ? 0 : -1);
+    }
+    zthread__numa_discover();
+    return Z_OK;
+}
+
+static void zthread__numa_init(void) 
+{
+    zthread__once(&zthread__numa_state, zthread__numa_load);
+}
+
+int zthread_numa_node_count(void) 
+{
+    zthread__numa_init();
+    return zthread__numa_nodes;
+}
+
+int zthread_numa_node_of_cpu(int cpu) 
+{
+    zthread__numa_init();
+    return (cpu < 0 || cpu >= ZTHREAD_MAX_CPUS) ? -1 : zthread__cpu_node[cpu];
+}
+
+int zthread_attr_set_node(zthread_attr_t *a, int node) 
+{
+    int cpu, found = 0;
+    zthread__numa_init();
+    for (cpu = 0; cpu < ZTHREAD_MAX_CPUS; cpu++) 
+    {
+        if (node >= 0 && zthread__cpu_node[cpu] == node) 
+        {
+            a->affinity[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+            found = 1;
+        }
+    }
+    return found ? Z_OK : Z_EINVAL;
+}
+
+// Reader-writer locks.
+
+#if defined(_WIN32) || defined(ZTHREAD__POSIX_2001)
+#   ifdef _WIN32
+#       define ZRWLOCK__INIT(l)         InitializeSRWLock(l)
+#       define ZRWLOCK__RDLOCK(l)       AcquireSRWLockShared(l)
+#       define ZRWLOCK__WRLOCK(l)       AcquireSRWLockExclusive(l)
+#       define ZRWLOCK__TRYRDLOCK(l)    (0 != TryAcquireSRWLockShared(l))
+#       define ZRWLOCK__TRYWRLOCK(l)    (0 != TryAcquireSRWLockExclusive(l))
+#       define ZRWLOCK__RDUNLOCK(l)     ReleaseSRWLockShared(l)
+#       define ZRWLOCK__WRUNLOCK(l)     ReleaseSRWLockExclusive(l)
+#       define ZRWLOCK__DESTROY(l)      ((void)(l))
+#   else
+#       define ZRWLOCK__INIT(l)         pthread_rwlock_init((l), NULL)
+#       define ZRWLOCK__RDLOCK(l)       pthread_rwlock_rdlock(l)
+#       define ZRWLOCK__WRLOCK(l)       pthread_rwlock_wrlock(l)
+#       define ZRWLOCK__TRYRDLOCK(l)    (0 == pthread_rwlock_tryrdlock(l))
+#       define ZRWLOCK__TRYWRLOCK(l)    (0 == pthread_rwlock_trywrlock(l))
+#       define ZRWLOCK__RDUNLOCK(l)     pthread_rwlock_unlock(l)
+#       define ZRWLOCK__WRUNLOCK(l)     pthread_rwlock_unlock(l)
+#       define ZRWLOCK__DESTROY(l)      pthread_rwlock_destroy(l)
+#   endif
+
+void zrwlock_init(zrwlock_t *rw) 
+{
+    zrwlock_init_ex(rw, ZRWLOCK_DEFAULT);
+}
+
+int zrwlock_init_ex(zrwlock_t *rw, int flags) 
+{
+    if (flags & ~ZRWLOCK_PREFER_WRITER) 
+    {
+        return Z_EINVAL;
+    }
+    ZRWLOCK__INIT(&rw->lock);
+    rw->writers = 0;
+    rw->flags = flags;
+    if (flags & ZRWLOCK_PREFER_WRITER) 
+    {
+        zmutex_init(&rw->turnstile);
+    }
+    return Z_OK;
+}
+
+// With PREFER_WRITER, a writer holds the turnstile while it waits for the
+// lock, so readers arriving behind it queue there instead of piling onto the
+// read side. Readers only look at 'writers' otherwise (a shared, read-only
+// line). Like any writer-preferring lock, a recursive read can deadlock.
+void zrwlock_rdlock(zrwlock_t *rw) 
+{
+    if ((rw->flags & ZRWLOCK_PREFER_WRITER) && zthread__ld32(&rw->writers, ZTHREAD__ACQ) > 0) 
+    {
+        zmutex_lock(&rw->turnstile);
+        zmutex_unlock(&rw->turnstile);
+    }
+    ZRWLOCK__RDLOCK(&rw->lock);
+}
+
+void zrwlock_wrlock(zrwlock_t *rw) 
+{
+    if (rw->flags & ZRWLOCK_PREFER_WRITER) 
+    {
+        zthread__fadd32(&rw->writers, 1, ZTHREAD__SEQ);
+        zmutex_lock(&rw->turnstile);
+        ZRWLOCK__WRLOCK(&rw->lock);
+        zmutex_unlock(&rw->turnstile);
+        zthread__fadd32(&rw->writers, -1, ZTHREAD__REL);
+        return;
+    }
+    ZRWLOCK__WRLOCK(&rw->lock);
+}
+
+int zrwlock_tryrdlock(zrwlock_t *rw) 
+{
+    // Do not jump the queue ahead of a waiting writer.
+    if ((rw->flags & ZRWLOCK_PREFER_WRITER) && zthread__ld32(&rw->writers, ZTHREAD__ACQ) > 0) 
+    {
+        return Z_ERR;
+    }
+    return ZRWLOCK__TRYRDLOCK(&rw->lock) ? Z_OK : Z_ERR;
+}
+
+int zrwlock_trywrlock(zrwlock_t *rw) 
+{
+    return ZRWLOCK__TRYWRLOCK(&rw->lock) ? Z_OK : Z_ERR;
+}
+
+void zrwlock_rdunlock(zrwlock_t *rw) 
+{
+    ZRWLOCK__RDUNLOCK(&rw->lock);
+}
+
+void zrwlock_wrunlock(zrwlock_t *rw) 
+{
+    ZRWLOCK__WRUNLOCK(&rw->lock);
+}
+
+void zrwlock_destroy(zrwlock_t *rw) 
+{
+    ZRWLOCK__DESTROY(&rw->lock);
+    if (rw->flags & ZRWLOCK_PREFER_WRITER) 
+    {
+        zmutex_destroy(&rw->turnstile);
+    }
+}
+#else
+void zrwlock_init(zrwlock_t *rw) 
+{
+    zrwlock_init_ex(rw, ZRWLOCK_DEFAULT);
+}
+
+int zrwlock_init_ex(zrwlock_t *rw, int flags) 
+{
+    if (flags & ~ZRWLOCK_PREFER_WRITER) 
+    {
+        return Z_EINVAL;
+    }
+    zmutex_init(&rw->m);
+    zcond_init(&rw->readers_cv);
+    zcond_init(&rw->writers_cv);
+    rw->readers = 0;
+    rw->writer = 0;
+    rw->writers = 0;
+    rw->flags = flags;
+    return Z_OK;
+}
+
+static int zrwlock__read_blocked(const zrwlock_t *rw) 
+{
+    return rw->writer || ((rw->flags & ZRWLOCK_PREFER_WRITER) && rw->writers > 0);
+}
+
+void zrwlock_rdlock(zrwlock_t *rw) 
+{
+    zmutex_lock(&rw->m);
+    while (zrwlock__read_blocked(rw)) 
+    {
+        zcond_wait(&rw->readers_cv, &rw->m);
+    }
+    rw->readers++;
+    zmutex_unlock(&rw->m);
+}
+
+void zrwlock_wrlock(zrwlock_t *rw) 
+{
+    zmutex_lock(&rw->m);
+    rw->writers++;
+    while (rw->writer || rw->readers > 0) 
+    {
+        zcond_wait(&rw->writers_cv, &rw->m);
+    }
+    rw->writers--;
+    rw->writer = 1;
+    zmutex_unlock(&rw->m);
+}
+
+int zrwlock_tryrdlock(zrwlock_t *rw) 
+{
+    int rc = Z_ERR;
+    zmutex_lock(&rw->m);
+    if (!zrwlock__read_blocked(rw)) 
+    {
+        rw->readers++;
+        rc = Z_OK;
+    }
+    zmutex_unlock(&rw->m);
+    return rc;
+}
+
+int zrwlock_trywrlock(zrwlock_t *rw) 
+{
+    int rc = Z_ERR;
+    zmutex_lock(&rw->m);
+    if (!rw->writer && 0 == rw->readers) 
+    {
+        rw->writer = 1;
+        rc = Z_OK;
+    }
+    zmutex_unlock(&rw->m);
+    return rc;
+}
+
+void zrwlock_rdunlock(zrwlock_t *rw) 
+{
+    zmutex_lock(&rw->m);
+    if (0 == --rw->readers && rw->writers > 0) 
+    {
+        zcond_signal(&rw->writers_cv);
+    }
+    zmutex_unlock(&rw->m);
+}
+
+void zrwlock_wrunlock(zrwlock_t *rw) 
+{
+    zmutex_lock(&rw->m);
+    rw->writer = 0;
+    if (rw->writers > 0) 
+    {
+        zcond_signal(&rw->writers_cv);
+    }
+    zcond_broadcast(&rw->readers_cv);
+    zmutex_unlock(&rw->m);
+}
+
+void zrwlock_destroy(zrwlock_t *rw) 
+{
+    zcond_destroy(&rw->writers_cv);
+    zcond_destroy(&rw->readers_cv);
+    zmutex_destroy(&rw->m);
+}
+#endif
+
+// Distributed reader lock.
+
+struct zbrlock__slot 
+{
+    zrwlock_t lock;
+    ZTHREAD_PAD(pad, sizeof(zrwlock_t));
+};
+
+struct zbrlock 
+{
+    struct zbrlock__slot *slots;
+    int count;
+    void *raw;
+};
+
+// Per-thread ticket (0 = not assigned yet): consecutive threads get
+// consecutive slots, whatever the lock.
+static ZTHREAD_LOCAL int32_t zbrlock__ticket = 0;
+static volatile int32_t zbrlock__next_ticket = 0;
+
+static zrwlock_t *zbrlock__mine(zbrlock_t *b) 
+{
+    int32_t t = zbrlock__ticket;
+    if (0 == t) 
+    {
+        t = zthread__fadd32(&zbrlock__next_ticket, 1, ZTHREAD__RLX) + 1;
+        // Skip 0 on wrap-around.
+        if (t <= 0) 
+        {
+            t = 1;
+        }
+        zbrlock__ticket = t;
+    }
+    return &b->slots[(t - 1) % b->count].lock;
+}
+
+zbrlock_t *zbrlock_create(int slots, int flags) 
+{
+    zbrlock_t *b;
+    int i;
+
+    if (flags & ~ZRWLOCK_PREFER_WRITER) 
+    {
+        return NULL;
+    }
+    if (slots <= 0) 
+    {
+        slots = zthread_cpu_count();
+    }
+    b = (zbrlock_t*)ZTHREAD_CALLOC(1, sizeof(*b));
+    if (!b) 
+    {
+        return NULL;
+    }
+    b->raw = ZTHREAD_MALLOC((size_t)slots * sizeof(struct zbrlock__slot) + ZTHREAD_CACHE_LINE - 1);
+    if (!b->raw) 
+    {
+        ZTHREAD_FREE(b);
+        return NULL;
+    }
+    b->slots = (struct zbrlock__slot*)(((uintptr_t)b->raw + ZTHREAD_CACHE_LINE - 1) & ~(uintptr_t)(ZTHREAD_CACHE_LINE - 1));
+    b->count = slots;
+    for (i = 0; i < slots; i++) 
+    {
+        zrwlock_init_ex(&b->slots[i].lock, flags);
+    }
+    return b;
+}
+
+void zbrlock_destroy(zbrlock_t *b) 
+{
+    int i;
+    if (!b) 
+    {
+        return;
+    }
+    for (i = 0; i < b->count; i++) 
+    {
+        zrwlock_destroy(&b->slots[i].lock);
+    }
+    ZTHREAD_FREE(b->raw);
+    ZTHREAD_FREE(b);
+}
+
+void zbrlock_rdlock(zbrlock_t *b) 
+{
+    zrwlock_rdlock(zbrlock__mine(b));
+}
+
+void zbrlock_rdunlock(zbrlock_t *b) 
+{
+    zrwlock_rdunlock(zbrlock__mine(b));
+}
+
+int zbrlock_tryrdlock(zbrlock_t *b) 
+{
+    return zrwlock_tryrdlock(zbrlock__mine(b));
+}
+
+// Always in slot order, so concurrent writers cannot deadlock.
+void zbrlock_wrlock(zbrlock_t *b) 
+{
+    int i;
+    for (i = 0; i < b->count; i++) 
+    {
+        zrwlock_wrlock(&b->slots[i].lock);
+    }
+}
+
+int zbrlock_trywrlock(zbrlock_t *b) 
+{
+    int i;
+    for (i = 0; i < b->count; i++) 
+    {
+        if (zrwlock_trywrlock(&b->slots[i].lock) != Z_OK) 
+        {
+            while (--i >= 0) 
+            {
+                zrwlock_wrunlock(&b->slots[i].lock);
+            }
+            return Z_ERR;
+        }
+    }
+    return Z_OK;
+}
+
+void zbrlock_wrunlock(zbrlock_t *b) 
+{
+    int i;
+    for (i = b->count - 1; i >= 0; i--) 
+    {
+        zrwlock_wrunlock(&b->slots[i].lock);
+    }
+}
+
+int zbrlock_slots(const zbrlock_t *b) 
+{
+    return b->count;
+}
+
+// Barriers and latches.
+
+// Waits while *word == val: spin first, then park on 'sem'. The waker changes
+// the word, then takes the whole 'sleepers' count and posts that many tokens.
+static void zthread__wait_word(volatile int32_t *word, int32_t val, int spin,
+                               volatile int32_t *sleepers, zsem_t *sem) 
+{
+    int32_t n;
+    int i;
+    for (i = 0; i < spin; i++) 
+    {
+        if (zthread__ld32(word, ZTHREAD__ACQ) != val) 
+        {
+            return;
+        }
+        ZTHREAD__PAUSE();
+    }
+    zthread__fadd32(sleepers, 1, ZTHREAD__SEQ);
+    if (zthread__ld32(word, ZTHREAD__SEQ) == val) 
+    {
+        zsem_wait(sem);
+        return;
+    }
+    // Released meanwhile: withdraw a registration the waker has not taken
+    // yet, or consume the token it posted for us.
+    n = zthread__ld32(sleepers, ZTHREAD__RLX);
+    while (n > 0) 
+    {
+        if (zatomic_cas32(sleepers, &n, n - 1, ZATOMIC_SEQ_CST)) 
+        {
+            return;
+        }
+    }
+    zsem_wait(sem);
+}
+
+static void zthread__wake_word(volatile int32_t *sleepers, zsem_t *sem) 
+{
+    int32_t n = zthread__xchg32(sleepers, 0, ZTHREAD__SEQ);
+    while (n-- > 0) 
+    {
+        zsem_post(sem);
+    }
+}
+
+static int zthread__wait_spin(void) 
+{
+    return zthread_cpu_count() > 1 ? ZTHREAD_WAIT_SPIN : 0;
+}
+
+int zbarrier_init(zbarrier_t *b, int count) 
+{
+    if (count <= 0) 
+    {
+        return Z_EINVAL;
+    }
+    if (zsem_init(&b->sem[0], 0) != Z_OK) 
+    {
+        return Z_ERR;
+    }
+    if (zsem_init(&b->sem[1], 0) != Z_OK) 
+    {
+        zsem_destroy(&b->sem[0]);
+        return Z_ERR;
+    }
+    b->total = count;
+    b->spin = zthread__wait_spin();
+    zthread__st32(&b->sleepers[0], 0, ZTHREAD__RLX);
+    zthread__st32(&b->sleepers[1], 0, ZTHREAD__RLX);
+    zthread__st32(&b->phase, 0, ZTHREAD__RLX);
+    zthread__st32(&b->remaining, count, ZTHREAD__REL);
+    return Z_OK;
+}
+
+// Each phase parks on its own semaphore: a thread still leaving phase k
+// cannot have its token taken by a thread already parked in phase k + 1
+// (phase k + 2, which reuses it, needs that thread to arrive first).
+int zbarrier_wait(zbarrier_t *b) 
+{
+    int32_t phase = zthread__ld32(&b->phase, ZTHREAD__ACQ);
+    int k = phase & 1;
+
+    if (zthread__fadd32(&b->remaining, -1, ZTHREAD__ACQ_REL) == 1) 
+    {
+        // Last arrival: re-arm, then flip the phase.
+        zthread__st32(&b->remaining, b->total, ZTHREAD__RLX);
+        zthread__st32(&b->phase, phase + 1, ZTHREAD__SEQ);
+        zthread__wake_word(&b->sleepers[k], &b->sem[k]);
+        return ZBARRIER_SERIAL;
+    }
+    zthread__wait_word(&b->phase, phase, b->spin, &b->sleepers[k], &b->sem[k]);
+    return 0;
+}
+
+void zbarrier_destroy(zbarrier_t *b) 
+{
+    zsem_destroy(&b->sem[1]);
+    zsem_destroy(&b->sem[0]);
+}
+
+int zlatch_init(zlatch_t *l, int count) 
+{
+    if (count < 0) 
+    {
+        return Z_EINVAL;
+    }
+    if (zsem_init(&l->sem, 0) != Z_OK) 
+    {
+        return Z_ERR;
+    }
+    l->spin = zthread__wait_spin();
+    zthread__st32(&l->sleepers, 0, ZTHREAD__RLX);
+    zthread__st32(&l->done, 0 == count, ZTHREAD__RLX);
+    zthread__st32(&l->count, count, ZTHREAD__REL);
+    return Z_OK;
+}
+
+void zlatch_count_down(zlatch_t *l, int n) 
+{
+    int32_t before = zthread__fadd32(&l->count, -n, ZTHREAD__ACQ_REL);
+    if (before > 0 && before - n <= 0) 
+    {
+        zthread__st32(&l->done, 1, ZTHREAD__SEQ);
+        zthread__wake_word(&l->sleepers, &l->sem);
+    }
+}
+
+int zlatch_try_wait(const zlatch_t *l) 
+{
+    return zthread__ld32(&l->done, ZTHREAD__ACQ) != 0;
+}
+
+void zlatch_wait(zlatch_t *l) 
+{
+    zthread__wait_word(&l->done, 0, l->spin, &l->sleepers, &l->sem);
+}
+
+void zlatch_arrive_and_wait(zlatch_t *l, int n) 
+{
+    zlatch_count_down(l, n);
+    zlatch_wait(l);
+}
+
+void zlatch_destroy(zlatch_t *l) 
+{
+    zsem_destroy(&l->sem);
+}
+
+#ifdef ZTHREAD__FUTEX
+// Futex backend (Drepper, "Futexes Are Tricky", mutex #3).
+
+#define ZMUTEX__STATE    3
+#define ZMUTEX__ADAPTIVE (1 << 30)
+#define ZMUTEX__SPIN     128
+
+#ifdef _WIN32
+#   ifdef _MSC_VER
+#       pragma comment(lib, "synchronization.lib")
+#   endif
+// Sleeps while *addr == val. A negative timeout waits forever.
+static int zthread__futex_wait(volatile int32_t *addr, int32_t val, int64_t timeout_ns) 
+{
+    DWORD ms = timeout_ns < 0 ? INFINITE : zthread__ns_to_ms(timeout_ns);
+    if (!WaitOnAddress((volatile VOID*)addr, &val, sizeof(val), ms) && ERROR_TIMEOUT == GetLastError()) 
+    {
+        return Z_ETIMEDOUT;
+    }
+    return Z_OK;
+}
+
+static void zthread__futex_wake(volatile int32_t *addr, int all) 
+{
+    if (all) 
+    {
+        WakeByAddressAll((PVOID)addr);
+    } 
+    else 
+    {
+        WakeByAddressSingle((PVOID)addr);
+    }
+}
+#else
+#   include <limits.h>
+#   include <linux/futex.h>
+// Sleeps while *addr == val. A negative timeout waits forever.
+static int zthread__futex_wait(volatile int32_t *addr, int32_t val, int64_t timeout_ns) 
+{
+    struct timespec rel, *prel = NULL;
+    if (timeout_ns >= 0) 
+    {
+        rel.tv_sec = (time_t)(timeout_ns / 1000000000);
+        rel.tv_nsec = (long)(timeout_ns % 1000000000);
+        prel = &rel;
+    }
+    if (-1 == syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, prel, NULL, 0) && ETIMEDOUT == errno) 
+    {
+        return Z_ETIMEDOUT;
+    }
+    return Z_OK;
+}
+
+static void zthread__futex_wake(volatile int32_t *addr, int all) 
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+}
+#endif
+
+void zmutex_init(zmutex_t *m) 
+{ 
+    zthread__st32(&m->state, 0, ZTHREAD__REL); 
+}
+
+int zmutex_init_ex(zmutex_t *m, int flags) 
+{
+    if (flags & ~ZMUTEX_ADAPTIVE) 
+    {
+        return Z_EINVAL;
+    }
+    zthread__st32(&m->state, (flags & ZMUTEX_ADAPTIVE) ? ZMUTEX__ADAPTIVE : 0, ZTHREAD__REL);
+    return Z_OK;
+}
+
+// Slow path: mark the lock contended (2) and sleep until we are the one who
+// swapped it out of the free state.
+static void zmutex__lock_contended(zmutex_t *m, int32_t mode) 
+{
+    while (zthread__xchg32(&m->state, mode | 2, ZTHREAD__ACQ) & ZMUTEX__STATE) 
+    {
+        zthread__futex_wait(&m->state, mode | 2, -1);
+    }
+}
+
+ZTHREAD__NOIPA void zmutex_lock(zmutex_t *m) 
+{
+    // The mode bit never changes after init, so it can be read once.
+    int32_t mode = zthread__ld32(&m->state, ZTHREAD__RLX) & ~ZMUTEX__STATE;
+
+    if (zthread__cas32(&m->state, mode, mode | 1)) 
+    {
+        return;
+    }
+    if (mode & ZMUTEX__ADAPTIVE) 
+    {
+        // Exponential backoff; give up early once someone is already parked.
+        int spins, i;
+        for (spins = 1; spins <= ZMUTEX__SPIN; spins <<= 1) 
+        {
+            int32_t s;
+            for (i = 0; i < spins; i++) 
+            {
+                ZTHREAD__PAUSE();
+            }
+            s = zthread__ld32(&m->state, ZTHREAD__RLX) & ZMUTEX__STATE;
+            if (s == 0 && zthread__cas32(&m->state, mode, mode | 1)) 
+            {
+                return;
+            }
+            if (s == 2) 
+            {
+                break;
+            }
+        }
+    }
+    zmutex__lock_contended(m, mode);
+}
+
+ZTHREAD__NOIPA void zmutex_unlock(zmutex_t *m) 
+{
+    // 1 -> 0 is the uncontended case; only 2 (waiters) needs a wake.
+    if ((zthread__fadd32(&m->state, -1, ZTHREAD__REL) & ZMUTEX__STATE) != 1) 
+    {
+        zthread__st32(&m->state, zthread__ld32(&m->state, ZTHREAD__RLX) & ~ZMUTEX__STATE, ZTHREAD__REL);
+        zthread__futex_wake(&m->state, 0);
+    }
+}
+
+void zmutex_destroy(zmutex_t *m) 
+{ 
+    (void)m; 
+}
+
+ZTHREAD__NOIPA int zmutex_trylock(zmutex_t *m) 
+{
+    int32_t mode = zthread__ld32(&m->state, ZTHREAD__RLX) & ~ZMUTEX__STATE;
+    return zthread__cas32(&m->state, mode, mode | 1) ? Z_OK : Z_ERR;
+}
+
+ZTHREAD__NOIPA int zmutex_timedlock(zmutex_t *m, int64_t timeout_ns) 
+{
+    int32_t mode = zthread__ld32(&m->state, ZTHREAD__RLX) & ~ZMUTEX__STATE;
+    int64_t deadline;
+
+    if (zthread__cas32(&m->state, mode, mode | 1)) 
+    {
+        return Z_OK;
+    }
+    deadline = zthread__mono_ns() + timeout_ns;
+    while (zthread__xchg32(&m->state, mode | 2, ZTHREAD__ACQ) & ZMUTEX__STATE) 
+    {
+        // Leaving the word at 2 on timeout only costs the owner one extra wake.
+        int64_t left = deadline - zthread__mono_ns();
+        if (left <= 0) 
+        {
+            return Z_ETIMEDOUT;
+        }
+        zthread__futex_wait(&m->state, mode | 2, left);
+    }
+    return Z_OK;
+}
+
+void zcond_init(zcond_t *c) 
+{ 
+    zthread__st32(&c->seq, 0, ZTHREAD__REL); 
+}
+
+ZTHREAD__NOIPA void zcond_wait(zcond_t *c, zmutex_t *m) 
+{
+    int32_t seq = zthread__ld32(&c->seq, ZTHREAD__ACQ);
+    int32_t mode = zthread__ld32(&m->state, ZTHREAD__RLX) & ~ZMUTEX__STATE;
+
+    zmutex_unlock(m);
+    zthread__futex_wait(&c->seq, seq, -1);
+    // Other waiters may be queued behind us, so relock in the contended state.
+    zmutex__lock_contended(m, mode);
+}
+
+ZTHREAD__NOIPA int zcond_timedwait(zcond_t *c, zmutex_t *m, int64_t timeout_ns) 
+{
+    int32_t seq = zthread__ld32(&c->seq, ZTHREAD__ACQ);
+    int32_t mode = zthread__ld32(&m->state, ZTHREAD__RLX) & ~ZMUTEX__STATE;
+    int rc;
+
+    zmutex_unlock(m);
+    rc = zthread__futex_wait(&c->seq, seq, timeout_ns < 0 ? 0 : timeout_ns);
+    zmutex__lock_contended(m, mode);
+    return rc;
+}
+
+ZTHREAD__NOIPA void zcond_signal(zcond_t *c) 
+{
+    zthread__fadd32(&c->seq, 1, ZTHREAD__REL);
+    zthread__futex_wake(&c->seq, 0);
+}
+
+ZTHREAD__NOIPA void zcond_broadcast(zcond_t *c) 
+{
+    zthread__fadd32(&c->seq, 1, ZTHREAD__REL);
+    zthread__futex_wake(&c->seq, 1);
+}
+
+void zcond_destroy(zcond_t *c) 
+{ 
+    (void)c; 
+}
+
+int zsem_init(zsem_t *s, unsigned initial) 
+{
+    if (initial > 0x7FFFFFFFu) 
+    {
+        return Z_EINVAL;
+    }
+    zthread__st32(&s->waiters, 0, ZTHREAD__RLX);
+    zthread__st32(&s->count, (int32_t)initial, ZTHREAD__REL);
+    return Z_OK;
+}
+
+int zsem_trywait(zsem_t *s) 
+{
+    int32_t c = zthread__ld32(&s->count, ZTHREAD__RLX);
+    while (c > 0) 
+    {
+        if (zatomic_cas32(&s->count, &c, c - 1, ZATOMIC_ACQUIRE)) 
+        {
+            return Z_OK;
+        }
+    }
+    return Z_ERR;
+}
+
+// 'waiters' is raised before sleeping on count == 0, and zsem_post reads it
+// after raising the count (both seq_cst): a post never misses a sleeper.
+// A negative timeout waits forever.
+ZTHREAD__NOIPA static int zsem__wait(zsem_t *s, int64_t timeout_ns) 
+{
+    int64_t deadline = timeout_ns < 0 ? -1 : zthread__mono_ns() + timeout_ns;
+    while (Z_OK != zsem_trywait(s)) 
+    {
+        int64_t left = -1;
+        if (deadline >= 0) 
+        {
+            left = deadline - zthread__mono_ns();
+            if (left <= 0) 
+            {
+                return Z_ETIMEDOUT;
+            }
+        }
+        zthread__fadd32(&s->waiters, 1, ZTHREAD__SEQ);
+        zthread__futex_wait(&s->count, 0, left);
+        zthread__fadd32(&s->waiters, -1, ZTHREAD__SEQ);
+    }
+    return Z_OK;
+}
+
+void zsem_wait(zsem_t *s) 
+{
+    zsem__wait(s, -1);
+}
+
+int zsem_timedwait(zsem_t *s, int64_t timeout_ns) 
+{
+    return zsem__wait(s, timeout_ns < 0 ? 0 : timeout_ns);
+}
+
+ZTHREAD__NOIPA void zsem_post(zsem_t *s) 
+{
+    zthread__fadd32(&s->count, 1, ZTHREAD__SEQ);
+    if (zthread__ld32(&s->waiters, ZTHREAD__SEQ) > 0) 
+    {
+        zthread__futex_wake(&s->count, 0);
+    }
+}
+
+void zsem_destroy(zsem_t *s) 
+{
+    (void)s;
+}
+#endif // ZTHREAD__FUTEX
+
+// Event counts.
+
+// A waiter raises 'waiters' before it re-checks the condition, and notify
+// reads it after the caller published (both seq_cst): either the waiter sees
+// the new state or the notifier sees the waiter and moves the epoch.
+void zeventcount_init(zeventcount_t *ec) 
+{
+    ec->epoch = 0;
+    ec->waiters = 0;
+#ifndef ZTHREAD__FUTEX
+    zmutex_init(&ec->lock);
+    zcond_init(&ec->cv);
+#endif
+}
+
+int32_t zeventcount_prepare_wait(zeventcount_t *ec) 
+{
+    zthread__fadd32(&ec->waiters, 1, ZTHREAD__SEQ);
+    return zthread__ld32(&ec->epoch, ZTHREAD__SEQ);
+}
+
+void zeventcount_cancel_wait(zeventcount_t *ec) 
+{
+    zthread__fadd32(&ec->waiters, -1, ZTHREAD__RLX);
+}
+
+void zeventcount_commit_wait(zeventcount_t *ec, int32_t key) 
+{
+#ifdef ZTHREAD__FUTEX
+    while (zthread__ld32(&ec->epoch, ZTHREAD__ACQ) == key) 
+    {
+        zthread__futex_wait(&ec->epoch, key, -1);
+    }
+#else
+    zmutex_lock(&ec->lock);
+    while (zthread__ld32(&ec->epoch, ZTHREAD__ACQ) == key) 
+    {
+        zcond_wait(&ec->cv, &ec->lock);
+    }
+    zmutex_unlock(&ec->lock);
+#endif
+    zthread__fadd32(&ec->waiters, -1, ZTHREAD__RLX);
+}
+
+static void zeventcount__notify(zeventcount_t *ec, int all) 
+{
+    zthread__fence(ZTHREAD__SEQ);
+    if (0 == zthread__ld32(&ec->waiters, ZTHREAD__SEQ)) 
+    {
+        return;
+    }
+#ifdef ZTHREAD__FUTEX
+    zthread__fadd32(&ec->epoch, 1, ZTHREAD__REL);
+    zthread__futex_wake(&ec->epoch, all);
+#else
+    // Under the lock, so a waiter cannot check the epoch and then miss the signal.
+    zmutex_lock(&ec->lock);
+    zthread__fadd32(&ec->epoch, 1, ZTHREAD__REL);
+    if (all) 
+    {
+        zcond_broadcast(&ec->cv);
+    } 
+    else 
+    {
+        zcond_signal(&ec->cv);
+    }
+    zmutex_unlock(&ec->lock);
+#endif
+}
+
+void zeventcount_notify(zeventcount_t *ec) 
+{
+    zeventcount__notify(ec, 0);
+}
+
+void zeventcount_notify_all(zeventcount_t *ec) 
+{
+    zeventcount__notify(ec, 1);
+}
+
+void zeventcount_destroy(zeventcount_t *ec) 
+{
+#ifndef ZTHREAD__FUTEX
+    zcond_destroy(&ec->cv);
+    zmutex_destroy(&ec->lock);
+#else
+    (void)ec;
+#endif
+}
+
+// Thread parking.
+
+#define ZPARKER__EMPTY    0
+#define ZPARKER__NOTIFIED 1
+#define ZPARKER__PARKED   (-1)
+
+struct zparker 
+{
+    volatile int32_t state;     // ZPARKER__*.
+#ifndef ZTHREAD__FUTEX
+    int32_t ready;              // 'lock' and 'cv' are initialized (owner only).
+    zmutex_t lock;
+    zcond_t cv;
+#endif
+};
+
+static ZTHREAD_LOCAL struct zparker zthread__parker_tls;
+
+#ifndef ZTHREAD__FUTEX
+static ztls_key_t zthread__parker_key;
+static volatile int32_t zthread__parker_state = 0;  // zthread__once.
+
+static void zthread__parker_exit(void *arg) 
+{
+    struct zparker *p = (struct zparker*)arg;
+    // An unparker that published our token may still be signalling.
+    zmutex_lock(&p->lock);
+    zmutex_unlock(&p->lock);
+    zcond_destroy(&p->cv);
+    zmutex_destroy(&p->lock);
+    p->ready = 0;
+}
+
+static int zthread__parker_init(void) 
+{
+    return ztls_key_create(&zthread__parker_key, zthread__parker_exit);
+}
+#endif
+
+zparker_t *zthread_parker(void) 
+{
+    struct zparker *p = &zthread__parker_tls;
+#ifndef ZTHREAD__FUTEX
+    if (!p->ready) 
+    {
+        int keyed = zthread__once(&zthread__parker_state, zthread__parker_init);
+        zmutex_init(&p->lock);
+        zcond_init(&p->cv);
+        p->ready = 1;
+        // Without the key the objects are simply never destroyed.
+        if (keyed) 
+        {
+            ztls_set(zthread__parker_key, p);
+        }
+    }
+#endif
+    return p;
+}
+
+#ifdef ZTHREAD__FUTEX
+void zthread_park(void) 
+{
+    struct zparker *p = zthread_parker();
+    // EMPTY -> PARKED, or NOTIFIED -> EMPTY when a token was already there.
+    if (zthread__fadd32(&p->state, -1, ZTHREAD__ACQ) == ZPARKER__NOTIFIED) 
+    {
+        return;
+    }
+    for (;;) 
+    {
+        zthread__futex_wait(&p->state, ZPARKER__PARKED, -1);
+        if (zthread__cas32(&p->state, ZPARKER__NOTIFIED, ZPARKER__EMPTY)) 
+        {
+            return;
+        }
+    }
+}
+
+int zthread_park_for(int64_t timeout_ns) 
+{
+    struct zparker *p = zthread_parker();
+    if (zthread__fadd32(&p->state, -1, ZTHREAD__ACQ) == ZPARKER__NOTIFIED) 
+    {
+        return Z_OK;
+    }
+    zthread__futex_wait(&p->state, ZPARKER__PARKED, timeout_ns < 0 ? 0 : timeout_ns);
+    return (zthread__xchg32(&p->state, ZPARKER__EMPTY, ZTHREAD__ACQ) == ZPARKER__NOTIFIED) ? Z_OK : Z_ETIMEDOUT;
+}
+
+void zthread_unpark(zparker_t *p) 
+{
+    if (zthread__xchg32(&p->state, ZPARKER__NOTIFIED, ZTHREAD__REL) == ZPARKER__PARKED) 
+    {
+        zthread__futex_wake(&p->state, 0);
+    }
+}
+#else
+// The parker holds 'lock' from its EMPTY -> PARKED step until zcond_wait
+// releases it, so an unparker that takes 'lock' cannot signal too early.
+// Returns 0 if a token was taken without sleeping.
+static int zthread__park_begin(struct zparker *p) 
+{
+    if (zthread__cas32(&p->state, ZPARKER__NOTIFIED, ZPARKER__EMPTY)) 
+    {
+        return 0;
+    }
+    zmutex_lock(&p->lock);
+    if (!zthread__cas32(&p->state, ZPARKER__EMPTY, ZPARKER__PARKED)) 
+    {
+        // Unparked in between.
+        zthread__st32(&p->state, ZPARKER__EMPTY, ZTHREAD__RLX);
+        zmutex_unlock(&p->lock);
+        return 0;
+    }
+    return 1;
+}
+
+void zthread_park(void) 
+{
+    struct zparker *p = zthread_parker();
+    if (!zthread__park_begin(p)) 
+    {
+        return;
+    }
+    for (;;) 
+    {
+        zcond_wait(&p->cv, &p->lock);
+        if (zthread__cas32(&p->state, ZPARKER__NOTIFIED, ZPARKER__EMPTY)) 
+        {
+            break;
+        }
+    }
+    zmutex_unlock(&p->lock);
+}
+
+int zthread_park_for(int64_t timeout_ns) 
+{
+    struct zparker *p = zthread_parker();
+    int rc;
+    if (!zthread__park_begin(p)) 
+    {
+        return Z_OK;
+    }
+    zcond_timedwait(&p->cv, &p->lock, timeout_ns < 0 ? 0 : timeout_ns);
+    rc = (zthread__xchg32(&p->state, ZPARKER__EMPTY, ZTHREAD__ACQ) == ZPARKER__NOTIFIED) ? Z_OK : Z_ETIMEDOUT;
+    zmutex_unlock(&p->lock);
+    return rc;
+}
+
+void zthread_unpark(zparker_t *p) 
+{
+    if (zthread__ld32(&p->state, ZTHREAD__ACQ) == ZPARKER__NOTIFIED) 
+    {
+        return;
+    }
+    // Publish and signal inside the lock: once the parker can see the token
+    // it may return and exit, and zthread__parker_exit waits for the lock.
+    zmutex_lock(&p->lock);
+    if (zthread__xchg32(&p->state, ZPARKER__NOTIFIED, ZTHREAD__REL) == ZPARKER__PARKED) 
+    {
+        zcond_signal(&p->cv);
+    }
+    zmutex_unlock(&p->lock);
+}
+#endif
+
+// Lock profiling.
+#ifdef ZTHREAD_PROFILE
+#undef zmutex_lock
+#undef zmutex_unlock
+#undef zmutex_trylock
+#undef zmutex_timedlock
+#undef zmutex_destroy
+#undef zcond_wait
+#undef zcond_timedwait
+#undef zcond_destroy
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#   include <intrin.h>
+#   define ZPROFILE__TICKS() ((int64_t)__rdtsc())
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   include <x86intrin.h>
+#   define ZPROFILE__TICKS() ((int64_t)__rdtsc())
+#elif defined(__GNUC__) && defined(__aarch64__)
+static inline int64_t zprofile__cntvct(void) 
+{
+    int64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+}
+#   define ZPROFILE__TICKS() zprofile__cntvct()
+#elif defined(_WIN32)
+static inline int64_t zprofile__qpc(void) 
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (int64_t)now.QuadPart;
+}
+#   define ZPROFILE__TICKS() zprofile__qpc()
+#else
+#   define ZPROFILE__TICKS() zthread__mono_ns()
+#endif
+
+// Counters are in ticks; the report scales them by the rate measured between
+// the first slot's creation and the read.
+struct zprofile__entry 
+{
+    void *volatile key;         // NULL (free), the lock, or &zprofile__gone.
+    const void *lock;
+    const char *volatile name;
+    volatile int32_t kind;
+    volatile int64_t acquires;
+    volatile int64_t contended;
+    volatile int64_t wait;
+    volatile int64_t max_wait;
+    volatile int64_t hold;
+    int64_t held_at;            // Written by the holder only.
+};
+
+static struct zprofile__entry zprofile__table[ZTHREAD_PROFILE_SLOTS];
+static char zprofile__gone;
+static volatile int32_t zprofile__state = 0;   // zthread__once.
+static int64_t zprofile__base_ticks;
+static int64_t zprofile__base_ns;
+
+static int zprofile__calibrate(void) 
+{
+    zprofile__base_ns = zthread__mono_ns();
+    zprofile__base_ticks = ZPROFILE__TICKS();
+    return Z_OK;
+}
+
+static void zprofile__start(void) 
+{
+    zthread__once(&zprofile__state, zprofile__calibrate);
+}
+
+// The slot of 'lock', created on first use. NULL once the table is full.
+static struct zprofile__entry *zprofile__get(const void *lock, int kind) 
+{
+    size_t h = (size_t)(((uintptr_t)lock >> 3) * (uintptr_t)2654435761u) % ZTHREAD_PROFILE_SLOTS;
+    size_t i;
+    for (i = 0; i < ZTHREAD_PROFILE_SLOTS; i++) 
+    {
+        struct zprofile__entry *e = &zprofile__table[(h + i) % ZTHREAD_PROFILE_SLOTS];
+        void *k = zthread__ldp(&e->key, ZTHREAD__ACQ);
+        if (k == lock) 
+        {
+            // A slot named before first use may have guessed the kind wrong.
+            if (zthread__ld32(&e->kind, ZTHREAD__RLX) != kind) 
+            {
+                zthread__st32(&e->kind, kind, ZTHREAD__REL);
+            }
+            return e;
+        }
+        if (NULL == k) 
+        {
+            zprofile__start();
+            if (zatomic_cas_ptr(&e->key, &k, (void*)lock, ZATOMIC_SEQ_CST)) 
+            {
+                e->lock = lock;
+                zthread__st32(&e->kind, kind, ZTHREAD__REL);
+                return e;
+            }
+            if (k == lock) 
+            {
+                return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+static struct zprofile__entry *zprofile__find(const void *lock) 
+{
+    size_t h = (size_t)(((uintptr_t)lock >> 3) * (uintptr_t)2654435761u) % ZTHREAD_PROFILE_SLOTS;
+    size_t i;
+    for (i = 0; i < ZTHREAD_PROFILE_SLOTS; i++) 
+    {
+        struct zprofile__entry *e = &zprofile__table[(h + i) % ZTHREAD_PROFILE_SLOTS];
+        void *k = zthread__ldp(&e->key, ZTHREAD__ACQ);
+        if (k == lock || NULL == k) 
+        {
+            return k ? e : NULL;
+        }
+    }
+    return NULL;
+}
+
+static void zprofile__waited(struct zprofile__entry *e, int64_t ticks, int contended) 
+{
+    int64_t max = zthread__ld(&e->max_wait, ZTHREAD__RLX);
+    zthread__fadd(&e->wait, ticks, ZTHREAD__RLX);
+    if (contended) 
+    {
+        zthread__fadd(&e->contended, 1, ZTHREAD__RLX);
+    }
+    while (ticks > max && !zatomic_cas64(&e->max_wait, &max, ticks, ZATOMIC_RELAXED)) 
+    {
+    }
+}
+
+static void zprofile__acquired(struct zprofile__entry *e, int64_t now) 
+{
+    zthread__fadd(&e->acquires, 1, ZTHREAD__RLX);
+    e->held_at = now;
+}
+
+static void zprofile__released(struct zprofile__entry *e) 
+{
+    zthread__fadd(&e->hold, ZPROFILE__TICKS() - e->held_at, ZTHREAD__RLX);
+}
+
+// Keeps the stats, but a new lock at the same address gets a fresh slot.
+static void zprofile__retire(const void *lock) 
+{
+    struct zprofile__entry *e = zprofile__find(lock);
+    if (e) 
+    {
+        zthread__stp(&e->key, &zprofile__gone, ZTHREAD__REL);
+    }
+}
+
+void zmutex_lock(zmutex_t *m) 
+{
+    struct zprofile__entry *e = zprofile__get(m, ZPROFILE_MUTEX);
+    int64_t t0;
+    if (!e) 
+    {
+        zmutex__native_lock(m);
+        return;
+    }
+    if (zmutex__native_trylock(m) == Z_OK) 
+    {
+        zprofile__acquired(e, ZPROFILE__TICKS());
+        return;
+    }
+    t0 = ZPROFILE__TICKS();
+    zmutex__native_lock(m);
+    {
+        int64_t t1 = ZPROFILE__TICKS();
+        zprofile__waited(e, t1 - t0, 1);
+        zprofile__acquired(e, t1);
+    }
+}
+
+int zmutex_trylock(zmutex_t *m) 
+{
+    struct zprofile__entry *e = zprofile__get(m, ZPROFILE_MUTEX);
+    if (zmutex__native_trylock(m) != Z_OK) 
+    {
+        return Z_ERR;
+    }
+    if (e) 
+    {
+        zprofile__acquired(e, ZPROFILE__TICKS());
+    }
+    return Z_OK;
+}
+
+int zmutex_timedlock(zmutex_t *m, int64_t timeout_ns) 
+{
+    struct zprofile__entry *e = zprofile__get(m, ZPROFILE_MUTEX);
+    int64_t t0, t1;
+    int rc;
+    if (zmutex__native_trylock(m) == Z_OK) 
+    {
+        if (e) 
+        {
+            zprofile__acquired(e, ZPROFILE__TICKS());
+        }
+        return Z_OK;
+    }
+    t0 = ZPROFILE__TICKS();
+    rc = zmutex__native_timedlock(m, timeout_ns);
+    t1 = ZPROFILE__TICKS();
+    if (e) 
+    {
+        zprofile__waited(e, t1 - t0, 1);
+        if (Z_OK == rc) 
+        {
+            zprofile__acquired(e, t1);
+        }
+    }
+    return rc;
+}
+
+void zmutex_unlock(zmutex_t *m) 
+{
+    struct zprofile__entry *e = zprofile__find(m);
+    if (e) 
+    {
+        zprofile__released(e);
+    }
+    zmutex__native_unlock(m);
+}
+
+void zmutex_destroy(zmutex_t *m) 
+{
+    zprofile__retire(m);
+    zmutex__native_destroy(m);
+}
+
+// The mutex is not held while blocked, so that time counts as wait on the
+// cond, not as hold time on the mutex.
+void zcond_wait(zcond_t *c, zmutex_t *m) 
+{
+    struct zprofile__entry *ce = zprofile__get(c, ZPROFILE_COND);
+    struct zprofile__entry *me = zprofile__find(m);
+    int64_t t0 = ZPROFILE__TICKS(), t1;
+    if (me) 
+    {
+        zprofile__released(me);
+    }
+    zcond__native_wait(c, m);
+    t1 = ZPROFILE__TICKS();
+    if (me) 
+    {
+        me->held_at = t1;
+    }
+    if (ce) 
+    {
+        zthread__fadd(&ce->acquires, 1, ZTHREAD__RLX);
+        zprofile__waited(ce, t1 - t0, 0);
+    }
+}
+
+int zcond_timedwait(zcond_t *c, zmutex_t *m, int64_t timeout_ns) 
+{
+    struct zprofile__entry *ce = zprofile__get(c, ZPROFILE_COND);
+    struct zprofile__entry *me = zprofile__find(m);
+    int64_t t0 = ZPROFILE__TICKS(), t1;
+    int rc;
+    if (me) 
+    {
+        zprofile__released(me);
+    }
+    rc = zcond__native_timedwait(c, m, timeout_ns);
+    t1 = ZPROFILE__TICKS();
+    if (me) 
+    {
+        me->held_at = t1;
+    }
+    if (ce) 
+    {
+        zthread__fadd(&ce->acquires, 1, ZTHREAD__RLX);
+        zprofile__waited(ce, t1 - t0, Z_ETIMEDOUT == rc);
+    }
+    return rc;
+}
+
+void zcond_destroy(zcond_t *c) 
+{
+    zprofile__retire(c);
+    zcond__native_destroy(c);
+}
+
+void zthread_profile_name(const void *lock, const char *name) 
+{
+    // The kind is fixed by the first lock call; until then assume a mutex.
+    struct zprofile__entry *e = zprofile__find(lock);
+    if (!e) 
+    {
+        e = zprofile__get(lock, ZPROFILE_MUTEX);
+    }
+    if (e) 
+    {
+        zthread__stp((void *volatile*)&e->name, (void*)name, ZTHREAD__REL);
+    }
+}
+
+// Nanoseconds per tick, from the time since the first slot was made.
+static double zprofile__scale(void) 
+{
+    int64_t ns, ticks;
+    if (zthread__ld32(&zprofile__state, ZTHREAD__ACQ) != 2) 
+    {
+        return 1.0;
+    }
+    ns = zthread__mono_ns() - zprofile__base_ns;
+    if (ns < 1000000) 
+    {
+        // Too short to measure the rate: wait a little.
+        zthread_sleep(10);
+        ns = zthread__mono_ns() - zprofile__base_ns;
+    }
+    ticks = ZPROFILE__TICKS() - zprofile__base_ticks;
+    return ticks > 0 ? (double)ns / (double)ticks : 1.0;
+}
+
+static int zprofile__read(int cursor, zprofile_stats_t *out, double scale) 
+{
+    for (; cursor < ZTHREAD_PROFILE_SLOTS; cursor++) 
+    {
+        struct zprofile__entry *e = &zprofile__table[cursor];
+        void *k = zthread__ldp(&e->key, ZTHREAD__ACQ);
+        if (!k) 
+        {
+            continue;
+        }
+        out->lock = e->lock;
+        out->name = (const char*)zthread__ldp((void *const volatile*)&e->name, ZTHREAD__ACQ);
+        out->kind = zthread__ld32(&e->kind, ZTHREAD__ACQ);
+        out->destroyed = (k == (void*)&zprofile__gone);
+        out->acquires = zthread__ld(&e->acquires, ZTHREAD__RLX);
+        out->contended = zthread__ld(&e->contended, ZTHREAD__RLX);
+        out->wait_ns = (int64_t)((double)zthread__ld(&e->wait, ZTHREAD__RLX) * scale);
+        out->max_wait_ns = (int64_t)((double)zthread__ld(&e->max_wait, ZTHREAD__RLX) * scale);
+        out->hold_ns = (int64_t)((double)zthread__ld(&e->hold, ZTHREAD__RLX) * scale);
+        return cursor + 1;
+    }
+    return 0;
+}
+
+int zthread_profile_next(int cursor, zprofile_stats_t *out) 
+{
+    return zprofile__read(cursor, out, zprofile__scale());
+}
+
+void zthread_profile_reset(void) 
+{
+    int i;
+    for (i = 0; i < ZTHREAD_PROFILE_SLOTS; i++) 
+    {
+        struct zprofile__entry *e = &zprofile__table[i];
+        zthread__st(&e->acquires, 0, ZTHREAD__RLX);
+        zthread__st(&e->contended, 0, ZTHREAD__RLX);
+        zthread__st(&e->wait, 0, ZTHREAD__RLX);
+        zthread__st(&e->max_wait, 0, ZTHREAD__RLX);
+        zthread__st(&e->hold, 0, ZTHREAD__RLX);
+    }
+}
+
+void zthread_profile_dump(FILE *out) 
+{
+    zprofile_stats_t s;
+    double scale = zprofile__scale();
+    int it = 0;
+    if (!out) 
+    {
+        out = stderr;
+    }
+    fprintf(out, "%-18s %-20s %-5s %12s %12s %14s %12s %14s\n",
+            "lock", "name", "kind", "acquires", "contended", "wait_ns", "max_wait_ns", "hold_ns");
+    while ((it = zprofile__read(it, &s, scale))) 
+    {
+        if (0 == s.acquires && 0 == s.contended) 
+        {
+            continue;
+        }
+        fprintf(out, "%-18p %-20s %-5s %12lld %12lld %14lld %12lld %14lld\n",
+                s.lock, s.name ? s.name : (s.destroyed ? "(destroyed)" : "-"),
+                ZPROFILE_COND == s.kind ? "cond" : "mutex",
+                (long long)s.acquires, (long long)s.contended, (long long)s.wait_ns,
+                (long long)s.max_wait_ns, (long long)s.hold_ns);
+    }
+    fflush(out);
+}
+#endif // ZTHREAD_PROFILE
+
+// Scheduler tracing.
+#ifdef ZTHREAD_TRACE
+#if ZTHREAD_TRACE_EVENTS < 2 || (ZTHREAD_TRACE_EVENTS & (ZTHREAD_TRACE_EVENTS - 1)) != 0
+#   error "ZTHREAD_TRACE_EVENTS must be a power of two"
+#endif
+
+#define ZTRACE__MASK ((int64_t)ZTHREAD_TRACE_EVENTS - 1)
+
+// One ring per worker thread, written by that thread only. The registry only
+// grows: a worker that exits leaves its events for the next flush, and a ring
+// is handed to a new worker once it is both unowned and drained.
+struct ztrace__ring 
+{
+    volatile int64_t head;      // Events written (owner only).
+    int64_t tail;               // Events flushed (under ztrace__lock).
+    struct ztrace__ring *next;
+    volatile int32_t owned;
+    uint32_t thread;
+    int32_t kind;
+    int32_t worker;
+    const void *sched;
+    ztrace_event_t ev[ZTHREAD_TRACE_EVENTS];
+};
+
+static struct ztrace__ring *ztrace__rings = NULL;
+static volatile int32_t ztrace__lock = 0;   // Registry and flushes; never taken per event.
+static uint32_t ztrace__threads = 0;
+
+static void ztrace__acquire(void) 
+{
+    while (!zthread__cas32(&ztrace__lock, 0, 1)) 
+    {
+        zthread_sleep(0);
+    }
+}
+
+static void ztrace__release(void) 
+{
+    zthread__st32(&ztrace__lock, 0, ZTHREAD__REL);
+}
+
+// A ring for the calling worker, or NULL (no memory: the worker is not traced).
+static struct ztrace__ring *ztrace__attach(int kind, const void *sched, int worker) 
+{
+    struct ztrace__ring *r;
+    ztrace__acquire();
+    for (r = ztrace__rings; r; r = r->next) 
+    {
+        if (!zthread__ld32(&r->owned, ZTHREAD__ACQ) && r->tail == zthread__ld(&r->head, ZTHREAD__RLX)) 
+        {
+            break;
+        }
+    }
+    if (!r) 
+    {
+        r = (struct ztrace__ring*)ZTHREAD_MALLOC(sizeof(*r));
+        if (r) 
+        {
+            r->head = 0;
+            r->tail = 0;
+            r->next = ztrace__rings;
+            ztrace__rings = r;
+        }
+    }
+    if (r) 
+    {
+        zthread__st32(&r->owned, 1, ZTHREAD__RLX);
+        r->thread = ++ztrace__threads;
+        r->kind = kind;
+        r->worker = worker;
+        r->sched = sched;
+    }
+    ztrace__release();
+    return r;
+}
+
+static void ztrace__detach(struct ztrace__ring *r) 
+{
+    if (r) 
+    {
+        zthread__st32(&r->owned, 0, ZTHREAD__REL);
+    }
+}
+
+static void ztrace__emit(struct ztrace__ring *r, int type, int32_t arg, uint64_t id) 
+{
+    int64_t h;
+    ztrace_event_t *e;
+    if (!r) 
+    {
+        return;
+    }
+    h = zthread__ld(&r->head, ZTHREAD__RLX);
+    e = &r->ev[h & ZTRACE__MASK];
+    // Keeps the slot stores after the previous 'head' store: a flush that saw
+    // them also sees that 'head', and with it that the slot was reused.
+    zthread__fence(ZTHREAD__REL);
+    e->ts_ns = zthread__mono_ns();
+    e->id = id;
+    e->type = (uint16_t)type;
+    e->reserved = 0;
+    e->arg = arg;
+    zthread__st(&r->head, h + 1, ZTHREAD__REL);
+}
+
+#define ZTRACE__EMIT(ring, type, arg, id) \
+    ztrace__emit((ring), (type), (int32_t)(arg), (uint64_t)(uintptr_t)(id))
+
+static void ztrace__json_sep(FILE *out, int *first) 
+{
+    fputs(*first ? "\n" : ",\n", out);
+    *first = 0;
+}
+
+static void ztrace__json_event(FILE *out, const struct ztrace__ring *r, const ztrace_event_t *e, int *first) 
+{
+    const char *task = (ZTRACE_FIBERS == r->kind) ? "fiber" : "task";
+    double ts = (double)e->ts_ns / 1000.0;
+
+    ztrace__json_sep(out, first);
+    fprintf(out, "{\"pid\":1,\"tid\":%u,\"ts\":%.3f,", r->thread, ts);
+    if (ZTRACE_TASK_BEGIN == e->type || ZTRACE_TASK_END == e->type) 
+    {
+        fprintf(out, "\"ph\":\"%s\",\"name\":\"%s\",\"args\":{\"%s\":\"0x%llx\"}}",
+                ZTRACE_TASK_BEGIN == e->type ? "B" : "E", task,
+                ZTRACE_FIBERS == r->kind ? "fiber" : "fn", (unsigned long long)e->id);
+    } 
+    else if (ZTRACE_STEAL == e->type || ZTRACE_STEAL_FAIL == e->type) 
+    {
+        fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\",\"args\":{\"victim\":%d}}",
+                ZTRACE_STEAL == e->type ? "steal" : "steal_fail", (int)e->arg);
+    } 
+    else if (ZTRACE_PARK == e->type || ZTRACE_UNPARK == e->type) 
+    {
+        fprintf(out, "\"ph\":\"%s\",\"name\":\"park\"}", ZTRACE_PARK == e->type ? "B" : "E");
+    } 
+    else if (ZTRACE_FIBERS == r->kind) 
+    {
+        fprintf(out, "\"ph\":\"C\",\"name\":\"queue depth\",\"args\":{\"ready\":%d}}", (int)e->arg);
+    } 
+    else 
+    {
+        fprintf(out, "\"ph\":\"C\",\"name\":\"queue depth\",\"args\":{\"local\":%d,\"inject\":%lld}}",
+                (int)e->arg, (long long)e->id);
+    }
+}
+
+// One worker's events, after its thread_name record.
+static void ztrace__json_ring(FILE *out, const struct ztrace__ring *r, const ztrace_event_t *ev, uint32_t n,
+                              int64_t dropped, int *first) 
+{
+    uint32_t i;
+    ztrace__json_sep(out, first);
+    fprintf(out, "{\"pid\":1,\"tid\":%u,\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":\"%s %p worker %d\"}}",
+            r->thread, ZTRACE_FIBERS == r->kind ? "fibers" : "pool", r->sched, (int)r->worker);
+    if (dropped > 0 && n > 0) 
+    {
+        ztrace__json_sep(out, first);
+        fprintf(out, "{\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"ph\":\"i\",\"s\":\"t\",\"name\":\"dropped\",\"args\":{\"events\":%lld}}",
+                r->thread, (double)ev[0].ts_ns / 1000.0, (long long)dropped);
+    }
+    for (i = 0; i < n; i++) 
+    {
+        ztrace__json_event(out, r, &ev[i], first);
+    }
+}
+
+int zthread_trace_flush(FILE *out, int format) 
+{
+    ztrace_event_t *buf;
+    struct ztrace__ring *r;
+    int first = 1;
+
+    if (format != ZTRACE_JSON && format != ZTRACE_BINARY) 
+    {
+        return Z_EINVAL;
+    }
+    buf = (ztrace_event_t*)ZTHREAD_MALLOC(sizeof(ztrace_event_t) * ZTHREAD_TRACE_EVENTS);
+    if (!buf) 
+    {
+        return Z_ERR;
+    }
+
+    ztrace__acquire();
+    if (ZTRACE_JSON == format) 
+    {
+        fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    } 
+    else 
+    {
+        fwrite("ZTRACE1", 1, 8, out);
+    }
+    for (r = ztrace__rings; r; r = r->next) 
+    {
+        int64_t head = zthread__ld(&r->head, ZTHREAD__ACQ);
+        int64_t start = r->tail, valid, end, i;
+
+        if (start < head - ZTHREAD_TRACE_EVENTS) 
+        {
+            start = head - ZTHREAD_TRACE_EVENTS;
+        }
+        for (i = start; i < head; i++) 
+        {
+            buf[i - start] = r->ev[i & ZTRACE__MASK];
+        }
+        // Slots the owner reused while we copied are discarded, including
+        // the one it may be writing right now.
+        zthread__fence(ZTHREAD__ACQ);
+        end = zthread__ld(&r->head, ZTHREAD__RLX);
+        valid = start;
+        if (valid < end - ZTHREAD_TRACE_EVENTS + 1) 
+        {
+            valid = end - ZTHREAD_TRACE_EVENTS + 1;
+        }
+        if (valid > head) 
+        {
+            valid = head;
+        }
+
+        if (head > r->tail) 
+        {
+            uint32_t n = (uint32_t)(head - valid);
+            int64_t dropped = valid - r->tail;
+            if (ZTRACE_JSON == format) 
+            {
+                ztrace__json_ring(out, r, buf + (valid - start), n, dropped, &first);
+            } 
+            else 
+            {
+                ztrace_block_t b;
+                b.thread = r->thread;
+                b.kind = r->kind;
+                b.worker = r->worker;
+                b.count = n;
+                b.sched = (uint64_t)(uintptr_t)r->sched;
+                b.dropped = dropped;
+                fwrite(&b, sizeof(b), 1, out);
+                fwrite(buf + (valid - start), sizeof(ztrace_event_t), n, out);
+            }
+            r->tail = head;
+        }
+    }
+    if (ZTRACE_JSON == format) 
+    {
+        fputs("\n]}\n", out);
+    }
+    ztrace__release();
+    ZTHREAD_FREE(buf);
+    return (fflush(out) != 0 || ferror(out)) ? Z_ERR : Z_OK;
+}
+#else
+#define ZTRACE__EMIT(ring, type, arg, id) ((void)0)
+#endif // ZTHREAD_TRACE
+
+// Thread pool.
+
+#define ZPOOL__DEQUE_INIT   256
+#define ZPOOL__INJECT_BATCH 16
+#define ZPOOL__SPIN_ROUNDS  64
+
+#define ZPOOL__WHEEL_BITS   6
+#define ZPOOL__WHEEL_SLOTS  64
+#define ZPOOL__WHEEL_LEVELS 6
+#define ZPOOL__WHEEL_SPAN   ((((uint64_t)1) << (ZPOOL__WHEEL_BITS * ZPOOL__WHEEL_LEVELS)) - 1)
+
+// Circular task buffer. Grown arrays keep a link to the previous one, since a
+// thief may still be reading it; the chain is released at shutdown.
+struct zpool__array 
+{
+    long long size;
+    struct zpool__array *prev;
+    void *volatile buf[1];
+};
+
+struct zpool__worker 
+{
+    // 'top' is written by thieves, 'bottom' only by the owner: keep them apart.
+    volatile int64_t top;
+    ZTHREAD_PAD(pad0, sizeof(int64_t));
+    volatile int64_t bottom;
+    void *volatile array;
+    ZTHREAD_PAD(pad1, sizeof(int64_t) + sizeof(void*));
+    zpool_t *pool;
+    zthread_t thread;
+    unsigned rng;
+    int index;
+#ifdef ZTHREAD_TRACE
+    struct ztrace__ring *trace;
+    int32_t traced_depth;       // Last ZTRACE_QUEUE_DEPTH values.
+    int64_t traced_inject;
+#endif
+};
+
+struct zpool 
+{
+    struct zpool__worker *workers;
+    int num_workers;
+    int capacity;           // Allocated workers (num_workers drops on a failed create).
+    int node;               // NUMA node for zpool_create_node, -1 otherwise.
+    zmutex_t lock;
+    zcond_t wake;
+    zcond_t idle;
+    // Injection queue for tasks submitted from outside the pool (under 'lock').
+    struct zpool__task *inject_head;
+    struct zpool__task *inject_tail;
+    volatile int64_t inject_len;
+    volatile int64_t pending;
+    volatile int64_t sleepers;
+    volatile int64_t stop;
+    // Timer wheel (under 'timer_lock'). A level-l timer agrees with
+    // 'wheel_now' on every digit above l and has a greater digit l, so each
+    // level's next slot is the lowest bit above the current digit. Timers
+    // beyond the top level wait on 'wheel_far'.
+    zmutex_t timer_lock;
+    zpool_timer_t *wheel[ZPOOL__WHEEL_LEVELS][ZPOOL__WHEEL_SLOTS];
+    uint64_t wheel_bits[ZPOOL__WHEEL_LEVELS];
+    zpool_timer_t *wheel_far;
+    uint64_t wheel_now;         // Last processed tick.
+    int64_t wheel_base;         // Monotonic ns of tick 0.
+    volatile int64_t next_timer;    // Deadline to poll at, INT64_MAX if no timer.
+    zcond_t timer_wake;         // The keeper: one idle worker sleeps until 'next_timer'.
+    int keeper;                 // Under 'lock'.
+};
+
+static ZTHREAD_LOCAL struct zpool__worker *zpool__current = NULL;
+
+// Pool memory: node-local for per-node pools.
+static void *zpool__alloc(int node, size_t sz) 
+{
+    return (node >= 0) ? ZTHREAD_NODE_MALLOC(sz, node) : ZTHREAD_MALLOC(sz);
+}
+
+static void zpool__release(int node, void *ptr, size_t sz) 
+{
+    if (node >= 0) 
+    {
+        ZTHREAD_NODE_FREE(ptr, sz, node);
+    } 
+    else 
+    {
+        ZTHREAD_FREE(ptr);
+    }
+}
+
+static size_t zpool__array_bytes(long long size) 
+{
+    return sizeof(struct zpool__array) + (size_t)(size - 1) * sizeof(void*);
+}
+
+static struct zpool__array *zpool__array_new(int node, long long size) 
+{
+    struct zpool__array *a = (struct zpool__array*)zpool__alloc(node, zpool__array_bytes(size));
+    if (a) 
+    {
+        a->size = size;
+        a->prev = NULL;
+    }
+    return a;
+}
+
+// Owner only.
+static int zpool__push(struct zpool__worker *w, struct zpool__task *t) 
+{
+    long long b = zthread__ld(&w->bottom, ZTHREAD__RLX);
+    long long top = zthread__ld(&w->top, ZTHREAD__ACQ);
+    struct zpool__array *a = (struct zpool__array*)zthread__ldp(&w->array, ZTHREAD__RLX);
+
+    if (b - top > a->size - 1) 
+    {
+        long long i;
+        struct zpool__array *grown = zpool__array_new(w->pool->node, a->size * 2);
+        if (!grown) 
+        {
+            return Z_ENOMEM;
+        }
+        for (i = top; i < b; i++) 
+        {
+            grown->buf[i & (grown->size - 1)] = a->buf[i & (a->size - 1)];
+        }
+        grown->prev = a;
+        zthread__stp(&w->array, grown, ZTHREAD__REL);
+        a = grown;
+    }
+    zthread__stp(&a->buf[b & (a->size - 1)], t, ZTHREAD__RLX);
+    zthread__st(&w->bottom, b + 1, ZTHREAD__REL);
+    return Z_OK;
+}
+
+// Owner only. LIFO end of the deque.
+static struct zpool__task *zpool__take(struct zpool__worker *w) 
+{
+    long long b = zthread__ld(&w->bottom, ZTHREAD__RLX) - 1;
+    struct zpool__array *a = (struct zpool__array*)zthread__ldp(&w->array, ZTHREAD__RLX);
+    struct zpool__task *t = NULL;
+    long long top;
+
+    zthread__st(&w->bottom, b, ZTHREAD__RLX);
+    zthread__fence(ZTHREAD__SEQ);
+    top = zthread__ld(&w->top, ZTHREAD__RLX);
+
+    if (top <= b) 
+    {
+        t = (struct zpool__task*)zthread__ldp(&a->buf[b & (a->size - 1)], ZTHREAD__RLX);
+        if (top == b) 
+        {
+            // Last element: race against thieves for it.
+            if (!zthread__cas(&w->top, top, top + 1)) 
+            {
+                t = NULL;
+            }
+            zthread__st(&w->bottom, b + 1, ZTHREAD__RLX);
+        }
+    } 
+    else 
+    {
+        zthread__st(&w->bottom, b + 1, ZTHREAD__RLX);
+    }
+    return t;
+}
+
+// Any thread. FIFO end of the deque. Sets *lost when a CAS race was lost.
+static struct zpool__task *zpool__steal(struct zpool__worker *w, int *lost) 
+{
+    long long top = zthread__ld(&w->top, ZTHREAD__ACQ);
+    long long b;
+
+    zthread__fence(ZTHREAD__SEQ);
+    b = zthread__ld(&w->bottom, ZTHREAD__ACQ);
+
+    if (top < b) 
+    {
+        struct zpool__array *a = (struct zpool__array*)zthread__ldp(&w->array, ZTHREAD__ACQ);
+        struct zpool__task *t = (struct zpool__task*)zthread__ldp(&a->buf[top & (a->size - 1)], ZTHREAD__RLX);
+        if (!zthread__cas(&w->top, top, top + 1)) 
+        {
+            *lost = 1;
+            return NULL;
+        }
+        return t;
+    }
+    return NULL;
+}
+
+static int zpool__has_work(zpool_t *p) 
+{
+    int i;
+    if (zthread__ld(&p->inject_len, ZTHREAD__RLX) > 0) 
+    {
+        return 1;
+    }
+    for (i = 0; i < p->num_workers; i++) 
+    {
+        struct zpool__worker *v = &p->workers[i];
+        if (zthread__ld(&v->bottom, ZTHREAD__ACQ) - zthread__ld(&v->top, ZTHREAD__ACQ) > 0) 
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Under 'lock': wakes a plain sleeper, or the keeper if it sleeps alone (it
+// waits on 'timer_wake', so a 'wake' signal would leave the task until its
+// deadline).
+static void zpool__wake_locked(zpool_t *p) 
+{
+    if (zthread__ld(&p->sleepers, ZTHREAD__RLX) > p->keeper) 
+    {
+        zcond_signal(&p->wake);
+    } 
+    else if (p->keeper) 
+    {
+        zcond_signal(&p->timer_wake);
+    }
+}
+
+static void zpool__notify(zpool_t *p) 
+{
+    zthread__fence(ZTHREAD__SEQ);
+    if (zthread__ld(&p->sleepers, ZTHREAD__SEQ) > 0) 
+    {
+        zmutex_lock(&p->lock);
+        zpool__wake_locked(p);
+        zmutex_unlock(&p->lock);
+    }
+}
+
+// Timer wheel.
+
+#define ZPOOL__TIMER_IDLE      0
+#define ZPOOL__TIMER_ARMED     1
+#define ZPOOL__TIMER_PENDING   2    // Fired and queued; the run has not started.
+#define ZPOOL__TIMER_CANCELLED 3    // Pending, then cancelled: runs once, no re-arm.
+
+static int zpool__ctz64(uint64_t v) 
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    while (!(v & 1)) 
+    {
+        v >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Under timer_lock. t->expiry must be after wheel_now.
+static void zpool__wheel_link(zpool_t *p, zpool_timer_t *t) 
+{
+    uint64_t now = p->wheel_now, diff = t->expiry ^ now;
+    zpool_timer_t **head;
+    int level = 0;
+
+    if (diff > ZPOOL__WHEEL_SPAN) 
+    {
+        t->level = ZPOOL__WHEEL_LEVELS;
+        t->slot = 0;
+        head = &p->wheel_far;
+    } 
+    else 
+    {
+        while ((diff >> (ZPOOL__WHEEL_BITS * (level + 1))) != 0) 
+        {
+            level++;
+        }
+        t->level = level;
+        t->slot = (int32_t)((t->expiry >> (ZPOOL__WHEEL_BITS * level)) & (ZPOOL__WHEEL_SLOTS - 1));
+        head = &p->wheel[level][t->slot];
+        p->wheel_bits[level] |= (uint64_t)1 << t->slot;
+    }
+    t->prev = NULL;
+    t->next = *head;
+    if (t->next) 
+    {
+        t->next->prev = t;
+    }
+    *head = t;
+}
+
+static void zpool__wheel_unlink(zpool_t *p, zpool_timer_t *t) 
+{
+    int far = (ZPOOL__WHEEL_LEVELS == t->level);
+    zpool_timer_t **head = far ? &p->wheel_far : &p->wheel[t->level][t->slot];
+    if (t->prev) 
+    {
+        t->prev->next = t->next;
+    } 
+    else 
+    {
+        *head = t->next;
+    }
+    if (t->next) 
+    {
+        t->next->prev = t->prev;
+    }
+    if (!far && !*head) 
+    {
+        p->wheel_bits[t->level] &= ~((uint64_t)1 << t->slot);
+    }
+}
+
+// Tick of the next slot to process, or UINT64_MAX if the wheel is empty.
+// Lower levels always come first. '*level' is ZPOOL__WHEEL_LEVELS for the
+// start of the next top-level rotation, where far timers are re-linked.
+static uint64_t zpool__wheel_next(const zpool_t *p, int *level) 
+{
+    uint64_t now = p->wheel_now;
+    int l;
+    for (l = 0; l < ZPOOL__WHEEL_LEVELS; l++) 
+    {
+        int shift = ZPOOL__WHEEL_BITS * l;
+        uint64_t digit = (now >> shift) & (ZPOOL__WHEEL_SLOTS - 1);
+        uint64_t above = p->wheel_bits[l] & ~((((uint64_t)2) << digit) - 1);
+        if (above) 
+        {
+            *level = l;
+            return ((now >> (shift + ZPOOL__WHEEL_BITS)) << (shift + ZPOOL__WHEEL_BITS)) +
+                   ((uint64_t)zpool__ctz64(above) << shift);
+        }
+    }
+    *level = ZPOOL__WHEEL_LEVELS;
+    return p->wheel_far ? (now | ZPOOL__WHEEL_SPAN) + 1 : UINT64_MAX;
+}
+
+// Under timer_lock. Processes every slot up to tick 'target', moving the due
+// timers onto '*fired' (linked through 'next').
+static void zpool__wheel_advance(zpool_t *p, uint64_t target, zpool_timer_t **fired) 
+{
+    for (;;) 
+    {
+        int level;
+        uint64_t at = zpool__wheel_next(p, &level);
+        zpool_timer_t *t, **head;
+
+        if (at > target) 
+        {
+            break;
+        }
+        p->wheel_now = at;
+        if (level < ZPOOL__WHEEL_LEVELS) 
+        {
+            int slot = (int)((at >> (ZPOOL__WHEEL_BITS * level)) & (ZPOOL__WHEEL_SLOTS - 1));
+            head = &p->wheel[level][slot];
+            p->wheel_bits[level] &= ~((uint64_t)1 << slot);
+        } 
+        else 
+        {
+            head = &p->wheel_far;
+        }
+        t = *head;
+        *head = NULL;
+        while (t) 
+        {
+            zpool_timer_t *next = t->next;
+            if (t->expiry <= at) 
+            {
+                t->state = ZPOOL__TIMER_PENDING;
+                t->next = *fired;
+                *fired = t;
+            } 
+            else 
+            {
+                zpool__wheel_link(p, t);
+            }
+            t = next;
+        }
+    }
+    if (target > p->wheel_now) 
+    {
+        p->wheel_now = target;
+    }
+}
+
+// Under timer_lock.
+static void zpool__wheel_update(zpool_t *p) 
+{
+    int level;
+    uint64_t at = zpool__wheel_next(p, &level);
+    zthread__st(&p->next_timer, UINT64_MAX == at ? INT64_MAX : p->wheel_base + (int64_t)at * ZTHREAD_TIMER_TICK, ZTHREAD__SEQ);
+}
+
+// Under timer_lock. Links 't' for t->deadline. Returns 1 if it is already
+// due (the caller queues it), 0 otherwise; sets '*sooner' if it moved the
+// nearest deadline forward.
+static int zpool__timer_arm(zpool_t *p, zpool_timer_t *t, int *sooner) 
+{
+    int64_t rel = t->deadline - p->wheel_base;
+    uint64_t at = (rel <= 0) ? 0 : (uint64_t)((rel + ZTHREAD_TIMER_TICK - 1) / ZTHREAD_TIMER_TICK);
+    int64_t ns;
+
+    if (at <= p->wheel_now) 
+    {
+        t->state = ZPOOL__TIMER_PENDING;
+        return 1;
+    }
+    t->state = ZPOOL__TIMER_ARMED;
+    t->expiry = at;
+    zpool__wheel_link(p, t);
+    ns = p->wheel_base + (int64_t)at * ZTHREAD_TIMER_TICK;
+    if (ns < zthread__ld(&p->next_timer, ZTHREAD__RLX)) 
+    {
+        zthread__st(&p->next_timer, ns, ZTHREAD__SEQ);
+        *sooner = 1;
+    }
+    return 0;
+}
+
+// Wakes the keeper for a nearer deadline, or any idle worker to become one.
+static void zpool__timer_notify(zpool_t *p) 
+{
+    zthread__fence(ZTHREAD__SEQ);
+    if (zthread__ld(&p->sleepers, ZTHREAD__SEQ) > 0) 
+    {
+        zmutex_lock(&p->lock);
+        if (p->keeper) 
+        {
+            zcond_signal(&p->timer_wake);
+        } 
+        else 
+        {
+            zcond_signal(&p->wake);
+        }
+        zmutex_unlock(&p->lock);
+    }
+}
+
+static void zpool__timer_queue(zpool_t *p, zpool_timer_t *fired) 
+{
+    while (fired) 
+    {
+        // Read first: once queued, the timer may run and be freed.
+        zpool_timer_t *next = fired->next;
+        zpool__submit_node(p, &fired->task);
+        fired = next;
+    }
+}
+
+// Queues the due timers. Returns 1 if it queued any. Cheap while none is due.
+static int zpool__timer_poll(zpool_t *p) 
+{
+    zpool_timer_t *fired = NULL;
+    int64_t due = zthread__ld(&p->next_timer, ZTHREAD__RLX), now;
+
+    if (INT64_MAX == due || (now = zthread__mono_ns()) < due) 
+    {
+        return 0;
+    }
+    // Another worker is polling: it queues them.
+    if (zmutex_trylock(&p->timer_lock) != Z_OK) 
+    {
+        return 0;
+    }
+    zpool__wheel_advance(p, (uint64_t)((now - p->wheel_base) / ZTHREAD_TIMER_TICK), &fired);
+    zpool__wheel_update(p);
+    zmutex_unlock(&p->timer_lock);
+    zpool__timer_queue(p, fired);
+    return fired != NULL;
+}
+
+// The task a fired timer queues. A periodic timer is re-armed before its
+// callback starts and 't' is not touched afterwards, so a callback may
+// cancel and free its own timer.
+static void zpool__timer_run(void *arg) 
+{
+    zpool_timer_t *t = (zpool_timer_t*)arg;
+    zpool_t *p = t->pool;
+    zpool_task_fn fn;
+    void *fn_arg;
+    int due = 0, sooner = 0, owned;
+
+    zmutex_lock(&p->timer_lock);
+    fn = t->fn;
+    fn_arg = t->arg;
+    owned = t->owned;
+    if (ZPOOL__TIMER_PENDING == t->state && t->period > 0) 
+    {
+        int64_t now = zthread__mono_ns();
+        t->deadline += t->period;
+        if (t->deadline <= now) 
+        {
+            t->deadline += t->period * ((now - t->deadline) / t->period + 1);
+        }
+        due = zpool__timer_arm(p, t, &sooner);
+    } 
+    else 
+    {
+        t->state = ZPOOL__TIMER_IDLE;
+    }
+    zmutex_unlock(&p->timer_lock);
+
+    if (due) 
+    {
+        zpool__submit_node(p, &t->task);
+    } 
+    else if (sooner) 
+    {
+        zpool__timer_notify(p);
+    }
+    if (owned) 
+    {
+        zthread__cache_free(t);
+    }
+    fn(fn_arg);
+}
+
+// After the workers are gone: drops the armed timers.
+static void zpool__timer_drop(zpool_t *p) 
+{
+    int l, i;
+    for (l = 0; l <= ZPOOL__WHEEL_LEVELS; l++) 
+    {
+        for (i = 0; i < (l < ZPOOL__WHEEL_LEVELS ? ZPOOL__WHEEL_SLOTS : 1); i++) 
+        {
+            zpool_timer_t *t = (l < ZPOOL__WHEEL_LEVELS) ? p->wheel[l][i] : p->wheel_far;
+            while (t) 
+            {
+                zpool_timer_t *next = t->next;
+                t->state = ZPOOL__TIMER_IDLE;
+                t->pool = NULL;
+                if (t->owned) 
+                {
+                    zthread__cache_free(t);
+                }
+                t = next;
+            }
+        }
+    }
+}
+
+void zpool__timer_init_ptr(zpool_timer_t *t, zpool_task_fn func, void *arg) 
+{
+    memset(t, 0, sizeof(*t));
+    t->task.fn = zpool__timer_run;
+    t->task.arg = t;
+    t->fn = func;
+    t->arg = arg;
+}
+
+int zpool_timer_start(zpool_t *p, zpool_timer_t *t, int64_t delay_ns, int64_t period_ns) 
+{
+    int due, sooner = 0;
+    if (delay_ns < 0 || period_ns < 0) 
+    {
+        return Z_EINVAL;
+    }
+    zmutex_lock(&p->timer_lock);
+    if (ZPOOL__TIMER_IDLE != t->state && t->pool != p) 
+    {
+        zmutex_unlock(&p->timer_lock);
+        return Z_EINVAL;
+    }
+    if (ZPOOL__TIMER_PENDING == t->state || ZPOOL__TIMER_CANCELLED == t->state) 
+    {
+        zmutex_unlock(&p->timer_lock);
+        return Z_ERR;
+    }
+    if (ZPOOL__TIMER_ARMED == t->state) 
+    {
+        zpool__wheel_unlink(p, t);
+    }
+    t->pool = p;
+    t->period = period_ns;
+    t->deadline = zthread__mono_ns() + delay_ns;
+    due = zpool__timer_arm(p, t, &sooner);
+    zmutex_unlock(&p->timer_lock);
+
+    if (due) 
+    {
+        zpool__submit_node(p, &t->task);
+    } 
+    else if (sooner) 
+    {
+        zpool__timer_notify(p);
+    }
+    return Z_OK;
+}
+
+int zpool_timer_cancel(zpool_timer_t *t) 
+{
+    zpool_t *p = t->pool;
+    int rc = Z_ERR;
+    if (!p) 
+    {
+        return Z_ERR;
+    }
+    zmutex_lock(&p->timer_lock);
+    if (ZPOOL__TIMER_ARMED == t->state) 
+    {
+        zpool__wheel_unlink(p, t);
+        t->state = ZPOOL__TIMER_IDLE;
+        rc = Z_OK;
+    } 
+    else if (ZPOOL__TIMER_PENDING == t->state) 
+    {
+        t->state = ZPOOL__TIMER_CANCELLED;
+    }
+    zmutex_unlock(&p->timer_lock);
+    return rc;
+}
+
+int zpool__submit_after_ptr(zpool_t *p, int64_t delay_ns, zpool_task_fn func, void *arg) 
+{
+    zpool_timer_t *t;
+    if (delay_ns < 0) 
+    {
+        return Z_EINVAL;
+    }
+    t = (zpool_timer_t*)zthread__cache_alloc(sizeof(*t));
+    if (!t) 
+    {
+        return Z_ENOMEM;
+    }
+    zpool__timer_init_ptr(t, func, arg);
+    t->owned = 1;
+    return zpool_timer_start(p, t, delay_ns, 0);
+}
+
+// Pops a batch from the injection queue: runs the first, keeps the rest local.
+static struct zpool__task *zpool__pop_inject(struct zpool__worker *w) 
+{
+    zpool_t *p = w->pool;
+    struct zpool__task *first, *t;
+    int n = 0, moved = 0;
+
+    if (zthread__ld(&p->inject_len, ZTHREAD__RLX) == 0) 
+    {
+        return NULL;
+    }
+
+    zmutex_lock(&p->lock);
+    first = p->inject_head;
+    if (first) 
+    {
+        p->inject_head = first->next;
+        n = 1;
+        while (p->inject_head && n < ZPOOL__INJECT_BATCH) 
+        {
+            // Unlink first: once pushed, a thief may run and free it.
+            t = p->inject_head;
+            p->inject_head = t->next;
+            if (zpool__push(w, t) != Z_OK) 
+            {
+                p->inject_head = t;
+                break;
+            }
+            n++;
+            moved++;
+        }
+        if (!p->inject_head) 
+        {
+            p->inject_tail = NULL;
+        }
+        zthread__st(&p->inject_len, p->inject_len - n, ZTHREAD__RLX);
+    }
+    zmutex_unlock(&p->lock);
+
+    if (moved) 
+    {
+        zpool__notify(p);
+    }
+    return first;
+}
+
+static struct zpool__task *zpool__find_task(struct zpool__worker *w) 
+{
+    zpool_t *p = w->pool;
+    struct zpool__task *t;
+    int round, i;
+
+    if ((t = zpool__take(w)) != NULL) 
+    {
+        return t;
+    }
+
+    for (round = 0; round < ZPOOL__SPIN_ROUNDS; round++) 
+    {
+        int lost = 0;
+        unsigned start;
+
+        if ((t = zpool__pop_inject(w)) != NULL) 
+        {
+            return t;
+        }
+
+        // xorshift32: cheap per-worker victim selection.
+        w->rng ^= w->rng << 13;
+        w->rng ^= w->rng >> 17;
+        w->rng ^= w->rng << 5;
+        start = w->rng % (unsigned)p->num_workers;
+
+        for (i = 0; i < p->num_workers; i++) 
+        {
+            struct zpool__worker *v = &p->workers[(start + (unsigned)i) % (unsigned)p->num_workers];
+            if (v == w) 
+            {
+                continue;
+            }
+            int miss = 0;
+            if ((t = zpool__steal(v, &miss)) != NULL) 
+            {
+                ZTRACE__EMIT(w->trace, ZTRACE_STEAL, v->index, t->fn);
+                return t;
+            }
+            if (miss) 
+            {
+                ZTRACE__EMIT(w->trace, ZTRACE_STEAL_FAIL, v->index, 0);
+                lost = 1;
+            }
+        }
+
+        if (!lost && !zpool__has_work(p)) 
+        {
+            break;
+        }
+        ZTHREAD__PAUSE();
+    }
+    return NULL;
+}
+
+#ifdef ZTHREAD_TRACE
+// Records the task start (and the queue depths when they changed) in the
+// calling worker's ring. Returns that ring, or NULL off the pool.
+static struct ztrace__ring *zpool__trace_begin(zpool_task_fn fn) 
+{
+    struct zpool__worker *w = zpool__current;
+    int32_t depth;
+    int64_t inject;
+    if (!w || !w->trace) 
+    {
+        return NULL;
+    }
+    depth = (int32_t)(zthread__ld(&w->bottom, ZTHREAD__RLX) - zthread__ld(&w->top, ZTHREAD__RLX));
+    inject = zthread__ld(&w->pool->inject_len, ZTHREAD__RLX);
+    if (depth != w->traced_depth || inject != w->traced_inject) 
+    {
+        w->traced_depth = depth;
+        w->traced_inject = inject;
+        ZTRACE__EMIT(w->trace, ZTRACE_QUEUE_DEPTH, depth, inject);
+    }
+    ZTRACE__EMIT(w->trace, ZTRACE_TASK_BEGIN, 0, fn);
+    return w->trace;
+}
+#endif
+
+static void zpool__run(zpool_t *p, struct zpool__task *t) 
+{
+    zpool_task_fn fn = t->fn;
+    void *arg = t->arg;
+#ifdef ZTHREAD_TRACE
+    struct ztrace__ring *ring = zpool__trace_begin(fn);
+#endif
+
+    // Released up front: a caller-owned node may be gone once fn starts.
+    if (t->cached) 
+    {
+        zthread__cache_free(t);
+    }
+    fn(arg);
+    ZTRACE__EMIT(ring, ZTRACE_TASK_END, 0, fn);
+
+    if (zthread__fadd(&p->pending, -1, ZTHREAD__SEQ) == 1) 
+    {
+        zmutex_lock(&p->lock);
+        zcond_broadcast(&p->idle);
+        zmutex_unlock(&p->lock);
+    }
+}
+
+// Sleeps until work shows up or, for the keeper, a timer is due. Returns 0
+// once the pool is stopping.
+static int zpool__park(struct zpool__worker *w) 
+{
+    zpool_t *p = w->pool;
+    int running, kept = 0;
+
+    zmutex_lock(&p->lock);
+    zthread__fadd(&p->sleepers, 1, ZTHREAD__SEQ);
+    zthread__fence(ZTHREAD__SEQ);
+    while (!zthread__ld(&p->stop, ZTHREAD__RLX) && !zpool__has_work(p)) 
+    {
+        int64_t due = zthread__ld(&p->next_timer, ZTHREAD__SEQ);
+        ZTRACE__EMIT(w->trace, ZTRACE_PARK, 0, 0);
+        if (INT64_MAX != due && !p->keeper) 
+        {
+            int64_t left = due - zthread__mono_ns();
+            if (left <= 0) 
+            {
+                break;
+            }
+            p->keeper = 1;
+            kept = 1;
+            zcond_timedwait(&p->timer_wake, &p->lock, left);
+            p->keeper = 0;
+        } 
+        else 
+        {
+            zcond_wait(&p->wake, &p->lock);
+        }
+        ZTRACE__EMIT(w->trace, ZTRACE_UNPARK, 0, 0);
+    }
+    zthread__fadd(&p->sleepers, -1, ZTHREAD__SEQ);
+    // Hand the deadline over to another sleeper.
+    if (kept && zthread__ld(&p->sleepers, ZTHREAD__RLX) > 0 &&
+        zthread__ld(&p->next_timer, ZTHREAD__RLX) != INT64_MAX) 
+    {
+        zcond_signal(&p->wake);
+    }
+    running = !zthread__ld(&p->stop, ZTHREAD__RLX) || zpool__has_work(p);
+    zmutex_unlock(&p->lock);
+    return running;
+}
+
+static void zpool__worker_main(void *arg) 
+{
+    struct zpool__worker *w = (struct zpool__worker*)arg;
+    zpool__current = w;
+#ifdef ZTHREAD_TRACE
+    w->trace = ztrace__attach(ZTRACE_POOL, w->pool, w->index);
+#endif
+
+    for (;;) 
+    {
+        struct zpool__task *t = zpool__find_task(w);
+        if (t) 
+        {
+            zpool__run(w->pool, t);
+            zpool__timer_poll(w->pool);
+        } 
+        else if (!zpool__timer_poll(w->pool) && !zpool__park(w)) 
+        {
+            break;
+        }
+    }
+#ifdef ZTHREAD_TRACE
+    ztrace__detach(w->trace);
+#endif
+    zpool__current = NULL;
+}
+
+static void zpool__free(zpool_t *p) 
+{
+    int i;
+    for (i = 0; i < p->num_workers; i++) 
+    {
+        struct zpool__array *a = (struct zpool__array*)p->workers[i].array;
+        while (a) 
+        {
+            struct zpool__array *prev = a->prev;
+            zpool__release(p->node, a, zpool__array_bytes(a->size));
+            a = prev;
+        }
+    }
+    zpool__timer_drop(p);
+    zcond_destroy(&p->timer_wake);
+    zmutex_destroy(&p->timer_lock);
+    zcond_destroy(&p->idle);
+    zcond_destroy(&p->wake);
+    zmutex_destroy(&p->lock);
+    zpool__release(p->node, p->workers, (size_t)p->capacity * sizeof(*p->workers));
+    zpool__release(p->node, p, sizeof(*p));
+}
+
+static zpool_t *zpool__create(int num_threads, int node) 
+{
+    zpool_t *p;
+    zthread_attr_t attr;
+    int i, started = 0;
+
+    zthread_attr_init(&attr);
+    if (node >= 0 && zthread_attr_set_node(&attr, node) != Z_OK) 
+    {
+        return NULL;
+    }
+
+    p = (zpool_t*)zpool__alloc(node, sizeof(*p));
+    if (!p) 
+    {
+        return NULL;
+    }
+    memset(p, 0, sizeof(*p));
+    p->node = node;
+    p->workers = (struct zpool__worker*)zpool__alloc(node, (size_t)num_threads * sizeof(*p->workers));
+    if (!p->workers) 
+    {
+        zpool__release(node, p, sizeof(*p));
+        return NULL;
+    }
+    memset(p->workers, 0, (size_t)num_threads * sizeof(*p->workers));
+    p->num_workers = num_threads;
+    p->capacity = num_threads;
+    zmutex_init(&p->lock);
+    zcond_init(&p->wake);
+    zcond_init(&p->idle);
+    zmutex_init(&p->timer_lock);
+    zcond_init(&p->timer_wake);
+    p->wheel_base = zthread__mono_ns();
+    p->next_timer = INT64_MAX;
+
+    for (i = 0; i < num_threads; i++) 
+    {
+        struct zpool__worker *w = &p->workers[i];
+        w->pool = p;
+        w->index = i;
+        w->rng = 2654435761u * (unsigned)(i + 1);
+        w->array = zpool__array_new(node, ZPOOL__DEQUE_INIT);
+        if (!w->array) 
+        {
+            p->num_workers = i;
+            zpool__free(p);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) 
+    {
+        if (zthread__create_ex_ptr(&p->workers[i].thread, zpool__worker_main, &p->workers[i], node >= 0 ? &attr : NULL) != Z_OK) 
+        {
+            break;
+        }
+        started++;
+    }
+
+    if (started != num_threads) 
+    {
+        zmutex_lock(&p->lock);
+        zthread__st(&p->stop, 1, ZTHREAD__SEQ);
+        zcond_broadcast(&p->wake);
+        zcond_signal(&p->timer_wake);
+        zmutex_unlock(&p->lock);
+        for (i = 0; i < started; i++) 
+        {
+            zthread_join(p->workers[i].thread);
+        }
+        zpool__free(p);
+        return NULL;
+    }
+    return p;
+}
+
+zpool_t *zpool_create(int num_threads) 
+{
+    if (num_threads <= 0) 
+    {
+        num_threads = zthread_cpu_count();
+    }
+    return zpool__create(num_threads, -1);
+}
+
+zpool_t *zpool_create_node(int num_threads, int node) 
+{
+    if (node < 0) 
+    {
+        return NULL;
+    }
+    if (num_threads <= 0) 
+    {
+        int cpu;
+        num_threads = 0;
+        for (cpu = 0; cpu < ZTHREAD_MAX_CPUS; cpu++) 
+        {
+            num_threads += (zthread_numa_node_of_cpu(cpu) == node);
+        }
+        if (0 == num_threads) 
+        {
+            return NULL;
+        }
+    }
+    return zpool__create(num_threads, node);
+}
+
+int zpool_node(const zpool_t *p) 
+{
+    return p->node;
+}
+
+int zpool__submit_ptr(zpool_t *p, zpool_task_fn func, void *arg) 
+{
+    struct zpool__task *t = (struct zpool__task*)zthread__cache_alloc(sizeof(*t));
+    if (!t) 
+    {
+        return Z_ENOMEM;
+    }
+    t->fn = func;
+    t->arg = arg;
+    t->cached = 1;
+    return zpool__submit_node(p, t);
+}
+
+int zpool__submit_node(zpool_t *p, struct zpool__task *t) 
+{
+    struct zpool__worker *w = zpool__current;
+    t->next = NULL;
+    zthread__fadd(&p->pending, 1, ZTHREAD__SEQ);
+
+    if (w && w->pool == p && zpool__push(w, t) == Z_OK) 
+    {
+        zpool__notify(p);
+        return Z_OK;
+    }
+
+    zmutex_lock(&p->lock);
+    if (p->inject_tail) 
+    {
+        p->inject_tail->next = t;
+    } 
+    else 
+    {
+        p->inject_head = t;
+    }
+    p->inject_tail = t;
+    zthread__st(&p->inject_len, p->inject_len + 1, ZTHREAD__SEQ);
+    zpool__wake_locked(p);
+    zmutex_unlock(&p->lock);
+    return Z_OK;
+}
+
+void zpool_wait_idle(zpool_t *p) 
+{
+    zmutex_lock(&p->lock);
+    while (zthread__ld(&p->pending, ZTHREAD__ACQ) > 0) 
+    {
+        zcond_wait(&p->idle, &p->lock);
+    }
+    zmutex_unlock(&p->lock);
+}
+
+void zpool_shutdown(zpool_t *p) 
+{
+    int i;
+    if (!p) 
+    {
+        return;
+    }
+    zpool_wait_idle(p);
+
+    zmutex_lock(&p->lock);
+    zthread__st(&p->stop, 1, ZTHREAD__SEQ);
+    zcond_broadcast(&p->wake);
+    zcond_signal(&p->timer_wake);
+    zmutex_unlock(&p->lock);
+
+    for (i = 0; i < p->num_workers; i++) 
+    {
+        zthread_join(p->workers[i].thread);
+    }
+    zpool__free(p);
+}
+
+int zpool_size(const zpool_t *p) 
+{
+    return p->num_workers;
+}
+
+int zpool_worker_index(const zpool_t *p) 
+{
+    struct zpool__worker *w = zpool__current;
+    return (p && w && w->pool == p) ? w->index : -1;
+}
+
+// Fork-join completion for state on the caller's stack (loops, graph runs).
+// The finisher signals under the lock, so it is done with the state once the
+// waiter owns the lock again.
+struct zpool__join 
+{
+    volatile int32_t done;
+    zmutex_t lock;
+    zcond_t cv;
+};
+
+static void zpool__join_init(struct zpool__join *j) 
+{
+    j->done = 0;
+    zmutex_init(&j->lock);
+    zcond_init(&j->cv);
+}
+
+static void zpool__join_destroy(struct zpool__join *j) 
+{
+    zcond_destroy(&j->cv);
+    zmutex_destroy(&j->lock);
+}
+
+static void zpool__join_signal(struct zpool__join *j) 
+{
+    zmutex_lock(&j->lock);
+    zthread__st32(&j->done, 1, ZTHREAD__REL);
+    zcond_broadcast(&j->cv);
+    zmutex_unlock(&j->lock);
+}
+
+// Waits until 'remaining' drains. A worker of 'p' keeps running pool tasks
+// (often the ones it waits for) meanwhile; other threads just block, so a
+// per-worker slot is never shared by two callers.
+static void zpool__join_wait(struct zpool__join *j, zpool_t *p, const volatile int64_t *remaining) 
+{
+    struct zpool__worker *w = zpool__current;
+    if (w && w->pool == p) 
+    {
+        while (zthread__ld(remaining, ZTHREAD__ACQ) > 0) 
+        {
+            struct zpool__task *t = zpool__find_task(w);
+            if (!t) 
+            {
+                break;
+            }
+            zpool__run(p, t);
+        }
+    }
+    zmutex_lock(&j->lock);
+    while (!zthread__ld32(&j->done, ZTHREAD__ACQ)) 
+    {
+        zcond_wait(&j->cv, &j->lock);
+    }
+    zmutex_unlock(&j->lock);
+}
+
+// Parallel loops.
+
+#define ZPARALLEL__CHUNKS 16    // Auto grain: about this many chunks per thread.
+
+struct zparallel__job 
+{
+    zpool_t *pool;
+    zparallel_fn fn;
+    void *ctx;
+    int64_t grain;
+    int lazy;
+    volatile int64_t remaining;     // Iterations not run yet.
+    struct zpool__join join;
+};
+
+struct zparallel__range 
+{
+    struct zparallel__job *job;
+    int64_t begin;
+    int64_t end;
+};
+
+static void zparallel__run(struct zparallel__job *job, int64_t b, int64_t e);
+
+static void zparallel__task(void *arg) 
+{
+    struct zparallel__range r = *(struct zparallel__range*)arg;
+    zthread__cache_free(arg);
+    zparallel__run(r.job, r.begin, r.end);
+}
+
+// Lazy splitting: only split while nothing we queued earlier is still waiting
+// to be picked up (own deque for workers, the injection queue otherwise).
+static int zparallel__idle_queue(zpool_t *p) 
+{
+    struct zpool__worker *w = zpool__current;
+    if (w && w->pool == p) 
+    {
+        return zthread__ld(&w->bottom, ZTHREAD__RLX) - zthread__ld(&w->top, ZTHREAD__ACQ) <= 0;
+    }
+    return zthread__ld(&p->inject_len, ZTHREAD__RLX) == 0;
+}
+
+// The job (on the caller's stack) stays alive until 'remaining' hits zero, so
+// everything is read before our last decrement.
+static void zparallel__run(struct zparallel__job *job, int64_t b, int64_t e) 
+{
+    zpool_t *p = job->pool;
+    zparallel_fn fn = job->fn;
+    void *ctx = job->ctx;
+    int64_t grain = job->grain;
+    int lazy = job->lazy;
+
+    while (b < e) 
+    {
+        int64_t n = e - b, step;
+        if (n > grain && (!lazy || zparallel__idle_queue(p))) 
+        {
+            struct zparallel__range *r = (struct zparallel__range*)zthread__cache_alloc(sizeof(*r));
+            if (r) 
+            {
+                r->job = job;
+                r->begin = b + n / 2;
+                r->end = e;
+                if (zpool__submit_ptr(p, zparallel__task, r) == Z_OK) 
+                {
+                    e = r->begin;
+                    continue;
+                }
+                zthread__cache_free(r);
+            }
+        }
+        step = (n < grain) ? n : grain;
+        fn(b, b + step, ctx);
+        b += step;
+        if (zthread__fadd(&job->remaining, -step, ZTHREAD__ACQ_REL) == step) 
+        {
+            zpool__join_signal(&job->join);
+        }
+    }
+}
+
+int zparallel_for(zpool_t *p, int64_t begin, int64_t end, int64_t grain, zparallel_fn fn, void *ctx) 
+{
+    struct zparallel__job job;
+    int64_t n = end - begin;
+
+    if (n < 0) 
+    {
+        return Z_EINVAL;
+    }
+    if (0 == n) 
+    {
+        return Z_OK;
+    }
+    if (!p || n == 1) 
+    {
+        fn(begin, end, ctx);
+        return Z_OK;
+    }
+
+    job.pool = p;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.lazy = (grain <= 0);
+    if (job.lazy) 
+    {
+        grain = n / ((int64_t)(p->num_workers + 1) * ZPARALLEL__CHUNKS);
+    }
+    job.grain = (grain < 1) ? 1 : grain;
+    job.remaining = n;
+    zpool__join_init(&job.join);
+
+    zparallel__run(&job, begin, end);
+    zpool__join_wait(&job.join, p, &job.remaining);
+    zpool__join_destroy(&job.join);
+    return Z_OK;
+}
+
+// Task graph.
+
+struct ztask__node 
+{
+    zpool_task_fn fn;
+    void *arg;
+    struct ztask_graph *graph;
+    int *succ;
+    int nsucc;
+    int succ_cap;
+    int32_t preds;                  // Incoming edges.
+    volatile int32_t pending;       // Predecessors still running in this run.
+};
+
+struct ztask_graph 
+{
+    struct ztask__node *nodes;
+    int *order;                     // Topological order (capacity entries).
+    int count;
+    int capacity;
+    int checked;                    // Edges unchanged since the last cycle check.
+    zpool_t *pool;                  // Pool of the current run.
+    volatile int64_t remaining;     // Tasks not finished in this run.
+    struct zpool__join join;
+};
+
+ztask_graph_t *ztask_graph_create(void) 
+{
+    ztask_graph_t *g = (ztask_graph_t*)ZTHREAD_CALLOC(1, sizeof(*g));
+    if (g) 
+    {
+        g->checked = 1;
+        zpool__join_init(&g->join);
+    }
+    return g;
+}
+
+void ztask_graph_destroy(ztask_graph_t *g) 
+{
+    int i;
+    if (!g) 
+    {
+        return;
+    }
+    for (i = 0; i < g->count; i++) 
+    {
+        ZTHREAD_FREE(g->nodes[i].succ);
+    }
+    zpool__join_destroy(&g->join);
+    ZTHREAD_FREE(g->nodes);
+    ZTHREAD_FREE(g->order);
+    ZTHREAD_FREE(g);
+}
+
+int ztask_graph__add_ptr(ztask_graph_t *g, zpool_task_fn fn, void *arg) 
+{
+    struct ztask__node *n;
+    if (g->count == g->capacity) 
+    {
+        int cap = g->capacity ? g->capacity * 2 : 16;
+        struct ztask__node *nodes = (struct ztask__node*)ZTHREAD_REALLOC(g->nodes, (size_t)cap * sizeof(*nodes));
+        int *order;
+        if (!nodes) 
+        {
+            return Z_ENOMEM;
+        }
+        g->nodes = nodes;
+        order = (int*)ZTHREAD_REALLOC(g->order, (size_t)cap * sizeof(*order));
+        if (!order) 
+        {
+            return Z_ENOMEM;
+        }
+        g->order = order;
+        g->capacity = cap;
+    }
+    n = &g->nodes[g->count];
+    memset(n, 0, sizeof(*n));
+    n->fn = fn;
+    n->arg = arg;
+    n->graph = g;
+    g->checked = 0;
+    return g->count++;
+}
+
+int ztask_graph_add_edge(ztask_graph_t *g, int from, int to) 
+{
+    struct ztask__node *n;
+    if (from < 0 || to < 0 || from >= g->count || to >= g->count || from == to) 
+    {
+        return Z_EINVAL;
+    }
+    n = &g->nodes[from];
+    if (n->nsucc == n->succ_cap) 
+    {
+        int cap = n->succ_cap ? n->succ_cap * 2 : 4;
+        int *succ = (int*)ZTHREAD_REALLOC(n->succ, (size_t)cap * sizeof(*succ));
+        if (!succ) 
+        {
+            return Z_ENOMEM;
+        }
+        n->succ = succ;
+        n->succ_cap = cap;
+    }
+    n->succ[n->nsucc++] = to;
+    g->nodes[to].preds++;
+    g->checked = 0;
+    return Z_OK;
+}
+
+int ztask_graph_size(const ztask_graph_t *g) 
+{
+    return g->count;
+}
+
+// Kahn's algorithm into g->order, with 'pending' as the scratch in-degree.
+// Returns 0 if some task sits on a cycle.
+static int ztask__sort(ztask_graph_t *g) 
+{
+    int head = 0, tail = 0, i, k;
+    for (i = 0; i < g->count; i++) 
+    {
+        g->nodes[i].pending = g->nodes[i].preds;
+        if (0 == g->nodes[i].preds) 
+        {
+            g->order[tail++] = i;
+        }
+    }
+    while (head < tail) 
+    {
+        struct ztask__node *n = &g->nodes[g->order[head++]];
+        for (k = 0; k < n->nsucc; k++) 
+        {
+            struct ztask__node *s = &g->nodes[n->succ[k]];
+            s->pending = s->pending - 1;
+            if (0 == s->pending) 
+            {
+                g->order[tail++] = n->succ[k];
+            }
+        }
+    }
+    return tail == g->count;
+}
+
+// Runs a task, then releases its successors. The first one that becomes
+// ready runs next on this thread; the others go to this worker's deque.
+static void ztask__exec(void *arg) 
+{
+    struct ztask__node *n = (struct ztask__node*)arg;
+    ztask_graph_t *g = n->graph;
+
+    while (n) 
+    {
+        struct ztask__node *next = NULL;
+        int k;
+
+        n->fn(n->arg);
+        for (k = 0; k < n->nsucc; k++) 
+        {
+            struct ztask__node *s = &g->nodes[n->succ[k]];
+            if (zthread__fadd32(&s->pending, -1, ZTHREAD__ACQ_REL) != 1) 
+            {
+                continue;
+            }
+            if (!next) 
+            {
+                next = s;
+            } 
+            else if (zpool__submit_ptr(g->pool, ztask__exec, s) != Z_OK) 
+            {
+                ztask__exec(s);
+            }
+        }
+        // With a successor still to run, this cannot be the last task.
+        if (zthread__fadd(&g->remaining, -1, ZTHREAD__ACQ_REL) == 1) 
+        {
+            zpool__join_signal(&g->join);
+        }
+        n = next;
+    }
+}
+
+int ztask_graph_run(ztask_graph_t *g, zpool_t *p) 
+{
+    int i;
+    if (!g->checked) 
+    {
+        if (!ztask__sort(g)) 
+        {
+            return Z_EINVAL;
+        }
+        g->checked = 1;
+    }
+    if (0 == g->count) 
+    {
+        return Z_OK;
+    }
+    if (!p) 
+    {
+        for (i = 0; i < g->count; i++) 
+        {
+            struct ztask__node *n = &g->nodes[g->order[i]];
+            n->fn(n->arg);
+        }
+        return Z_OK;
+    }
+
+    for (i = 0; i < g->count; i++) 
+    {
+        g->nodes[i].pending = g->nodes[i].preds;
+    }
+    g->pool = p;
+    g->join.done = 0;
+    zthread__st(&g->remaining, g->count, ZTHREAD__REL);
+
+    // Roots lead the topological order.
+    for (i = 0; i < g->count && 0 == g->nodes[g->order[i]].preds; i++) 
+    {
+        struct ztask__node *n = &g->nodes[g->order[i]];
+        if (zpool__submit_ptr(p, ztask__exec, n) != Z_OK) 
+        {
+            ztask__exec(n);
+        }
+    }
+    zpool__join_wait(&g->join, p, &g->remaining);
+    return Z_OK;
+}
+
+// Bounded MPMC queue.
+
+#define ZQUEUE__SPIN 64
+
+struct zqueue__slot 
+{
+    volatile int64_t seq;
+    void *data;
+    ZTHREAD_PAD(pad, sizeof(int64_t) + sizeof(void*));
+};
+
+struct zqueue 
+{
+    volatile int64_t enqueue_pos;
+    ZTHREAD_PAD(pad0, sizeof(int64_t));
+    volatile int64_t dequeue_pos;
+    ZTHREAD_PAD(pad1, sizeof(int64_t));
+    volatile int64_t push_waiters;
+    volatile int64_t pop_waiters;
+    struct zqueue__slot *slots;
+    long long mask;
+    void *raw;
+    zmutex_t lock;
+    zcond_t not_full;
+    zcond_t not_empty;
+};
+
+static int zqueue__push(zqueue_t *q, void *item) 
+{
+    long long pos = zthread__ld(&q->enqueue_pos, ZTHREAD__RLX);
+    struct zqueue__slot *slot;
+
+    for (;;) 
+    {
+        long long diff;
+        slot = &q->slots[pos & q->mask];
+        diff = zthread__ld(&slot->seq, ZTHREAD__ACQ) - pos;
+        if (0 == diff) 
+        {
+            if (zthread__cas(&q->enqueue_pos, pos, pos + 1)) 
+            {
+                break;
+            }
+            pos = zthread__ld(&q->enqueue_pos, ZTHREAD__RLX);
+        } 
+        else if (diff < 0) 
+        {
+            // The slot still holds last lap's item.
+            return Z_EFULL;
+        } 
+        else 
+        {
+            pos = zthread__ld(&q->enqueue_pos, ZTHREAD__RLX);
+        }
+    }
+    slot->data = item;
+    zthread__st(&slot->seq, pos + 1, ZTHREAD__REL);
+    return Z_OK;
+}
+
+static int zqueue__pop(zqueue_t *q, void **out) 
+{
+    long long pos = zthread__ld(&q->dequeue_pos, ZTHREAD__RLX);
+    struct zqueue__slot *slot;
+
+    for (;;) 
+    {
+        long long diff;
+        slot = &q->slots[pos & q->mask];
+        diff = zthread__ld(&slot->seq, ZTHREAD__ACQ) - (pos + 1);
+        if (0 == diff) 
+        {
+            if (zthread__cas(&q->dequeue_pos, pos, pos + 1)) 
+            {
+                break;
+            }
+            pos = zthread__ld(&q->dequeue_pos, ZTHREAD__RLX);
+        } 
+        else if (diff < 0) 
+        {
+            return Z_EEMPTY;
+        } 
+        else 
+        {
+            pos = zthread__ld(&q->dequeue_pos, ZTHREAD__RLX);
+        }
+    }
+    *out = slot->data;
+    // Hand the slot to the producer one lap ahead.
+    zthread__st(&slot->seq, pos + q->mask + 1, ZTHREAD__REL);
+    return Z_OK;
+}
+
+// Wakes one parked thread, skipping the lock entirely when nobody waits.
+static void zqueue__notify(zqueue_t *q, volatile int64_t *waiters, zcond_t *c) 
+{
+    zthread__fence(ZTHREAD__SEQ);
+    if (zthread__ld(waiters, ZTHREAD__RLX) > 0) 
+    {
+        zmutex_lock(&q->lock);
+        zcond_signal(c);
+        zmutex_unlock(&q->lock);
+    }
+}
+
+zqueue_t *zqueue_create(size_t capacity) 
+{
+    zqueue_t *q;
+    size_t cap = 2, i;
+
+    // Past the top power of two the doubling below would wrap to 0.
+    if (capacity > ((size_t)-1 >> 1) + 1) 
+    {
+        return NULL;
+    }
+    while (cap < capacity) 
+    {
+        cap <<= 1;
+    }
+    if (cap > ((size_t)-1 - ZTHREAD_CACHE_LINE) / sizeof(struct zqueue__slot)) 
+    {
+        return NULL;
+    }
+    q = (zqueue_t*)ZTHREAD_CALLOC(1, sizeof(*q));
+    if (!q) 
+    {
+        return NULL;
+    }
+    // Over-allocate so the slot array starts on a cache line boundary.
+    q->raw = ZTHREAD_MALLOC(cap * sizeof(struct zqueue__slot) + ZTHREAD_CACHE_LINE - 1);
+    if (!q->raw) 
+    {
+        ZTHREAD_FREE(q);
+        return NULL;
+    }
+    q->slots = (struct zqueue__slot*)(((uintptr_t)q->raw + ZTHREAD_CACHE_LINE - 1) & ~(uintptr_t)(ZTHREAD_CACHE_LINE - 1));
+    q->mask = (long long)cap - 1;
+    for (i = 0; i < cap; i++) 
+    {
+        q->slots[i].seq = (long long)i;
+    }
+    zmutex_init(&q->lock);
+    zcond_init(&q->not_full);
+    zcond_init(&q->not_empty);
+    return q;
+}
+
+void zqueue_destroy(zqueue_t *q) 
+{
+    if (!q) 
+    {
+        return;
+    }
+    zcond_destroy(&q->not_empty);
+    zcond_destroy(&q->not_full);
+    zmutex_destroy(&q->lock);
+    ZTHREAD_FREE(q->raw);
+    ZTHREAD_FREE(q);
+}
+
+int zqueue_try_push(zqueue_t *q, void *item) 
+{
+    if (zqueue__push(q, item) != Z_OK) 
+    {
+        return Z_EFULL;
+    }
+    zqueue__notify(q, &q->pop_waiters, &q->not_empty);
+    return Z_OK;
+}
+
+int zqueue_try_pop(zqueue_t *q, void **out) 
+{
+    if (zqueue__pop(q, out) != Z_OK) 
+    {
+        return Z_EEMPTY;
+    }
+    zqueue__notify(q, &q->push_waiters, &q->not_full);
+    return Z_OK;
+}
+
+void zqueue_push(zqueue_t *q, void *item) 
+{
+    int i;
+    for (i = 0; i < ZQUEUE__SPIN; i++) 
+    {
+        if (zqueue__push(q, item) == Z_OK) 
+        {
+            zqueue__notify(q, &q->pop_waiters, &q->not_empty);
+            return;
+        }
+        ZTHREAD__PAUSE();
+    }
+
+    // Register as a waiter before the final re-check, so a consumer that
+    // frees a slot after it either sees us or we see its slot.
+    zmutex_lock(&q->lock);
+    zthread__fadd(&q->push_waiters, 1, ZTHREAD__SEQ);
+    zthread__fence(ZTHREAD__SEQ);
+    while (zqueue__push(q, item) != Z_OK) 
+    {
+        zcond_wait(&q->not_full, &q->lock);
+    }
+    zthread__fadd(&q->push_waiters, -1, ZTHREAD__SEQ);
+    zmutex_unlock(&q->lock);
+    zqueue__notify(q, &q->pop_waiters, &q->not_empty);
+}
+
+void *zqueue_pop(zqueue_t *q) 
+{
+    void *item = NULL;
+    int i;
+    for (i = 0; i < ZQUEUE__SPIN; i++) 
+    {
+        if (zqueue__pop(q, &item) == Z_OK) 
+        {
+            zqueue__notify(q, &q->push_waiters, &q->not_full);
+            return item;
+        }
+        ZTHREAD__PAUSE();
+    }
+
+    zmutex_lock(&q->lock);
+    zthread__fadd(&q->pop_waiters, 1, ZTHREAD__SEQ);
+    zthread__fence(ZTHREAD__SEQ);
+    while (zqueue__pop(q, &item) != Z_OK) 
+    {
+        zcond_wait(&q->not_empty, &q->lock);
+    }
+    zthread__fadd(&q->pop_waiters, -1, ZTHREAD__SEQ);
+    zmutex_unlock(&q->lock);
+    zqueue__notify(q, &q->push_waiters, &q->not_full);
+    return item;
+}
+
+size_t zqueue_capacity(const zqueue_t *q) 
+{
+    return (size_t)q->mask + 1;
+}
+
+// Bounded SPSC ring.
+
+struct zspsc 
+{
+    // Producer line: 'tail' is published, 'head_cache' is private.
+    volatile int64_t tail;
+    int64_t head_cache;
+    ZTHREAD_PAD(pad0, 2 * sizeof(int64_t));
+    // Consumer line.
+    volatile int64_t head;
+    int64_t tail_cache;
+    ZTHREAD_PAD(pad1, 2 * sizeof(int64_t));
+    unsigned char *buf;
+    size_t elem_size;
+    int64_t mask;
+    void *raw;
+};
+
+zspsc_t *zspsc_create(size_t elem_size, size_t capacity) 
+{
+    zspsc_t *q;
+    size_t cap = 2;
+
+    // Past the top power of two the doubling below would wrap to 0.
+    if (0 == elem_size || capacity > ((size_t)-1 >> 1) + 1) 
+    {
+        return NULL;
+    }
+    while (cap < capacity) 
+    {
+        cap <<= 1;
+    }
+    if (cap > ((size_t)-1 - ZTHREAD_CACHE_LINE) / elem_size) 
+    {
+        return NULL;
+    }
+    q = (zspsc_t*)ZTHREAD_CALLOC(1, sizeof(*q));
+    if (!q) 
+    {
+        return NULL;
+    }
+    q->raw = ZTHREAD_MALLOC(cap * elem_size + ZTHREAD_CACHE_LINE - 1);
+    if (!q->raw) 
+    {
+        ZTHREAD_FREE(q);
+        return NULL;
+    }
+    q->buf = (unsigned char*)(((uintptr_t)q->raw + ZTHREAD_CACHE_LINE - 1) & ~(uintptr_t)(ZTHREAD_CACHE_LINE - 1));
+    q->elem_size = elem_size;
+    q->mask = (int64_t)cap - 1;
+    return q;
+}
+
+void zspsc_destroy(zspsc_t *q) 
+{
+    if (!q) 
+    {
+        return;
+    }
+    ZTHREAD_FREE(q->raw);
+    ZTHREAD_FREE(q);
+}
+
+void *zspsc_reserve(zspsc_t *q, size_t want, size_t *got) 
+{
+    int64_t tail = zthread__ld(&q->tail, ZTHREAD__RLX);
+    int64_t size = q->mask + 1;
+    int64_t n = size - (tail - q->head_cache);
+
+    if (n < (int64_t)want) 
+    {
+        // Pairs with the consumer's release: its reads of the slots are done.
+        q->head_cache = zthread__ld(&q->head, ZTHREAD__ACQ);
+        n = size - (tail - q->head_cache);
+    }
+    if (n > (int64_t)want) 
+    {
+        n = (int64_t)want;
+    }
+    if (n > size - (tail & q->mask)) 
+    {
+        n = size - (tail & q->mask);
+    }
+    *got = (size_t)n;
+    return (n > 0) ? q->buf + (size_t)(tail & q->mask) * q->elem_size : NULL;
+}
+
+void zspsc_commit(zspsc_t *q, size_t n) 
+{
+    zthread__st(&q->tail, zthread__ld(&q->tail, ZTHREAD__RLX) + (int64_t)n, ZTHREAD__REL);
+}
+
+const void *zspsc_peek(zspsc_t *q, size_t want, size_t *got) 
+{
+    int64_t head = zthread__ld(&q->head, ZTHREAD__RLX);
+    int64_t n = q->tail_cache - head;
+
+    if (n < (int64_t)want) 
+    {
+        q->tail_cache = zthread__ld(&q->tail, ZTHREAD__ACQ);
+        n = q->tail_cache - head;
+    }
+    if (n > (int64_t)want) 
+    {
+        n = (int64_t)want;
+    }
+    if (n > q->mask + 1 - (head & q->mask)) 
+    {
+        n = q->mask + 1 - (head & q->mask);
+    }
+    *got = (size_t)n;
+    return (n > 0) ? q->buf + (size_t)(head & q->mask) * q->elem_size : NULL;
+}
+
+void zspsc_release(zspsc_t *q, size_t n) 
+{
+    zthread__st(&q->head, zthread__ld(&q->head, ZTHREAD__RLX) + (int64_t)n, ZTHREAD__REL);
+}
+
+int zspsc_try_push(zspsc_t *q, const void *item) 
+{
+    size_t got;
+    void *slot = zspsc_reserve(q, 1, &got);
+    if (!slot) 
+    {
+        return Z_EFULL;
+    }
+    memcpy(slot, item, q->elem_size);
+    zspsc_commit(q, 1);
+    return Z_OK;
+}
+
+int zspsc_try_pop(zspsc_t *q, void *out) 
+{
+    size_t got;
+    const void *slot = zspsc_peek(q, 1, &got);
+    if (!slot) 
+    {
+        return Z_EEMPTY;
+    }
+    memcpy(out, slot, q->elem_size);
+    zspsc_release(q, 1);
+    return Z_OK;
+}
+
+size_t zspsc_size(const zspsc_t *q) 
+{
+    int64_t head = zthread__ld(&q->head, ZTHREAD__ACQ);
+    int64_t n = zthread__ld(&q->tail, ZTHREAD__ACQ) - head;
+    return (n > 0) ? (size_t)n : 0;
+}
+
+size_t zspsc_capacity(const zspsc_t *q) 
+{
+    return (size_t)q->mask + 1;
+}
+
+// Intrusive MPSC queue.
+// Senders exchange themselves into 'head' and then link the previous node to
+// themselves, so the chain from 'tail' can briefly end early. A stub node
+// keeps the chain non-empty: the consumer re-pushes it before taking the
+// last real node. try_pop_all swaps in the other stub, so the chain it
+// detaches (which may still hold the old one) is never linked to again.
+
+struct zmpsc 
+{
+    // Sender line.
+    zmpsc_node_t *volatile head;
+    ZTHREAD_PAD(pad0, sizeof(void*));
+    // Read by every sender, written by the consumer only around a sleep.
+    zeventcount_t ec;
+    ZTHREAD_PAD(pad1, sizeof(zeventcount_t));
+    // Consumer line.
+    zmpsc_node_t *tail;
+    zmpsc_node_t *stub;             // The stub in use (one of 'stubs').
+    zmpsc_node_t stubs[2];
+};
+
+zmpsc_t *zmpsc_create(void) 
+{
+    zmpsc_t *q = (zmpsc_t*)ZTHREAD_CALLOC(1, sizeof(*q));
+    if (!q) 
+    {
+        return NULL;
+    }
+    zeventcount_init(&q->ec);
+    q->stub = &q->stubs[0];
+    q->head = q->stub;
+    q->tail = q->stub;
+    return q;
+}
+
+void zmpsc_destroy(zmpsc_t *q) 
+{
+    if (!q) 
+    {
+        return;
+    }
+    zeventcount_destroy(&q->ec);
+    ZTHREAD_FREE(q);
+}
+
+static void zmpsc__link(zmpsc_t *q, zmpsc_node_t *first, zmpsc_node_t *last) 
+{
+    zmpsc_node_t *prev;
+    zthread__stp((void *volatile*)&last->next, NULL, ZTHREAD__RLX);
+    prev = (zmpsc_node_t*)zatomic_exchange_ptr((void *volatile*)&q->head, last, ZATOMIC_ACQ_REL);
+    zthread__stp((void *volatile*)&prev->next, first, ZTHREAD__REL);
+}
+
+void zmpsc_push(zmpsc_t *q, zmpsc_node_t *n) 
+{
+    zmpsc__link(q, n, n);
+    zeventcount_notify(&q->ec);
+}
+
+void zmpsc_push_list(zmpsc_t *q, zmpsc_node_t *first, zmpsc_node_t *last) 
+{
+    zmpsc__link(q, first, last);
+    zeventcount_notify(&q->ec);
+}
+
+static zmpsc_node_t *zmpsc__next(zmpsc_node_t *n) 
+{
+    return (zmpsc_node_t*)zthread__ldp((void *volatile*)&n->next, ZTHREAD__ACQ);
+}
+
+zmpsc_node_t *zmpsc_try_pop(zmpsc_t *q) 
+{
+    zmpsc_node_t *tail = q->tail;
+    zmpsc_node_t *next = zmpsc__next(tail);
+
+    if (tail == q->stub) 
+    {
+        if (!next) 
+        {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = zmpsc__next(tail);
+    }
+    if (next) 
+    {
+        q->tail = next;
+        return tail;
+    }
+    // 'tail' looks like the last node. Unless a sender is midway, put the
+    // stub behind it so it can be handed out.
+    if (tail != (zmpsc_node_t*)zthread__ldp((void *volatile*)&q->head, ZTHREAD__ACQ)) 
+    {
+        return NULL;
+    }
+    zmpsc__link(q, q->stub, q->stub);
+    next = zmpsc__next(tail);
+    if (next) 
+    {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+zmpsc_node_t *zmpsc_try_pop_all(zmpsc_t *q) 
+{
+    zmpsc_node_t *stub = q->stub;
+    zmpsc_node_t *fresh = &q->stubs[stub == &q->stubs[0]];
+    zmpsc_node_t *first = NULL, **link = &first;
+    zmpsc_node_t *n = q->tail, *last;
+
+    if (zmpsc_empty(q)) 
+    {
+        return NULL;
+    }
+    fresh->next = NULL;
+    last = (zmpsc_node_t*)zatomic_exchange_ptr((void *volatile*)&q->head, fresh, ZATOMIC_ACQ_REL);
+    q->stub = fresh;
+    q->tail = fresh;
+
+    // Walk the detached chain to 'last', dropping the old stub and waiting
+    // out any sender that has exchanged but not linked yet.
+    for (;;) 
+    {
+        zmpsc_node_t *next = NULL;
+        int spins = 0;
+        while (n != last && NULL == (next = zmpsc__next(n))) 
+        {
+            if (++spins < 64) 
+            {
+                ZTHREAD__PAUSE();
+            } 
+            else 
+            {
+                zthread_sleep(0);
+            }
+        }
+        if (n != stub) 
+        {
+            *link = n;
+            link = (zmpsc_node_t**)&n->next;
+        }
+        if (n == last) 
+        {
+            break;
+        }
+        n = next;
+    }
+    *link = NULL;
+    return first;
+}
+
+zmpsc_node_t *zmpsc_pop(zmpsc_t *q) 
+{
+    zmpsc_node_t *n;
+    while (NULL == (n = zmpsc_try_pop(q))) 
+    {
+        int32_t key = zeventcount_prepare_wait(&q->ec);
+        n = zmpsc_try_pop(q);
+        if (n) 
+        {
+            zeventcount_cancel_wait(&q->ec);
+            break;
+        }
+        zeventcount_commit_wait(&q->ec, key);
+    }
+    return n;
+}
+
+zmpsc_node_t *zmpsc_pop_all(zmpsc_t *q) 
+{
+    zmpsc_node_t *n;
+    while (NULL == (n = zmpsc_try_pop_all(q))) 
+    {
+        int32_t key = zeventcount_prepare_wait(&q->ec);
+        n = zmpsc_try_pop_all(q);
+        if (n) 
+        {
+            zeventcount_cancel_wait(&q->ec);
+            break;
+        }
+        zeventcount_commit_wait(&q->ec, key);
+    }
+    return n;
+}
+
+int zmpsc_empty(const zmpsc_t *q) 
+{
+    zmpsc_node_t *tail = q->tail;
+    return tail == q->stub && (zmpsc_node_t*)zthread__ldp((void *volatile*)&q->head, ZTHREAD__ACQ) == tail;
+}
+
+// Memory reclamation.
+// One record per registered thread, on a registry list that only grows:
+// records of exited threads are reused, so scanners can walk it without a
+// lock. A retired EBR node waits in one of three limbo lists, by the global
+// epoch it was retired in (mod 3); the epoch only moves from E to E + 1 once
+// every thread inside a critical section has observed E, so the nodes of
+// epoch E are unreachable once it reaches E + 2.
+
+struct zreclaim__node 
+{
+    struct zreclaim__node *next;
+    void *ptr;
+    zreclaim_fn fn;
+};
+
+struct zreclaim__thread 
+{
+    // Scanned by other threads.
+    volatile int64_t epoch;         // (epoch << 1) | 1 inside a critical section, 0 outside.
+    void *volatile hazards[ZTHREAD_HAZARDS];
+    ZTHREAD_PAD(pad0, sizeof(int64_t) + ZTHREAD_HAZARDS * sizeof(void*));
+    // Owner only.
+    int depth;
+    int retired;                    // EBR retires since the last advance attempt.
+    struct zreclaim__node *limbo[3];
+    int64_t limbo_epoch[3];
+    struct zreclaim__node *hazard_list;
+    int hazard_count;
+    // Registry.
+    volatile int32_t in_use;
+    struct zreclaim__thread *next;
+};
+
+static void *volatile zreclaim__threads = NULL;
+static volatile int32_t zreclaim__count = 0;
+static volatile int64_t zebr__epoch = 0;
+// Nodes left by exited threads.
+static void *volatile zebr__orphans = NULL;
+static void *volatile zhazard__orphans = NULL;
+
+static ZTHREAD_LOCAL struct zreclaim__thread *zreclaim__self = NULL;
+static ztls_key_t zreclaim__key;
+static volatile int32_t zreclaim__key_state = 0;  // zthread__once.
+
+static void zreclaim__free_list(struct zreclaim__node *n) 
+{
+    while (n) 
+    {
+        struct zreclaim__node *next = n->next;
+        n->fn(n->ptr);
+        zthread__cache_free(n);
+        n = next;
+    }
+}
+
+// Pushes the chain 'first'..'last' onto an orphan list.
+static void zreclaim__orphan(void *volatile *list, struct zreclaim__node *first, struct zreclaim__node *last) 
+{
+    void *head = zthread__ldp(list, ZTHREAD__RLX);
+    for (;;) 
+    {
+        last->next = (struct zreclaim__node*)head;
+        if (zatomic_cas_ptr(list, &head, first, ZATOMIC_ACQ_REL)) 
+        {
+            return;
+        }
+    }
+}
+
+static void zreclaim__exit(void *arg);
+
+static int zreclaim__key_init(void) 
+{
+    return ztls_key_create(&zreclaim__key, zreclaim__exit);
+}
+
+static struct zreclaim__thread *zreclaim__get(void) 
+{
+    struct zreclaim__thread *r = zreclaim__self;
+    int keyed;
+    void *head;
+
+    if (r) 
+    {
+        return r;
+    }
+    keyed = zthread__once(&zreclaim__key_state, zreclaim__key_init);
+
+    // Reuse the record of an exited thread, with whatever it still holds.
+    for (r = (struct zreclaim__thread*)zthread__ldp(&zreclaim__threads, ZTHREAD__ACQ); r; r = r->next) 
+    {
+        if (0 == zthread__ld32(&r->in_use, ZTHREAD__RLX) && zthread__cas32(&r->in_use, 0, 1)) 
+        {
+            break;
+        }
+    }
+    if (!r) 
+    {
+        r = (struct zreclaim__thread*)ZTHREAD_CALLOC(1, sizeof(*r));
+        if (!r) 
+        {
+            return NULL;
+        }
+        r->in_use = 1;
+        head = zthread__ldp(&zreclaim__threads, ZTHREAD__RLX);
+        for (;;) 
+        {
+            r->next = (struct zreclaim__thread*)head;
+            if (zatomic_cas_ptr(&zreclaim__threads, &head, r, ZATOMIC_ACQ_REL)) 
+            {
+                break;
+            }
+        }
+        zthread__fadd32(&zreclaim__count, 1, ZTHREAD__RLX);
+    }
+    zreclaim__self = r;
+    // Without the key the record is simply never released.
+    if (keyed) 
+    {
+        ztls_set(zreclaim__key, r);
+    }
+    return r;
+}
+
+// Moves the epoch forward if every thread inside a critical section has
+// observed the current one. Returns the epoch now in effect.
+static int64_t zebr__advance(void) 
+{
+    int64_t e = zthread__ld(&zebr__epoch, ZTHREAD__SEQ);
+    struct zreclaim__thread *r;
+    for (r = (struct zreclaim__thread*)zthread__ldp(&zreclaim__threads, ZTHREAD__ACQ); r; r = r->next) 
+    {
+        int64_t v = zthread__ld(&r->epoch, ZTHREAD__SEQ);
+        if ((v & 1) && (v >> 1) != e) 
+        {
+            return e;
+        }
+    }
+    if (zthread__cas(&zebr__epoch, e, e + 1)) 
+    {
+        return e + 1;
+    }
+    return zthread__ld(&zebr__epoch, ZTHREAD__SEQ);
+}
+
+static void zebr__add(struct zreclaim__thread *r, struct zreclaim__node *n) 
+{
+    int64_t e = zthread__ld(&zebr__epoch, ZTHREAD__SEQ);
+    int i = (int)(e % 3);
+    // The list still holds epoch e - 3 or older: all of it is safe.
+    if (r->limbo[i] && r->limbo_epoch[i] != e) 
+    {
+        struct zreclaim__node *old = r->limbo[i];
+        r->limbo[i] = NULL;
+        zreclaim__free_list(old);
+    }
+    r->limbo_epoch[i] = e;
+    n->next = r->limbo[i];
+    r->limbo[i] = n;
+}
+
+// Frees the limbo lists that are two epochs old and adopts the orphans.
+static void zebr__collect(struct zreclaim__thread *r, int64_t e) 
+{
+    int i;
+    struct zreclaim__node *n;
+    for (i = 0; i < 3; i++) 
+    {
+        if (r->limbo[i] && r->limbo_epoch[i] + 2 <= e) 
+        {
+            n = r->limbo[i];
+            r->limbo[i] = NULL;
+            zreclaim__free_list(n);
+        }
+    }
+    // Orphans are re-stamped with the current epoch: later than needed, never early.
+    if (zthread__ldp(&zebr__orphans, ZTHREAD__RLX)) 
+    {
+        n = (struct zreclaim__node*)zatomic_exchange_ptr(&zebr__orphans, NULL, ZATOMIC_ACQUIRE);
+        while (n) 
+        {
+            struct zreclaim__node *next = n->next;
+            zebr__add(r, n);
+            n = next;
+        }
+    }
+}
+
+static int zhazard__held(void *ptr) 
+{
+    struct zreclaim__thread *r;
+    int i;
+    for (r = (struct zreclaim__thread*)zthread__ldp(&zreclaim__threads, ZTHREAD__ACQ); r; r = r->next) 
+    {
+        for (i = 0; i < ZTHREAD_HAZARDS; i++) 
+        {
+            if (zthread__ldp(&r->hazards[i], ZTHREAD__ACQ) == ptr) 
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void zhazard__scan(struct zreclaim__thread *r) 
+{
+    struct zreclaim__node *n, *keep = NULL;
+    int kept = 0;
+
+    if (zthread__ldp(&zhazard__orphans, ZTHREAD__RLX)) 
+    {
+        n = (struct zreclaim__node*)zatomic_exchange_ptr(&zhazard__orphans, NULL, ZATOMIC_ACQUIRE);
+        while (n) 
+        {
+            struct zreclaim__node *next = n->next;
+            n->next = r->hazard_list;
+            r->hazard_list = n;
+            n = next;
+        }
+    }
+    // Pairs with the fence after a hazard store: a protector either sees the
+    // node unlinked or we see its hazard.
+    zthread__fence(ZTHREAD__SEQ);
+    // Detached first: a free function may retire more nodes.
+    n = r->hazard_list;
+    r->hazard_list = NULL;
+    r->hazard_count = 0;
+    while (n) 
+    {
+        struct zreclaim__node *next = n->next;
+        if (zhazard__held(n->ptr)) 
+        {
+            n->next = keep;
+            keep = n;
+            kept++;
+        } 
+        else 
+        {
+            n->fn(n->ptr);
+            zthread__cache_free(n);
+        }
+        n = next;
+    }
+    while (keep) 
+    {
+        n = keep->next;
+        keep->next = r->hazard_list;
+        r->hazard_list = keep;
+        keep = n;
+    }
+    r->hazard_count += kept;
+}
+
+// TLS destructor: leave, hand over what is still pending, release the record.
+static void zreclaim__exit(void *arg) 
+{
+    struct zreclaim__thread *r = (struct zreclaim__thread*)arg;
+    struct zreclaim__node *first = NULL, *last = NULL;
+    int i;
+
+    r->depth = 0;
+    zthread__st(&r->epoch, 0, ZTHREAD__REL);
+    for (i = 0; i < ZTHREAD_HAZARDS; i++) 
+    {
+        zthread__stp(&r->hazards[i], NULL, ZTHREAD__REL);
+    }
+    zebr__collect(r, zebr__advance());
+    for (i = 0; i < 3; i++) 
+    {
+        struct zreclaim__node *n = r->limbo[i];
+        r->limbo[i] = NULL;
+        while (n) 
+        {
+            struct zreclaim__node *next = n->next;
+            n->next = first;
+            first = n;
+            if (!last) 
+            {
+                last = n;
+            }
+            n = next;
+        }
+    }
+    if (first) 
+    {
+        zreclaim__orphan(&zebr__orphans, first, last);
+    }
+    if (r->hazard_list) 
+    {
+        zhazard__scan(r);
+    }
+    if (r->hazard_list) 
+    {
+        for (last = r->hazard_list; last->next; last = last->next) 
+        {
+        }
+        zreclaim__orphan(&zhazard__orphans, r->hazard_list, last);
+        r->hazard_list = NULL;
+        r->hazard_count = 0;
+    }
+    r->retired = 0;
+    zreclaim__self = NULL;
+    zthread__st32(&r->in_use, 0, ZTHREAD__REL);
+}
+
+void zebr_enter(void) 
+{
+    struct zreclaim__thread *r = zreclaim__get();
+    if (r && 0 == r->depth++) 
+    {
+        int64_t e = zthread__ld(&zebr__epoch, ZTHREAD__RLX);
+        zthread__st(&r->epoch, (e << 1) | 1, ZTHREAD__RLX);
+        // The epoch is visible before any load of the protected structure.
+        zthread__fence(ZTHREAD__SEQ);
+    }
+}
+
+void zebr_exit(void) 
+{
+    struct zreclaim__thread *r = zreclaim__self;
+    if (r && r->depth > 0 && 0 == --r->depth) 
+    {
+        zthread__st(&r->epoch, 0, ZTHREAD__REL);
+    }
+}
+
+int zebr__retire_ptr(void *ptr, zreclaim_fn fn) 
+{
+    struct zreclaim__thread *r = zreclaim__get();
+    struct zreclaim__node *n;
+    if (!r) 
+    {
+        return Z_ENOMEM;
+    }
+    n = (struct zreclaim__node*)zthread__cache_alloc(sizeof(*n));
+    if (!n) 
+    {
+        return Z_ENOMEM;
+    }
+    n->ptr = ptr;
+    n->fn = fn;
+    zebr__add(r, n);
+    if (++r->retired >= ZTHREAD_EBR_SCAN) 
+    {
+        r->retired = 0;
+        zebr__collect(r, zebr__advance());
+    }
+    return Z_OK;
+}
+
+void zebr_synchronize(void) 
+{
+    struct zreclaim__thread *r = zreclaim__get();
+    int64_t target = zthread__ld(&zebr__epoch, ZTHREAD__SEQ) + 2;
+    int64_t e;
+    int spins = 0;
+    for (;;) 
+    {
+        e = zebr__advance();
+        if (e >= target) 
+        {
+            break;
+        }
+        if (++spins < 64) 
+        {
+            ZTHREAD__PAUSE();
+        } 
+        else 
+        {
+            zthread_sleep(0);
+        }
+    }
+    if (r) 
+    {
+        zebr__collect(r, e);
+    }
+}
+
+void *zhazard__protect_ptr(int slot, void *const volatile *src) 
+{
+    struct zreclaim__thread *r = zreclaim__get();
+    void *p = zthread__ldp(src, ZTHREAD__ACQ);
+    if (!r) 
+    {
+        return NULL;
+    }
+    for (;;) 
+    {
+        void *again;
+        zthread__stp(&r->hazards[slot], p, ZTHREAD__RLX);
+        zthread__fence(ZTHREAD__SEQ);
+        again = zthread__ldp(src, ZTHREAD__ACQ);
+        if (again == p) 
+        {
+            return p;
+        }
+        p = again;
+    }
+}
+
+void zhazard_set(int slot, void *ptr) 
+{
+    struct zreclaim__thread *r = zreclaim__get();
+    if (r) 
+    {
+        zthread__stp(&r->hazards[slot], ptr, ZTHREAD__RLX);
+        zthread__fence(ZTHREAD__SEQ);
+    }
+}
+
+void zhazard_clear(int slot) 
+{
+    struct zreclaim__thread *r = zreclaim__self;
+    if (r) 
+    {
+        zthread__stp(&r->hazards[slot], NULL, ZTHREAD__REL);
+    }
+}
+
+int zhazard__retire_ptr(void *ptr, zreclaim_fn fn) 
+{
+    struct zreclaim__thread *r = zreclaim__get();
+    struct zreclaim__node *n;
+    if (!r) 
+    {
+        return Z_ENOMEM;
+    }
+    n = (struct zreclaim__node*)zthread__cache_alloc(sizeof(*n));
+    if (!n) 
+    {
+        return Z_ENOMEM;
+    }
+    n->ptr = ptr;
+    n->fn = fn;
+    n->next = r->hazard_list;
+    r->hazard_list = n;
+    if (++r->hazard_count >= ZTHREAD_HAZARD_SCAN + 2 * ZTHREAD_HAZARDS * zthread__ld32(&zreclaim__count, ZTHREAD__RLX)) 
+    {
+        zhazard__scan(r);
+    }
+    return Z_OK;
+}
+
+void zhazard_scan(void) 
+{
+    struct zreclaim__thread *r = zreclaim__get();
+    if (r) 
+    {
+        zhazard__scan(r);
+    }
+}
+
+// RCU pointer.
+
+static void zrcu__retire(zrcu_ptr_t *r, void *old) 
+{
+    if (old && zebr__retire_ptr(old, r->free_fn) != Z_OK) 
+    {
+        zebr_synchronize();
+        r->free_fn(old);
+    }
+}
+
+void zrcu__init_ptr(zrcu_ptr_t *r, void *initial, zreclaim_fn free_fn) 
+{
+    r->free_fn = free_fn;
+    zthread__stp(&r->ptr, initial, ZTHREAD__REL);
+}
+
+void zrcu_store(zrcu_ptr_t *r, void *next) 
+{
+    zrcu__retire(r, zrcu_exchange(r, next));
+}
+
+int zrcu_compare_store(zrcu_ptr_t *r, void *expected, void *next) 
+{
+    if (!zatomic_cas_ptr(&r->ptr, &expected, next, ZATOMIC_ACQ_REL)) 
+    {
+        return Z_ERR;
+    }
+    zrcu__retire(r, expected);
+    return Z_OK;
+}
+
+void *zrcu_exchange(zrcu_ptr_t *r, void *next) 
+{
+    return zatomic_exchange_ptr(&r->ptr, next, ZATOMIC_ACQ_REL);
+}
+
+void zrcu_destroy(zrcu_ptr_t *r) 
+{
+    void *p = zrcu_exchange(r, NULL);
+    if (p) 
+    {
+        r->free_fn(p);
+    }
+}
+
+// Sharded hash map.
+
+#define ZCMAP__MIN_SLOTS 8
+
+struct zcmap__slot 
+{
+    uint64_t tag;               // Mixed hash, 0 for an empty slot.
+    const void *key;
+    void *value;
+};
+
+struct zcmap__shard 
+{
+    zrwlock_t lock;
+    struct zcmap__slot *slots;  // 'cap' slots, a power of two (or NULL).
+    size_t cap;
+    volatile int64_t count;
+    ZTHREAD_PAD(pad, sizeof(zrwlock_t) + sizeof(void*) + sizeof(size_t) + sizeof(int64_t));
+};
+
+struct zcmap 
+{
+    struct zcmap__shard *shards;
+    size_t mask;
+    zcmap_hash_fn hash;
+    zcmap_eq_fn eq;
+    void *raw;
+};
+
+// Keys grouped by shard for the batch calls: the keys of shard s are
+// order[start[s]] to order[start[s + 1] - 1].
+struct zcmap__batch 
+{
+    uint64_t *tags;
+    size_t *order;
+    size_t *start;
+};
+
+// Finalizer of MurmurHash3: user hashes may be weak (an identity for ints).
+static uint64_t zcmap__tag(const zcmap_t *m, const void *key) 
+{
+    uint64_t h = m->hash ? m->hash(key) : (uint64_t)(uintptr_t)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+
+// Shards take the high bits, slots the low ones.
+static struct zcmap__shard *zcmap__shard_of(const zcmap_t *m, uint64_t tag) 
+{
+    return &m->shards[(size_t)(tag >> 40) & m->mask];
+}
+
+static struct zcmap__slot *zcmap__lookup(const zcmap_t *m, const struct zcmap__shard *s, uint64_t tag, const void *key) 
+{
+    size_t i, mask;
+    if (!s->slots) 
+    {
+        return NULL;
+    }
+    mask = s->cap - 1;
+    // The load factor stays below 3/4, so an empty slot ends every probe.
+    for (i = (size_t)tag & mask;; i = (i + 1) & mask) 
+    {
+        struct zcmap__slot *e = &s->slots[i];
+        if (0 == e->tag) 
+        {
+            return NULL;
+        }
+        if (e->tag == tag && (m->eq ? m->eq(e->key, key) : e->key == key)) 
+        {
+            return e;
+        }
+    }
+}
+
+static void zcmap__place(struct zcmap__slot *slots, size_t cap, const struct zcmap__slot *e) 
+{
+    size_t i = (size_t)e->tag & (cap - 1);
+    while (slots[i].tag) 
+    {
+        i = (i + 1) & (cap - 1);
+    }
+    slots[i] = *e;
+}
+
+static int zcmap__grow(struct zcmap__shard *s) 
+{
+    size_t cap = s->cap ? s->cap * 2 : ZCMAP__MIN_SLOTS, i;
+    struct zcmap__slot *slots;
+    if (cap > (size_t)-1 / sizeof(*slots)) 
+    {
+        return Z_ENOMEM;
+    }
+    slots = (struct zcmap__slot*)ZTHREAD_CALLOC(cap, sizeof(*slots));
+    if (!slots) 
+    {
+        return Z_ENOMEM;
+    }
+    for (i = 0; i < s->cap; i++) 
+    {
+        if (s->slots[i].tag) 
+        {
+            zcmap__place(slots, cap, &s->slots[i]);
+        }
+    }
+    ZTHREAD_FREE(s->slots);
+    s->slots = slots;
+    s->cap = cap;
+    return Z_OK;
+}
+
+// Under the shard's write lock.
+static int zcmap__put(const zcmap_t *m, struct zcmap__shard *s, uint64_t tag, const void *key, void *value, int replace, void **old) 
+{
+    struct zcmap__slot *e = zcmap__lookup(m, s, tag, key);
+    struct zcmap__slot fresh;
+    int64_t count = zthread__ld(&s->count, ZTHREAD__RLX);
+
+    if (e) 
+    {
+        if (!replace) 
+        {
+            return Z_EEXIST;
+        }
+        if (old) 
+        {
+            *old = e->value;
+        }
+        e->value = value;
+        return Z_OK;
+    }
+    if ((size_t)(count + 1) * 4 > s->cap * 3 && zcmap__grow(s) != Z_OK) 
+    {
+        return Z_ENOMEM;
+    }
+    fresh.tag = tag;
+    fresh.key = key;
+    fresh.value = value;
+    zcmap__place(s->slots, s->cap, &fresh);
+    zthread__st(&s->count, count + 1, ZTHREAD__RLX);
+    if (old) 
+    {
+        *old = NULL;
+    }
+    return Z_OK;
+}
+
+// Under the shard's write lock. Backward shift: pulls every later entry of
+// the cluster that may live at 'e' into it, so probes never see a hole.
+static void zcmap__remove(struct zcmap__shard *s, struct zcmap__slot *e) 
+{
+    size_t mask = s->cap - 1, i = (size_t)(e - s->slots), j = i;
+    for (;;) 
+    {
+        size_t home;
+        j = (j + 1) & mask;
+        if (0 == s->slots[j].tag) 
+        {
+            break;
+        }
+        home = (size_t)s->slots[j].tag & mask;
+        // Keep the entry if its home lies cyclically in (i, j].
+        if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) 
+        {
+            s->slots[i] = s->slots[j];
+            i = j;
+        }
+    }
+    s->slots[i].tag = 0;
+    s->slots[i].key = NULL;
+    s->slots[i].value = NULL;
+    zthread__st(&s->count, zthread__ld(&s->count, ZTHREAD__RLX) - 1, ZTHREAD__RLX);
+}
+
+static int zcmap__group(const zcmap_t *m, const void *const *keys, size_t n, struct zcmap__batch *b) 
+{
+    size_t shards = m->mask + 1, i;
+    unsigned char *mem;
+
+    if (n > ((size_t)-1 / 2 - (shards + 1) * sizeof(size_t)) / (sizeof(uint64_t) + sizeof(size_t))) 
+    {
+        return Z_ENOMEM;
+    }
+    mem = (unsigned char*)ZTHREAD_MALLOC(n * (sizeof(uint64_t) + sizeof(size_t)) + (shards + 1) * sizeof(size_t));
+    if (!mem) 
+    {
+        return Z_ENOMEM;
+    }
+    b->tags = (uint64_t*)mem;
+    b->order = (size_t*)(mem + n * sizeof(uint64_t));
+    b->start = b->order + n;
+    memset(b->start, 0, (shards + 1) * sizeof(size_t));
+
+    // Counting sort by shard.
+    for (i = 0; i < n; i++) 
+    {
+        b->tags[i] = zcmap__tag(m, keys[i]);
+        b->start[((size_t)(b->tags[i] >> 40) & m->mask) + 1]++;
+    }
+    for (i = 0; i < shards; i++) 
+    {
+        b->start[i + 1] += b->start[i];
+    }
+    for (i = 0; i < n; i++) 
+    {
+        b->order[b->start[(size_t)(b->tags[i] >> 40) & m->mask]++] = i;
+    }
+    // Each start[s] now holds the end of shard s: shift them back.
+    for (i = shards; i > 0; i--) 
+    {
+        b->start[i] = b->start[i - 1];
+    }
+    b->start[0] = 0;
+    return Z_OK;
+}
+
+zcmap_t *zcmap_create(size_t shards, zcmap_hash_fn hash, zcmap_eq_fn eq) 
+{
+    zcmap_t *m;
+    size_t count = 1, i;
+
+    if (0 == shards) 
+    {
+        shards = (size_t)zthread_cpu_count() * 4;
+    }
+    // Past the top power of two the doubling below would wrap to 0.
+    if (shards > ((size_t)-1 >> 1) + 1) 
+    {
+        return NULL;
+    }
+    while (count < shards) 
+    {
+        count <<= 1;
+    }
+    if (count > ((size_t)-1 - ZTHREAD_CACHE_LINE) / sizeof(struct zcmap__shard)) 
+    {
+        return NULL;
+    }
+    m = (zcmap_t*)ZTHREAD_CALLOC(1, sizeof(*m));
+    if (!m) 
+    {
+        return NULL;
+    }
+    // Over-allocate so every shard header starts on a cache line boundary.
+    m->raw = ZTHREAD_MALLOC(count * sizeof(struct zcmap__shard) + ZTHREAD_CACHE_LINE - 1);
+    if (!m->raw) 
+    {
+        ZTHREAD_FREE(m);
+        return NULL;
+    }
+    m->shards = (struct zcmap__shard*)(((uintptr_t)m->raw + ZTHREAD_CACHE_LINE - 1) & ~(uintptr_t)(ZTHREAD_CACHE_LINE - 1));
+    memset(m->shards, 0, count * sizeof(struct zcmap__shard));
+    for (i = 0; i < count; i++) 
+    {
+        zrwlock_init(&m->shards[i].lock);
+    }
+    m->mask = count - 1;
+    m->hash = hash;
+    m->eq = eq;
+    return m;
+}
+
+void zcmap_destroy(zcmap_t *m) 
+{
+    size_t i;
+    if (!m) 
+    {
+        return;
+    }
+    for (i = 0; i <= m->mask; i++) 
+    {
+        zrwlock_destroy(&m->shards[i].lock);
+        ZTHREAD_FREE(m->shards[i].slots);
+    }
+    ZTHREAD_FREE(m->raw);
+    ZTHREAD_FREE(m);
+}
+
+int zcmap_insert(zcmap_t *m, const void *key, void *value) 
+{
+    uint64_t tag = zcmap__tag(m, key);
+    struct zcmap__shard *s = zcmap__shard_of(m, tag);
+    int rc;
+    zrwlock_wrlock(&s->lock);
+    rc = zcmap__put(m, s, tag, key, value, 0, NULL);
+    zrwlock_wrunlock(&s->lock);
+    return rc;
+}
+
+int zcmap_put(zcmap_t *m, const void *key, void *value, void **old) 
+{
+    uint64_t tag = zcmap__tag(m, key);
+    struct zcmap__shard *s = zcmap__shard_of(m, tag);
+    int rc;
+    zrwlock_wrlock(&s->lock);
+    rc = zcmap__put(m, s, tag, key, value, 1, old);
+    zrwlock_wrunlock(&s->lock);
+    return rc;
+}
+
+int zcmap_find(zcmap_t *m, const void *key, void **value) 
+{
+    uint64_t tag = zcmap__tag(m, key);
+    struct zcmap__shard *s = zcmap__shard_of(m, tag);
+    struct zcmap__slot *e;
+    zrwlock_rdlock(&s->lock);
+    e = zcmap__lookup(m, s, tag, key);
+    if (e && value) 
+    {
+        *value = e->value;
+    }
+    zrwlock_rdunlock(&s->lock);
+    return e ? Z_OK : Z_ENOTFOUND;
+}
+
+int zcmap_erase(zcmap_t *m, const void *key, void **value) 
+{
+    uint64_t tag = zcmap__tag(m, key);
+    struct zcmap__shard *s = zcmap__shard_of(m, tag);
+    struct zcmap__slot *e;
+    zrwlock_wrlock(&s->lock);
+    e = zcmap__lookup(m, s, tag, key);
+    if (e) 
+    {
+        if (value) 
+        {
+            *value = e->value;
+        }
+        zcmap__remove(s, e);
+    }
+    zrwlock_wrunlock(&s->lock);
+    return e ? Z_OK : Z_ENOTFOUND;
+}
+
+size_t zcmap_insert_many(zcmap_t *m, const void *const *keys, void *const *values, size_t n, int *results) 
+{
+    struct zcmap__batch b;
+    size_t done = 0, sh, k;
+
+    if (0 == n) 
+    {
+        return 0;
+    }
+    // Without scratch memory, fall back to one lock per key.
+    if (zcmap__group(m, keys, n, &b) != Z_OK) 
+    {
+        for (k = 0; k < n; k++) 
+        {
+            int rc = zcmap_insert(m, keys[k], values[k]);
+            done += (Z_OK == rc);
+            if (results) 
+            {
+                results[k] = rc;
+            }
+        }
+        return done;
+    }
+    for (sh = 0; sh <= m->mask; sh++) 
+    {
+        struct zcmap__shard *s = &m->shards[sh];
+        if (b.start[sh] == b.start[sh + 1]) 
+        {
+            continue;
+        }
+        zrwlock_wrlock(&s->lock);
+        for (k = b.start[sh]; k < b.start[sh + 1]; k++) 
+        {
+            size_t i = b.order[k];
+            int rc = zcmap__put(m, s, b.tags[i], keys[i], values[i], 0, NULL);
+            done += (Z_OK == rc);
+            if (results) 
+            {
+                results[i] = rc;
+            }
+        }
+        zrwlock_wrunlock(&s->lock);
+    }
+    ZTHREAD_FREE(b.tags);
+    return done;
+}
+
+size_t zcmap_find_many(zcmap_t *m, const void *const *keys, void **values, size_t n, int *results) 
+{
+    struct zcmap__batch b;
+    size_t found = 0, sh, k;
+
+    if (0 == n) 
+    {
+        return 0;
+    }
+    if (zcmap__group(m, keys, n, &b) != Z_OK) 
+    {
+        for (k = 0; k < n; k++) 
+        {
+            int rc;
+            values[k] = NULL;
+            rc = zcmap_find(m, keys[k], &values[k]);
+            found += (Z_OK == rc);
+            if (results) 
+            {
+                results[k] = rc;
+            }
+        }
+        return found;
+    }
+    for (sh = 0; sh <= m->mask; sh++) 
+    {
+        struct zcmap__shard *s = &m->shards[sh];
+        if (b.start[sh] == b.start[sh + 1]) 
+        {
+            continue;
+        }
+        zrwlock_rdlock(&s->lock);
+        for (k = b.start[sh]; k < b.start[sh + 1]; k++) 
+        {
+            size_t i = b.order[k];
+            struct zcmap__slot *e = zcmap__lookup(m, s, b.tags[i], keys[i]);
+            values[i] = e ? e->value : NULL;
+            found += (e != NULL);
+            if (results) 
+            {
+                results[i] = e ? Z_OK : Z_ENOTFOUND;
+            }
+        }
+        zrwlock_rdunlock(&s->lock);
+    }
+    ZTHREAD_FREE(b.tags);
+    return found;
+}
+
+size_t zcmap_size(const zcmap_t *m) 
+{
+    int64_t n = 0;
+    size_t i;
+    for (i = 0; i <= m->mask; i++) 
+    {
+        n += zthread__ld(&m->shards[i].count, ZTHREAD__RLX);
+    }
+    return (size_t)n;
+}
+
+// Fibers.
+// Every switch goes through one worker: the fiber that leaves records what
+// should happen to it ('action'), and whoever gets the CPU next performs it
+// once it is off the old stack. That is how a parked fiber's spinlock stays
+// held until its registers are saved, and why a finished fiber can go back on
+// the free list without anyone freeing the stack it still runs on.
+#if defined(_WIN32)
+#   define ZFIBER__WIN 1
+#elif !defined(ZTHREAD_FIBER_UCONTEXT) && defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+#   define ZFIBER__ASM 1
+#else
+#   define ZFIBER__UCONTEXT 1
+#   include <ucontext.h>
+#endif
+
+#ifndef ZFIBER__WIN
+#   include <sys/mman.h>
+#endif
+
+#ifndef FIBER_FLAG_FLOAT_SWITCH
+#   define FIBER_FLAG_FLOAT_SWITCH 0x1
+#endif
+
+#define ZFIBER__SPIN 64
+
+// Deferred actions for the fiber that just switched out.
+#define ZFIBER__NONE  0
+#define ZFIBER__READY 1     // Yielded: back on the run queue.
+#define ZFIBER__PARK  2     // Blocked: release the object's spinlock.
+#define ZFIBER__DONE  3     // Finished: back on the free list.
+
+struct zfiber__ctx 
+{
+#if defined(ZFIBER__WIN)
+    LPVOID handle;
+#elif defined(ZFIBER__ASM)
+    void *sp;
+#else
+    ucontext_t uc;
+#endif
+};
+
+struct zfiber 
+{
+    struct zfiber__ctx ctx;
+    zfiber_fn fn;
+    void *arg;
+    zfiber_sched_t *sched;
+    struct zfiber *next;        // Run queue or free list.
+    void *stack;                // Mapping (guard page included).
+    size_t stack_bytes;
+};
+
+struct zfiber__worker 
+{
+    zfiber_sched_t *sched;
+    struct zfiber__ctx ctx;     // The thread's own context (the scheduler loop).
+    struct zfiber *current;
+    struct zfiber *prev;
+    int action;
+    volatile int32_t *unlock;   // PARK: spinlock to release.
+    zthread_t thread;
+#ifdef ZTHREAD_TRACE
+    struct ztrace__ring *trace;
+    int32_t traced_depth;       // Last ZTRACE_QUEUE_DEPTH value.
+#endif
+};
+
+struct zfiber__waiter 
+{
+    struct zfiber__waiter *next;
+    struct zfiber *fiber;       // NULL for a plain thread.
+    zsem_t *sem;                // Thread waiter: NULL polls 'woken' instead.
+    volatile int32_t woken;
+};
+
+struct zfiber_sched 
+{
+    volatile int32_t lock;
+    struct zfiber *head;
+    struct zfiber *tail;
+    struct zfiber *free_list;
+    int32_t idle;               // Workers asleep on 'wake'.
+    int32_t stop;
+    int64_t live;               // Spawned and not finished.
+#ifdef ZTHREAD_TRACE
+    volatile int32_t ready;     // Fibers in the run queue.
+#endif
+    zsem_t wake;
+    size_t stack_size;
+    int num_workers;
+    struct zfiber__worker *workers;
+};
+
+struct zfqueue 
+{
+    zfmutex_t lock;
+    zfcond_t not_full;
+    zfcond_t not_empty;
+    void **buf;
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+static ZTHREAD_LOCAL struct zfiber__worker *zfiber__tls = NULL;
+
+// A fiber may resume on another thread, so the TLS address must be computed
+// afresh after every switch rather than hoisted out of the caller.
+#if defined(_MSC_VER)
+static __declspec(noinline) struct zfiber__worker *zfiber__self(void)
+#elif defined(__GNUC__)
+static __attribute__((noinline)) ZTHREAD__NOIPA struct zfiber__worker *zfiber__self(void)
+#else
+static struct zfiber__worker *zfiber__self(void)
+#endif
+{
+    return zfiber__tls;
+}
+
+static void zfiber__spin_lock(volatile int32_t *l) 
+{
+    int i = 0;
+    while (zthread__ld32(l, ZTHREAD__RLX) != 0 || !zthread__cas32(l, 0, 1)) 
+    {
+        if (++i < ZFIBER__SPIN) 
+        {
+            ZTHREAD__PAUSE();
+        } 
+        else 
+        {
+            zthread_sleep(0);
+        }
+    }
+}
+
+static void zfiber__spin_unlock(volatile int32_t *l) 
+{
+    zthread__st32(l, 0, ZTHREAD__REL);
+}
+
+// Context switching.
+#if defined(ZFIBER__ASM)
+
+// zthread__fiber_jump(save, to): pushes the callee-saved registers, stores the
+// stack pointer in *save, loads 'to' and pops the same frame from it.
+#ifdef __cplusplus
+extern "C"
+#endif
+void zthread__fiber_jump(void **save, void *to);
+
+#if defined(__APPLE__)
+#   define ZFIBER__ASM_HEAD ".text\n.globl _zthread__fiber_jump\n.p2align 4\n_zthread__fiber_jump:\n"
+#else
+#   define ZFIBER__ASM_HEAD ".text\n.globl zthread__fiber_jump\n.hidden zthread__fiber_jump\n" \
+                            ".type zthread__fiber_jump, %function\n.p2align 4\nzthread__fiber_jump:\n"
+#endif
+
+#if defined(__x86_64__)
+// Frame: x87 control word, MXCSR, r15, r14, r13, r12, rbx, rbp, return address.
+#define ZFIBER__FRAME 64
+__asm__(
+    ZFIBER__ASM_HEAD
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $16, %rsp\n"
+    "    stmxcsr 8(%rsp)\n"
+    "    fnstcw (%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr 8(%rsp)\n"
+    "    fldcw (%rsp)\n"
+    "    addq $16, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+);
+#else
+// Frame: x19-x28, x29 (fp), x30 (lr, the resume address), d8-d15.
+#define ZFIBER__FRAME 160
+__asm__(
+    ZFIBER__ASM_HEAD
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+);
+#endif
+#endif // ZFIBER__ASM
+
+static void zfiber__jump(struct zfiber__ctx *from, struct zfiber__ctx *to) 
+{
+#if defined(ZFIBER__WIN)
+    (void)from;
+    SwitchToFiber(to->handle);
+#elif defined(ZFIBER__ASM)
+    zthread__fiber_jump(&from->sp, to->sp);
+#else
+    swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+// Run queue (under s->lock).
+static struct zfiber *zfiber__pop_locked(zfiber_sched_t *s) 
+{
+    struct zfiber *f = s->head;
+    if (f) 
+    {
+        s->head = f->next;
+        if (!s->head) 
+        {
+            s->tail = NULL;
+        }
+        f->next = NULL;
+#ifdef ZTHREAD_TRACE
+        zthread__st32(&s->ready, s->ready - 1, ZTHREAD__RLX);
+#endif
+    }
+    return f;
+}
+
+static struct zfiber *zfiber__pop(zfiber_sched_t *s) 
+{
+    struct zfiber *f;
+    zfiber__spin_lock(&s->lock);
+    f = zfiber__pop_locked(s);
+    zfiber__spin_unlock(&s->lock);
+    return f;
+}
+
+// Claims up to 'max' idle workers for the caller to post (under s->lock).
+static int32_t zfiber__take_idle(zfiber_sched_t *s, int32_t max) 
+{
+    int32_t n = s->idle < max ? s->idle : max;
+    s->idle -= n;
+    return n;
+}
+
+static void zfiber__make_ready(zfiber_sched_t *s, struct zfiber *f) 
+{
+    int32_t wake;
+    f->next = NULL;
+    zfiber__spin_lock(&s->lock);
+    if (s->tail) 
+    {
+        s->tail->next = f;
+    } 
+    else 
+    {
+        s->head = f;
+    }
+    s->tail = f;
+#ifdef ZTHREAD_TRACE
+    zthread__st32(&s->ready, s->ready + 1, ZTHREAD__RLX);
+#endif
+    wake = zfiber__take_idle(s, 1);
+    zfiber__spin_unlock(&s->lock);
+    if (wake) 
+    {
+        zsem_post(&s->wake);
+    }
+}
+
+static void zfiber__retire(zfiber_sched_t *s, struct zfiber *f) 
+{
+    int32_t wake = 0;
+    zfiber__spin_lock(&s->lock);
+    f->next = s->free_list;
+    s->free_list = f;
+    s->live--;
+    if (s->stop && 0 == s->live) 
+    {
+        wake = zfiber__take_idle(s, s->idle);
+    }
+    zfiber__spin_unlock(&s->lock);
+    while (wake-- > 0) 
+    {
+        zsem_post(&s->wake);
+    }
+}
+
+// Runs on the new stack right after every switch.
+static void zfiber__after_switch(struct zfiber__worker *w) 
+{
+    struct zfiber *prev = w->prev;
+    int action = w->action;
+
+    w->prev = NULL;
+    w->action = ZFIBER__NONE;
+#ifdef ZTHREAD_TRACE
+    if (prev) 
+    {
+        ZTRACE__EMIT(w->trace, ZTRACE_TASK_END, 0, prev);
+    }
+    if (w->current) 
+    {
+        int32_t depth = zthread__ld32(&w->sched->ready, ZTHREAD__RLX);
+        if (depth != w->traced_depth) 
+        {
+            w->traced_depth = depth;
+            ZTRACE__EMIT(w->trace, ZTRACE_QUEUE_DEPTH, depth, 0);
+        }
+        ZTRACE__EMIT(w->trace, ZTRACE_TASK_BEGIN, 0, w->current);
+    }
+#endif
+    if (ZFIBER__READY == action) 
+    {
+        zfiber__make_ready(prev->sched, prev);
+    } 
+    else if (ZFIBER__PARK == action) 
+    {
+        zfiber__spin_unlock(w->unlock);
+    } 
+    else if (ZFIBER__DONE == action) 
+    {
+        zfiber__retire(prev->sched, prev);
+    }
+}
+
+// Leaves the current fiber for 'next', or for the worker loop if NULL.
+static void zfiber__switch_out(struct zfiber__worker *w, struct zfiber *next, int action, volatile int32_t *unlock) 
+{
+    struct zfiber *self = w->current;
+    w->prev = self;
+    w->action = action;
+    w->unlock = unlock;
+    w->current = next;
+    zfiber__jump(&self->ctx, next ? &next->ctx : &w->ctx);
+    // Possibly on another worker now.
+    zfiber__after_switch(zfiber__self());
+}
+
+static void zfiber__suspend(struct zfiber__worker *w, int action, volatile int32_t *unlock) 
+{
+    zfiber__switch_out(w, zfiber__pop(w->sched), action, unlock);
+}
+
+// Bottom of every fiber stack. A finished fiber parks here on the free list
+// and the next spawn that reuses it simply resumes the loop.
+static void zfiber__main(void) 
+{
+    zfiber__after_switch(zfiber__self());
+    for (;;) 
+    {
+        struct zfiber *f = zfiber__self()->current;
+        f->fn(f->arg);
+        zfiber__suspend(zfiber__self(), ZFIBER__DONE, NULL);
+    }
+}
+
+#ifdef ZFIBER__WIN
+static VOID WINAPI zfiber__win_main(LPVOID arg) 
+{
+    (void)arg;
+    zfiber__main();
+}
+#endif
+
+// Stacks: mmap with a PROT_NONE guard page below, or the heap without mmap.
+#ifndef ZFIBER__WIN
+static size_t zfiber__page(void) 
+{
+#if defined(_SC_PAGESIZE)
+    long n = sysconf(_SC_PAGESIZE);
+    return n > 0 ? (size_t)n : 4096;
+#else
+    return 4096;
+#endif
+}
+
+static int zfiber__stack_alloc(struct zfiber *f, size_t size, char **lo) 
+{
+    size_t page = zfiber__page();
+    size = (size + page - 1) & ~(page - 1);
+#if defined(MAP_ANONYMOUS) || defined(MAP_ANON)
+#   ifndef MAP_ANONYMOUS
+#       define MAP_ANONYMOUS MAP_ANON
+#   endif
+    f->stack = mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == f->stack) 
+    {
+        f->stack = NULL;
+        return Z_ENOMEM;
+    }
+    mprotect(f->stack, page, PROT_NONE);
+    f->stack_bytes = size + page;
+    *lo = (char*)f->stack + page;
+#else
+    f->stack = ZTHREAD_MALLOC(size);
+    if (!f->stack) 
+    {
+        return Z_ENOMEM;
+    }
+    f->stack_bytes = size;
+    *lo = (char*)f->stack;
+#endif
+    return Z_OK;
+}
+
+static void zfiber__stack_free(struct zfiber *f) 
+{
+#if defined(MAP_ANONYMOUS)
+    munmap(f->stack, f->stack_bytes);
+#else
+    ZTHREAD_FREE(f->stack);
+#endif
+}
+#endif // !ZFIBER__WIN
+
+#ifdef ZFIBER__UCONTEXT
+// Kept apart from zfiber__new: getcontext returns twice, which makes GCC
+// distrust every local that lives across it.
+static void zfiber__make_context(ucontext_t *uc, char *lo, size_t size) 
+{
+    getcontext(uc);
+    uc->uc_stack.ss_sp = lo;
+    uc->uc_stack.ss_size = size;
+    uc->uc_link = NULL;
+    makecontext(uc, zfiber__main, 0);
+}
+#endif
+
+static struct zfiber *zfiber__new(zfiber_sched_t *s) 
+{
+    struct zfiber *f = (struct zfiber*)ZTHREAD_CALLOC(1, sizeof(*f));
+#ifndef ZFIBER__WIN
+    char *lo;
+#endif
+    if (!f) 
+    {
+        return NULL;
+    }
+    f->sched = s;
+#if defined(ZFIBER__WIN)
+    f->ctx.handle = CreateFiberEx(s->stack_size, s->stack_size, FIBER_FLAG_FLOAT_SWITCH, zfiber__win_main, NULL);
+    if (!f->ctx.handle) 
+    {
+        ZTHREAD_FREE(f);
+        return NULL;
+    }
+#else
+    if (zfiber__stack_alloc(f, s->stack_size, &lo) != Z_OK) 
+    {
+        ZTHREAD_FREE(f);
+        return NULL;
+    }
+#   if defined(ZFIBER__ASM) 
+    {
+        // A saved frame whose return address is zfiber__main, placed so that
+        // the stack is ABI-aligned when it "returns" there.
+        uintptr_t top = ((uintptr_t)((char*)f->stack + f->stack_bytes) - 16) & ~(uintptr_t)15;
+        uintptr_t *sp;
+#       if defined(__x86_64__)
+        ((uintptr_t*)top)[0] = (uintptr_t)zfiber__main;
+        ((uintptr_t*)top)[1] = 0;
+        sp = (uintptr_t*)(top - ZFIBER__FRAME);
+        memset(sp, 0, ZFIBER__FRAME);
+        ((uint16_t*)sp)[0] = 0x037F;   // x87 default control word.
+        ((uint32_t*)sp)[2] = 0x1F80;   // MXCSR default.
+#       else
+        sp = (uintptr_t*)(top + 16 - ZFIBER__FRAME);
+        memset(sp, 0, ZFIBER__FRAME);
+        sp[11] = (uintptr_t)zfiber__main;
+#       endif
+        f->ctx.sp = sp;
+    }
+    (void)lo;
+#   else
+    zfiber__make_context(&f->ctx.uc, lo, (size_t)((char*)f->stack + f->stack_bytes - lo));
+#   endif
+#endif
+    return f;
+}
+
+static void zfiber__delete(struct zfiber *f) 
+{
+#ifdef ZFIBER__WIN
+    DeleteFiber(f->ctx.handle);
+#else
+    zfiber__stack_free(f);
+#endif
+    ZTHREAD_FREE(f);
+}
+
+static void zfiber__worker_main(void *arg) 
+{
+    struct zfiber__worker *w = (struct zfiber__worker*)arg;
+    zfiber_sched_t *s = w->sched;
+
+#ifdef ZFIBER__WIN
+    w->ctx.handle = ConvertThreadToFiberEx(NULL, FIBER_FLAG_FLOAT_SWITCH);
+    if (!w->ctx.handle) 
+    {
+        return;
+    }
+#endif
+    zfiber__tls = w;
+#ifdef ZTHREAD_TRACE
+    w->trace = ztrace__attach(ZTRACE_FIBERS, s, (int)(w - s->workers));
+#endif
+    for (;;) 
+    {
+        struct zfiber *f;
+        zfiber__spin_lock(&s->lock);
+        while (NULL == (f = zfiber__pop_locked(s))) 
         {
-            if (joinable) 
+            if (s->stop && 0 == s->live) 
             {
-                ::zthread_detach(inner);
-                joinable = false;
+                break;
             }
+            s->idle++;
+            zfiber__spin_unlock(&s->lock);
+            ZTRACE__EMIT(w->trace, ZTRACE_PARK, 0, 0);
+            zsem_wait(&s->wake);
+            ZTRACE__EMIT(w->trace, ZTRACE_UNPARK, 0, 0);
+            zfiber__spin_lock(&s->lock);
         }
-
-        bool joinable_state() const 
-        { 
-            return joinable; 
-        }
-
-        ::zthread_t native_handle() 
-        { 
-            return inner; 
-        }
-        
-        static void sleep(int ms) 
-        { 
-            ::zthread_sleep(ms); 
+        zfiber__spin_unlock(&s->lock);
+        if (!f) 
+        {
+            break;
         }
-    };
+        w->current = f;
+        zfiber__jump(&w->ctx, &f->ctx);
+        zfiber__after_switch(w);
+    }
+#ifdef ZTHREAD_TRACE
+    ztrace__detach(w->trace);
+#endif
+    zfiber__tls = NULL;
+#ifdef ZFIBER__WIN
+    ConvertFiberToThread();
+#endif
 }
 
-#endif // __cplusplus
+static void zfiber__sched_free(zfiber_sched_t *s) 
+{
+    while (s->free_list) 
+    {
+        struct zfiber *f = s->free_list;
+        s->free_list = f->next;
+        zfiber__delete(f);
+    }
+    zsem_destroy(&s->wake);
+    ZTHREAD_FREE(s->workers);
+    ZTHREAD_FREE(s);
+}
 
-#endif // ZTHREAD_H
+// Sets 'stop' and joins the first 'n' workers; every fiber must be done.
+static void zfiber__stop(zfiber_sched_t *s, int n) 
+{
+    int32_t wake;
+    int i;
+    zfiber__spin_lock(&s->lock);
+    s->stop = 1;
+    wake = (0 == s->live) ? zfiber__take_idle(s, s->idle) : 0;
+    zfiber__spin_unlock(&s->lock);
+    while (wake-- > 0) 
+    {
+        zsem_post(&s->wake);
+    }
+    for (i = 0; i < n; i++) 
+    {
+        zthread_join(s->workers[i].thread);
+    }
+}
 
-#ifdef ZTHREAD_IMPLEMENTATION
-#ifndef ZTHREAD_IMPLEMENTATION_GUARD
-#define ZTHREAD_IMPLEMENTATION_GUARD
+zfiber_sched_t *zfiber_sched_create(int num_threads, size_t stack_size) 
+{
+    zfiber_sched_t *s;
+    int i;
 
-struct zthread__wrap 
-{ 
-    zthread_proxy_fn f; 
-    void *arg; 
-};
+    if (num_threads <= 0) 
+    {
+        num_threads = zthread_cpu_count();
+    }
+    s = (zfiber_sched_t*)ZTHREAD_CALLOC(1, sizeof(*s));
+    if (!s) 
+    {
+        return NULL;
+    }
+    s->stack_size = stack_size ? stack_size : ZTHREAD_FIBER_STACK;
+    s->workers = (struct zfiber__worker*)ZTHREAD_CALLOC((size_t)num_threads, sizeof(*s->workers));
+    if (!s->workers || zsem_init(&s->wake, 0) != Z_OK) 
+    {
+        ZTHREAD_FREE(s->workers);
+        ZTHREAD_FREE(s);
+        return NULL;
+    }
+    s->num_workers = num_threads;
+    for (i = 0; i < num_threads; i++) 
+    {
+        s->workers[i].sched = s;
+        if (zthread_create(&s->workers[i].thread, zfiber__worker_main, &s->workers[i]) != Z_OK) 
+        {
+            zfiber__stop(s, i);
+            zfiber__sched_free(s);
+            return NULL;
+        }
+    }
+    return s;
+}
 
-#ifdef _WIN32
-static unsigned __stdcall zthread__proxy_entry(void *p) 
+void zfiber_sched_shutdown(zfiber_sched_t *s) 
 {
-    struct zthread__wrap *w = (struct zthread__wrap*)p;
-    w->f(w->arg); 
-    ZTHREAD_FREE(w); 
-    return 0;
+    if (!s) 
+    {
+        return;
+    }
+    zfiber__stop(s, s->num_workers);
+    zfiber__sched_free(s);
 }
-int zthread__create_ptr(zthread_t *t, zthread_proxy_fn func, void *arg) 
+
+int zfiber__spawn_ptr(zfiber_sched_t *s, zfiber_fn fn, void *arg) 
 {
-    struct zthread__wrap *w = (struct zthread__wrap*)ZTHREAD_MALLOC(sizeof(*w)); 
-    if (!w) 
+    struct zfiber *f;
+
+    zfiber__spin_lock(&s->lock);
+    f = s->free_list;
+    if (f) 
     {
-        return Z_ENOMEM;
+        s->free_list = f->next;
     }
-    w->f = func; 
-    w->arg = arg;
-    *t = (HANDLE)_beginthreadex(NULL, 0, zthread__proxy_entry, w, 0, NULL);
-    
-    if (NULL == *t) 
+    zfiber__spin_unlock(&s->lock);
+    if (!f && NULL == (f = zfiber__new(s))) 
     {
-        ZTHREAD_FREE(w);
-        return Z_ERR;
+        return Z_ENOMEM;
     }
+    f->fn = fn;
+    f->arg = arg;
+
+    zfiber__spin_lock(&s->lock);
+    s->live++;
+    zfiber__spin_unlock(&s->lock);
+    zfiber__make_ready(s, f);
     return Z_OK;
 }
 
-void zthread_join(zthread_t t) 
-{ 
-    WaitForSingleObject(t, INFINITE); 
-    CloseHandle(t); 
+void zfiber_yield(void) 
+{
+    struct zfiber__worker *w = zfiber__self();
+    struct zfiber *next;
+    if (!w || !w->current) 
+    {
+        zthread_sleep(0);
+        return;
+    }
+    next = zfiber__pop(w->sched);
+    if (next) 
+    {
+        zfiber__switch_out(w, next, ZFIBER__READY, NULL);
+    }
 }
 
-void zthread_detach(zthread_t t) 
-{ 
-    CloseHandle(t); 
+int zfiber_in_fiber(void) 
+{
+    struct zfiber__worker *w = zfiber__self();
+    return (w && w->current) ? 1 : 0;
 }
 
-void zthread_sleep(int ms) 
-{ 
-    Sleep(ms); 
+// Waiters. A fiber parks through its worker; a thread blocks on a semaphore
+// of its own. Wakers run under the object's spinlock, and a woken thread takes
+// that lock once more before it destroys the semaphore the waker just posted.
+static void zfiber__waiter_init(struct zfiber__waiter *wt, zsem_t *sem) 
+{
+    struct zfiber__worker *w = zfiber__self();
+    wt->next = NULL;
+    wt->fiber = w ? w->current : NULL;
+    wt->sem = NULL;
+    wt->woken = 0;
+    if (!wt->fiber && zsem_init(sem, 0) == Z_OK) 
+    {
+        wt->sem = sem;
+    }
 }
 
-void zmutex_init(zmutex_t *m) 
-{ 
-    InitializeCriticalSection(m); 
+static void zfiber__enqueue(struct zfiber__waiter **head, struct zfiber__waiter **tail, struct zfiber__waiter *wt) 
+{
+    if (*tail) 
+    {
+        (*tail)->next = wt;
+    } 
+    else 
+    {
+        *head = wt;
+    }
+    *tail = wt;
 }
 
-void zmutex_lock(zmutex_t *m) 
-{ 
-    EnterCriticalSection(m); 
+static struct zfiber__waiter *zfiber__dequeue(struct zfiber__waiter **head, struct zfiber__waiter **tail) 
+{
+    struct zfiber__waiter *wt = *head;
+    if (wt) 
+    {
+        *head = wt->next;
+        if (!*head) 
+        {
+            *tail = NULL;
+        }
+    }
+    return wt;
 }
 
-void zmutex_unlock(zmutex_t *m) 
-{ 
-    LeaveCriticalSection(m); 
+// Enqueued under '*spin', which this releases.
+static void zfiber__park(struct zfiber__waiter *wt, volatile int32_t *spin) 
+{
+    if (wt->fiber) 
+    {
+        zfiber__suspend(zfiber__self(), ZFIBER__PARK, spin);
+        return;
+    }
+    zfiber__spin_unlock(spin);
+    if (wt->sem) 
+    {
+        zsem_wait(wt->sem);
+    } 
+    else 
+    {
+        while (!zthread__ld32(&wt->woken, ZTHREAD__ACQ)) 
+        {
+            zthread_sleep(0);
+        }
+    }
+    zfiber__spin_lock(spin);
+    zfiber__spin_unlock(spin);
+    if (wt->sem) 
+    {
+        zsem_destroy(wt->sem);
+    }
 }
 
-void zmutex_destroy(zmutex_t *m) 
-{ 
-    DeleteCriticalSection(m); 
+// Under the object's spinlock.
+static void zfiber__wake(struct zfiber__waiter *wt) 
+{
+    struct zfiber *f = wt->fiber;
+    if (f) 
+    {
+        zfiber__make_ready(f->sched, f);
+        return;
+    }
+    zthread__st32(&wt->woken, 1, ZTHREAD__REL);
+    if (wt->sem) 
+    {
+        zsem_post(wt->sem);
+    }
 }
 
-void zcond_init(zcond_t *c) 
-{ 
-    InitializeConditionVariable(c); 
+void zfmutex_init(zfmutex_t *m) 
+{
+    m->spin = 0;
+    m->locked = 0;
+    m->head = NULL;
+    m->tail = NULL;
 }
-void zcond_wait(zcond_t *c, zmutex_t *m) 
-{ 
-    SleepConditionVariableCS(c, m, INFINITE); 
+
+void zfmutex_lock(zfmutex_t *m) 
+{
+    struct zfiber__waiter wt;
+    zsem_t sem;
+
+    zfiber__spin_lock(&m->spin);
+    if (!m->locked) 
+    {
+        m->locked = 1;
+        zfiber__spin_unlock(&m->spin);
+        return;
+    }
+    zfiber__waiter_init(&wt, &sem);
+    zfiber__enqueue(&m->head, &m->tail, &wt);
+    // Unlock hands the mutex over without clearing 'locked'.
+    zfiber__park(&wt, &m->spin);
 }
 
-void zcond_signal(zcond_t *c) 
-{ 
-    WakeConditionVariable(c); 
+int zfmutex_trylock(zfmutex_t *m) 
+{
+    int ok;
+    zfiber__spin_lock(&m->spin);
+    ok = !m->locked;
+    m->locked = 1;
+    zfiber__spin_unlock(&m->spin);
+    return ok ? Z_OK : Z_ERR;
 }
 
-void zcond_broadcast(zcond_t *c) 
-{ 
-    WakeAllConditionVariable(c); 
+void zfmutex_unlock(zfmutex_t *m) 
+{
+    struct zfiber__waiter *wt;
+    zfiber__spin_lock(&m->spin);
+    wt = zfiber__dequeue(&m->head, &m->tail);
+    if (wt) 
+    {
+        zfiber__wake(wt);
+    } 
+    else 
+    {
+        m->locked = 0;
+    }
+    zfiber__spin_unlock(&m->spin);
 }
 
-void zcond_destroy(zcond_t *c) 
-{ 
-    (void)c; 
-} 
+void zfmutex_destroy(zfmutex_t *m) 
+{
+    (void)m;
+}
 
-#else
-// POSIX implementation.
+void zfcond_init(zfcond_t *c) 
+{
+    c->spin = 0;
+    c->head = NULL;
+    c->tail = NULL;
+}
 
-static void* zthread__proxy_entry(void *p) 
+void zfcond_wait(zfcond_t *c, zfmutex_t *m) 
 {
-    struct zthread__wrap *w = (struct zthread__wrap*)p;
-    w->f(w->arg); 
-    ZTHREAD_FREE(w); 
-    return NULL;
+    struct zfiber__waiter wt;
+    zsem_t sem;
+
+    zfiber__waiter_init(&wt, &sem);
+    zfiber__spin_lock(&c->spin);
+    zfiber__enqueue(&c->head, &c->tail, &wt);
+    // Still holding c->spin, so a signal cannot slip in before we park.
+    zfmutex_unlock(m);
+    zfiber__park(&wt, &c->spin);
+    zfmutex_lock(m);
 }
 
-int zthread__create_ptr(zthread_t *t, zthread_proxy_fn func, void *arg) 
+void zfcond_signal(zfcond_t *c) 
 {
-    struct zthread__wrap *w = (struct zthread__wrap*)ZTHREAD_MALLOC(sizeof(*w));
-    if (!w) 
+    struct zfiber__waiter *wt;
+    zfiber__spin_lock(&c->spin);
+    wt = zfiber__dequeue(&c->head, &c->tail);
+    if (wt) 
     {
-        return Z_ENOMEM; 
+        zfiber__wake(wt);
     }
-    w->f = func; 
-    w->arg = arg;
+    zfiber__spin_unlock(&c->spin);
+}
 
-    if (0 != pthread_create(t, NULL, zthread__proxy_entry, w)) 
+void zfcond_broadcast(zfcond_t *c) 
+{
+    struct zfiber__waiter *wt;
+    zfiber__spin_lock(&c->spin);
+    while (NULL != (wt = zfiber__dequeue(&c->head, &c->tail))) 
     {
-        ZTHREAD_FREE(w);
-        return Z_ERR;
+        zfiber__wake(wt);
     }
-    return Z_OK;
-}
-
-void zthread_join(zthread_t t) 
-{ 
-    pthread_join(t, NULL); 
-}
-
-void zthread_detach(zthread_t t) 
-{ 
-    pthread_detach(t); 
+    zfiber__spin_unlock(&c->spin);
 }
 
-void zthread_sleep(int ms) 
-{ 
-    struct timespec ts;
-    ts.tv_sec = ms / 1000;
-    ts.tv_nsec = (ms % 1000) * 1000000;
-    nanosleep(&ts, NULL);
+void zfcond_destroy(zfcond_t *c) 
+{
+    (void)c;
 }
 
-void zmutex_init(zmutex_t *m) 
-{ 
-    pthread_mutex_init(m, NULL); 
-}
-void zmutex_lock(zmutex_t *m) 
-{ 
-    pthread_mutex_lock(m); 
+zfqueue_t *zfqueue_create(size_t capacity) 
+{
+    zfqueue_t *q;
+    if (0 == capacity) 
+    {
+        return NULL;
+    }
+    q = (zfqueue_t*)ZTHREAD_CALLOC(1, sizeof(*q));
+    if (!q) 
+    {
+        return NULL;
+    }
+    q->buf = (void**)ZTHREAD_MALLOC(capacity * sizeof(void*));
+    if (!q->buf) 
+    {
+        ZTHREAD_FREE(q);
+        return NULL;
+    }
+    q->capacity = capacity;
+    zfmutex_init(&q->lock);
+    zfcond_init(&q->not_full);
+    zfcond_init(&q->not_empty);
+    return q;
 }
 
-void zmutex_unlock(zmutex_t *m) 
-{ 
-    pthread_mutex_unlock(m); 
+void zfqueue_destroy(zfqueue_t *q) 
+{
+    if (!q) 
+    {
+        return;
+    }
+    zfcond_destroy(&q->not_empty);
+    zfcond_destroy(&q->not_full);
+    zfmutex_destroy(&q->lock);
+    ZTHREAD_FREE(q->buf);
+    ZTHREAD_FREE(q);
 }
 
-void zmutex_destroy(zmutex_t *m) 
-{ 
-    pthread_mutex_destroy(m); 
+// Under q->lock.
+static void zfqueue__put(zfqueue_t *q, void *item) 
+{
+    q->buf[(q->head + q->count) % q->capacity] = item;
+    q->count++;
+    zfcond_signal(&q->not_empty);
 }
 
-void zcond_init(zcond_t *c) 
-{ 
-    pthread_cond_init(c, NULL); 
+static void *zfqueue__take(zfqueue_t *q) 
+{
+    void *item = q->buf[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    zfcond_signal(&q->not_full);
+    return item;
 }
 
-void zcond_wait(zcond_t *c, zmutex_t *m) 
-{ 
-    pthread_cond_wait(c, m); 
+void zfqueue_push(zfqueue_t *q, void *item) 
+{
+    zfmutex_lock(&q->lock);
+    while (q->count == q->capacity) 
+    {
+        zfcond_wait(&q->not_full, &q->lock);
+    }
+    zfqueue__put(q, item);
+    zfmutex_unlock(&q->lock);
 }
 
-void zcond_signal(zcond_t *c) 
-{ 
-    pthread_cond_signal(c); 
+void *zfqueue_pop(zfqueue_t *q) 
+{
+    void *item;
+    zfmutex_lock(&q->lock);
+    while (0 == q->count) 
+    {
+        zfcond_wait(&q->not_empty, &q->lock);
+    }
+    item = zfqueue__take(q);
+    zfmutex_unlock(&q->lock);
+    return item;
 }
 
-void zcond_broadcast(zcond_t *c) 
-{ 
-    pthread_cond_broadcast(c); 
+int zfqueue_try_push(zfqueue_t *q, void *item) 
+{
+    int rc = Z_EFULL;
+    zfmutex_lock(&q->lock);
+    if (q->count < q->capacity) 
+    {
+        zfqueue__put(q, item);
+        rc = Z_OK;
+    }
+    zfmutex_unlock(&q->lock);
+    return rc;
 }
 
-void zcond_destroy(zcond_t *c) 
-{ 
-    pthread_cond_destroy(c); 
+int zfqueue_try_pop(zfqueue_t *q, void **out) 
+{
+    int rc = Z_EEMPTY;
+    zfmutex_lock(&q->lock);
+    if (q->count > 0) 
+    {
+        *out = zfqueue__take(q);
+        rc = Z_OK;
+    }
+    zfmutex_unlock(&q->lock);
+    return rc;
 }
-#endif
 
 #endif // ZTHREAD_IMPLEMENTATION_GUARD
 